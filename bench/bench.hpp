@@ -0,0 +1,76 @@
+#ifndef SVG_BENCH_H
+#define SVG_BENCH_H
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Timing for the programs `make bench` runs; each prints a table per comparison with the median
+// time of a case and its speed against the first case of the table. platform.h comes first.
+class Bench
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    Bench() = delete;
+    ~Bench() = delete;
+
+    static double GetSeconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Median seconds of a call over runs, after one run to warm up
+    template <class TFunc>
+    static double Time(const TFunc& fn, int runs = 7)
+    {
+        fn();
+        std::vector<double> times;
+        for (int i = 0; i < runs; i++) {
+            const Clock::time_point start = Clock::now();
+            fn();
+            times.push_back(GetSeconds(start));
+        }
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    }
+
+    static void Title(const char* title)
+    {
+        ::printf("\n%s (%u hardware threads)\n", title, std::thread::hardware_concurrency());
+    }
+
+    static void Report(const char* name, double seconds, double baseline)
+    {
+        ::printf("  %-40s %10.3f ms %8.2fx\n", name, seconds * 1000, baseline / seconds);
+    }
+
+    // For throughput, in millions of items a second
+    static void ReportRate(const char* name, double seconds, double count, const char* unit)
+    {
+        ::printf("  %-40s %10.3f ms %8.0f M%s/s\n", name, seconds * 1000, count / seconds / 1e6, unit);
+    }
+
+    // A document of count shapes with gradients, strokes and some transparency, the kind of
+    // content whose render time grows with the pixels rather than with the parse
+    static std::string MakeDocument(int count, int width = 400, int height = 300)
+    {
+        std::string text = "<svg xmlns='http://www.w3.org/2000/svg' width='" + std::to_string(width) + "' height='" + std::to_string(height) + "'>"
+            "<defs><linearGradient id='a'><stop offset='0' stop-color='#f80'/><stop offset='1' stop-color='#08f' stop-opacity='0.6'/></linearGradient>"
+            "<radialGradient id='b'><stop offset='0' stop-color='#fff'/><stop offset='1' stop-color='#306' stop-opacity='0.3'/></radialGradient></defs>";
+        for (int i = 0; i < count; i++) {
+            const int x = (i * 37) % width;
+            const int y = (i * 53) % height;
+            const int r = 8 + (i * 7) % 40;
+            text += "<g transform='rotate(" + std::to_string(i * 11 % 360) + " " + std::to_string(x) + " " + std::to_string(y) + ")'>";
+            text += "<ellipse cx='" + std::to_string(x) + "' cy='" + std::to_string(y) + "' rx='" + std::to_string(r) + "' ry='" + std::to_string(r / 2 + 3) + "' fill='url(#" + (i % 2 ? "a" : "b") + ")' stroke='#123' stroke-width='1.5' opacity='0.8'/>";
+            text += "<path d='M" + std::to_string(x) + " " + std::to_string(y) + "c10 -20 30 -20 40 0s30 20 40 0' fill='none' stroke='#c33' stroke-width='2'/></g>";
+        }
+        return text + "</svg>";
+    }
+};
+
+#endif
@@ -0,0 +1,101 @@
+// Built as C++20, for AsyncAwaiter
+#include "platform.h"
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async.hpp"
+#include "bench.hpp"
+
+static const int REQUESTS = 200;
+
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { ::abort(); }
+    };
+};
+
+// Counts finished requests and wakes the caller after the last
+struct Requests
+{
+    std::atomic<int> left;
+    std::promise<void> done;
+
+    explicit Requests(int count)
+        : left(count)
+    {
+    }
+
+    void Finish()
+    {
+        if (--this->left == 0) {
+            this->done.set_value();
+        }
+    }
+};
+
+static HRESULT LoadAndRender(const std::string& text, const SvgOptions& opt)
+{
+    Svg svg;
+    SvgRenderTarget target;
+    SvgRenderTarget::RenderOptions renderOpt;
+    renderOpt.SetCanvasSize(256, 256).SetToContain();
+    HRESULT hr = svg.Load(text.data(), text.size(), opt);
+    return SUCCEEDED(hr) ? svg.Render(renderOpt, &target) : hr;
+}
+
+static Detached AwaitLoadAndRender(const std::string* text, const SvgOptions* opt, Requests* requests)
+{
+    Svg svg;
+    SvgRenderTarget target;
+    SvgRenderTarget::RenderOptions renderOpt;
+    renderOpt.SetCanvasSize(256, 256).SetToContain();
+    SvgLoadOperation load;
+    SvgRenderOperation render;
+    HRESULT hr = co_await AsyncAwaiter(load, [&] {
+        return load.Start(&svg, text->data(), text->size(), *opt);
+    });
+    if (SUCCEEDED(hr)) {
+        co_await AsyncAwaiter(render, [&] {
+            return render.Start(&svg, renderOpt, &target);
+        });
+    }
+    requests->Finish();
+}
+
+int main()
+{
+    const std::string text = Bench::MakeDocument(60);
+    SvgOptions opt;
+
+    Bench::Title("Async operations: 200 load and render requests");
+    const double threads = Bench::Time([&] {
+        std::vector<std::thread> pool;
+        for (int i = 0; i < REQUESTS; i++) {
+            pool.emplace_back([&] {
+                LoadAndRender(text, opt);
+            });
+        }
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+    }, 5);
+    Bench::Report("thread per request", threads, threads);
+
+    Bench::Report("coroutines on the task scheduler", Bench::Time([&] {
+        Requests requests(REQUESTS);
+        for (int i = 0; i < REQUESTS; i++) {
+            AwaitLoadAndRender(&text, &opt, &requests);
+        }
+        requests.done.get_future().wait();
+    }, 5), threads);
+    return 0;
+}
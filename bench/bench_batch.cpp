@@ -0,0 +1,67 @@
+#include "platform.h"
+#include <string>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "bench.hpp"
+
+// The views a gallery asks of one document at once: thumbnails, previews and zoomed crops
+static const size_t JOBS = 12;
+
+static void MakeJobs(SvgRenderTarget::RenderOptions* opts)
+{
+    for (size_t i = 0; i < JOBS; i++) {
+        switch (i % 3) {
+        case 0:
+            opts[i].SetCanvasSize(256, 256).SetToContain();
+            break;
+        case 1:
+            opts[i].SetCanvasSize(1024, 1024).SetToContain();
+            break;
+        default:
+            opts[i].SetScale(4).SetClip(static_cast<uint32_t>(i * 40), 200, 512, 512);
+            break;
+        }
+    }
+}
+
+int main()
+{
+    const std::string text = Bench::MakeDocument(400);
+    SvgOptions svgOpt;
+    Svg svg;
+    if (FAILED(svg.Load(text.data(), text.size(), svgOpt))) {
+        ::fprintf(stderr, "bench_batch: the document does not parse\n");
+        return 1;
+    }
+    SvgRenderTarget::RenderOptions opts[JOBS];
+    MakeJobs(opts);
+
+    Bench::Title("RenderBatch: 12 views of one document");
+    const double serial = Bench::Time([&] {
+        SvgRenderTarget targets[JOBS];
+        for (size_t i = 0; i < JOBS; i++) {
+            svg.Render(opts[i], &targets[i]);
+        }
+    });
+    Bench::Report("serial Render per view", serial, serial);
+
+    Bench::Report("RenderBatch on the shared tree", Bench::Time([&] {
+        SvgRenderTarget targets[JOBS];
+        svg.RenderBatch(opts, JOBS, targets);
+    }), serial);
+
+    // The alternative to the tree's lock: each worker parses the document once and renders its
+    // share of the views without waiting on the others
+    Bench::Report("one parse per worker, parse included", Bench::Time([&] {
+        Svg copies[Parallel::MAX_WORKERS];
+        SvgRenderTarget targets[JOBS];
+        Parallel::ForWorker(JOBS, [&](unsigned worker, size_t i) {
+            if (copies[worker].IsNull()) {
+                copies[worker].Load(text.data(), text.size(), svgOpt);
+            }
+            copies[worker].Render(opts[i], &targets[i]);
+        });
+    }), serial);
+    return 0;
+}
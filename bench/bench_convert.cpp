@@ -0,0 +1,62 @@
+#include "platform.h"
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "convert.hpp"
+#include "bench.hpp"
+
+template <class T>
+struct Tag
+{
+    typedef T Type;
+};
+
+template <class TFunc>
+static void ForEachFormat(const TFunc& fn)
+{
+    fn(Tag<FormatPRGBA8>(), "PRGBA8");
+    fn(Tag<FormatRGBA8>(), "RGBA8");
+    fn(Tag<FormatPBGRA8>(), "PBGRA8");
+    fn(Tag<FormatBGRA8>(), "BGRA8");
+    fn(Tag<FormatPARGB8>(), "PARGB8");
+    fn(Tag<FormatARGB8>(), "ARGB8");
+    fn(Tag<FormatRGB565>(), "RGB565");
+    fn(Tag<FormatGray8>(), "Gray8");
+    fn(Tag<FormatGrayA8>(), "GrayA8");
+    fn(Tag<FormatAlpha8>(), "Alpha8");
+    fn(Tag<FormatRGBA16>(), "RGBA16");
+}
+
+// The frame size comes in at run time, as with a constant GCC warns about loops it cannot prove
+// to end when it inlines the conversions
+int main(int argc, char** argv)
+{
+    const size_t PIXELS = argc > 1 ? static_cast<size_t>(::atol(argv[1])) : 1920 * 1080;
+    // Premultiplied and translucent, so that no alpha shortcut applies
+    std::vector<uint32_t> rendered(PIXELS);
+    for (size_t i = 0; i < PIXELS; i++) {
+        const uint32_t a = 64 + i % 192;
+        rendered[i] = PixelFormat::Premultiply((static_cast<uint32_t>(i * 0x010305u) & 0xffffff) | (a << 24));
+    }
+    std::vector<uint8_t> converted(PIXELS * 8);
+    std::vector<uint32_t> back(PIXELS);
+
+    Bench::Title("PixelConverter: a frame of 1920x1080 pixels from and to premultiplied RGBA");
+    ForEachFormat([&](auto tag, const char* name) {
+        typedef typename decltype(tag)::Type Format;
+        const std::string to = std::string("PRGBA8 to ") + name;
+        Bench::ReportRate(to.c_str(), Bench::Time([&] {
+            PixelConverter::Convert<FormatPRGBA8, Format>(rendered.data(), converted.data(), PIXELS);
+        }), PIXELS, "pixel");
+    });
+    ForEachFormat([&](auto tag, const char* name) {
+        typedef typename decltype(tag)::Type Format;
+        PixelConverter::Convert<FormatPRGBA8, Format>(rendered.data(), converted.data(), PIXELS);
+        const std::string from = std::string(name) + " to PRGBA8";
+        Bench::ReportRate(from.c_str(), Bench::Time([&] {
+            PixelConverter::Convert<Format, FormatPRGBA8>(converted.data(), back.data(), PIXELS);
+        }), PIXELS, "pixel");
+    });
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "platform.h"
+#include <stdio.h>
+#include <dirent.h>
+#include <signal.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "isolate.hpp"
+#include "bench.hpp"
+
+// RenderWorkerPool with workers exec'd against workers forked by a zygote: how long a job waits
+// for its worker to be replaced, and what the workers cost in memory. The workers are this
+// program, run again by the pool.
+
+static const int WORKERS = 4;
+
+static std::string GetSelf()
+{
+    char path[4096];
+    const ssize_t cch = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    return std::string(path, cch > 0 ? static_cast<size_t>(cch) : 0);
+}
+
+// Live processes whose parent is parent
+static std::vector<pid_t> GetChildren(pid_t parent)
+{
+    std::vector<pid_t> children;
+    DIR* dir = ::opendir("/proc");
+    if (dir == nullptr) {
+        return children;
+    }
+    while (dirent* entry = ::readdir(dir)) {
+        const pid_t pid = static_cast<pid_t>(::atoi(entry->d_name));
+        char path[64];
+        ::snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+        FILE* fp = pid > 0 ? ::fopen(path, "r") : nullptr;
+        if (fp == nullptr) {
+            continue;
+        }
+        char stat[512] = {};
+        const size_t cb = ::fread(stat, 1, sizeof(stat) - 1, fp);
+        ::fclose(fp);
+        stat[cb] = 0;
+        const char* end = ::strrchr(stat, ')');
+        char state = 0;
+        int ppid = 0;
+        if (end != nullptr && ::sscanf(end + 1, " %c %d", &state, &ppid) == 2 && ppid == parent && state != 'Z') {
+            children.push_back(pid);
+        }
+    }
+    ::closedir(dir);
+    return children;
+}
+
+// The workers and the zygote, if any
+static std::vector<pid_t> GetProcesses()
+{
+    std::vector<pid_t> processes = GetChildren(::getpid());
+    for (size_t i = 0, count = processes.size(); i < count; i++) {
+        const std::vector<pid_t> more = GetChildren(processes[i]);
+        processes.insert(processes.end(), more.begin(), more.end());
+    }
+    return processes;
+}
+
+// The workers, whichever process started them
+static std::vector<pid_t> GetWorkers(bool zygote)
+{
+    std::vector<pid_t> workers = GetChildren(::getpid());
+    if (zygote) {
+        std::vector<pid_t> forked;
+        for (pid_t pid : workers) {
+            const std::vector<pid_t> more = GetChildren(pid);
+            forked.insert(forked.end(), more.begin(), more.end());
+        }
+        workers.swap(forked);
+    }
+    return workers;
+}
+
+// Kilobytes of a smaps_rollup field
+static long ReadRollup(pid_t pid, const char* field)
+{
+    char path[64];
+    ::snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", static_cast<int>(pid));
+    FILE* fp = ::fopen(path, "r");
+    if (fp == nullptr) {
+        return 0;
+    }
+    char line[256];
+    long kb = 0;
+    const size_t cch = ::strlen(field);
+    while (::fgets(line, sizeof(line), fp) != nullptr) {
+        if (::strncmp(line, field, cch) == 0 && line[cch] == ':') {
+            kb = ::atol(line + cch + 1);
+            break;
+        }
+    }
+    ::fclose(fp);
+    return kb;
+}
+
+static HRESULT Render(RenderWorkerPool& pool, const std::string& text, uint32_t size)
+{
+    RenderWorkerResult result;
+    return pool.Render(text.data(), static_cast<uint32_t>(text.size()), size, RenderQualityPrecise, 10000, &result);
+}
+
+// Median seconds of a render right after its worker was killed, with the kill itself not counted
+static double TimeRespawn(RenderWorkerPool& pool, bool zygote, const std::string& text, int runs = 15)
+{
+    Render(pool, text, 32);
+    std::vector<double> times;
+    for (int i = 0; i < runs; i++) {
+        std::vector<pid_t> workers = GetWorkers(zygote);
+        for (pid_t pid : workers) {
+            ::kill(pid, SIGKILL);
+        }
+        while (!workers.empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            workers = GetWorkers(zygote);
+        }
+        const Bench::Clock::time_point start = Bench::Clock::now();
+        Render(pool, text, 32);
+        times.push_back(Bench::GetSeconds(start));
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+int main(int argc, char** argv)
+{
+    if (RenderWorker::ServeIfAsked(argc, argv)) {
+        return 0;
+    }
+    const std::string self = GetSelf();
+    const std::string text = Bench::MakeDocument(20);
+
+    Bench::Title("RenderWorkerPool: a 32 px thumbnail on a warm worker, and after its worker was killed");
+    double warm = 0;
+    {
+        RenderWorkerPool pool(self.c_str(), 1);
+        warm = Bench::Time([&] {
+            Render(pool, text, 32);
+        }, 15);
+    }
+    Bench::Report("warm worker", warm, warm);
+    for (bool zygote : { false, true }) {
+        RenderWorkerPool pool(self.c_str(), 1);
+        pool.SetZygote(zygote);
+        Bench::Report(zygote ? "worker forked by the zygote" : "worker exec'd", TimeRespawn(pool, zygote, text), warm);
+    }
+
+    ::printf("\nRenderWorkerPool: memory of %d workers after a render each, zygote included\n", WORKERS);
+    for (bool zygote : { false, true }) {
+        RenderWorkerPool pool(self.c_str(), WORKERS);
+        pool.SetZygote(zygote);
+        // Concurrent jobs spread over the workers
+        std::vector<std::thread> clients;
+        for (int i = 0; i < WORKERS; i++) {
+            clients.emplace_back([&] {
+                Render(pool, Bench::MakeDocument(2000), 256);
+            });
+        }
+        for (std::thread& client : clients) {
+            client.join();
+        }
+        const std::vector<pid_t> processes = GetProcesses();
+        long rss = 0;
+        long pss = 0;
+        for (pid_t pid : processes) {
+            rss += ReadRollup(pid, "Rss");
+            pss += ReadRollup(pid, "Pss");
+        }
+        ::printf("  %-40s %3zu processes %8.1f MB RSS %8.1f MB PSS\n", zygote ? "forked by the zygote" : "exec'd", processes.size(), rss / 1024.0, pss / 1024.0);
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include "platform.h"
+#include <string>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "bench.hpp"
+
+int main()
+{
+    // The sizes the shell's thumbnail cache asks for
+    static const uint32_t SIZES[] = { 256, 96, 48, 32, 16 };
+    static const size_t COUNT = sizeof(SIZES) / sizeof(SIZES[0]);
+    const std::string text = Bench::MakeDocument(2000);
+    SvgOptions svgOpt;
+    Svg svg;
+    if (FAILED(svg.Load(text.data(), text.size(), svgOpt))) {
+        return 1;
+    }
+
+    Bench::Title("RenderMipmaps: thumbnails at 256, 96, 48, 32 and 16 of 2000 shapes");
+    const double independent = Bench::Time([&] {
+        SvgRenderTarget targets[COUNT];
+        for (size_t i = 0; i < COUNT; i++) {
+            SvgRenderTarget::RenderOptions opt;
+            opt.SetCanvasSize(SIZES[i], SIZES[i]).SetToContain();
+            svg.Render(opt, &targets[i]);
+        }
+    });
+    Bench::Report("one Render per size", independent, independent);
+
+    Bench::Report("RenderMipmaps", Bench::Time([&] {
+        SvgRenderTarget targets[COUNT];
+        svg.RenderMipmaps(SIZES, COUNT, targets);
+    }), independent);
+
+    return 0;
+}
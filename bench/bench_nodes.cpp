@@ -0,0 +1,59 @@
+#include "platform.h"
+#include <string>
+#include <vector>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "bench.hpp"
+
+// A sprite sheet of count icons, each a group with an id, as icon sets ship them
+static std::string MakeSprites(int count)
+{
+    std::string text = "<svg xmlns='http://www.w3.org/2000/svg' width='1600' height='1600'>";
+    for (int i = 0; i < count; i++) {
+        const int x = (i % 40) * 40;
+        const int y = (i / 40) * 40;
+        text += "<g id='icon" + std::to_string(i) + "' transform='translate(" + std::to_string(x) + " " + std::to_string(y) + ")'>"
+            "<circle cx='16' cy='16' r='14' fill='#f80' stroke='#222' stroke-width='2'/>"
+            "<path d='M8 16l6 6 10-12' fill='none' stroke='#fff' stroke-width='3'/></g>";
+    }
+    return text + "</svg>";
+}
+
+int main()
+{
+    static const int ICONS = 300;
+    const std::string text = MakeSprites(ICONS);
+    std::vector<std::string> names;
+    std::vector<const char*> ids;
+    for (int i = 0; i < ICONS; i++) {
+        names.push_back("icon" + std::to_string(i));
+    }
+    for (const std::string& name : names) {
+        ids.push_back(name.c_str());
+    }
+    SvgOptions svgOpt;
+    SvgRenderTarget::RenderOptions opt;
+    opt.SetCanvasSize(64, 64).SetToContain();
+
+    Bench::Title("RenderNodes: 300 icons of one sprite sheet at 64x64");
+    const double reparse = Bench::Time([&] {
+        for (int i = 0; i < ICONS; i++) {
+            Svg svg;
+            SvgRenderTarget target;
+            if (SUCCEEDED(svg.Load(text.data(), text.size(), svgOpt))) {
+                svg.RenderNode(ids[i], opt, &target);
+            }
+        }
+    }, 3);
+    Bench::Report("Load and RenderNode per icon", reparse, reparse);
+
+    Bench::Report("one Load, RenderNodes", Bench::Time([&] {
+        Svg svg;
+        std::vector<SvgRenderTarget> targets(ICONS);
+        if (SUCCEEDED(svg.Load(text.data(), text.size(), svgOpt))) {
+            svg.RenderNodes(ids.data(), ICONS, opt, targets.data());
+        }
+    }, 3), reparse);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "platform.h"
+#include <string>
+#include <vector>
+
+#include "png.hpp"
+#include "palette.hpp"
+#include "export.hpp"
+#include "bench.hpp"
+
+// Indexed-colour PNGs against RGBA ones for icons of a few to a few hundred colours: the size
+// ratio, the cost of finding the palette and encoding, and the decode side, which is inflating
+// the smaller stream plus, for a consumer that wants RGBA, expanding the indices.
+
+// A transparent background and a grid of count - 1 flat squares, each its own colour, some of
+// them translucent; anti-aliasing is left out so the count is exact, and past 256 the indexed
+// encoder falls back to RGBA
+static std::vector<uint32_t> MakeIcon(uint32_t size, unsigned count)
+{
+    std::vector<uint32_t> pixels(static_cast<size_t>(size) * size, 0);
+    uint32_t columns = 1;
+    while (columns * columns < count - 1) {
+        columns++;
+    }
+    const uint32_t cell = size / columns;
+    for (unsigned i = 1; i < count; i++) {
+        // Premultiplied as they stand: no channel of a translucent one exceeds its alpha
+        const uint32_t colour = i % 3 == 0
+            ? (i & 0x7F) | ((i >> 7) * 30 << 8) | (60 << 16) | ((128 + i % 64) << 24)
+            : (i & 0xFF) | (((i >> 8) * 40 + 10) << 8) | (200 << 16) | 0xFF000000u;
+        const uint32_t x0 = (i - 1) % columns * cell;
+        const uint32_t y0 = (i - 1) / columns * cell;
+        for (uint32_t y = y0 + 1; y + 1 < y0 + cell; y++) {
+            for (uint32_t x = x0 + 1; x + 1 < x0 + cell; x++) {
+                pixels[static_cast<size_t>(y) * size + x] = colour;
+            }
+        }
+    }
+    return pixels;
+}
+
+static double Inflate(const ByteBuffer& png, std::vector<uint8_t>* out)
+{
+    // Every IDAT body, in order
+    std::vector<uint8_t> idat;
+    const uint8_t* data = png.GetData();
+    for (size_t offset = 8; offset + 12 <= png.GetSize();) {
+        const uint32_t cb = (static_cast<uint32_t>(data[offset]) << 24) | (data[offset + 1] << 16) | (data[offset + 2] << 8) | data[offset + 3];
+        if (::memcmp(data + offset + 4, "IDAT", 4) == 0) {
+            idat.insert(idat.end(), data + offset + 8, data + offset + 8 + cb);
+        }
+        offset += cb + 12;
+    }
+    return Bench::Time([&] {
+        uLongf cb = static_cast<uLongf>(out->size());
+        ::uncompress(out->data(), &cb, idat.data(), static_cast<uLong>(idat.size()));
+    });
+}
+
+int main()
+{
+    static const uint32_t SIZE = 256;
+    Bench::Title("SaveCompactPng: 256x256 icons, indexed against RGBA, in ms");
+    // Encode times include finding the palette; inflate is of either stream, expand of the indices
+    ::printf("  %-7s %-5s %8s %8s %7s %8s %8s %8s %8s %8s %8s\n", "colours", "depth", "RGBA KB", "index KB", "ratio",
+        "palette", "RGBA enc", "idx enc", "RGBA inf", "idx inf", "expand");
+    for (unsigned count : { 2u, 4u, 16u, 64u, 256u, 600u }) {
+        const std::vector<uint32_t> pixels = MakeIcon(SIZE, count);
+        IndexedImage indexed;
+        const double palette = Bench::Time([&] {
+            indexed.Create(pixels.data(), SIZE, SIZE, SIZE);
+        });
+        const bool fits = !indexed.IsNull();
+        MemorySink rgba;
+        MemorySink compact;
+        const double rgbaSeconds = Bench::Time([&] {
+            rgba.GetBuffer().Clear();
+            PngWriter writer;
+            writer.Begin(&rgba, SIZE, SIZE);
+            writer.WriteRows(pixels.data(), SIZE, SIZE);
+            writer.End();
+        });
+        const double compactSeconds = Bench::Time([&] {
+            compact.GetBuffer().Clear();
+            SvgExporter::SaveCompactPng(pixels.data(), SIZE, SIZE, SIZE, &compact);
+        });
+        const unsigned colours = fits ? indexed.GetColourCount() : count;
+        const char* depth = !fits ? "RGBA" : colours <= 2 ? "1" : colours <= 4 ? "2" : colours <= 16 ? "4" : "8";
+        const size_t cbLine = fits ? (SIZE * (colours <= 2 ? 1 : colours <= 4 ? 2 : colours <= 16 ? 4 : 8) + 7) / 8 : SIZE * 4;
+        std::vector<uint8_t> inflated(SIZE * (SIZE * 4 + 1));
+        const double rgbaInflate = Inflate(rgba.GetBuffer(), &inflated);
+        inflated.resize(SIZE * (cbLine + 1));
+        const double compactInflate = Inflate(compact.GetBuffer(), &inflated);
+        std::vector<uint32_t> expanded(pixels.size());
+        const double expand = fits ? Bench::Time([&] {
+            indexed.CopyTo(expanded.data(), SIZE);
+        }) : 0;
+        const double rgbaSize = static_cast<double>(rgba.GetBuffer().GetSize());
+        const double compactSize = static_cast<double>(compact.GetBuffer().GetSize());
+        ::printf("  %-7u %-5s %8.1f %8.1f %6.2fx %8.3f %8.3f %8.3f %8.3f %8.3f %8.3f\n", colours, depth, rgbaSize / 1024, compactSize / 1024,
+            rgbaSize / compactSize, palette * 1000, rgbaSeconds * 1000, compactSeconds * 1000, rgbaInflate * 1000, compactInflate * 1000, expand * 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "platform.h"
+#include <stdint.h>
+#include <atomic>
+
+#include "parallel.hpp"
+#include "bench.hpp"
+
+// Stands in for a job of the given size without touching memory, so that only the
+// scheduling differs between runs
+static uint32_t Spin(uint32_t rounds)
+{
+    uint32_t x = rounds;
+    for (uint32_t i = 0; i < rounds; i++) {
+        x = x * 1664525u + 1013904223u;
+    }
+    return x;
+}
+
+// count jobs on a group, every hugeEvery-th of them huge and the others tiny, as when a batch
+// of thumbnails holds a few large drawings
+static void RunMixed(TaskScheduler& scheduler, int count, int hugeEvery)
+{
+    std::atomic<uint32_t> sink(0);
+    TaskGroup group(TaskPriorityNormal, nullptr, scheduler);
+    for (int i = 0; i < count; i++) {
+        const uint32_t rounds = hugeEvery > 0 && i % hugeEvery == 0 ? 20000000u : 2000u;
+        group.Run([&sink, rounds] {
+            sink += Spin(rounds);
+        });
+    }
+    group.Wait();
+}
+
+static void Scale(const char* title, int count, int hugeEvery)
+{
+    static const unsigned CONCURRENCY[] = { 1, 2, 4, 8 };
+    static TaskScheduler* schedulers[4];
+    Bench::Title(title);
+    double baseline = 0;
+    for (int i = 0; i < 4; i++) {
+        if (schedulers[i] == nullptr) {
+            schedulers[i] = new TaskScheduler(CONCURRENCY[i]);
+        }
+        const double seconds = Bench::Time([&] {
+            RunMixed(*schedulers[i], count, hugeEvery);
+        }, 5);
+        if (i == 0) {
+            baseline = seconds;
+        }
+        char name[32];
+        ::snprintf(name, sizeof(name), "concurrency %u", CONCURRENCY[i]);
+        Bench::Report(name, seconds, baseline);
+    }
+}
+
+int main()
+{
+    Scale("TaskScheduler: 4000 tiny jobs", 4000, 0);
+    Scale("TaskScheduler: 4000 tiny jobs, every 500th huge", 4000, 500);
+    Scale("TaskScheduler: 16 huge jobs", 16, 1);
+    return 0;
+}
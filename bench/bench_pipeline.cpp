@@ -0,0 +1,136 @@
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+
+#include "batch.hpp"
+#include "bench.hpp"
+
+// SvgBatchExporter over a corpus of files, `bench_pipeline [directory of .svg files]`, or a
+// generated one of small and large documents without one: files a second against loading,
+// rendering and encoding each file in turn, and how busy every stage was, which shows the
+// bottleneck and whether giving a stage more threads could help.
+
+static std::vector<std::string> ReadCorpus(const char* path)
+{
+    std::vector<std::string> paths;
+    DIR* dir = ::opendir(path);
+    if (dir == nullptr) {
+        return paths;
+    }
+    while (dirent* entry = ::readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.size() >= 5 && name.compare(name.size() - 4, 4, ".svg") == 0) {
+            paths.push_back(std::string(path) + "/" + name);
+        }
+    }
+    ::closedir(dir);
+    return paths;
+}
+
+// Mostly small documents with a large one every so often, as an icon set with a few
+// illustrations in it; removed again by main
+static std::vector<std::string> MakeCorpus(size_t count)
+{
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < count; i++) {
+        const std::string text = i % 8 == 0 ? Bench::MakeDocument(800, 800, 600) : Bench::MakeDocument(20 + static_cast<int>(i % 5) * 20);
+        char path[32];
+        ::strcpy(path, "/tmp/svg-bench-XXXXXX");
+        const int fd = ::mkstemp(path);
+        if (fd < 0) {
+            continue;
+        }
+        const bool written = ::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+        ::close(fd);
+        if (written) {
+            paths.push_back(path);
+        } else {
+            ::unlink(path);
+        }
+    }
+    return paths;
+}
+
+static void ReportStages(const SvgBatchExporter& exporter)
+{
+    ::printf("  %-10s %7s %7s %10s %12s\n", "stage", "threads", "items", "busy ms", "utilisation");
+    for (size_t i = 0; i < BatchStageCount; i++) {
+        const PipelineStageStats& stats = exporter.GetStageStats(static_cast<BatchStage>(i));
+        ::printf("  %-10s %7u %7llu %10.1f %11.0f%%\n", stats.name, stats.concurrency, static_cast<unsigned long long>(stats.items),
+            stats.busySeconds * 1000, stats.GetUtilisation(exporter.GetElapsedSeconds()) * 100);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const bool generated = argc <= 1;
+    const std::vector<std::string> paths = generated ? MakeCorpus(64) : ReadCorpus(argv[1]);
+    if (paths.empty()) {
+        ::fprintf(stderr, "bench_pipeline: no .svg files\n");
+        return 1;
+    }
+    const size_t count = paths.size();
+    SvgOptions opt;
+    SvgRenderTarget::RenderOptions ropt;
+    ropt.SetCanvasSize(256, 256).SetToContain();
+    std::vector<MemorySink> sinks(count);
+    std::vector<SvgBatchJob> jobs(count);
+    for (size_t i = 0; i < count; i++) {
+        jobs[i] = { paths[i].c_str(), &sinks[i], S_OK };
+    }
+    const auto clear = [&] {
+        for (MemorySink& sink : sinks) {
+            sink.GetBuffer().Clear();
+        }
+    };
+
+    const std::string title = "SvgBatchExporter: " + std::to_string(count) + " files to 256x256 PNGs, against a loop over them";
+    Bench::Title(title.c_str());
+    const double serial = Bench::Time([&] {
+        clear();
+        for (size_t i = 0; i < count; i++) {
+            Svg svg;
+            SvgRenderTarget target;
+            if (SUCCEEDED(svg.Load(paths[i].c_str(), opt)) && SUCCEEDED(svg.Render(ropt, &target))) {
+                SvgExporter::SaveCompactPng(target, &sinks[i]);
+            }
+        }
+    }, 3);
+    ::printf("  %-40s %10.3f ms %8.1f files/s\n", "load, render, encode per file", serial * 1000, count / serial);
+
+    SvgBatchExporter exporter;
+    const double batch = Bench::Time([&] {
+        clear();
+        exporter.SavePngs(jobs.data(), count, opt, ropt);
+    }, 3);
+    ::printf("  %-40s %10.3f ms %8.1f files/s %6.2fx\n", "SvgBatchExporter, default stages", batch * 1000, count / batch, serial / batch);
+    size_t failed = 0;
+    for (const SvgBatchJob& job : jobs) {
+        failed += FAILED(job.result);
+    }
+    if (failed > 0) {
+        ::printf("  %zu files failed\n", failed);
+    }
+    // The stats are of the last run
+    ReportStages(exporter);
+
+    // The encoder is the other stage with real work, so it is the one to widen next
+    exporter.SetConcurrency(BatchStageEncode, 2).SetQueueCapacity(4);
+    const double wide = Bench::Time([&] {
+        clear();
+        exporter.SavePngs(jobs.data(), count, opt, ropt);
+    }, 3);
+    ::printf("  %-40s %10.3f ms %8.1f files/s %6.2fx\n", "two encoders, queues of 4", wide * 1000, count / wide, serial / wide);
+    ReportStages(exporter);
+
+    if (generated) {
+        for (const std::string& path : paths) {
+            ::unlink(path.c_str());
+        }
+    }
+    return 0;
+}
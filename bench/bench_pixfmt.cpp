@@ -0,0 +1,76 @@
+#include "platform.h"
+#include <string>
+#include <vector>
+
+#include "pixfmt.hpp"
+#include "bench.hpp"
+
+// PixelFormat::ToBgra on frames that are opaque, mostly opaque with translucent edges, mostly
+// transparent as icons are, and translucent throughout, against a loop that unpremultiplies
+// every pixel the way thumbnails were converted before alpha was classified
+
+struct Mix
+{
+    const char* name;
+    // Out of 256: opaque, then clear, the rest translucent
+    uint32_t opaque;
+    uint32_t clear;
+};
+
+static std::vector<uint32_t> MakePixels(size_t count, const Mix& mix)
+{
+    std::vector<uint32_t> pixels(count);
+    uint32_t state = 1;
+    for (size_t i = 0; i < count; i++) {
+        state = state * 1103515245u + 12345u;
+        const uint32_t kind = (state >> 16) & 0xFF;
+        const uint32_t a = kind < mix.opaque ? 255 : kind < mix.opaque + mix.clear ? 0 : 1 + (state >> 8) % 254;
+        const uint32_t c = (state >> 4) % (a + 1);
+        pixels[i] = c | ((a - c) << 8) | ((c / 2) << 16) | (a << 24);
+    }
+    return pixels;
+}
+
+static uint32_t Clamp(int x)
+{
+    return x < 0 ? 0 : x > 255 ? 255 : static_cast<uint32_t>(x);
+}
+
+static void DivideEvery(const uint32_t* src, uint32_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        const int r = src[i] & 0xff;
+        const int g = (src[i] >> 8) & 0xff;
+        const int b = (src[i] >> 16) & 0xff;
+        const int a = src[i] >> 24;
+        dst[i] = a == 0 ? 0 : Clamp((b * 256 - 128) / a) | (Clamp((g * 256 - 128) / a) << 8) | (Clamp((r * 256 - 128) / a) << 16) | (static_cast<uint32_t>(a) << 24);
+    }
+}
+
+int main()
+{
+    static const size_t PIXELS = 1920 * 1080;
+    static const Mix MIXES[] = {
+        { "opaque", 256, 0 },
+        { "opaque, 5% translucent edges", 243, 0 },
+        { "icon, 70% clear, 5% edges", 64, 179 },
+        { "translucent", 0, 0 },
+    };
+    std::vector<uint32_t> out(PIXELS);
+    Bench::Title("PixelFormat::ToBgra: a 1920x1080 frame");
+    for (const Mix& mix : MIXES) {
+        const std::vector<uint32_t> pixels = MakePixels(PIXELS, mix);
+        ::printf("  %s\n", mix.name);
+        const double divide = Bench::Time([&] {
+            DivideEvery(pixels.data(), out.data(), PIXELS);
+        });
+        Bench::ReportRate("dividing every pixel", divide, PIXELS, "pixel");
+        Bench::ReportRate("ToBgra, straight", Bench::Time([&] {
+            PixelFormat::ToBgra<true>(pixels.data(), out.data(), PIXELS);
+        }), PIXELS, "pixel");
+        Bench::ReportRate("ToBgra, premultiplied", Bench::Time([&] {
+            PixelFormat::ToBgra<false>(pixels.data(), out.data(), PIXELS);
+        }), PIXELS, "pixel");
+    }
+    return 0;
+}
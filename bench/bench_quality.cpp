@@ -0,0 +1,190 @@
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "quality.hpp"
+#include "bench.hpp"
+
+// Latency against pixel difference of speed and precise renders over a corpus, to tune the
+// thresholds of RenderQualityPolicy: `bench_quality [directory of .svg files]`, or a generated
+// corpus of shapes, text and filters without one. The policy's choices come last, from what it
+// learned over the same renders, against rendering everything precise.
+
+struct Document
+{
+    std::string name;
+    std::string text;
+};
+
+static std::string MakeText(int count)
+{
+    std::string text = "<svg xmlns='http://www.w3.org/2000/svg' width='400' height='300'>";
+    for (int i = 0; i < count; i++) {
+        text += "<text x='" + std::to_string(10 + (i * 37) % 300) + "' y='" + std::to_string(20 + (i * 53) % 260)
+            + "' font-size='" + std::to_string(8 + i % 24) + "' fill='#234'>Thumbnail " + std::to_string(i) + "</text>";
+    }
+    return text + "</svg>";
+}
+
+static std::string MakeFilters(int filters, int shapes)
+{
+    std::string text = "<svg xmlns='http://www.w3.org/2000/svg' width='400' height='300'>";
+    for (int i = 0; i < filters; i++) {
+        text += "<filter id='f" + std::to_string(i) + "'><feGaussianBlur stdDeviation='" + std::to_string(2 + i % 6) + "'/>"
+            "<feColorMatrix type='saturate' values='0.5'/></filter>";
+    }
+    for (int i = 0; i < shapes; i++) {
+        text += "<rect x='" + std::to_string((i * 37) % 360) + "' y='" + std::to_string((i * 53) % 260)
+            + "' width='40' height='30' rx='6' fill='#08f' filter='url(#f" + std::to_string(i % filters) + ")'/>";
+    }
+    return text + "</svg>";
+}
+
+static std::vector<Document> ReadCorpus(const char* path)
+{
+    std::vector<Document> corpus;
+    DIR* dir = ::opendir(path);
+    if (dir == nullptr) {
+        return corpus;
+    }
+    while (dirent* entry = ::readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.size() < 5 || name.compare(name.size() - 4, 4, ".svg") != 0) {
+            continue;
+        }
+        FILE* fp = ::fopen((std::string(path) + "/" + name).c_str(), "rb");
+        if (fp == nullptr) {
+            continue;
+        }
+        std::string text;
+        char buffer[65536];
+        size_t cb;
+        while ((cb = ::fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+            text.append(buffer, cb);
+        }
+        ::fclose(fp);
+        corpus.push_back({ name, text });
+    }
+    ::closedir(dir);
+    return corpus;
+}
+
+static std::vector<Document> MakeCorpus()
+{
+    return {
+        { "shapes-20", Bench::MakeDocument(20) },
+        { "shapes-300", Bench::MakeDocument(300) },
+        { "shapes-3000", Bench::MakeDocument(3000) },
+        { "text-40", MakeText(40) },
+        { "text-400", MakeText(400) },
+        { "filters-2x20", MakeFilters(2, 20) },
+        { "filters-16x200", MakeFilters(16, 200) },
+    };
+}
+
+// Mean absolute difference per channel, 0 to 255, and the share of pixels that differ at all
+static void Compare(const SvgRenderTarget& a, const SvgRenderTarget& b, double* mean, double* changed)
+{
+    *mean = 0;
+    *changed = 0;
+    if (a.GetWidth() != b.GetWidth() || a.GetHeight() != b.GetHeight() || a.GetWidth() == 0 || a.GetHeight() == 0) {
+        *mean = 255;
+        *changed = 1;
+        return;
+    }
+    const size_t count = static_cast<size_t>(a.GetWidth()) * a.GetHeight();
+    uint64_t sum = 0;
+    size_t differing = 0;
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t pa = a.GetPixels()[i];
+        const uint32_t pb = b.GetPixels()[i];
+        if (pa != pb) {
+            differing++;
+            for (int shift = 0; shift < 32; shift += 8) {
+                sum += static_cast<uint64_t>(::abs(static_cast<int>((pa >> shift) & 0xFF) - static_cast<int>((pb >> shift) & 0xFF)));
+            }
+        }
+    }
+    *mean = static_cast<double>(sum) / (count * 4);
+    *changed = static_cast<double>(differing) / count;
+}
+
+int main(int argc, char** argv)
+{
+    static const uint32_t SIZES[] = { 32, 48, 96, 256, 512 };
+    const std::vector<Document> corpus = argc > 1 ? ReadCorpus(argv[1]) : MakeCorpus();
+    SvgOptions qualityOpt[2];
+    qualityOpt[RenderQualitySpeed].SetSpeedOverQuality(true);
+    qualityOpt[RenderQualityPrecise].SetSpeedOverQuality(false);
+
+    struct Sample
+    {
+        size_t document;
+        uint32_t size;
+        SvgComplexity complexity;
+        double seconds[2];
+        double mean;
+        double changed;
+    };
+    std::vector<Sample> samples;
+
+    Bench::Title("RenderQualityPolicy: speed against precise renders, per document and size");
+    ::printf("  %-20s %5s %6s %4s %10s %10s %8s %9s\n", "document", "size", "elems", "filt", "speed ms", "precise ms", "mean diff", "changed");
+    for (size_t d = 0; d < corpus.size(); d++) {
+        const Document& document = corpus[d];
+        Sanitiser sans;
+        SvgComplexity complexity;
+        sans.Run(document.text.data(), document.text.size(), nullptr, &complexity);
+        Svg svg[2];
+        if (FAILED(svg[RenderQualitySpeed].Load(document.text.data(), document.text.size(), qualityOpt[RenderQualitySpeed]))
+            || FAILED(svg[RenderQualityPrecise].Load(document.text.data(), document.text.size(), qualityOpt[RenderQualityPrecise]))) {
+            ::printf("  %-20s failed to load\n", document.name.c_str());
+            continue;
+        }
+        for (uint32_t size : SIZES) {
+            SvgRenderTarget::RenderOptions opt;
+            opt.SetCanvasSize(size, size).SetToContain();
+            Sample sample = { d, size, complexity, {}, 0, 0 };
+            SvgRenderTarget targets[2];
+            for (int quality = 0; quality < 2; quality++) {
+                sample.seconds[quality] = Bench::Time([&] {
+                    svg[quality].Render(opt, &targets[quality]);
+                }, 3);
+            }
+            Compare(targets[RenderQualitySpeed], targets[RenderQualityPrecise], &sample.mean, &sample.changed);
+            ::printf("  %-20s %5u %6u %4u %10.3f %10.3f %8.3f %8.1f%%\n", document.name.c_str(), size, complexity.elements, complexity.filterPrimitives,
+                sample.seconds[RenderQualitySpeed] * 1000, sample.seconds[RenderQualityPrecise] * 1000, sample.mean, sample.changed * 100);
+            samples.push_back(sample);
+        }
+    }
+
+    // Each document at each size once, in corpus order, with the policy learning as it goes
+    RenderQualityPolicy policy;
+    double policySeconds = 0;
+    double preciseSeconds = 0;
+    double policyDiff = 0;
+    size_t speedChoices = 0;
+    for (const Sample& sample : samples) {
+        const uint64_t pixels = static_cast<uint64_t>(sample.size) * sample.size;
+        const RenderQuality quality = policy.Choose(sample.size, pixels, sample.complexity);
+        policy.Record(sample.complexity, quality, pixels, sample.seconds[quality]);
+        policySeconds += sample.seconds[quality];
+        preciseSeconds += sample.seconds[RenderQualityPrecise];
+        if (quality == RenderQualitySpeed) {
+            policyDiff += sample.mean;
+            speedChoices++;
+        }
+    }
+    if (!samples.empty()) {
+        ::printf("\nRenderQualityPolicy with its default thresholds over the %zu renders above\n", samples.size());
+        Bench::Report("all precise", preciseSeconds, preciseSeconds);
+        Bench::Report("as the policy chooses", policySeconds, preciseSeconds);
+        ::printf("  %zu renders for speed, mean diff %.3f over all renders\n", speedChoices, policyDiff / samples.size());
+    }
+    return 0;
+}
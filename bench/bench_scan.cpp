@@ -0,0 +1,43 @@
+#include "platform.h"
+#include <string>
+
+#include "svg.hpp"
+#include "bench.hpp"
+
+// What gathering SvgComplexity adds to the sanitiser pass, against parsing the same text
+static std::string MakeFilters(int count)
+{
+    std::string text = "<svg xmlns='http://www.w3.org/2000/svg' width='400' height='300'>";
+    for (int i = 0; i < count; i++) {
+        text += "<filter id='f" + std::to_string(i) + "'><feGaussianBlur stdDeviation='3'/><feBlend in='SourceGraphic' in2='BackgroundImage'/></filter>"
+            "<path d='M" + std::to_string(i % 400) + " 10l20 30h-40z' filter='url(#f" + std::to_string(i) + ")'/>";
+    }
+    return text + "</svg>";
+}
+
+int main()
+{
+    const std::string documents[] = { Bench::MakeDocument(5000), MakeFilters(5000) };
+    const char* const names[] = { "5000 shapes", "5000 filters" };
+    for (int i = 0; i < 2; i++) {
+        const std::string& text = documents[i];
+        const std::string title = std::string("Sanitiser: ") + names[i] + ", " + std::to_string(text.size() >> 10) + " KB";
+        Bench::Title(title.c_str());
+        const double sanitise = Bench::Time([&] {
+            Sanitiser sans;
+            sans.Run(text.data(), text.size());
+        });
+        Bench::Report("sanitise", sanitise, sanitise);
+        Bench::Report("sanitise and scan", Bench::Time([&] {
+            Sanitiser sans;
+            SvgComplexity complexity;
+            sans.Run(text.data(), text.size(), nullptr, &complexity);
+        }), sanitise);
+        SvgOptions opt;
+        Bench::Report("parse", Bench::Time([&] {
+            Svg svg;
+            svg.Load(text.data(), text.size(), opt);
+        }, 3), sanitise);
+    }
+    return 0;
+}
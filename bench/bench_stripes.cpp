@@ -0,0 +1,163 @@
+#include "platform.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <string>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "export.hpp"
+#include "bench.hpp"
+
+// What stripes cost: first the time a cancel token adds to a render, which splits it into
+// stripes that each render their overlap rows again, against the 32-row stripes it used to
+// take; then peak memory and time of exporting a PNG up to a gigapixel, rendered in stripes
+// straight into the encoder against rendering the whole image first. Each export runs in a
+// child process of its own, whose peak resident size wait4 reports, so one case's peak does
+// not hide the next one's.
+
+// Counts the bytes instead of keeping them, so only the export's own memory shows
+class CountingSink : public ByteSink
+{
+public:
+    uint64_t size = 0;
+
+    HRESULT Write(const void*, size_t cb) override
+    {
+        this->size += cb;
+        return S_OK;
+    }
+};
+
+struct Result
+{
+    double seconds;
+    uint64_t size;
+};
+
+// Peak resident MB of the child that ran fn, or a negative number when it failed
+template <class TFunc>
+static double RunIsolated(const TFunc& fn, Result* result)
+{
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        return -1;
+    }
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        ::close(fds[0]);
+        const Bench::Clock::time_point start = Bench::Clock::now();
+        Result out = { 0, 0 };
+        const HRESULT hr = fn(&out.size);
+        out.seconds = Bench::GetSeconds(start);
+        const bool written = ::write(fds[1], &out, sizeof(out)) == static_cast<ssize_t>(sizeof(out));
+        ::_exit(SUCCEEDED(hr) && written ? 0 : 1);
+    }
+    ::close(fds[1]);
+    if (pid < 0) {
+        ::close(fds[0]);
+        return -1;
+    }
+    const bool read = ::read(fds[0], result, sizeof(*result)) == static_cast<ssize_t>(sizeof(*result));
+    ::close(fds[0]);
+    int status = 0;
+    rusage usage = {};
+    if (::wait4(pid, &status, 0, &usage) != pid || !read || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+    // Kilobytes on Linux
+    return usage.ru_maxrss / 1024.0;
+}
+
+static void Report(const char* name, double peak, const Result& result)
+{
+    if (peak < 0) {
+        ::printf("  %-28s %10s\n", name, "failed");
+        return;
+    }
+    ::printf("  %-28s %10.1f %10.0f %10.1f\n", name, peak, result.seconds * 1000, result.size / 1048576.0);
+}
+
+int main()
+{
+    const std::string text = Bench::MakeDocument(300, 400, 400);
+    SvgOptions svgOpt;
+    Svg svg;
+    if (FAILED(svg.Load(text.data(), text.size(), svgOpt))) {
+        ::fprintf(stderr, "bench_stripes: the document does not parse\n");
+        return 1;
+    }
+    Bench::Title("Render with a cancel token, against none");
+    CancelToken token;
+    for (uint32_t size : { 96u, 256u, 1024u, 4096u }) {
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetCanvasSize(size, size).SetToContain();
+        ::printf("  %ux%u\n", size, size);
+        const double plain = Bench::Time([&] {
+            SvgRenderTarget target;
+            svg.Render(opt, &target);
+        });
+        Bench::Report("no token, one pass", plain, plain);
+        // Into a target of its own, as a render with a token does
+        Bench::Report("32-row stripes, 8 rows of overlap", Bench::Time([&] {
+            SvgRenderTarget target;
+            svg.RenderStripes(opt, 32, 8, [&](const uint32_t* stripe, uint32_t width, uint32_t height, uint32_t y, uint32_t rows) {
+                if (y == 0 && FAILED(target.Create(width, height))) {
+                    return E_OUTOFMEMORY;
+                }
+                ::memcpy(target.GetPixels() + static_cast<size_t>(y) * width, stripe, static_cast<size_t>(width) * 4 * rows);
+                return S_OK;
+            });
+        }), plain);
+        SvgRenderTarget::RenderOptions cancellable = opt;
+        cancellable.SetCancelToken(&token);
+        Bench::Report("token", Bench::Time([&] {
+            SvgRenderTarget target;
+            svg.Render(cancellable, &target);
+        }), plain);
+    }
+
+    Bench::Title("SvgExporter::SavePng: peak resident MB, striped against whole, one process per case");
+    ::printf("  %-28s %10s %10s %10s\n", "", "peak MB", "ms", "PNG MB");
+    Result idle = { 0, 0 };
+    Report("baseline, nothing exported", RunIsolated([](uint64_t*) {
+        return S_OK;
+    }, &idle), idle);
+    // The whole image at a gigapixel is 4GB, more than the comparison is worth; 32768 squared
+    // would be one pixel past what SetCanvasSize takes
+    for (uint32_t size : { 4096u, 8192u, 16384u, 32000u }) {
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetCanvasSize(size, size).SetToContain();
+        ::printf("  %ux%u, %.0f megapixels\n", size, size, static_cast<double>(size) * size / 1e6);
+        Result striped = { 0, 0 };
+        Report("stripes into the encoder", RunIsolated([&](uint64_t* cb) {
+            CountingSink sink;
+            const HRESULT hr = SvgExporter::SavePng(svg, opt, &sink);
+            *cb = sink.size;
+            return hr;
+        }, &striped), striped);
+        if (size > 16384) {
+            continue;
+        }
+        Result whole = { 0, 0 };
+        Report("whole image, then encoded", RunIsolated([&](uint64_t* cb) {
+            SvgRenderTarget target;
+            HRESULT hr = svg.Render(opt, &target);
+            CountingSink sink;
+            PngWriter writer;
+            if (SUCCEEDED(hr)) {
+                hr = writer.Begin(&sink, target.GetWidth(), target.GetHeight());
+            }
+            if (SUCCEEDED(hr)) {
+                hr = writer.WriteRows(target.GetPixels(), target.GetHeight(), target.GetWidth());
+            }
+            if (SUCCEEDED(hr)) {
+                hr = writer.End();
+            }
+            *cb = sink.size;
+            return hr;
+        }, &whole), whole);
+    }
+    return 0;
+}
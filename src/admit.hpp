@@ -0,0 +1,198 @@
+#ifndef SVG_ADMIT_H
+#define SVG_ADMIT_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "complexity.hpp"
+#include "parallel.hpp"
+
+enum AdmissionDecision
+{
+    AdmissionAdmit,
+    // Render the cheap placeholder instead, e.g. at a fraction of the size
+    AdmissionDowngrade,
+    AdmissionReject,
+};
+
+class AdmissionController;
+
+// Cost a job holds against the budget until it finishes, i.e. the ticket is released or destroyed
+class AdmissionTicket
+{
+private:
+    AdmissionController* owner = nullptr;
+    uint64_t cost = 0;
+
+    friend class AdmissionController;
+
+public:
+    AdmissionTicket() = default;
+    AdmissionTicket(const AdmissionTicket&) = delete;
+    AdmissionTicket& operator =(const AdmissionTicket&) = delete;
+
+    AdmissionTicket(AdmissionTicket&& src)
+        : owner(src.owner)
+        , cost(src.cost)
+    {
+        src.owner = nullptr;
+        src.cost = 0;
+    }
+
+    ~AdmissionTicket()
+    {
+        this->Release();
+    }
+
+    inline void Release();
+
+    uint64_t GetCost() const
+    {
+        return this->cost;
+    }
+};
+
+
+// Sheds load before it queues up rather than after
+// Each job's cost is estimated up front from its source size, a pre-scan of its structure and
+// the pixels asked for. While the cost of the admitted jobs not finished yet is within the
+// budget, jobs are admitted; past it, a job gets its cheaper placeholder when that still fits,
+// and is rejected otherwise. Latency then stays bounded by the budget instead of growing with
+// the backlog. Costs are in estimated nanoseconds of rendering; the default weights are rough
+// and meant to rank jobs, not to predict their time. All members may be called from any thread.
+class AdmissionController
+{
+private:
+    uint64_t budget;
+    double perByte = 5;
+    double perElement = 20000;
+    double perPixel = 10;
+    // Added to perPixel for each filter primitive
+    double perFilterPixel = 20;
+    std::atomic<uint64_t> outstanding;
+    std::atomic<uint64_t> peak;
+    std::atomic<uint64_t> admitted;
+    std::atomic<uint64_t> downgraded;
+    std::atomic<uint64_t> rejected;
+
+    // A job is let in when nothing else is outstanding, or one larger than the budget could never run
+    bool TryCharge(uint64_t cost)
+    {
+        uint64_t current = this->outstanding.load();
+        do {
+            if (current != 0 && (cost > this->budget || current > this->budget - cost)) {
+                return false;
+            }
+        } while (!this->outstanding.compare_exchange_weak(current, current + cost));
+        const uint64_t total = current + cost;
+        uint64_t highest = this->peak.load();
+        while (total > highest && !this->peak.compare_exchange_weak(highest, total)) {
+        }
+        return true;
+    }
+
+    void Credit(uint64_t cost)
+    {
+        this->outstanding -= cost;
+    }
+
+    friend class AdmissionTicket;
+
+public:
+    // The default budget is two seconds of estimated work per core
+    explicit AdmissionController(uint64_t budget = 2000000000ull * Parallel::GetConcurrency())
+        : budget(budget)
+        , outstanding(0)
+        , peak(0)
+        , admitted(0)
+        , downgraded(0)
+        , rejected(0)
+    {
+    }
+
+    AdmissionController(const AdmissionController&) = delete;
+    AdmissionController& operator =(const AdmissionController&) = delete;
+
+    // Only before jobs are admitted
+    AdmissionController& SetBudget(uint64_t budget)
+    {
+        this->budget = budget;
+        return *this;
+    }
+
+    AdmissionController& SetWeights(double perByte, double perElement, double perPixel, double perFilterPixel)
+    {
+        this->perByte = perByte;
+        this->perElement = perElement;
+        this->perPixel = perPixel;
+        this->perFilterPixel = perFilterPixel;
+        return *this;
+    }
+
+    uint64_t Estimate(const SvgComplexity& complexity, uint64_t pixels) const
+    {
+        const double cost = complexity.bytes * this->perByte
+            + complexity.elements * this->perElement
+            + pixels * (this->perPixel + complexity.filterPrimitives * this->perFilterPixel);
+        return cost < 1.8e19 ? static_cast<uint64_t>(cost) : UINT64_MAX;
+    }
+
+    // placeholderCost is what the downgraded job would cost; UINT64_MAX when it has none
+    AdmissionDecision Admit(uint64_t cost, uint64_t placeholderCost, AdmissionTicket* ticket)
+    {
+        ticket->Release();
+        AdmissionDecision decision = AdmissionReject;
+        if (this->TryCharge(cost)) {
+            decision = AdmissionAdmit;
+            this->admitted++;
+        } else if (placeholderCost < cost && this->TryCharge(placeholderCost)) {
+            decision = AdmissionDowngrade;
+            cost = placeholderCost;
+            this->downgraded++;
+        } else {
+            this->rejected++;
+            return decision;
+        }
+        ticket->owner = this;
+        ticket->cost = cost;
+        return decision;
+    }
+
+    // Cost of the admitted jobs whose tickets are still held
+    uint64_t GetOutstandingCost() const
+    {
+        return this->outstanding.load();
+    }
+
+    uint64_t GetPeakCost() const
+    {
+        return this->peak.load();
+    }
+
+    uint64_t GetAdmittedCount() const
+    {
+        return this->admitted.load();
+    }
+
+    uint64_t GetDowngradedCount() const
+    {
+        return this->downgraded.load();
+    }
+
+    uint64_t GetRejectedCount() const
+    {
+        return this->rejected.load();
+    }
+};
+
+
+inline void AdmissionTicket::Release()
+{
+    if (this->owner != nullptr) {
+        this->owner->Credit(this->cost);
+        this->owner = nullptr;
+        this->cost = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef SVG_ASYNC_H
+#define SVG_ASYNC_H
+
+#include <mutex>
+#include <condition_variable>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "export.hpp"
+#include "parallel.hpp"
+#include "cancel.hpp"
+
+// Where asynchronous operations run; hosts with an event loop of their own can supply one
+// Post must run the task exactly once, on any thread, and may do so before it returns.
+class Executor
+{
+public:
+    virtual ~Executor() = default;
+    virtual void Post(Task* task) = 0;
+
+    // Runs tasks on the shared task scheduler at normal priority
+    static Executor& GetDefault();
+};
+
+
+class SchedulerExecutor : public Executor
+{
+private:
+    TaskScheduler& scheduler;
+    TaskPriority priority;
+
+public:
+    explicit SchedulerExecutor(TaskScheduler& scheduler = TaskScheduler::GetShared(), TaskPriority priority = TaskPriorityNormal)
+        : scheduler(scheduler)
+        , priority(priority)
+    {
+    }
+
+    void Post(Task* task) override
+    {
+        this->scheduler.Post(task, this->priority);
+    }
+};
+
+
+inline Executor& Executor::GetDefault()
+{
+    static SchedulerExecutor executor;
+    return executor;
+}
+
+
+// Load, render or encode that runs on an executor and reports back when done, like OVERLAPPED
+// The caller owns the operation, so starting one allocates nothing, and reuses it once it has
+// completed. Completion is reported through the callback, on the thread the work ran on, or by
+// waiting, which returns only after the callback has. The callback reads the result with
+// GetResult; the operation is pending until it returns, so it cannot wait on, restart or
+// destroy the operation.
+class AsyncOperation : private Task
+{
+public:
+    typedef void (*Completion)(AsyncOperation& op, void* context);
+    typedef void (*Resume)(void* context);
+
+private:
+    Executor* executor = nullptr;
+    Completion completion = nullptr;
+    void* context = nullptr;
+    Resume resume = nullptr;
+    void* resumeContext = nullptr;
+    HRESULT result = S_OK;
+    bool pending = false;
+    mutable std::mutex lock;
+    std::condition_variable done;
+
+    void Run() override
+    {
+        HRESULT hr = CancelToken::Check(this->token);
+        if (SUCCEEDED(hr)) {
+            hr = this->Execute();
+        }
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->result = hr;
+        }
+        // Still pending while the callback runs, so that waiters and destructors wait for it too
+        if (this->completion != nullptr) {
+            this->completion(*this, this->context);
+        }
+        // A waiter may destroy the operation as soon as it is marked done
+        Resume resume;
+        void* resumeContext;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            resume = this->resume;
+            resumeContext = this->resumeContext;
+            this->resume = nullptr;
+            this->pending = false;
+            this->done.notify_all();
+        }
+        if (resume != nullptr) {
+            resume(resumeContext);
+        }
+    }
+
+protected:
+    const CancelToken* token = nullptr;
+
+    virtual HRESULT Execute() = 0;
+
+    // Called by Start before it touches the arguments, which the running work reads
+    HRESULT Begin()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->pending) {
+            return HRESULT_FROM_WIN32(ERROR_BUSY);
+        }
+        this->pending = true;
+        this->result = E_PENDING;
+        return S_OK;
+    }
+
+    void Post()
+    {
+        Executor* executor = this->executor != nullptr ? this->executor : &Executor::GetDefault();
+        executor->Post(this);
+    }
+
+public:
+    AsyncOperation() = default;
+    AsyncOperation(const AsyncOperation&) = delete;
+    AsyncOperation& operator =(const AsyncOperation&) = delete;
+
+    // Not waiting for it here would leave the executor with a dangling task
+    virtual ~AsyncOperation()
+    {
+        this->Wait();
+    }
+
+    AsyncOperation& SetExecutor(Executor* executor)
+    {
+        this->executor = executor;
+        return *this;
+    }
+
+    AsyncOperation& SetCompletion(Completion completion, void* context)
+    {
+        this->completion = completion;
+        this->context = context;
+        return *this;
+    }
+
+    // Operations not started when it fires complete with its error without doing anything
+    AsyncOperation& SetCancelToken(const CancelToken* token)
+    {
+        this->token = token;
+        return *this;
+    }
+
+    bool IsPending() const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->pending;
+    }
+
+    // Calls resume once the next run has completed, after the operation is done, so that what it
+    // resumes may restart or destroy it. Fails while the operation is pending; only the one
+    // thread that then starts it may set it.
+    HRESULT SetResume(Resume resume, void* context)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (this->pending) {
+            return HRESULT_FROM_WIN32(ERROR_BUSY);
+        }
+        this->resume = resume;
+        this->resumeContext = context;
+        return S_OK;
+    }
+
+    // E_PENDING until the work has finished, which is before the callback runs
+    HRESULT GetResult() const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->result;
+    }
+
+    HRESULT Wait()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->done.wait(guard, [this] {
+            return !this->pending;
+        });
+        return this->result;
+    }
+};
+
+
+class SvgLoadOperation : public AsyncOperation
+{
+private:
+    Svg* svg = nullptr;
+    const void* ptr = nullptr;
+    size_t cb = 0;
+    const PathChar* path = nullptr;
+    const SvgOptions* opt = nullptr;
+
+    HRESULT Execute() override
+    {
+        return this->path != nullptr
+            ? this->svg->Load(this->path, *this->opt, this->token)
+            : this->svg->Load(this->ptr, this->cb, *this->opt, this->token);
+    }
+
+public:
+    ~SvgLoadOperation()
+    {
+        this->Wait();
+    }
+
+    // svg, the data and opt must stay alive until it completes
+    HRESULT Start(Svg* svg, const void* ptr, size_t cb, const SvgOptions& opt)
+    {
+        HRESULT hr = this->Begin();
+        if (FAILED(hr)) {
+            return hr;
+        }
+        this->svg = svg;
+        this->ptr = ptr;
+        this->cb = cb;
+        this->path = nullptr;
+        this->opt = &opt;
+        this->Post();
+        return S_OK;
+    }
+
+    HRESULT Start(Svg* svg, const PathChar* path, const SvgOptions& opt)
+    {
+        HRESULT hr = this->Begin();
+        if (FAILED(hr)) {
+            return hr;
+        }
+        this->svg = svg;
+        this->ptr = nullptr;
+        this->cb = 0;
+        this->path = path;
+        this->opt = &opt;
+        this->Post();
+        return S_OK;
+    }
+};
+
+
+class SvgRenderOperation : public AsyncOperation
+{
+private:
+    const Svg* svg = nullptr;
+    SvgRenderTarget::RenderOptions opt;
+    SvgRenderTarget* target = nullptr;
+
+    HRESULT Execute() override
+    {
+        return this->svg->Render(this->opt, this->target);
+    }
+
+public:
+    ~SvgRenderOperation()
+    {
+        this->Wait();
+    }
+
+    // opt is copied; the operation's cancel token, when set, also stops the render between stripes
+    HRESULT Start(const Svg* svg, const SvgRenderTarget::RenderOptions& opt, SvgRenderTarget* target)
+    {
+        HRESULT hr = this->Begin();
+        if (FAILED(hr)) {
+            return hr;
+        }
+        this->svg = svg;
+        this->opt = opt;
+        if (this->token != nullptr) {
+            this->opt.SetCancelToken(this->token);
+        }
+        this->target = target;
+        this->Post();
+        return S_OK;
+    }
+};
+
+
+class SvgEncodeOperation : public AsyncOperation
+{
+private:
+    const SvgRenderTarget* target = nullptr;
+    ByteSink* sink = nullptr;
+    PngOptions png;
+
+    HRESULT Execute() override
+    {
+        return SvgExporter::SaveCompactPng(*this->target, this->sink, this->png);
+    }
+
+public:
+    ~SvgEncodeOperation()
+    {
+        this->Wait();
+    }
+
+    // Encodes an already rendered image as PNG, see SvgExporter::SaveCompactPng
+    HRESULT Start(const SvgRenderTarget* target, ByteSink* sink, const PngOptions& png = PngOptions())
+    {
+        HRESULT hr = this->Begin();
+        if (FAILED(hr)) {
+            return hr;
+        }
+        this->target = target;
+        this->sink = sink;
+        this->png = png;
+        this->Post();
+        return S_OK;
+    }
+};
+
+
+#if defined(__cpp_impl_coroutine)
+// Lets a coroutine wait for an operation without blocking a thread:
+//     HRESULT hr = co_await AsyncAwaiter(op, [&] { return op.Start(&svg, ptr, cb, opt); });
+// start is called once the coroutine is suspended and returns what the operation's Start does;
+// the coroutine resumes with the operation's result on the thread that completed it, or at once
+// with start's error. Nothing else may start the operation while it is awaited.
+template <class TStart>
+class AsyncAwaiter
+{
+private:
+    AsyncOperation& op;
+    TStart start;
+    HRESULT hr = S_OK;
+
+    static void Resume(void* context)
+    {
+        std::coroutine_handle<>::from_address(context).resume();
+    }
+
+public:
+    AsyncAwaiter(AsyncOperation& op, TStart start)
+        : op(op)
+        , start(std::move(start))
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    // The coroutine may already have resumed, and this awaiter be gone, when a started operation's
+    // Start returns, so only a failed start touches the awaiter afterwards
+    bool await_suspend(std::coroutine_handle<> handle)
+    {
+        HRESULT hr = this->op.SetResume(Resume, handle.address());
+        if (SUCCEEDED(hr)) {
+            hr = this->start();
+            if (FAILED(hr)) {
+                this->op.SetResume(nullptr, nullptr);
+            }
+        }
+        if (FAILED(hr)) {
+            this->hr = hr;
+            return false;
+        }
+        return true;
+    }
+
+    HRESULT await_resume() const
+    {
+        return FAILED(this->hr) ? this->hr : this->op.GetResult();
+    }
+};
+#endif
+
+#endif
@@ -0,0 +1,429 @@
+#ifndef SVG_ATLAS_H
+#define SVG_ATLAS_H
+
+#include <stdio.h>
+#include <new>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "parallel.hpp"
+#include "buffer.hpp"
+
+// Skyline bottom-left rectangle packer
+// The atlas has a fixed width and grows downwards as needed.
+class SkylinePacker
+{
+private:
+    struct Segment
+    {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+
+    Segment* segments = nullptr;
+    size_t count = 0;
+    size_t capacity = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    // Returns the lowest y at which a w wide rectangle can sit starting at segment i
+    bool Fit(size_t i, uint32_t w, uint32_t* y) const
+    {
+        const uint32_t x = this->segments[i].x;
+        if (w > this->width - x) {
+            return false;
+        }
+        uint32_t top = 0;
+        uint32_t remaining = w;
+        while (remaining > 0) {
+            if (i >= this->count) {
+                return false;
+            }
+            if (this->segments[i].y > top) {
+                top = this->segments[i].y;
+            }
+            remaining = this->segments[i].width >= remaining ? 0 : remaining - this->segments[i].width;
+            i++;
+        }
+        *y = top;
+        return true;
+    }
+
+    bool InsertSegment(size_t index, const Segment& segment)
+    {
+        if (this->count == this->capacity) {
+            const size_t newCapacity = this->capacity < 16 ? 16 : this->capacity * 2;
+            Segment* newSegments = static_cast<Segment*>(::realloc(this->segments, newCapacity * sizeof(Segment)));
+            if (newSegments == nullptr) {
+                return false;
+            }
+            this->segments = newSegments;
+            this->capacity = newCapacity;
+        }
+        ::memmove(this->segments + index + 1, this->segments + index, (this->count - index) * sizeof(Segment));
+        this->segments[index] = segment;
+        this->count++;
+        return true;
+    }
+
+    void RemoveSegment(size_t index)
+    {
+        ::memmove(this->segments + index, this->segments + index + 1, (this->count - index - 1) * sizeof(Segment));
+        this->count--;
+    }
+
+public:
+    SkylinePacker()
+    {
+    }
+
+    ~SkylinePacker()
+    {
+        ::free(this->segments);
+    }
+
+    SkylinePacker(const SkylinePacker&) = delete;
+    SkylinePacker& operator =(const SkylinePacker&) = delete;
+
+    bool Init(uint32_t width)
+    {
+        this->count = 0;
+        this->width = width;
+        this->height = 0;
+        const Segment floor = { 0, 0, width };
+        return width > 0 && this->InsertSegment(0, floor);
+    }
+
+    uint32_t GetHeight() const
+    {
+        return this->height;
+    }
+
+    bool Insert(uint32_t w, uint32_t h, uint32_t* px, uint32_t* py)
+    {
+        if (w == 0 || h == 0 || w > this->width) {
+            return false;
+        }
+        size_t best = SIZE_MAX;
+        uint32_t bestY = UINT32_MAX;
+        uint32_t bestWidth = UINT32_MAX;
+        for (size_t i = 0; i < this->count; i++) {
+            uint32_t y;
+            if (this->Fit(i, w, &y) && h <= UINT32_MAX - y) {
+                if (y + h < bestY || (y + h == bestY && this->segments[i].width < bestWidth)) {
+                    best = i;
+                    bestY = y + h;
+                    bestWidth = this->segments[i].width;
+                }
+            }
+        }
+        if (best == SIZE_MAX) {
+            return false;
+        }
+        const Segment segment = { this->segments[best].x, bestY, w };
+        if (!this->InsertSegment(best, segment)) {
+            return false;
+        }
+        // shrink or drop the segments now covered by the new one
+        const uint32_t right = segment.x + segment.width;
+        for (size_t i = best + 1; i < this->count;) {
+            Segment& s = this->segments[i];
+            if (s.x >= right) {
+                break;
+            }
+            const uint32_t end = s.x + s.width;
+            if (end <= right) {
+                this->RemoveSegment(i);
+            } else {
+                s.width = end - right;
+                s.x = right;
+                break;
+            }
+        }
+        // merge neighbours at the same level
+        for (size_t i = 0; i + 1 < this->count;) {
+            if (this->segments[i].y == this->segments[i + 1].y) {
+                this->segments[i].width += this->segments[i + 1].width;
+                this->RemoveSegment(i + 1);
+            } else {
+                i++;
+            }
+        }
+        *px = segment.x;
+        *py = bestY - h;
+        if (bestY > this->height) {
+            this->height = bestY;
+        }
+        return true;
+    }
+};
+
+
+// Renders many small SVG documents into a single premultiplied RGBA image
+// Icons are parsed and rendered in parallel; each worker renders into its own scratch
+// pixmap, which is then copied row by row into the icon's slot of the atlas.
+class SvgAtlas
+{
+public:
+    struct Item
+    {
+        // input, owned by the caller
+        const char* name;
+        const void* data;
+        size_t size;
+        uint32_t canvasSize;
+        // output
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+        uint32_t height;
+        HRESULT result;
+    };
+
+private:
+    static const uint32_t DEFAULT_MAX_WIDTH = 4096;
+
+    Item* items = nullptr;
+    size_t count = 0;
+    uint32_t padding = 1;
+    uint32_t maxWidth = 0;
+    SvgRenderTarget image;
+
+    uint32_t ChooseWidth() const
+    {
+        uint64_t area = 0;
+        uint32_t widest = 0;
+        for (size_t i = 0; i < this->count; i++) {
+            const Item& item = this->items[i];
+            if (SUCCEEDED(item.result)) {
+                area += static_cast<uint64_t>(item.width + this->padding) * (item.height + this->padding);
+                if (item.width + this->padding > widest) {
+                    widest = item.width + this->padding;
+                }
+            }
+        }
+        // roughly square, rounded up to a power of two
+        uint32_t width = 16;
+        while (width < widest || static_cast<uint64_t>(width) * width < area) {
+            if (width >= DEFAULT_MAX_WIDTH) {
+                break;
+            }
+            width *= 2;
+        }
+        return width < widest ? widest : width;
+    }
+
+    HRESULT Pack()
+    {
+        const uint32_t width = this->maxWidth != 0 ? this->maxWidth : this->ChooseWidth();
+        size_t* order = static_cast<size_t*>(::calloc(this->count, sizeof(size_t)));
+        if (order == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        // tallest first packs tighter with a skyline
+        size_t n = 0;
+        for (size_t i = 0; i < this->count; i++) {
+            if (SUCCEEDED(this->items[i].result)) {
+                size_t j = n++;
+                while (j > 0 && this->items[order[j - 1]].height < this->items[i].height) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = i;
+            }
+        }
+        SkylinePacker packer;
+        HRESULT hr = n > 0 ? S_OK : E_FAIL;
+        if (SUCCEEDED(hr)) {
+            hr = packer.Init(width + this->padding) ? S_OK : E_OUTOFMEMORY;
+        }
+        for (size_t i = 0; i < n && SUCCEEDED(hr); i++) {
+            Item& item = this->items[order[i]];
+            if (!packer.Insert(item.width + this->padding, item.height + this->padding, &item.x, &item.y)) {
+                item.result = E_OUTOFMEMORY;
+            }
+        }
+        ::free(order);
+        if (SUCCEEDED(hr)) {
+            const uint32_t height = packer.GetHeight() > this->padding ? packer.GetHeight() - this->padding : 1;
+            hr = this->image.Create(width, height);
+        }
+        return hr;
+    }
+
+    static void AppendJsonString(ByteBuffer* out, const char* str, bool* ok)
+    {
+        *ok = *ok && out->AppendByte('"');
+        for (; *str != '\0' && *ok; str++) {
+            const unsigned char c = static_cast<unsigned char>(*str);
+            if (c == '"' || c == '\\') {
+                *ok = out->AppendByte('\\') && out->AppendByte(c);
+            } else if (c < 0x20) {
+                char escaped[8];
+                ::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                *ok = out->Append(escaped);
+            } else {
+                *ok = out->AppendByte(c);
+            }
+        }
+        *ok = *ok && out->AppendByte('"');
+    }
+
+public:
+    SvgAtlas()
+    {
+    }
+
+    SvgAtlas(const SvgAtlas&) = delete;
+    SvgAtlas& operator =(const SvgAtlas&) = delete;
+
+    // Empty space kept between icons, so that filtering in the consumer does not bleed
+    SvgAtlas& SetPadding(uint32_t padding)
+    {
+        this->padding = padding;
+        return *this;
+    }
+
+    // Fixed atlas width; zero picks a roughly square power of two
+    SvgAtlas& SetWidth(uint32_t width)
+    {
+        this->maxWidth = width;
+        return *this;
+    }
+
+    // Parses, packs and renders every item; items that fail keep their own result
+    // Fails only when nothing could be packed or the atlas cannot be allocated.
+    HRESULT Build(Item* items, size_t count, const SvgOptions& opt)
+    {
+        this->items = items;
+        this->count = count;
+        Svg* svgs = new(std::nothrow) Svg[count > 0 ? count : 1];
+        if (svgs == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        Parallel::For(count, [&](size_t i) {
+            Item& item = items[i];
+            item.x = item.y = item.width = item.height = 0;
+            item.result = svgs[i].Load(item.data, item.size, opt);
+            if (SUCCEEDED(item.result)) {
+                SvgRenderTarget::RenderOptions ropt;
+                ropt.SetCanvasSize(item.canvasSize, item.canvasSize).SetToContain();
+                item.result = svgs[i].CalcImageSize(ropt, &item.width, &item.height);
+            }
+            if (SUCCEEDED(item.result) && (item.width == 0 || item.height == 0)) {
+                item.result = E_FAIL;
+            }
+        });
+        HRESULT hr = this->Pack();
+        if (SUCCEEDED(hr)) {
+            const unsigned workers = Parallel::GetConcurrency();
+            uint32_t** scratch = static_cast<uint32_t**>(::calloc(workers, sizeof(uint32_t*)));
+            size_t* scratchSize = static_cast<size_t*>(::calloc(workers, sizeof(size_t)));
+            hr = scratch != nullptr && scratchSize != nullptr ? S_OK : E_OUTOFMEMORY;
+            if (SUCCEEDED(hr)) {
+                uint32_t* const atlas = this->image.GetPixels();
+                const size_t stride = this->image.GetWidth();
+                Parallel::ForWorker(count, [&](unsigned worker, size_t i) {
+                    Item& item = items[i];
+                    if (FAILED(item.result)) {
+                        return;
+                    }
+                    const size_t pixels = static_cast<size_t>(item.width) * item.height;
+                    if (scratchSize[worker] < pixels) {
+                        ::free(scratch[worker]);
+                        scratch[worker] = static_cast<uint32_t*>(::malloc(pixels * sizeof(uint32_t)));
+                        scratchSize[worker] = scratch[worker] != nullptr ? pixels : 0;
+                    }
+                    if (scratch[worker] == nullptr) {
+                        item.result = E_OUTOFMEMORY;
+                        return;
+                    }
+                    ::memset(scratch[worker], 0, pixels * sizeof(uint32_t));
+                    SvgRenderTarget::RenderOptions ropt;
+                    ropt.SetCanvasSize(item.canvasSize, item.canvasSize).SetToContain();
+                    item.result = svgs[i].RenderTo(ropt, item.width, item.height, scratch[worker]);
+                    if (SUCCEEDED(item.result)) {
+                        // slots never overlap, so workers can write to the atlas without locking
+                        const uint32_t* src = scratch[worker];
+                        uint32_t* dst = atlas + item.y * stride + item.x;
+                        for (uint32_t y = 0; y < item.height; y++) {
+                            ::memcpy(dst, src, item.width * sizeof(uint32_t));
+                            src += item.width;
+                            dst += stride;
+                        }
+                    }
+                });
+                for (unsigned i = 0; i < workers; i++) {
+                    ::free(scratch[i]);
+                }
+            }
+            ::free(scratch);
+            ::free(scratchSize);
+        }
+        delete[] svgs;
+        return hr;
+    }
+
+    const SvgRenderTarget& GetImage() const
+    {
+        return this->image;
+    }
+
+    // {"width":W,"height":H,"sprites":[{"name":"...","x":0,"y":0,"width":16,"height":16},...]}
+    HRESULT WriteIndexJson(ByteBuffer* out) const
+    {
+        char number[128];
+        ::snprintf(number, sizeof(number), "{\"width\":%u,\"height\":%u,\"sprites\":[", this->image.GetWidth(), this->image.GetHeight());
+        bool ok = out->Append(number);
+        bool first = true;
+        for (size_t i = 0; i < this->count && ok; i++) {
+            const Item& item = this->items[i];
+            if (FAILED(item.result)) {
+                continue;
+            }
+            ok = out->Append(first ? "{\"name\":" : ",{\"name\":");
+            first = false;
+            AppendJsonString(out, item.name != nullptr ? item.name : "", &ok);
+            ::snprintf(number, sizeof(number), ",\"x\":%u,\"y\":%u,\"width\":%u,\"height\":%u}", item.x, item.y, item.width, item.height);
+            ok = ok && out->Append(number);
+        }
+        ok = ok && out->Append("]}\n");
+        return ok ? S_OK : E_OUTOFMEMORY;
+    }
+
+    // Little endian: "SVGA", u32 version, u32 width, u32 height, u32 count,
+    // then per sprite u32 x, y, width, height, u16 name length and the name without terminator
+    HRESULT WriteIndexBinary(ByteBuffer* out) const
+    {
+        uint32_t n = 0;
+        for (size_t i = 0; i < this->count; i++) {
+            n += SUCCEEDED(this->items[i].result) ? 1 : 0;
+        }
+        bool ok = out->Append("SVGA", 4)
+            && out->AppendU32(1)
+            && out->AppendU32(this->image.GetWidth())
+            && out->AppendU32(this->image.GetHeight())
+            && out->AppendU32(n);
+        for (size_t i = 0; i < this->count && ok; i++) {
+            const Item& item = this->items[i];
+            if (FAILED(item.result)) {
+                continue;
+            }
+            const char* name = item.name != nullptr ? item.name : "";
+            size_t len = ::strlen(name);
+            if (len > UINT16_MAX) {
+                len = UINT16_MAX;
+            }
+            ok = out->AppendU32(item.x)
+                && out->AppendU32(item.y)
+                && out->AppendU32(item.width)
+                && out->AppendU32(item.height)
+                && out->AppendU16(static_cast<uint16_t>(len))
+                && out->Append(name, len);
+        }
+        return ok ? S_OK : E_OUTOFMEMORY;
+    }
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef SVG_BATCH_H
+#define SVG_BATCH_H
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "export.hpp"
+#include "pipeline.hpp"
+#include "parallel.hpp"
+
+enum BatchStage
+{
+    // Maps the file
+    BatchStageRead,
+    // Inflates gzip and rewrites the problematic filters, see Sanitiser
+    BatchStageSanitise,
+    BatchStageParse,
+    BatchStageRender,
+    // Picks the PNG colour type and encodes
+    BatchStageEncode,
+    BatchStageCount,
+};
+
+struct SvgBatchJob
+{
+    const PathChar* path;
+    ByteSink* sink;
+    HRESULT result;
+};
+
+
+// Renders many documents to PNG with every step in a pipeline stage of its own
+// While one file renders the next ones are read and parsed and the previous ones encoded, and
+// each stage holds at most a few files, so memory stays flat however long the batch is.
+class SvgBatchExporter
+{
+private:
+    struct Item
+    {
+        SvgBatchJob* job = nullptr;
+        HRESULT hr = S_OK;
+        const void* mapped = nullptr;
+        size_t cbMapped = 0;
+        Sanitiser sans;
+        bool sanitised = false;
+        Svg svg;
+        SvgRenderTarget target;
+
+        ~Item()
+        {
+            this->Unmap();
+        }
+
+        void Unmap()
+        {
+            if (this->mapped != nullptr) {
+                mmclose(this->mapped);
+                this->mapped = nullptr;
+            }
+        }
+
+        // Steps skip items that failed earlier or whose batch was cancelled
+        bool Proceed(const CancelToken* token)
+        {
+            if (SUCCEEDED(this->hr)) {
+                this->hr = CancelToken::Check(token);
+            }
+            return SUCCEEDED(this->hr);
+        }
+    };
+
+    unsigned concurrency[BatchStageCount];
+    size_t queueCapacity = 2;
+    PipelineStageStats stats[BatchStageCount] = {};
+    double elapsed = 0;
+
+public:
+    // Rendering, the usual bottleneck, gets a thread per core and the other stages one each
+    SvgBatchExporter()
+    {
+        for (unsigned& n : this->concurrency) {
+            n = 1;
+        }
+        this->concurrency[BatchStageRender] = Parallel::GetConcurrency();
+    }
+
+    SvgBatchExporter(const SvgBatchExporter&) = delete;
+    SvgBatchExporter& operator =(const SvgBatchExporter&) = delete;
+
+    SvgBatchExporter& SetConcurrency(BatchStage stage, unsigned threads)
+    {
+        this->concurrency[stage] = threads > 0 ? threads : 1;
+        return *this;
+    }
+
+    // Files each stage hands on before it waits for the next one to catch up
+    SvgBatchExporter& SetQueueCapacity(size_t capacity)
+    {
+        this->queueCapacity = capacity;
+        return *this;
+    }
+
+    // Each job's result says how its file went; fails only when the batch could not run
+    // Files not started when token fires get its error.
+    HRESULT SavePngs(SvgBatchJob* jobs, size_t count, const SvgOptions& opt, const SvgRenderTarget::RenderOptions& ropt, const PngOptions& png = PngOptions(), const CancelToken* token = nullptr)
+    {
+        Pipeline<Item> pipeline;
+        pipeline.SetQueueCapacity(this->queueCapacity);
+        pipeline.AddStage("read", this->concurrency[BatchStageRead], [&](Item& item) {
+            if (item.Proceed(token)) {
+                item.mapped = mmopen(item.job->path, &item.cbMapped);
+                if (item.mapped == nullptr) {
+                    item.hr = HRESULT_FROM_WIN32(::GetLastError());
+                }
+            }
+        });
+        pipeline.AddStage("sanitise", this->concurrency[BatchStageSanitise], [&](Item& item) {
+            if (item.Proceed(token) && opt.GetWorkaround()) {
+                // Like Svg::Load, input the sanitiser fails on is parsed as it is
+                const HRESULT hr = item.sans.Run(item.mapped, item.cbMapped, token);
+                if (CancelToken::IsCancellation(hr)) {
+                    item.hr = hr;
+                }
+                item.sanitised = SUCCEEDED(hr);
+            }
+        });
+        pipeline.AddStage("parse", this->concurrency[BatchStageParse], [&](Item& item) {
+            if (item.Proceed(token)) {
+                item.hr = item.sanitised
+                    ? item.svg.Parse(item.sans.GetData(), item.sans.GetSize(), opt)
+                    : item.svg.Parse(item.mapped, item.cbMapped, opt);
+            }
+            // The source is not needed past here
+            item.Unmap();
+            Sanitiser drop(std::move(item.sans));
+        });
+        pipeline.AddStage("render", this->concurrency[BatchStageRender], [&](Item& item) {
+            if (item.Proceed(token)) {
+                item.hr = item.svg.Render(ropt, &item.target);
+            }
+            item.svg.Destroy();
+        });
+        pipeline.AddStage("encode", this->concurrency[BatchStageEncode], [&](Item& item) {
+            if (item.Proceed(token)) {
+                item.hr = SvgExporter::SaveCompactPng(item.target, item.job->sink, png);
+            }
+            item.target.Destroy();
+        });
+        HRESULT hr = pipeline.Run(count, [&](size_t i, Item& item) {
+            item.job = &jobs[i];
+            item.job->result = E_PENDING;
+        }, [&](Item& item) {
+            item.job->result = item.hr;
+        });
+        for (size_t i = 0; i < BatchStageCount; i++) {
+            this->stats[i] = pipeline.GetStageStats(i);
+        }
+        this->elapsed = pipeline.GetElapsedSeconds();
+        return hr;
+    }
+
+    // Of the last batch; utilisation near one marks the stage holding the others up
+    const PipelineStageStats& GetStageStats(BatchStage stage) const
+    {
+        return this->stats[stage];
+    }
+
+    double GetElapsedSeconds() const
+    {
+        return this->elapsed;
+    }
+
+    // Files per second over the last batch
+    double GetThroughput() const
+    {
+        uint64_t items = this->stats[BatchStageEncode].items;
+        return this->elapsed > 0 ? items / this->elapsed : 0;
+    }
+};
+
+#endif
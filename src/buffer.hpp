@@ -0,0 +1,158 @@
+#ifndef SVG_BUFFER_H
+#define SVG_BUFFER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Growable byte buffer for encoder output
+class ByteBuffer
+{
+private:
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    template <typename T>
+    static void Swap(T& x, T& y)
+    {
+        T t = x;
+        x = y;
+        y = t;
+    }
+
+public:
+    ByteBuffer()
+    {
+    }
+
+    ~ByteBuffer()
+    {
+        ::free(this->data);
+    }
+
+    ByteBuffer(ByteBuffer&& src)
+    {
+        this->data = src.data;
+        this->size = src.size;
+        this->capacity = src.capacity;
+        src.data = nullptr;
+        src.size = 0;
+        src.capacity = 0;
+    }
+
+    ByteBuffer& operator =(ByteBuffer&& src)
+    {
+        Swap(this->data, src.data);
+        Swap(this->size, src.size);
+        Swap(this->capacity, src.capacity);
+        return *this;
+    }
+
+    ByteBuffer(const ByteBuffer&) = delete;
+    ByteBuffer& operator =(const ByteBuffer&) = delete;
+
+    const uint8_t* GetData() const
+    {
+        return this->data;
+    }
+
+    uint8_t* GetData()
+    {
+        return this->data;
+    }
+
+    size_t GetSize() const
+    {
+        return this->size;
+    }
+
+    void Clear()
+    {
+        this->size = 0;
+    }
+
+    // Drops cb bytes from the front
+    void Discard(size_t cb)
+    {
+        if (cb >= this->size) {
+            this->size = 0;
+            return;
+        }
+        ::memmove(this->data, this->data + cb, this->size - cb);
+        this->size -= cb;
+    }
+
+    bool Reserve(size_t capacity)
+    {
+        if (capacity <= this->capacity) {
+            return true;
+        }
+        size_t newCapacity = this->capacity < 256 ? 256 : this->capacity;
+        while (newCapacity < capacity) {
+            if (newCapacity > SIZE_MAX / 2) {
+                newCapacity = capacity;
+                break;
+            }
+            newCapacity *= 2;
+        }
+        uint8_t* newData = static_cast<uint8_t*>(::realloc(this->data, newCapacity));
+        if (newData == nullptr) {
+            return false;
+        }
+        this->data = newData;
+        this->capacity = newCapacity;
+        return true;
+    }
+
+    // Extends the buffer by cb bytes and returns the uninitialised tail
+    uint8_t* Extend(size_t cb)
+    {
+        if (cb > SIZE_MAX - this->size || !this->Reserve(this->size + cb)) {
+            return nullptr;
+        }
+        uint8_t* tail = this->data + this->size;
+        this->size += cb;
+        return tail;
+    }
+
+    bool Append(const void* src, size_t cb)
+    {
+        uint8_t* tail = this->Extend(cb);
+        if (tail == nullptr) {
+            return false;
+        }
+        ::memcpy(tail, src, cb);
+        return true;
+    }
+
+    bool Append(const char* str)
+    {
+        return this->Append(str, ::strlen(str));
+    }
+
+    bool AppendByte(uint8_t value)
+    {
+        return this->Append(&value, 1);
+    }
+
+    bool AppendU16(uint16_t value)
+    {
+        const uint8_t bytes[2] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8) };
+        return this->Append(bytes, sizeof(bytes));
+    }
+
+    bool AppendU32(uint32_t value)
+    {
+        const uint8_t bytes[4] = { static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24) };
+        return this->Append(bytes, sizeof(bytes));
+    }
+
+    bool AppendU32BE(uint32_t value)
+    {
+        const uint8_t bytes[4] = { static_cast<uint8_t>(value >> 24), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) };
+        return this->Append(bytes, sizeof(bytes));
+    }
+};
+
+#endif
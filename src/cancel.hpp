@@ -0,0 +1,83 @@
+#ifndef SVG_CANCEL_H
+#define SVG_CANCEL_H
+
+#include <atomic>
+#include <chrono>
+
+// Asks long work to stop, from any thread, or once a deadline has passed
+// Work polls Check() between steps it controls, e.g. inflate blocks, sanitiser input and
+// render stripes; a single resvg call cannot be interrupted, so the delay is at most one
+// step. Cancelled work returns HRESULT_FROM_WIN32(ERROR_CANCELLED), and work past its
+// deadline HRESULT_FROM_WIN32(ERROR_TIMEOUT), so callers can tell the two from failures.
+class CancelToken
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    std::atomic<bool> cancelled;
+    Clock::time_point deadline = Clock::time_point::max();
+
+public:
+    CancelToken()
+        : cancelled(false)
+    {
+    }
+
+    CancelToken(const CancelToken&) = delete;
+    CancelToken& operator =(const CancelToken&) = delete;
+
+    CancelToken& SetDeadline(Clock::time_point deadline)
+    {
+        this->deadline = deadline;
+        return *this;
+    }
+
+    // Deadline relative to now
+    CancelToken& SetTimeout(uint32_t milliseconds)
+    {
+        this->deadline = Clock::now() + std::chrono::milliseconds(milliseconds);
+        return *this;
+    }
+
+    void Cancel()
+    {
+        this->cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    // For reuse once the work it was handed to has finished
+    void Reset()
+    {
+        this->cancelled.store(false, std::memory_order_relaxed);
+        this->deadline = Clock::time_point::max();
+    }
+
+    bool IsCancelled() const
+    {
+        return this->cancelled.load(std::memory_order_relaxed);
+    }
+
+    HRESULT Check() const
+    {
+        if (this->IsCancelled()) {
+            return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+        if (this->deadline != Clock::time_point::max() && Clock::now() >= this->deadline) {
+            return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+        }
+        return S_OK;
+    }
+
+    // Work without a token always goes on
+    static HRESULT Check(const CancelToken* token)
+    {
+        return token != nullptr ? token->Check() : S_OK;
+    }
+
+    static bool IsCancellation(HRESULT hr)
+    {
+        return hr == HRESULT_FROM_WIN32(ERROR_CANCELLED) || hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+    }
+};
+
+#endif
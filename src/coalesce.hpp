@@ -0,0 +1,243 @@
+#ifndef SVG_COALESCE_H
+#define SVG_COALESCE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <random>
+
+#include "cancel.hpp"
+
+// 64-bit hash of the content, keyed per process, so that documents made to collide in one
+// process do not in another; the same bytes give the same fingerprint only within a process.
+// It reads 32 bytes a step in four independent lanes, several times as fast as a byte-wise hash
+// on the documents of tens of megabytes it has to cope with. Not cryptographic: SingleFlight
+// compares the content itself before sharing a result.
+inline uint64_t ContentFingerprint(const void* ptr, size_t cb)
+{
+    static const uint64_t K = 0x9e3779b97f4a7c15ull;
+    static const uint64_t seed = [] {
+        try {
+            std::random_device random;
+            return (static_cast<uint64_t>(random()) << 32) ^ random();
+        } catch (...) {
+            return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        }
+    }();
+    const uint8_t* p = static_cast<const uint8_t*>(ptr);
+    uint64_t lanes[4] = { seed, seed ^ K, seed + K, ~seed };
+    size_t i = 0;
+    for (; i + 32 <= cb; i += 32) {
+        for (int j = 0; j < 4; j++) {
+            uint64_t word;
+            ::memcpy(&word, p + i + j * 8, 8);
+            lanes[j] = (lanes[j] ^ word) * K;
+            lanes[j] = (lanes[j] << 29) | (lanes[j] >> 35);
+        }
+    }
+    uint64_t hash = cb;
+    for (uint64_t lane : lanes) {
+        hash = (hash ^ lane) * K;
+        hash ^= hash >> 32;
+    }
+    // FNV-1a over what is left
+    for (; i < cb; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+    // A final mix, as the lanes only spread upwards
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    return hash ^ (hash >> 33);
+}
+
+
+// Lets concurrent identical requests share one computation
+// The first caller with a key runs it, and those arriving with the same key while it runs
+// wait for it and get the same result. Nothing is kept once it has finished, so this is not
+// a cache. A computation that was cancelled is not shared, as that was up to the caller that
+// ran it: its waiters run again, each under its own token. When the key is only a fingerprint
+// of some content, the callers pass the content too, and share only with a computation over
+// the same bytes; one whose key collides runs on its own.
+template <class TKey, class TValue>
+class SingleFlight
+{
+private:
+    struct Call
+    {
+        bool done = false;
+        HRESULT hr = E_PENDING;
+        std::shared_ptr<const TValue> value;
+        // The leader's content, valid until it returns, which it does only once no waiter is
+        // still comparing against it
+        const void* content = nullptr;
+        size_t cb = 0;
+        unsigned comparing = 0;
+    };
+
+    std::mutex lock;
+    std::condition_variable finished;
+    std::map<TKey, std::shared_ptr<Call>> calls;
+    std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> coalesced;
+    std::atomic<uint64_t> collided;
+
+    template <class TFunc>
+    static HRESULT Execute(const TFunc& fn, std::shared_ptr<const TValue>* result)
+    {
+        std::shared_ptr<TValue> value;
+        try {
+            value = std::make_shared<TValue>();
+        } catch (...) {
+            return E_OUTOFMEMORY;
+        }
+        HRESULT hr = fn(value.get());
+        if (SUCCEEDED(hr)) {
+            *result = std::move(value);
+        }
+        return hr;
+    }
+
+    // Called with the lock held; compares without it, as the content may be large
+    bool IsSameContent(std::unique_lock<std::mutex>& guard, Call& call, const void* content, size_t cb)
+    {
+        if (call.content == content || content == nullptr) {
+            return call.cb == cb;
+        }
+        if (call.cb != cb) {
+            return false;
+        }
+        call.comparing++;
+        guard.unlock();
+        const bool same = ::memcmp(call.content, content, cb) == 0;
+        guard.lock();
+        if (--call.comparing == 0) {
+            this->finished.notify_all();
+        }
+        return same;
+    }
+
+public:
+    SingleFlight()
+        : executed(0)
+        , coalesced(0)
+        , collided(0)
+    {
+    }
+
+    SingleFlight(const SingleFlight&) = delete;
+    SingleFlight& operator =(const SingleFlight&) = delete;
+
+    // Gets the result for key, from fn(TValue*) when no identical call is under way
+    // Waiting gives up with the token's error when it fires; the computation goes on for the
+    // others. result is set only on success.
+    template <class TFunc>
+    HRESULT Do(const TKey& key, const TFunc& fn, std::shared_ptr<const TValue>* result, const CancelToken* token = nullptr)
+    {
+        return this->Do(key, nullptr, 0, fn, result, token);
+    }
+
+    // Same as above for a key derived from content, e.g. its fingerprint; content must stay
+    // valid until this returns
+    template <class TFunc>
+    HRESULT Do(const TKey& key, const void* content, size_t cb, const TFunc& fn, std::shared_ptr<const TValue>* result, const CancelToken* token = nullptr)
+    {
+        for (;;) {
+            std::shared_ptr<Call> call;
+            bool leader = false;
+            bool alone = false;
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                try {
+                    auto it = this->calls.find(key);
+                    if (it != this->calls.end()) {
+                        call = it->second;
+                        if (!this->IsSameContent(guard, *call, content, cb)) {
+                            this->collided++;
+                            alone = true;
+                        }
+                    } else {
+                        call = std::make_shared<Call>();
+                        call->content = content;
+                        call->cb = cb;
+                        this->calls.emplace(key, call);
+                        leader = true;
+                    }
+                } catch (...) {
+                    alone = true;
+                }
+            }
+            if (alone) {
+                // Runs on its own rather than not at all, or rather than share another's result
+                this->executed++;
+                return Execute(fn, result);
+            }
+            if (leader) {
+                this->executed++;
+                std::shared_ptr<const TValue> value;
+                HRESULT hr = Execute(fn, &value);
+                {
+                    std::unique_lock<std::mutex> guard(this->lock);
+                    this->calls.erase(key);
+                    call->hr = hr;
+                    call->value = value;
+                    call->done = true;
+                    this->finished.notify_all();
+                    while (call->comparing > 0) {
+                        this->finished.wait(guard);
+                    }
+                }
+                if (SUCCEEDED(hr)) {
+                    *result = std::move(value);
+                }
+                return hr;
+            }
+            this->coalesced++;
+            std::unique_lock<std::mutex> guard(this->lock);
+            while (!call->done) {
+                HRESULT hr = CancelToken::Check(token);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+                if (token == nullptr) {
+                    this->finished.wait(guard);
+                } else {
+                    // Polled now and then, as tokens do not signal
+                    this->finished.wait_for(guard, std::chrono::milliseconds(10));
+                }
+            }
+            if (CancelToken::IsCancellation(call->hr)) {
+                continue;
+            }
+            if (SUCCEEDED(call->hr)) {
+                *result = call->value;
+            }
+            return call->hr;
+        }
+    }
+
+    // Computations run, and requests that waited for one instead
+    uint64_t GetExecutedCount() const
+    {
+        return this->executed.load();
+    }
+
+    uint64_t GetCoalescedCount() const
+    {
+        return this->coalesced.load();
+    }
+
+    // Requests whose key matched a running computation over other content; counted as executed
+    uint64_t GetCollidedCount() const
+    {
+        return this->collided.load();
+    }
+};
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef SVG_COMPLEXITY_H
+#define SVG_COMPLEXITY_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Filter primitives counted by type; the order is that of SvgComplexity::FILTER_NAMES
+enum SvgFilterType
+{
+    SvgFilterBlend,
+    SvgFilterColorMatrix,
+    SvgFilterComponentTransfer,
+    SvgFilterComposite,
+    SvgFilterConvolveMatrix,
+    SvgFilterDiffuseLighting,
+    SvgFilterDisplacementMap,
+    SvgFilterDropShadow,
+    SvgFilterFlood,
+    SvgFilterGaussianBlur,
+    SvgFilterImage,
+    SvgFilterMerge,
+    SvgFilterMorphology,
+    SvgFilterOffset,
+    SvgFilterSpecularLighting,
+    SvgFilterTile,
+    SvgFilterTurbulence,
+    SvgFilterTypeCount,
+};
+
+
+// Structural counts of a document, gathered by the Sanitiser in the same pass that rewrites it
+// Cheap enough to decide whether and how to render before parsing, and to report why a
+// document is slow. Elements inside comments are counted too, as the sanitiser does not tell
+// them apart.
+struct SvgComplexity
+{
+    // Of the text after gzip is inflated
+    uint64_t bytes = 0;
+    uint32_t elements = 0;
+    // Of path data, and coordinates of path data and polygon and polyline points
+    uint32_t pathCommands = 0;
+    uint32_t pathCoordinates = 0;
+    // Each one touches every pixel of its region
+    uint32_t filterPrimitives = 0;
+    uint32_t filters[SvgFilterTypeCount] = {};
+    uint32_t gradients = 0;
+    uint32_t masks = 0;
+    uint32_t clipPaths = 0;
+    uint32_t texts = 0;
+    uint32_t images = 0;
+    // Decoded size of the images embedded as data URLs
+    uint64_t imageBytes = 0;
+
+    // Attributes of the last element that are worth a look
+    enum Attributes
+    {
+        AttributesNone,
+        AttributesPath,
+        AttributesPoints,
+        AttributesImage,
+    };
+
+    static const char* GetFilterName(SvgFilterType type)
+    {
+        static const char* const FILTER_NAMES[SvgFilterTypeCount] = {
+            "feBlend", "feColorMatrix", "feComponentTransfer", "feComposite", "feConvolveMatrix",
+            "feDiffuseLighting", "feDisplacementMap", "feDropShadow", "feFlood", "feGaussianBlur",
+            "feImage", "feMerge", "feMorphology", "feOffset", "feSpecularLighting", "feTile",
+            "feTurbulence",
+        };
+        return FILTER_NAMES[type];
+    }
+
+    // tag is the element name, namespace prefix included
+    Attributes AddElement(const char* tag, size_t len)
+    {
+        const char* colon = static_cast<const char*>(::memchr(tag, ':', len));
+        if (colon != nullptr) {
+            len -= colon + 1 - tag;
+            tag = colon + 1;
+        }
+        this->elements++;
+        if (len > 2 && tag[0] == 'f' && tag[1] == 'e') {
+            for (int i = 0; i < SvgFilterTypeCount; i++) {
+                if (IsName(tag, len, GetFilterName(static_cast<SvgFilterType>(i)))) {
+                    this->filters[i]++;
+                    this->filterPrimitives++;
+                    break;
+                }
+            }
+        } else if (IsName(tag, len, "path")) {
+            return AttributesPath;
+        } else if (IsName(tag, len, "polygon") || IsName(tag, len, "polyline")) {
+            return AttributesPoints;
+        } else if (IsName(tag, len, "image")) {
+            this->images++;
+            return AttributesImage;
+        } else if (IsName(tag, len, "linearGradient") || IsName(tag, len, "radialGradient")) {
+            this->gradients++;
+        } else if (IsName(tag, len, "mask")) {
+            this->masks++;
+        } else if (IsName(tag, len, "clipPath")) {
+            this->clipPaths++;
+        } else if (IsName(tag, len, "text")) {
+            this->texts++;
+        }
+        return AttributesNone;
+    }
+
+    void AddAttribute(Attributes attributes, const char* name, size_t cbName, const char* value, size_t cbValue)
+    {
+        switch (attributes) {
+        case AttributesPath:
+            if (IsName(name, cbName, "d")) {
+                this->AddPathData(value, value + cbValue);
+            }
+            break;
+        case AttributesPoints:
+            if (IsName(name, cbName, "points")) {
+                this->AddPathData(value, value + cbValue);
+            }
+            break;
+        case AttributesImage:
+            if (IsName(name, cbName, "href") || IsName(name, cbName, "xlink:href")) {
+                this->imageBytes += GetDataUrlSize(value, cbValue);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+private:
+    static bool IsName(const char* s, size_t len, const char* name)
+    {
+        return ::strlen(name) == len && ::memcmp(s, name, len) == 0;
+    }
+
+    static bool IsDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // Commands are letters and coordinates numbers, e.g. "M10-5.5.5" is one and three
+    void AddPathData(const char* s, const char* end)
+    {
+        while (s < end) {
+            const char c = *s;
+            if (IsDigit(c) || ((c == '-' || c == '+' || c == '.') && s + 1 < end && (IsDigit(s[1]) || s[1] == '.'))) {
+                this->pathCoordinates++;
+                if (c == '-' || c == '+') {
+                    s++;
+                }
+                while (s < end && IsDigit(*s)) {
+                    s++;
+                }
+                if (s < end && *s == '.') {
+                    s++;
+                    while (s < end && IsDigit(*s)) {
+                        s++;
+                    }
+                }
+                if (s + 1 < end && (*s == 'e' || *s == 'E') && (IsDigit(s[1]) || s[1] == '-' || s[1] == '+')) {
+                    s += 2;
+                    while (s < end && IsDigit(*s)) {
+                        s++;
+                    }
+                }
+                continue;
+            }
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+                this->pathCommands++;
+            }
+            s++;
+        }
+    }
+
+    // Decoded size of a data URL, zero for anything else
+    static uint64_t GetDataUrlSize(const char* value, size_t len)
+    {
+        if (len < 5 || ::memcmp(value, "data:", 5) != 0) {
+            return 0;
+        }
+        const char* comma = static_cast<const char*>(::memchr(value, ',', len));
+        if (comma == nullptr) {
+            return 0;
+        }
+        const size_t cbHeader = comma - value;
+        const uint64_t payload = len - cbHeader - 1;
+        if (cbHeader >= 7 && ::memcmp(comma - 7, ";base64", 7) == 0) {
+            return payload * 3 / 4;
+        }
+        return payload;
+    }
+};
+
+#endif
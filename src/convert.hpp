@@ -0,0 +1,519 @@
+#ifndef SVG_CONVERT_H
+#define SVG_CONVERT_H
+
+#include "pixfmt.hpp"
+
+// Pixel layouts the converter can read and write
+// Each one loads to and stores from premultiplied RGBA in a uint32_t, which is
+// what resvg renders, so any pair converts through that form. Load4 and Store4
+// do the same for four pixels at once; the base supplies scalar loops for
+// layouts without a vector form.
+template <class TFormat>
+struct PixelLayout
+{
+#ifdef SVG_SSE2
+    static __m128i Load4(const uint8_t* src)
+    {
+        alignas(16) uint32_t pixels[4];
+        for (int i = 0; i < 4; i++) {
+            pixels[i] = TFormat::Load(src + i * TFormat::BYTES);
+        }
+        return _mm_load_si128(reinterpret_cast<const __m128i*>(pixels));
+    }
+
+    static void Store4(uint8_t* dst, __m128i v)
+    {
+        alignas(16) uint32_t pixels[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(pixels), v);
+        for (int i = 0; i < 4; i++) {
+            TFormat::Store(dst + i * TFormat::BYTES, pixels[i]);
+        }
+    }
+#endif
+};
+
+
+enum ChannelOrder
+{
+    OrderRGBA,
+    OrderBGRA,
+    OrderARGB,
+};
+
+// Byte order within a 32-bit pixel, read as a little-endian uint32_t
+template <ChannelOrder Order>
+struct ChannelSwizzle;
+
+template <>
+struct ChannelSwizzle<OrderRGBA>
+{
+    static uint32_t ToRgba(uint32_t pixel)
+    {
+        return pixel;
+    }
+
+    static uint32_t FromRgba(uint32_t pixel)
+    {
+        return pixel;
+    }
+
+#ifdef SVG_SSE2
+    static __m128i ToRgba4(__m128i v)
+    {
+        return v;
+    }
+
+    static __m128i FromRgba4(__m128i v)
+    {
+        return v;
+    }
+#endif
+};
+
+template <>
+struct ChannelSwizzle<OrderBGRA>
+{
+    static uint32_t ToRgba(uint32_t pixel)
+    {
+        return PixelFormat::SwapRedBlue(pixel);
+    }
+
+    static uint32_t FromRgba(uint32_t pixel)
+    {
+        return PixelFormat::SwapRedBlue(pixel);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i ToRgba4(__m128i v)
+    {
+        return PixelFormat::SwapRedBlue4(v);
+    }
+
+    static __m128i FromRgba4(__m128i v)
+    {
+        return PixelFormat::SwapRedBlue4(v);
+    }
+#endif
+};
+
+// Alpha in the first byte, so a rotate by one byte either way
+template <>
+struct ChannelSwizzle<OrderARGB>
+{
+    static uint32_t ToRgba(uint32_t pixel)
+    {
+        return (pixel >> 8) | (pixel << 24);
+    }
+
+    static uint32_t FromRgba(uint32_t pixel)
+    {
+        return (pixel << 8) | (pixel >> 24);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i ToRgba4(__m128i v)
+    {
+        return _mm_or_si128(_mm_srli_epi32(v, 8), _mm_slli_epi32(v, 24));
+    }
+
+    static __m128i FromRgba4(__m128i v)
+    {
+        return _mm_or_si128(_mm_slli_epi32(v, 8), _mm_srli_epi32(v, 24));
+    }
+#endif
+};
+
+
+// Premultiplication as a compile-time choice, so formats never test it per pixel
+template <bool Premultiplied>
+struct AlphaMode
+{
+    static uint32_t ToPremultiplied(uint32_t pixel)
+    {
+        return pixel;
+    }
+
+    static uint32_t FromPremultiplied(uint32_t pixel)
+    {
+        return pixel;
+    }
+
+#ifdef SVG_SSE2
+    static __m128i ToPremultiplied4(__m128i v)
+    {
+        return v;
+    }
+
+    static __m128i FromPremultiplied4(__m128i v)
+    {
+        return v;
+    }
+#endif
+};
+
+template <>
+struct AlphaMode<false>
+{
+    static uint32_t ToPremultiplied(uint32_t pixel)
+    {
+        return PixelFormat::Premultiply(pixel);
+    }
+
+    static uint32_t FromPremultiplied(uint32_t pixel)
+    {
+        return PixelFormat::Unpremultiply(pixel);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i ToPremultiplied4(__m128i v)
+    {
+        return PixelFormat::Premultiply4(v);
+    }
+
+    static __m128i FromPremultiplied4(__m128i v)
+    {
+        return PixelFormat::Unpremultiply4(v);
+    }
+#endif
+};
+
+
+// Four 8-bit channels
+template <ChannelOrder Order, bool Premultiplied>
+struct FormatRgba32 : PixelLayout<FormatRgba32<Order, Premultiplied>>
+{
+    static const size_t BYTES = 4;
+
+    static uint32_t Load(const uint8_t* src)
+    {
+        uint32_t pixel;
+        ::memcpy(&pixel, src, 4);
+        return AlphaMode<Premultiplied>::ToPremultiplied(ChannelSwizzle<Order>::ToRgba(pixel));
+    }
+
+    static void Store(uint8_t* dst, uint32_t pixel)
+    {
+        pixel = ChannelSwizzle<Order>::FromRgba(AlphaMode<Premultiplied>::FromPremultiplied(pixel));
+        ::memcpy(dst, &pixel, 4);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i Load4(const uint8_t* src)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        return AlphaMode<Premultiplied>::ToPremultiplied4(ChannelSwizzle<Order>::ToRgba4(v));
+    }
+
+    static void Store4(uint8_t* dst, __m128i v)
+    {
+        v = ChannelSwizzle<Order>::FromRgba4(AlphaMode<Premultiplied>::FromPremultiplied4(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), v);
+    }
+#endif
+};
+
+typedef FormatRgba32<OrderRGBA, true> FormatPRGBA8;
+typedef FormatRgba32<OrderRGBA, false> FormatRGBA8;
+typedef FormatRgba32<OrderBGRA, true> FormatPBGRA8;
+typedef FormatRgba32<OrderBGRA, false> FormatBGRA8;
+typedef FormatRgba32<OrderARGB, true> FormatPARGB8;
+typedef FormatRgba32<OrderARGB, false> FormatARGB8;
+
+
+// 5-6-5 bits with red at the top, opaque
+// Stores the premultiplied colour, which is the image over black.
+struct FormatRGB565 : PixelLayout<FormatRGB565>
+{
+    static const size_t BYTES = 2;
+
+    static uint32_t Load(const uint8_t* src)
+    {
+        const uint32_t value = src[0] | (src[1] << 8);
+        const uint32_t r = value >> 11;
+        const uint32_t g = (value >> 5) & 0x3f;
+        const uint32_t b = value & 0x1f;
+        return ((r << 3) | (r >> 2)) | (((g << 2) | (g >> 4)) << 8) | (((b << 3) | (b >> 2)) << 16) | 0xff000000;
+    }
+
+    // Rounds each channel to the nearest level
+    static void Store(uint8_t* dst, uint32_t pixel)
+    {
+        const uint32_t r = ((pixel & 0xff) * 249 + 1014) >> 11;
+        const uint32_t g = (((pixel >> 8) & 0xff) * 253 + 505) >> 10;
+        const uint32_t b = (((pixel >> 16) & 0xff) * 249 + 1014) >> 11;
+        const uint32_t value = (r << 11) | (g << 5) | b;
+        dst[0] = static_cast<uint8_t>(value);
+        dst[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i Load4(const uint8_t* src)
+    {
+        const __m128i value = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)), _mm_setzero_si128());
+        const __m128i r = _mm_srli_epi32(value, 11);
+        const __m128i g = _mm_and_si128(_mm_srli_epi32(value, 5), _mm_set1_epi32(0x3f));
+        const __m128i b = _mm_and_si128(value, _mm_set1_epi32(0x1f));
+        const __m128i r8 = _mm_or_si128(_mm_slli_epi32(r, 3), _mm_srli_epi32(r, 2));
+        const __m128i g8 = _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 4));
+        const __m128i b8 = _mm_or_si128(_mm_slli_epi32(b, 3), _mm_srli_epi32(b, 2));
+        return _mm_or_si128(_mm_or_si128(r8, _mm_slli_epi32(g8, 8)), _mm_or_si128(_mm_slli_epi32(b8, 16), _mm_set1_epi32(static_cast<int>(0xff000000))));
+    }
+
+    static void Store4(uint8_t* dst, __m128i v)
+    {
+        const __m128i low = _mm_set1_epi32(0xff);
+        // The products fit in 16 bits, as in PixelFormat::Luma4
+        const __m128i r = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(v, low), _mm_set1_epi32(249)), _mm_set1_epi32(1014)), 11);
+        const __m128i g = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(v, 8), low), _mm_set1_epi32(253)), _mm_set1_epi32(505)), 10);
+        const __m128i b = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(v, 16), low), _mm_set1_epi32(249)), _mm_set1_epi32(1014)), 11);
+        const __m128i value = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 11), _mm_slli_epi32(g, 5)), b);
+        PixelFormat::StoreLowWords4(dst, value);
+    }
+#endif
+};
+
+
+// 8-bit luma of the image over black
+struct FormatGray8 : PixelLayout<FormatGray8>
+{
+    static const size_t BYTES = 1;
+
+    static uint32_t Load(const uint8_t* src)
+    {
+        return src[0] * 0x010101u | 0xff000000;
+    }
+
+    static void Store(uint8_t* dst, uint32_t pixel)
+    {
+        dst[0] = static_cast<uint8_t>(PixelFormat::Luma(pixel));
+    }
+
+#ifdef SVG_SSE2
+    static __m128i Load4(const uint8_t* src)
+    {
+        const __m128i g = PixelFormat::LoadBytes4(src);
+        return _mm_or_si128(_mm_or_si128(g, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(g, 16), _mm_set1_epi32(static_cast<int>(0xff000000))));
+    }
+
+    static void Store4(uint8_t* dst, __m128i v)
+    {
+        PixelFormat::StoreLowBytes4(dst, PixelFormat::Luma4(v));
+    }
+#endif
+};
+
+
+// Straight luma followed by alpha
+struct FormatGrayA8 : PixelLayout<FormatGrayA8>
+{
+    static const size_t BYTES = 2;
+
+    static uint32_t Load(const uint8_t* src)
+    {
+        const uint32_t a = src[1];
+        return PixelFormat::Div255(src[0] * a) * 0x010101u | (a << 24);
+    }
+
+    static void Store(uint8_t* dst, uint32_t pixel)
+    {
+        dst[0] = static_cast<uint8_t>(PixelFormat::Luma(PixelFormat::Unpremultiply(pixel)));
+        dst[1] = static_cast<uint8_t>(pixel >> 24);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i Load4(const uint8_t* src)
+    {
+        const __m128i value = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)), _mm_setzero_si128());
+        const __m128i g = _mm_and_si128(value, _mm_set1_epi32(0xff));
+        const __m128i a = _mm_slli_epi32(_mm_srli_epi32(value, 8), 24);
+        return PixelFormat::Premultiply4(_mm_or_si128(_mm_or_si128(g, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(g, 16), a)));
+    }
+
+    static void Store4(uint8_t* dst, __m128i v)
+    {
+        const __m128i g = PixelFormat::Luma4(PixelFormat::Unpremultiply4(v));
+        PixelFormat::StoreLowWords4(dst, _mm_or_si128(g, _mm_slli_epi32(_mm_srli_epi32(v, 24), 8)));
+    }
+#endif
+};
+
+
+// Coverage only; loads as black
+struct FormatAlpha8 : PixelLayout<FormatAlpha8>
+{
+    static const size_t BYTES = 1;
+
+    static uint32_t Load(const uint8_t* src)
+    {
+        return static_cast<uint32_t>(src[0]) << 24;
+    }
+
+    static void Store(uint8_t* dst, uint32_t pixel)
+    {
+        dst[0] = static_cast<uint8_t>(pixel >> 24);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i Load4(const uint8_t* src)
+    {
+        return _mm_slli_epi32(PixelFormat::LoadBytes4(src), 24);
+    }
+
+    static void Store4(uint8_t* dst, __m128i v)
+    {
+        PixelFormat::StoreLowBytes4(dst, _mm_srli_epi32(v, 24));
+    }
+#endif
+};
+
+
+// Straight RGBA with a native-endian uint16_t per channel
+struct FormatRGBA16 : PixelLayout<FormatRGBA16>
+{
+    static const size_t BYTES = 8;
+
+    static uint32_t Load(const uint8_t* src)
+    {
+        uint16_t channels[4];
+        ::memcpy(channels, src, 8);
+        uint32_t pixel = 0;
+        for (int i = 0; i < 4; i++) {
+            // c / 257 rounded to nearest
+            pixel |= ((channels[i] * 255u + 32895) >> 16) << (i * 8);
+        }
+        return PixelFormat::Premultiply(pixel);
+    }
+
+    static void Store(uint8_t* dst, uint32_t pixel)
+    {
+        pixel = PixelFormat::Unpremultiply(pixel);
+        uint16_t channels[4];
+        for (int i = 0; i < 4; i++) {
+            channels[i] = static_cast<uint16_t>(((pixel >> (i * 8)) & 0xff) * 257);
+        }
+        ::memcpy(dst, channels, 8);
+    }
+
+#ifdef SVG_SSE2
+    static __m128i Load4(const uint8_t* src)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        const __m128i c0 = Narrow(_mm_unpacklo_epi16(lo, zero));
+        const __m128i c1 = Narrow(_mm_unpackhi_epi16(lo, zero));
+        const __m128i c2 = Narrow(_mm_unpacklo_epi16(hi, zero));
+        const __m128i c3 = Narrow(_mm_unpackhi_epi16(hi, zero));
+        return PixelFormat::Premultiply4(_mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3)));
+    }
+
+    // Repeating each byte multiplies it by 257
+    static void Store4(uint8_t* dst, __m128i v)
+    {
+        v = PixelFormat::Unpremultiply4(v);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi8(v, v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi8(v, v));
+    }
+
+private:
+    // Same rounding as Load, on 32-bit lanes: c * 255 is (c << 8) - c
+    static __m128i Narrow(__m128i c)
+    {
+        return _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(c, 8), c), _mm_set1_epi32(32895)), 16);
+    }
+#endif
+};
+
+
+// How one format becomes another
+// The general case goes through premultiplied RGBA; the specialisations below
+// skip that where it would cost time or precision.
+template <class TSrc, class TDst>
+struct PixelConversion
+{
+    static void Run(const uint8_t* src, uint8_t* dst, size_t count)
+    {
+        size_t i = 0;
+#ifdef SVG_SSE2
+        for (; i + 4 <= count; i += 4) {
+            TDst::Store4(dst + i * TDst::BYTES, TSrc::Load4(src + i * TSrc::BYTES));
+        }
+#endif
+        for (; i < count; i++) {
+            TDst::Store(dst + i * TDst::BYTES, TSrc::Load(src + i * TSrc::BYTES));
+        }
+    }
+};
+
+template <class TFormat>
+struct PixelConversion<TFormat, TFormat>
+{
+    static void Run(const uint8_t* src, uint8_t* dst, size_t count)
+    {
+        ::memmove(dst, src, count * TFormat::BYTES);
+    }
+};
+
+// Between two 32-bit layouts with the same alpha mode only the bytes move,
+// which keeps straight colours under zero alpha
+template <ChannelOrder SrcOrder, ChannelOrder DstOrder, bool Premultiplied>
+struct PixelConversion<FormatRgba32<SrcOrder, Premultiplied>, FormatRgba32<DstOrder, Premultiplied>>
+{
+    static void Run(const uint8_t* src, uint8_t* dst, size_t count)
+    {
+        size_t i = 0;
+#ifdef SVG_SSE2
+        for (; i + 4 <= count; i += 4) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), ChannelSwizzle<DstOrder>::FromRgba4(ChannelSwizzle<SrcOrder>::ToRgba4(v)));
+        }
+#endif
+        for (; i < count; i++) {
+            uint32_t pixel;
+            ::memcpy(&pixel, src + i * 4, 4);
+            pixel = ChannelSwizzle<DstOrder>::FromRgba(ChannelSwizzle<SrcOrder>::ToRgba(pixel));
+            ::memcpy(dst + i * 4, &pixel, 4);
+        }
+    }
+};
+
+// Matches both of the above, so it has to be spelt out
+template <ChannelOrder Order, bool Premultiplied>
+struct PixelConversion<FormatRgba32<Order, Premultiplied>, FormatRgba32<Order, Premultiplied>>
+{
+    static void Run(const uint8_t* src, uint8_t* dst, size_t count)
+    {
+        ::memmove(dst, src, count * 4);
+    }
+};
+
+
+class PixelConverter
+{
+public:
+    PixelConverter() = delete;
+    ~PixelConverter() = delete;
+
+    // count pixels from src in TSrc to dst in TDst; the buffers must not overlap
+    // unless they are the same format
+    template <class TSrc, class TDst>
+    static void Convert(const void* src, void* dst, size_t count)
+    {
+        PixelConversion<TSrc, TDst>::Run(static_cast<const uint8_t*>(src), static_cast<uint8_t*>(dst), count);
+    }
+
+    // Strides are in bytes and may be negative
+    template <class TSrc, class TDst>
+    static void Convert(const void* src, ptrdiff_t srcStride, void* dst, ptrdiff_t dstStride, uint32_t width, uint32_t height)
+    {
+        const uint8_t* s = static_cast<const uint8_t*>(src);
+        uint8_t* d = static_cast<uint8_t*>(dst);
+        for (uint32_t y = 0; y < height; y++) {
+            PixelConversion<TSrc, TDst>::Run(s, d, width);
+            s += srcStride;
+            d += dstStride;
+        }
+    }
+};
+
+#endif
@@ -1,13 +1,18 @@
 #ifndef SVG_DEBUG_H
 #define SVG_DEBUG_H
 
+#include <stdio.h>
+#include <stdarg.h>
+#include <wchar.h>
+
+#ifdef _WIN32
 class Debug
 {
 private:
-    static bool allocated;
-
     static void AllocConsoleIfNotYet()
     {
+        // Local, so that the header can be included by more than one file
+        static bool allocated;
         if (!allocated) {
             ::AllocConsole();
             allocated = true;
@@ -40,7 +45,34 @@ public:
         va_end(argPtr);
     }
 };
+#else
+// Goes to stderr, which is there already
+class Debug
+{
+public:
+    Debug() = delete;
+    ~Debug() = delete;
+
+    static void Print(const char* format, ...) throw()
+    {
+        va_list argPtr;
+        va_start(argPtr, format);
+        ::vfprintf(stderr, format, argPtr);
+        va_end(argPtr);
+    }
 
-bool Debug::allocated;
+    // Narrowed first, as a stream cannot take both wide and narrow output
+    static void Print(const wchar_t* format, ...) throw()
+    {
+        wchar_t buffer[1025];
+        va_list argPtr;
+        va_start(argPtr, format);
+        if (::vswprintf(buffer, ARRAYSIZE(buffer), format, argPtr) >= 0) {
+            ::fprintf(stderr, "%ls", buffer);
+        }
+        va_end(argPtr);
+    }
+};
+#endif
 
 #endif
@@ -0,0 +1,94 @@
+#ifndef SVG_EXPORT_H
+#define SVG_EXPORT_H
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "png.hpp"
+#include "qoi.hpp"
+#include "rawimage.hpp"
+#include "palette.hpp"
+
+class SvgExporter
+{
+private:
+    static const uint32_t STRIPE_OVERLAP = 8;
+
+    // Renders in stripes straight into a streaming encoder, so peak memory
+    // does not depend on the output size
+    template <class TWriter, typename... TArgs>
+    static HRESULT Save(const Svg& svg, const SvgRenderTarget::RenderOptions& opt, uint32_t stripeRows, TWriter& writer, ByteSink* sink, const TArgs&... args)
+    {
+        HRESULT hr = svg.RenderStripes(opt, stripeRows, STRIPE_OVERLAP, [&](const uint32_t* pixels, uint32_t width, uint32_t height, uint32_t y, uint32_t rows) {
+            HRESULT hr = S_OK;
+            if (y == 0) {
+                hr = writer.Begin(sink, width, height, args...);
+            }
+            if (SUCCEEDED(hr)) {
+                hr = writer.WriteRows(pixels, rows, width);
+            }
+            return hr;
+        });
+        if (SUCCEEDED(hr)) {
+            hr = writer.End();
+        }
+        return hr;
+    }
+
+public:
+    SvgExporter() = delete;
+    ~SvgExporter() = delete;
+
+    static HRESULT SavePng(const Svg& svg, const SvgRenderTarget::RenderOptions& opt, ByteSink* sink, const PngOptions& png = PngOptions(), uint32_t stripeRows = 0)
+    {
+        PngWriter writer;
+        return Save(svg, opt, stripeRows, writer, sink, png);
+    }
+
+    // Stores an already rendered image as an indexed-colour PNG when it has at most 256
+    // colours, which decodes to exactly what the RGBA encoding would, and as RGBA otherwise
+    static HRESULT SaveCompactPng(const SvgRenderTarget& target, ByteSink* sink, const PngOptions& png = PngOptions())
+    {
+        return SaveCompactPng(target.GetPixels(), target.GetWidth(), target.GetHeight(), target.GetWidth(), sink, png);
+    }
+
+    // Same for premultiplied RGBA rendered elsewhere; stride is in pixels
+    static HRESULT SaveCompactPng(const uint32_t* pixels, uint32_t width, uint32_t height, size_t stride, ByteSink* sink, const PngOptions& png = PngOptions())
+    {
+        IndexedImage indexed;
+        HRESULT hr = indexed.Create(pixels, width, height, stride);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        PngWriter writer;
+        if (hr == S_OK) {
+            hr = writer.BeginIndexed(sink, width, height, indexed.GetPalette(), indexed.GetColourCount(), png);
+            if (SUCCEEDED(hr)) {
+                hr = writer.WriteIndexedRows(indexed.GetIndices(), height, width);
+            }
+        } else {
+            hr = writer.Begin(sink, width, height, png);
+            if (SUCCEEDED(hr)) {
+                hr = writer.WriteRows(pixels, height, stride);
+            }
+        }
+        if (SUCCEEDED(hr)) {
+            hr = writer.End();
+        }
+        return hr;
+    }
+
+    // Premultiplied RGBA as rendered; see RawImageWriter for the layout
+    static HRESULT SaveRaw(const Svg& svg, const SvgRenderTarget::RenderOptions& opt, ByteSink* sink, uint32_t stripeRows = 0)
+    {
+        RawImageWriter writer;
+        return Save(svg, opt, stripeRows, writer, sink);
+    }
+
+    static HRESULT SaveQoi(const Svg& svg, const SvgRenderTarget::RenderOptions& opt, ByteSink* sink, uint32_t stripeRows = 0)
+    {
+        QoiWriter writer;
+        return Save(svg, opt, stripeRows, writer, sink);
+    }
+};
+
+#endif
@@ -0,0 +1,1209 @@
+#ifndef SVG_ISOLATE_H
+#define SVG_ISOLATE_H
+
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#endif
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "quality.hpp"
+#include "parallel.hpp"
+
+// Renders documents in worker processes, so one that crashes or hangs resvg only costs its worker
+// Each job gets a section of shared memory that holds the source on the way in and the pixels on
+// the way out, and a small message on the worker's stdin names it. A worker that dies or runs
+// past the timeout is thrown away and replaced straight away. Workers load the fonts once, when
+// they start, and signal when they are ready, so the start-up does not count against a job's
+// timeout.
+// On Windows workers are rundll32 processes in a job object that caps their memory and kills
+// them along with the pool, and jobs come down a pipe. Elsewhere they are forked and exec'd with
+// an address space limit, or forked warm from a zygote process, the pipe is a socket pair that
+// carries the section's descriptor, and the worker writes a byte back when it is ready and after
+// each job.
+class RenderWorker
+{
+public:
+#ifdef _WIN32
+    // Sent down the pipe; the handles are valid in the worker
+    struct Job
+    {
+        uint64_t section;
+        uint64_t done;
+        uint32_t cbSource;
+        uint32_t size;
+        uint32_t quality;
+        uint32_t reserved;
+    };
+#else
+    // Sent down the socket, along with the section's descriptor
+    struct Job
+    {
+        uint32_t cbSource;
+        uint32_t size;
+        uint32_t quality;
+        uint32_t reserved;
+    };
+
+#endif
+
+    // Start of the section, followed by the source and then the pixels
+    struct Header
+    {
+        HRESULT hr;
+        uint32_t width;
+        uint32_t height;
+        uint32_t reserved;
+    };
+
+    RenderWorker() = delete;
+    ~RenderWorker() = delete;
+
+    static size_t GetPixelOffset(uint32_t cbSource)
+    {
+        return (sizeof(Header) + cbSource + 15) & ~static_cast<size_t>(15);
+    }
+
+    // The image fits in size x size, so that much room is left for the pixels
+    static uint64_t GetSectionSize(uint32_t cbSource, uint32_t size)
+    {
+        return GetPixelOffset(cbSource) + static_cast<uint64_t>(size) * size * 4;
+    }
+
+    // The worker wrote the header, so nothing reads pixels by it before it is checked: a worker
+    // gone wrong must not send the reader past the end of the section
+    static HRESULT ReadHeader(const BYTE* view, uint32_t size, uint32_t* width, uint32_t* height)
+    {
+        Header header;
+        ::memcpy(&header, view, sizeof(header));
+        if (FAILED(header.hr)) {
+            return header.hr;
+        }
+        if (header.width == 0 || header.height == 0 || header.width > size || header.height > size) {
+            return E_UNEXPECTED;
+        }
+        *width = header.width;
+        *height = header.height;
+        return header.hr;
+    }
+
+#ifndef _WIN32
+    // argv[1] of a worker process, and of a zygote
+    static const char* GetWorkerArg()
+    {
+        return "--render-worker";
+    }
+
+    static const char* GetZygoteArg()
+    {
+        return "--render-zygote";
+    }
+
+    // For the main of the program the pool runs: serves stdin and returns true when argv says
+    // this process is a worker or a zygote, returns false at once when it does not
+    static bool ServeIfAsked(int argc, char** argv)
+    {
+        if (argc != 2) {
+            return false;
+        }
+        if (::strcmp(argv[1], GetWorkerArg()) == 0) {
+            Serve(STDIN_FILENO);
+            return true;
+        }
+        if (::strcmp(argv[1], GetZygoteArg()) == 0) {
+            ServeZygote(STDIN_FILENO);
+            return true;
+        }
+        return false;
+    }
+#endif
+
+#ifdef _WIN32
+    // Runs jobs from input until the pipe is closed; the worker process' main loop
+    // The fonts are loaded once, up front, and shared by every job; ready is set after that.
+    static void Serve(HANDLE input, HANDLE ready)
+    {
+        SvgOptions opt;
+        opt.LoadSystemFonts();
+        if (ready != nullptr) {
+            ::SetEvent(ready);
+            ::CloseHandle(ready);
+        }
+        Job job;
+        while (Read(input, &job, sizeof(job))) {
+            HANDLE section = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(job.section));
+            HANDLE done = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(job.done));
+            BYTE* view = static_cast<BYTE*>(::MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(GetSectionSize(job.cbSource, job.size))));
+            if (view != nullptr) {
+                Header* header = reinterpret_cast<Header*>(view);
+                header->hr = RunJob(opt, job, view, &header->width, &header->height);
+                ::UnmapViewOfFile(view);
+            }
+            ::CloseHandle(section);
+            ::SetEvent(done);
+            ::CloseHandle(done);
+        }
+    }
+
+private:
+    static bool Read(HANDLE input, void* data, DWORD cb)
+    {
+        BYTE* ptr = static_cast<BYTE*>(data);
+        while (cb > 0) {
+            DWORD read = 0;
+            if (!::ReadFile(input, ptr, cb, &read, nullptr) || read == 0) {
+                return false;
+            }
+            ptr += read;
+            cb -= read;
+        }
+        return true;
+    }
+#else
+    // Runs jobs from input until the socket is closed; the worker process' main loop
+    // The fonts are loaded once, up front, and shared by every job.
+    static void Serve(int input)
+    {
+        SvgOptions opt;
+        opt.LoadSystemFonts();
+        ServeJobs(input, opt);
+    }
+
+    // Loads the fonts and then forks a warm worker for each request on control, until it is
+    // closed; the zygote process' main loop. The workers share the zygote's memory copy-on-write,
+    // fonts included, and serve as soon as they are forked. The zygote stays single threaded, so
+    // that its children can go on without exec'ing.
+    static void ServeZygote(int control)
+    {
+        SvgOptions opt;
+        opt.LoadSystemFonts();
+        // Workers are reaped as they exit; the pool never waits for them
+        ::signal(SIGCHLD, SIG_IGN);
+        if (!Signal(control, 'R')) {
+            return;
+        }
+        ZygoteRequest request;
+        int socket = -1;
+        while (ReceiveDescriptor(control, &request, sizeof(request), &socket)) {
+            const pid_t pid = ::fork();
+            if (pid == 0) {
+                ::close(control);
+                ::signal(SIGCHLD, SIG_DFL);
+                rlimit limit;
+                if (::getrlimit(RLIMIT_AS, &limit) == 0 && LimitMemory(request.memoryLimit, &limit)) {
+                    ::setrlimit(RLIMIT_AS, &limit);
+                }
+                ServeJobs(socket, opt);
+                ::_exit(0);
+            }
+            const int32_t reply = pid > 0 ? static_cast<int32_t>(pid) : -errno;
+            ::close(socket);
+            if (::send(control, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply)) {
+                return;
+            }
+        }
+    }
+
+private:
+    friend class RenderWorkerPool;
+
+    // Sent to the zygote along with the descriptor of the new worker's end of its socket pair
+    struct ZygoteRequest
+    {
+        uint64_t memoryLimit;
+    };
+
+    // Lowers limit to bytes, 0 meaning the host's own limit; false when there is nothing to change
+    static bool LimitMemory(uint64_t bytes, rlimit* limit)
+    {
+        if (bytes == 0 || (limit->rlim_max != RLIM_INFINITY && bytes >= limit->rlim_max)) {
+            return false;
+        }
+        limit->rlim_max = static_cast<rlim_t>(bytes);
+        limit->rlim_cur = limit->rlim_max;
+        return true;
+    }
+
+    // Writes the ready byte and then runs jobs until the socket is closed
+    static void ServeJobs(int input, SvgOptions& opt)
+    {
+        if (!Signal(input, 'R')) {
+            return;
+        }
+        Job job;
+        int section = -1;
+        while (ReceiveDescriptor(input, &job, sizeof(job), &section)) {
+            const uint64_t cbSection = GetSectionSize(job.cbSource, job.size);
+            void* view = cbSection <= SIZE_MAX ? ::mmap(nullptr, static_cast<size_t>(cbSection), PROT_READ | PROT_WRITE, MAP_SHARED, section, 0) : MAP_FAILED;
+            ::close(section);
+            if (view != MAP_FAILED) {
+                BYTE* bytes = static_cast<BYTE*>(view);
+                Header* header = reinterpret_cast<Header*>(bytes);
+                header->hr = RunJob(opt, job, bytes, &header->width, &header->height);
+                ::munmap(view, static_cast<size_t>(cbSection));
+            }
+            if (!Signal(input, 'D')) {
+                return;
+            }
+        }
+    }
+
+    static bool Signal(int output, char c)
+    {
+        for (;;) {
+            const ssize_t sent = ::send(output, &c, 1, MSG_NOSIGNAL);
+            if (sent == 1) {
+                return true;
+            }
+            if (sent < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+    }
+
+    static HRESULT SendDescriptor(int socket, const void* data, size_t cb, int fd)
+    {
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        iovec iov = { const_cast<void*>(data), cb };
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        ::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        ssize_t sent;
+        do {
+            sent = ::sendmsg(socket, &msg, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        if (sent < 0) {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+        return static_cast<size_t>(sent) == cb ? S_OK : E_FAIL;
+    }
+
+    // A message without a descriptor, or a short one, ends the loop like a closed socket
+    static bool ReceiveDescriptor(int socket, void* data, size_t cb, int* fd)
+    {
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        iovec iov = { data, cb };
+        msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t received;
+        do {
+            received = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+        } while (received < 0 && errno == EINTR);
+        // The control buffer is only filled in by a message
+        if (received <= 0) {
+            return false;
+        }
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+            return false;
+        }
+        // The descriptor that fit is ours to close when the rest is rejected
+        ::memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+        if ((msg.msg_flags & MSG_CTRUNC) != 0 || static_cast<size_t>(received) != cb) {
+            ::close(*fd);
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    static HRESULT RunJob(SvgOptions& opt, const Job& job, BYTE* view, uint32_t* width, uint32_t* height)
+    {
+        *width = 0;
+        *height = 0;
+        opt.SetSpeedOverQuality(job.quality == RenderQualitySpeed);
+        Svg svg;
+        HRESULT hr = svg.Load(view + sizeof(Header), job.cbSource, opt);
+        SvgRenderTarget::RenderOptions ropt;
+        ropt.SetCanvasSize(job.size, job.size).SetToContain();
+        UINT cx = 0;
+        UINT cy = 0;
+        if (SUCCEEDED(hr)) {
+            hr = svg.CalcImageSize(ropt, &cx, &cy);
+        }
+        if (SUCCEEDED(hr) && (cx > job.size || cy > job.size)) {
+            hr = E_UNEXPECTED;
+        }
+        if (SUCCEEDED(hr)) {
+            // The section comes zero filled, which is the clear pixmap RenderTo wants
+            hr = svg.RenderTo(ropt, cx, cy, reinterpret_cast<uint32_t*>(view + GetPixelOffset(job.cbSource)));
+        }
+        if (SUCCEEDED(hr)) {
+            *width = cx;
+            *height = cy;
+        }
+        return hr;
+    }
+};
+
+
+// Pixels a worker rendered, read straight from the shared section
+class RenderWorkerResult
+{
+private:
+#ifdef _WIN32
+    HANDLE section = nullptr;
+#else
+    size_t cbView = 0;
+#endif
+    BYTE* view = nullptr;
+    const uint32_t* pixels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    friend class RenderWorkerPool;
+
+public:
+    RenderWorkerResult() = default;
+    RenderWorkerResult(const RenderWorkerResult&) = delete;
+    RenderWorkerResult& operator =(const RenderWorkerResult&) = delete;
+
+    ~RenderWorkerResult()
+    {
+        this->Destroy();
+    }
+
+    bool IsNull() const
+    {
+        return this->pixels == nullptr;
+    }
+
+    void Destroy()
+    {
+#ifdef _WIN32
+        if (this->view != nullptr) {
+            ::UnmapViewOfFile(this->view);
+            this->view = nullptr;
+        }
+        if (this->section != nullptr) {
+            ::CloseHandle(this->section);
+            this->section = nullptr;
+        }
+#else
+        if (this->view != nullptr) {
+            ::munmap(this->view, this->cbView);
+            this->view = nullptr;
+            this->cbView = 0;
+        }
+#endif
+        this->pixels = nullptr;
+        this->width = 0;
+        this->height = 0;
+    }
+
+    // Premultiplied RGBA, like SvgRenderTarget::GetPixels
+    const uint32_t* GetPixels() const
+    {
+        return this->pixels;
+    }
+
+    uint32_t GetWidth() const
+    {
+        return this->width;
+    }
+
+    uint32_t GetHeight() const
+    {
+        return this->height;
+    }
+
+#ifdef _WIN32
+    HRESULT ToGdiBitmap(bool premultiplied, HBITMAP* phbmp, PixelAlpha* alpha = nullptr, const CancelToken* cancel = nullptr) const
+    {
+        *phbmp = nullptr;
+        if (this->pixels == nullptr) {
+            return E_FAIL;
+        }
+        return SvgRenderTarget::ToGdiBitmap(this->pixels, this->width, this->height, premultiplied, phbmp, alpha, cancel);
+    }
+#endif
+};
+
+
+#ifdef _WIN32
+class RenderWorkerPool
+{
+private:
+    static const unsigned MAX_WORKERS = 8;
+    static const size_t DEFAULT_MEMORY_LIMIT = 1024U << 20;
+    // Longest a worker may take to load the fonts
+    static const DWORD STARTUP_TIMEOUT = 30000;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Worker
+    {
+        HANDLE process = nullptr;
+        HANDLE input = nullptr;
+        // Until the worker has signalled it
+        HANDLE ready = nullptr;
+        bool busy = false;
+    };
+
+    std::wstring command;
+    unsigned count;
+    HANDLE job = nullptr;
+    Worker workers[MAX_WORKERS];
+    std::mutex lock;
+    std::condition_variable idle;
+
+    static void Kill(Worker& worker)
+    {
+        if (worker.process != nullptr) {
+            ::TerminateProcess(worker.process, ERROR_PROCESS_ABORTED);
+            ::CloseHandle(worker.process);
+            worker.process = nullptr;
+        }
+        if (worker.input != nullptr) {
+            ::CloseHandle(worker.input);
+            worker.input = nullptr;
+        }
+        if (worker.ready != nullptr) {
+            ::CloseHandle(worker.ready);
+            worker.ready = nullptr;
+        }
+    }
+
+    // Throws the worker away and starts the next one now, so it warms up before it is needed
+    // A failed start is tried again by the next job.
+    void Replace(Worker& worker)
+    {
+        Kill(worker);
+        this->Spawn(worker);
+    }
+
+    HRESULT WaitReady(Worker& worker)
+    {
+        if (worker.ready == nullptr) {
+            return S_OK;
+        }
+        HANDLE handles[] = { worker.ready, worker.process };
+        const DWORD wait = ::WaitForMultipleObjects(ARRAYSIZE(handles), handles, FALSE, STARTUP_TIMEOUT);
+        if (wait != WAIT_OBJECT_0) {
+            return wait == WAIT_TIMEOUT ? HRESULT_FROM_WIN32(ERROR_TIMEOUT) : HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED);
+        }
+        ::CloseHandle(worker.ready);
+        worker.ready = nullptr;
+        return S_OK;
+    }
+
+    HRESULT SetLimits(size_t memoryLimit)
+    {
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+        limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE | JOB_OBJECT_LIMIT_DIE_ON_UNHANDLED_EXCEPTION | JOB_OBJECT_LIMIT_PROCESS_MEMORY;
+        limits.ProcessMemoryLimit = memoryLimit;
+        return ::SetInformationJobObject(this->job, JobObjectExtendedLimitInformation, &limits, sizeof(limits)) ? S_OK : ResultFromLastError();
+    }
+
+    // Only the read end of the pipe and the ready event are inherited, not whatever else the host
+    // left inheritable. The event's handle value goes on the command line.
+    HRESULT Spawn(Worker& worker)
+    {
+        SECURITY_ATTRIBUTES sa = { sizeof(sa), nullptr, TRUE };
+        HANDLE ready = ::CreateEventW(&sa, TRUE, FALSE, nullptr);
+        if (ready == nullptr) {
+            return ResultFromLastError();
+        }
+        HANDLE read = nullptr;
+        HANDLE write = nullptr;
+        if (!::CreatePipe(&read, &write, &sa, 0)) {
+            HRESULT hr = ResultFromLastError();
+            ::CloseHandle(ready);
+            return hr;
+        }
+        ::SetHandleInformation(write, HANDLE_FLAG_INHERIT, 0);
+        HANDLE inherited[] = { read, ready };
+        HRESULT hr = S_OK;
+        SIZE_T cbAttributes = 0;
+        ::InitializeProcThreadAttributeList(nullptr, 1, 0, &cbAttributes);
+        auto attributes = static_cast<LPPROC_THREAD_ATTRIBUTE_LIST>(::malloc(cbAttributes));
+        hr = attributes != nullptr ? S_OK : E_OUTOFMEMORY;
+        if (SUCCEEDED(hr)) {
+            hr = ::InitializeProcThreadAttributeList(attributes, 1, 0, &cbAttributes) ? S_OK : ResultFromLastError();
+            if (FAILED(hr)) {
+                ::free(attributes);
+                attributes = nullptr;
+            }
+        }
+        if (SUCCEEDED(hr)) {
+            hr = ::UpdateProcThreadAttribute(attributes, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherited, sizeof(inherited), nullptr, nullptr) ? S_OK : ResultFromLastError();
+        }
+        PROCESS_INFORMATION pi = {};
+        if (SUCCEEDED(hr)) {
+            STARTUPINFOEXW si = {};
+            si.StartupInfo.cb = sizeof(si);
+            si.StartupInfo.dwFlags = STARTF_USESTDHANDLES;
+            si.StartupInfo.hStdInput = read;
+            si.lpAttributeList = attributes;
+            std::wstring command = this->command + L" " + std::to_wstring(reinterpret_cast<uintptr_t>(ready));
+            hr = ::CreateProcessW(nullptr, &command[0], nullptr, nullptr, TRUE, CREATE_SUSPENDED | CREATE_NO_WINDOW | EXTENDED_STARTUPINFO_PRESENT, nullptr, nullptr, &si.StartupInfo, &pi) ? S_OK : ResultFromLastError();
+        }
+        if (attributes != nullptr) {
+            ::DeleteProcThreadAttributeList(attributes);
+            ::free(attributes);
+        }
+        ::CloseHandle(read);
+        if (SUCCEEDED(hr)) {
+            if (::AssignProcessToJobObject(this->job, pi.hProcess)) {
+                ::ResumeThread(pi.hThread);
+            } else {
+                hr = ResultFromLastError();
+                ::TerminateProcess(pi.hProcess, ERROR_PROCESS_ABORTED);
+            }
+            ::CloseHandle(pi.hThread);
+        }
+        if (FAILED(hr)) {
+            if (pi.hProcess != nullptr) {
+                ::CloseHandle(pi.hProcess);
+            }
+            ::CloseHandle(write);
+            ::CloseHandle(ready);
+            return hr;
+        }
+        worker.process = pi.hProcess;
+        worker.input = write;
+        worker.ready = ready;
+        return S_OK;
+    }
+
+    // Hands the job to the worker, starting one first if it is not running
+    // A worker that died while idle shows up as a broken pipe, and gets one restart.
+    HRESULT Send(Worker& worker, HANDLE section, HANDLE done, const RenderWorker::Job& params)
+    {
+        HRESULT hr = S_OK;
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (worker.process == nullptr) {
+                hr = this->Spawn(worker);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+            }
+            HANDLE remoteSection = nullptr;
+            HANDLE remoteDone = nullptr;
+            hr = ::DuplicateHandle(::GetCurrentProcess(), section, worker.process, &remoteSection, 0, FALSE, DUPLICATE_SAME_ACCESS) ? S_OK : ResultFromLastError();
+            if (SUCCEEDED(hr)) {
+                hr = ::DuplicateHandle(::GetCurrentProcess(), done, worker.process, &remoteDone, 0, FALSE, DUPLICATE_SAME_ACCESS) ? S_OK : ResultFromLastError();
+            }
+            if (SUCCEEDED(hr)) {
+                RenderWorker::Job job = params;
+                job.section = reinterpret_cast<uintptr_t>(remoteSection);
+                job.done = reinterpret_cast<uintptr_t>(remoteDone);
+                DWORD written = 0;
+                hr = ::WriteFile(worker.input, &job, sizeof(job), &written, nullptr) && written == sizeof(job) ? S_OK : ResultFromLastError();
+            }
+            if (SUCCEEDED(hr)) {
+                return S_OK;
+            }
+            // Handles duplicated into the worker go away with it
+            Kill(worker);
+        }
+        return hr;
+    }
+
+    // nullptr when none comes free before the deadline
+    Worker* Acquire(Clock::time_point deadline)
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        for (;;) {
+            for (unsigned i = 0; i < this->count; i++) {
+                if (!this->workers[i].busy) {
+                    this->workers[i].busy = true;
+                    return &this->workers[i];
+                }
+            }
+            if (this->idle.wait_until(guard, deadline) == std::cv_status::timeout && Clock::now() >= deadline) {
+                return nullptr;
+            }
+        }
+    }
+
+    static DWORD GetRemaining(Clock::time_point deadline)
+    {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now() + std::chrono::microseconds(999)).count();
+        return ms <= 0 ? 0 : ms >= INFINITE ? INFINITE - 1 : static_cast<DWORD>(ms);
+    }
+
+    void Release(Worker& worker)
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            worker.busy = false;
+        }
+        this->idle.notify_one();
+    }
+
+public:
+    // module is the DLL with the worker entry point, RenderWorkerW, which rundll32 calls
+    explicit RenderWorkerPool(HMODULE module)
+    {
+        wchar_t system[MAX_PATH];
+        wchar_t path[MAX_PATH];
+        const UINT cchSystem = ::GetSystemDirectoryW(system, ARRAYSIZE(system));
+        const DWORD cchPath = ::GetModuleFileNameW(module, path, ARRAYSIZE(path));
+        if (cchSystem != 0 && cchSystem < ARRAYSIZE(system) && cchPath != 0 && cchPath < ARRAYSIZE(path)) {
+            this->command = std::wstring(L"\"") + system + L"\\rundll32.exe\" \"" + path + L"\",RenderWorker";
+        }
+        const unsigned n = Parallel::GetConcurrency();
+        this->count = n < MAX_WORKERS ? n : MAX_WORKERS;
+        this->job = ::CreateJobObjectW(nullptr, nullptr);
+        if (this->job != nullptr && FAILED(this->SetLimits(DEFAULT_MEMORY_LIMIT))) {
+            ::CloseHandle(this->job);
+            this->job = nullptr;
+        }
+    }
+
+    RenderWorkerPool(const RenderWorkerPool&) = delete;
+    RenderWorkerPool& operator =(const RenderWorkerPool&) = delete;
+
+    ~RenderWorkerPool()
+    {
+        for (unsigned i = 0; i < MAX_WORKERS; i++) {
+            Kill(this->workers[i]);
+        }
+        if (this->job != nullptr) {
+            ::CloseHandle(this->job);
+        }
+    }
+
+    // Most a worker may commit, in bytes, running ones included
+    HRESULT SetMemoryLimit(size_t bytes)
+    {
+        return this->job != nullptr ? this->SetLimits(bytes) : E_UNEXPECTED;
+    }
+
+    // Renders the source to fit in size x size pixels, like SetCanvasSize(size, size).SetToContain()
+    // timeout is in milliseconds and covers the wait for a free worker and the render, but not a
+    // worker's start-up. A job that runs past it fails with HRESULT_FROM_WIN32(ERROR_TIMEOUT), and
+    // one whose worker dies, e.g. by crashing or going over the memory limit, with
+    // HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED).
+    HRESULT Render(const void* source, uint32_t cbSource, uint32_t size, RenderQuality quality, DWORD timeout, RenderWorkerResult* result)
+    {
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+        result->Destroy();
+        if (this->command.empty() || this->job == nullptr) {
+            return E_UNEXPECTED;
+        }
+        if (size == 0) {
+            return E_INVALIDARG;
+        }
+        const uint64_t cbSection = RenderWorker::GetSectionSize(cbSource, size);
+        if (cbSection > SIZE_MAX) {
+            return E_OUTOFMEMORY;
+        }
+        HANDLE section = ::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(cbSection >> 32), static_cast<DWORD>(cbSection), nullptr);
+        if (section == nullptr) {
+            return ResultFromLastError();
+        }
+        BYTE* view = static_cast<BYTE*>(::MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, 0));
+        HRESULT hr = view != nullptr ? S_OK : ResultFromLastError();
+        HANDLE done = nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        if (SUCCEEDED(hr)) {
+            ::memcpy(view + sizeof(RenderWorker::Header), source, cbSource);
+            reinterpret_cast<RenderWorker::Header*>(view)->hr = E_UNEXPECTED;
+            done = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+            hr = done != nullptr ? S_OK : ResultFromLastError();
+        }
+        if (SUCCEEDED(hr)) {
+            RenderWorker::Job job = {};
+            job.cbSource = cbSource;
+            job.size = size;
+            job.quality = quality;
+            Worker* worker = this->Acquire(deadline);
+            hr = worker != nullptr ? this->Send(*worker, section, done, job) : HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            if (SUCCEEDED(hr)) {
+                const Clock::time_point start = Clock::now();
+                hr = this->WaitReady(*worker);
+                if (FAILED(hr)) {
+                    this->Replace(*worker);
+                }
+                deadline += Clock::now() - start;
+            }
+            if (SUCCEEDED(hr)) {
+                HANDLE handles[] = { done, worker->process };
+                const DWORD wait = ::WaitForMultipleObjects(ARRAYSIZE(handles), handles, FALSE, GetRemaining(deadline));
+                if (wait == WAIT_OBJECT_0) {
+                    hr = RenderWorker::ReadHeader(view, size, &width, &height);
+                } else {
+                    hr = wait == WAIT_TIMEOUT ? HRESULT_FROM_WIN32(ERROR_TIMEOUT) : HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED);
+                    this->Replace(*worker);
+                }
+            }
+            if (worker != nullptr) {
+                this->Release(*worker);
+            }
+            ::CloseHandle(done);
+        }
+        if (SUCCEEDED(hr)) {
+            result->section = section;
+            result->view = view;
+            result->pixels = reinterpret_cast<const uint32_t*>(view + RenderWorker::GetPixelOffset(cbSource));
+            result->width = width;
+            result->height = height;
+            return hr;
+        }
+        if (view != nullptr) {
+            ::UnmapViewOfFile(view);
+        }
+        ::CloseHandle(section);
+        return hr;
+    }
+};
+#else
+class RenderWorkerPool
+{
+private:
+    static const unsigned MAX_WORKERS = 8;
+    static const size_t DEFAULT_MEMORY_LIMIT = 1024U << 20;
+    // Longest a worker or the zygote may take to load the fonts, in milliseconds
+    static const int STARTUP_TIMEOUT = 30000;
+
+    typedef std::chrono::steady_clock Clock;
+
+    // A worker, or the zygote
+    struct Process
+    {
+        pid_t pid = 0;
+        int socket = -1;
+        // Forked by the zygote rather than by this process
+        bool forked = false;
+    };
+
+    struct Worker : Process
+    {
+        // Until the worker has written its ready byte
+        bool starting = false;
+        bool busy = false;
+    };
+
+    std::string command;
+    unsigned count;
+    // Bytes of address space, 0 for none
+    std::atomic<size_t> memoryLimit;
+    std::atomic<bool> useZygote;
+    Worker workers[MAX_WORKERS];
+    std::mutex lock;
+    std::condition_variable idle;
+    // Requests to the zygote go one at a time
+    Process zygote;
+    std::mutex zygoteLock;
+
+    // A process the zygote forked is not a child of this one, so it cannot be waited for, and once
+    // it has closed its end of the socket it is gone and its pid may already be someone else's
+    static void Kill(Process& process)
+    {
+        if (process.pid > 0) {
+            char c = 0;
+            if (!process.forked || ::recv(process.socket, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 0) {
+                ::kill(process.pid, SIGKILL);
+            }
+            while (!process.forked && ::waitpid(process.pid, nullptr, 0) < 0 && errno == EINTR) {
+            }
+            process.pid = 0;
+        }
+        if (process.socket >= 0) {
+            ::close(process.socket);
+            process.socket = -1;
+        }
+        process.forked = false;
+    }
+
+    static void Kill(Worker& worker)
+    {
+        Kill(static_cast<Process&>(worker));
+        worker.starting = false;
+    }
+
+    // Throws the worker away and starts the next one now, so it warms up before it is needed
+    // A failed start is tried again by the next job.
+    void Replace(Worker& worker)
+    {
+        Kill(worker);
+        this->Spawn(worker);
+    }
+
+    static int GetRemaining(Clock::time_point deadline)
+    {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now() + std::chrono::microseconds(999)).count();
+        return ms <= 0 ? 0 : ms > INT_MAX ? INT_MAX : static_cast<int>(ms);
+    }
+
+    // Waits for cb bytes from the process; ERROR_PROCESS_ABORTED once it has closed its end by dying
+    static HRESULT Receive(const Process& process, Clock::time_point deadline, void* data, size_t cb)
+    {
+        BYTE* ptr = static_cast<BYTE*>(data);
+        while (cb > 0) {
+            pollfd pfd = { process.socket, POLLIN, 0 };
+            const int ready = ::poll(&pfd, 1, GetRemaining(deadline));
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready < 0) {
+                return HRESULT_FROM_WIN32(::GetLastError());
+            }
+            if (ready == 0) {
+                return HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            }
+            const ssize_t received = ::recv(process.socket, ptr, cb, 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED);
+            }
+            ptr += received;
+            cb -= static_cast<size_t>(received);
+        }
+        return S_OK;
+    }
+
+    static HRESULT WaitReady(const Process& process)
+    {
+        char c = 0;
+        HRESULT hr = Receive(process, Clock::now() + std::chrono::milliseconds(static_cast<int>(STARTUP_TIMEOUT)), &c, 1);
+        if (SUCCEEDED(hr) && c != 'R') {
+            hr = HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED);
+        }
+        return hr;
+    }
+
+    static HRESULT WaitReady(Worker& worker)
+    {
+        if (!worker.starting) {
+            return S_OK;
+        }
+        HRESULT hr = WaitReady(static_cast<const Process&>(worker));
+        if (SUCCEEDED(hr)) {
+            worker.starting = false;
+        }
+        return hr;
+    }
+
+    // Anonymous shared memory the worker maps through the descriptor it is sent
+    static int CreateSection(uint64_t cb)
+    {
+#ifdef __linux__
+        int fd = ::memfd_create("svg-render", MFD_CLOEXEC);
+#else
+        static std::atomic<unsigned> serial(0);
+        char name[64];
+        ::snprintf(name, sizeof(name), "/svg-render-%ld-%u", static_cast<long>(::getpid()), serial++);
+        int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd >= 0) {
+            ::shm_unlink(name);
+        }
+#endif
+        if (fd >= 0 && ::ftruncate(fd, static_cast<off_t>(cb)) != 0) {
+            const int error = errno;
+            ::close(fd);
+            errno = error;
+            fd = -1;
+        }
+        return fd;
+    }
+
+    // Runs the command with arg as argv[1]; the child's end of the socket pair becomes its stdin
+    // and is the only descriptor it keeps. Between fork and exec the child makes only
+    // async-signal-safe calls, as the parent may have other threads holding locks.
+    HRESULT Exec(const char* arg, Process* process)
+    {
+        int fds[2];
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+        char* argv[] = { const_cast<char*>(this->command.c_str()), const_cast<char*>(arg), nullptr };
+        rlimit limit;
+        ::getrlimit(RLIMIT_AS, &limit);
+        const bool limited = RenderWorker::LimitMemory(this->memoryLimit, &limit);
+        const long maxFd = ::sysconf(_SC_OPEN_MAX);
+        sigset_t signals;
+        ::sigemptyset(&signals);
+        const pid_t pid = ::fork();
+        if (pid == 0) {
+            const bool ok = fds[1] == STDIN_FILENO ? ::fcntl(fds[1], F_SETFD, 0) == 0 : ::dup2(fds[1], STDIN_FILENO) == STDIN_FILENO;
+            if (ok) {
+#ifdef SYS_close_range
+                if (::syscall(SYS_close_range, STDERR_FILENO + 1, ~0U, 0) != 0)
+#endif
+                for (long fd = STDERR_FILENO + 1; fd < maxFd && fd < 65536; fd++) {
+                    ::close(static_cast<int>(fd));
+                }
+                ::sigprocmask(SIG_SETMASK, &signals, nullptr);
+                if (!limited || ::setrlimit(RLIMIT_AS, &limit) == 0) {
+                    ::execv(argv[0], argv);
+                }
+            }
+            ::_exit(127);
+        }
+        const HRESULT hr = pid < 0 ? HRESULT_FROM_WIN32(::GetLastError()) : S_OK;
+        ::close(fds[1]);
+        if (FAILED(hr)) {
+            ::close(fds[0]);
+            return hr;
+        }
+        process->pid = pid;
+        process->socket = fds[0];
+        process->forked = false;
+        return S_OK;
+    }
+
+    // Has the zygote fork a worker, starting the zygote first if it is not running
+    // A zygote that died shows up as a broken pipe, and gets one restart.
+    HRESULT Fork(Worker& worker)
+    {
+        std::lock_guard<std::mutex> guard(this->zygoteLock);
+        HRESULT hr = S_OK;
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (this->zygote.pid == 0) {
+                hr = this->Exec(RenderWorker::GetZygoteArg(), &this->zygote);
+                if (SUCCEEDED(hr)) {
+                    hr = WaitReady(this->zygote);
+                }
+                if (FAILED(hr)) {
+                    Kill(this->zygote);
+                    return hr;
+                }
+            }
+            int fds[2];
+            if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+                return HRESULT_FROM_WIN32(::GetLastError());
+            }
+            RenderWorker::ZygoteRequest request = {};
+            request.memoryLimit = this->memoryLimit;
+            hr = RenderWorker::SendDescriptor(this->zygote.socket, &request, sizeof(request), fds[1]);
+            ::close(fds[1]);
+            int32_t pid = 0;
+            if (SUCCEEDED(hr)) {
+                hr = Receive(this->zygote, Clock::now() + std::chrono::milliseconds(static_cast<int>(STARTUP_TIMEOUT)), &pid, sizeof(pid));
+            }
+            if (SUCCEEDED(hr) && pid <= 0) {
+                ::close(fds[0]);
+                return HRESULT_FROM_WIN32(ERROR_NOT_ENOUGH_MEMORY);
+            }
+            if (SUCCEEDED(hr)) {
+                worker.pid = static_cast<pid_t>(pid);
+                worker.socket = fds[0];
+                worker.forked = true;
+                return S_OK;
+            }
+            ::close(fds[0]);
+            Kill(this->zygote);
+        }
+        return hr;
+    }
+
+    HRESULT Spawn(Worker& worker)
+    {
+        HRESULT hr = this->useZygote ? this->Fork(worker) : this->Exec(RenderWorker::GetWorkerArg(), &worker);
+        if (SUCCEEDED(hr)) {
+            worker.starting = true;
+        }
+        return hr;
+    }
+
+    // Hands the job to the worker, starting one first if it is not running
+    // A worker that died while idle shows up as a broken pipe, and gets one restart.
+    HRESULT Send(Worker& worker, int section, const RenderWorker::Job& job)
+    {
+        HRESULT hr = S_OK;
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (worker.pid == 0) {
+                hr = this->Spawn(worker);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+            }
+            hr = RenderWorker::SendDescriptor(worker.socket, &job, sizeof(job), section);
+            if (SUCCEEDED(hr)) {
+                return S_OK;
+            }
+            Kill(worker);
+        }
+        return hr;
+    }
+
+    // nullptr when none comes free before the deadline
+    Worker* Acquire(Clock::time_point deadline)
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        for (;;) {
+            for (unsigned i = 0; i < this->count; i++) {
+                if (!this->workers[i].busy) {
+                    this->workers[i].busy = true;
+                    return &this->workers[i];
+                }
+            }
+            if (this->idle.wait_until(guard, deadline) == std::cv_status::timeout && Clock::now() >= deadline) {
+                return nullptr;
+            }
+        }
+    }
+
+    void Release(Worker& worker)
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            worker.busy = false;
+        }
+        this->idle.notify_one();
+    }
+
+    // Idle workers are restarted by their next job, busy ones once they finish
+    void KillIdle()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        for (unsigned i = 0; i < this->count; i++) {
+            if (!this->workers[i].busy) {
+                Kill(this->workers[i]);
+            }
+        }
+    }
+
+public:
+    // command is the executable the workers run, whose main calls RenderWorker::ServeIfAsked
+    explicit RenderWorkerPool(const char* command, unsigned count = Parallel::GetConcurrency())
+        : command(command)
+        , count(count == 0 ? 1 : count < MAX_WORKERS ? count : MAX_WORKERS)
+        , memoryLimit(DEFAULT_MEMORY_LIMIT)
+        , useZygote(false)
+    {
+    }
+
+    RenderWorkerPool(const RenderWorkerPool&) = delete;
+    RenderWorkerPool& operator =(const RenderWorkerPool&) = delete;
+
+    ~RenderWorkerPool()
+    {
+        for (unsigned i = 0; i < MAX_WORKERS; i++) {
+            Kill(this->workers[i]);
+        }
+        Kill(this->zygote);
+    }
+
+    // Most address space a worker may map, in bytes, or 0 for no limit beyond the host's own
+    // Idle workers are restarted under it by their next job, busy ones once they finish.
+    HRESULT SetMemoryLimit(size_t bytes)
+    {
+        this->memoryLimit = bytes;
+        this->KillIdle();
+        return S_OK;
+    }
+
+    // Forks workers from a zygote, a process that loads the fonts once and then only forks,
+    // rather than exec'ing each one. They share its memory copy-on-write and serve within
+    // milliseconds, which matters most when workers that crash or hang are replaced.
+    // The zygote starts with the first worker; workers already running are replaced as above.
+    HRESULT SetZygote(bool enabled)
+    {
+        this->useZygote = enabled;
+        this->KillIdle();
+        if (!enabled) {
+            std::lock_guard<std::mutex> guard(this->zygoteLock);
+            Kill(this->zygote);
+        }
+        return S_OK;
+    }
+
+    // Renders the source to fit in size x size pixels, like SetCanvasSize(size, size).SetToContain()
+    // timeout is in milliseconds and covers the wait for a free worker and the render, but not a
+    // worker's start-up. A job that runs past it fails with HRESULT_FROM_WIN32(ERROR_TIMEOUT), and
+    // one whose worker dies, e.g. by crashing or going over the memory limit, with
+    // HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED).
+    HRESULT Render(const void* source, uint32_t cbSource, uint32_t size, RenderQuality quality, DWORD timeout, RenderWorkerResult* result)
+    {
+        Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeout);
+        result->Destroy();
+        if (this->command.empty()) {
+            return E_UNEXPECTED;
+        }
+        if (size == 0) {
+            return E_INVALIDARG;
+        }
+        const uint64_t cbSection = RenderWorker::GetSectionSize(cbSource, size);
+        if (cbSection > SIZE_MAX) {
+            return E_OUTOFMEMORY;
+        }
+        const int section = CreateSection(cbSection);
+        if (section < 0) {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+        void* mapped = ::mmap(nullptr, static_cast<size_t>(cbSection), PROT_READ | PROT_WRITE, MAP_SHARED, section, 0);
+        HRESULT hr = mapped != MAP_FAILED ? S_OK : HRESULT_FROM_WIN32(::GetLastError());
+        BYTE* view = mapped != MAP_FAILED ? static_cast<BYTE*>(mapped) : nullptr;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        if (SUCCEEDED(hr)) {
+            ::memcpy(view + sizeof(RenderWorker::Header), source, cbSource);
+            reinterpret_cast<RenderWorker::Header*>(view)->hr = E_UNEXPECTED;
+            RenderWorker::Job job = {};
+            job.cbSource = cbSource;
+            job.size = size;
+            job.quality = quality;
+            Worker* worker = this->Acquire(deadline);
+            hr = worker != nullptr ? this->Send(*worker, section, job) : HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+            if (SUCCEEDED(hr)) {
+                const Clock::time_point start = Clock::now();
+                hr = WaitReady(*worker);
+                if (FAILED(hr)) {
+                    this->Replace(*worker);
+                }
+                deadline += Clock::now() - start;
+            }
+            if (SUCCEEDED(hr)) {
+                char c = 0;
+                hr = Receive(*worker, deadline, &c, 1);
+                if (SUCCEEDED(hr) && c != 'D') {
+                    hr = HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED);
+                }
+                if (SUCCEEDED(hr)) {
+                    hr = RenderWorker::ReadHeader(view, size, &width, &height);
+                } else {
+                    this->Replace(*worker);
+                }
+            }
+            if (worker != nullptr) {
+                this->Release(*worker);
+            }
+        }
+        ::close(section);
+        if (SUCCEEDED(hr)) {
+            result->cbView = static_cast<size_t>(cbSection);
+            result->view = view;
+            result->pixels = reinterpret_cast<const uint32_t*>(view + RenderWorker::GetPixelOffset(cbSource));
+            result->width = width;
+            result->height = height;
+            return hr;
+        }
+        if (view != nullptr) {
+            ::munmap(view, static_cast<size_t>(cbSection));
+        }
+        return hr;
+    }
+};
+#endif
+
+#endif
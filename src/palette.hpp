@@ -0,0 +1,191 @@
+#ifndef SVG_PALETTE_H
+#define SVG_PALETTE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simd.h"
+
+// Up to 256 premultiplied RGBA colours plus one byte per pixel
+// Most icons fit, and then the image is a quarter of the size with nothing lost.
+class IndexedImage
+{
+private:
+    static const unsigned MAX_COLOURS = 256;
+    static const unsigned HASH_BITS = 10;
+    static const unsigned HASH_SIZE = 1u << HASH_BITS;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    unsigned colourCount = 0;
+    uint32_t palette[MAX_COLOURS];
+    uint8_t* indices = nullptr;
+
+    static unsigned Hash(uint32_t pixel)
+    {
+        return (pixel * 0x9e3779b1u) >> (32 - HASH_BITS);
+    }
+
+    // Moves translucent entries in front of opaque ones, so a PNG tRNS chunk can stop early
+    void SortByAlpha()
+    {
+        uint8_t remap[MAX_COLOURS];
+        uint32_t sorted[MAX_COLOURS];
+        unsigned n = 0;
+        bool moved = false;
+        for (unsigned pass = 0; pass < 2; pass++) {
+            for (unsigned i = 0; i < this->colourCount; i++) {
+                const bool opaque = (this->palette[i] >> 24) == 255;
+                if (opaque == (pass == 1)) {
+                    moved |= n != i;
+                    remap[i] = static_cast<uint8_t>(n);
+                    sorted[n++] = this->palette[i];
+                }
+            }
+        }
+        if (!moved) {
+            return;
+        }
+        ::memcpy(this->palette, sorted, this->colourCount * sizeof(uint32_t));
+        const size_t count = static_cast<size_t>(this->width) * this->height;
+        for (size_t i = 0; i < count; i++) {
+            this->indices[i] = remap[this->indices[i]];
+        }
+    }
+
+public:
+    IndexedImage()
+    {
+    }
+
+    ~IndexedImage()
+    {
+        ::free(this->indices);
+    }
+
+    IndexedImage(const IndexedImage&) = delete;
+    IndexedImage& operator =(const IndexedImage&) = delete;
+
+    void Destroy()
+    {
+        ::free(this->indices);
+        this->indices = nullptr;
+        this->width = this->height = 0;
+        this->colourCount = 0;
+    }
+
+    // Builds the palette and the indices in a single pass, bailing out at the 257th colour
+    // Returns S_FALSE when the pixels do not fit, which leaves the image empty.
+    // stride is in pixels.
+    HRESULT Create(const uint32_t* pixels, uint32_t width, uint32_t height, size_t stride)
+    {
+        this->Destroy();
+        if (pixels == nullptr || width == 0 || height == 0) {
+            return E_INVALIDARG;
+        }
+        uint8_t* indices = static_cast<uint8_t*>(::malloc(static_cast<size_t>(width) * height));
+        if (indices == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        int16_t slots[HASH_SIZE];
+        ::memset(slots, 0xff, sizeof(slots));
+        unsigned count = 0;
+        uint32_t last = ~pixels[0];
+        uint8_t lastIndex = 0;
+        uint8_t* out = indices;
+        for (uint32_t y = 0; y < height; y++) {
+            const uint32_t* src = pixels + y * stride;
+            uint32_t x = 0;
+            while (x < width) {
+                const uint32_t pixel = src[x];
+                if (pixel == last) {
+                    // Flat areas dominate icons, so skip along runs of the previous colour
+                    uint32_t same = 1;
+#ifdef SVG_SSE2
+                    const __m128i v = _mm_set1_epi32(static_cast<int>(pixel));
+                    while (x + same + 4 <= width && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + same)), v)) == 0xffff) {
+                        same += 4;
+                    }
+#endif
+                    while (x + same < width && src[x + same] == pixel) {
+                        same++;
+                    }
+                    ::memset(out, lastIndex, same);
+                    out += same;
+                    x += same;
+                    continue;
+                }
+                unsigned slot = Hash(pixel);
+                while (slots[slot] >= 0 && this->palette[slots[slot]] != pixel) {
+                    slot = (slot + 1) & (HASH_SIZE - 1);
+                }
+                if (slots[slot] < 0) {
+                    if (count == MAX_COLOURS) {
+                        ::free(indices);
+                        return S_FALSE;
+                    }
+                    this->palette[count] = pixel;
+                    slots[slot] = static_cast<int16_t>(count++);
+                }
+                last = pixel;
+                lastIndex = static_cast<uint8_t>(slots[slot]);
+                *out++ = lastIndex;
+                x++;
+            }
+        }
+        this->indices = indices;
+        this->width = width;
+        this->height = height;
+        this->colourCount = count;
+        this->SortByAlpha();
+        return S_OK;
+    }
+
+    // Expands back to premultiplied RGBA; stride is in pixels
+    void CopyTo(uint32_t* pixels, size_t stride) const
+    {
+        const uint8_t* src = this->indices;
+        for (uint32_t y = 0; y < this->height; y++) {
+            uint32_t* dst = pixels + y * stride;
+            for (uint32_t x = 0; x < this->width; x++) {
+                dst[x] = this->palette[src[x]];
+            }
+            src += this->width;
+        }
+    }
+
+    bool IsNull() const
+    {
+        return this->indices == nullptr;
+    }
+
+    uint32_t GetWidth() const
+    {
+        return this->width;
+    }
+
+    uint32_t GetHeight() const
+    {
+        return this->height;
+    }
+
+    unsigned GetColourCount() const
+    {
+        return this->colourCount;
+    }
+
+    // Premultiplied RGBA, translucent entries first
+    const uint32_t* GetPalette() const
+    {
+        return this->palette;
+    }
+
+    // One byte per pixel, top-down, width bytes per row
+    const uint8_t* GetIndices() const
+    {
+        return this->indices;
+    }
+};
+
+#endif
@@ -0,0 +1,559 @@
+#ifndef SVG_PARALLEL_H
+#define SVG_PARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <new>
+
+#include "cancel.hpp"
+
+// Queued tasks of a higher priority run first; running ones are never preempted
+enum TaskPriority
+{
+    TaskPriorityHigh,
+    TaskPriorityNormal,
+    TaskPriorityLow,
+    TaskPriorityCount,
+};
+
+class TaskGroup;
+
+// Unit of work for TaskScheduler, run once by whichever thread takes it
+class Task
+{
+private:
+    Task* next = nullptr;
+    TaskGroup* group = nullptr;
+    TaskPriority priority = TaskPriorityNormal;
+    // Deleted after it has run
+    bool owned = false;
+
+    friend class TaskScheduler;
+    friend class TaskGroup;
+
+public:
+    virtual ~Task() = default;
+    virtual void Run() = 0;
+};
+
+
+// Work-stealing scheduler shared by everything that runs in parallel
+// Each worker thread has a deque per priority: it pushes and pops its own tasks at the back,
+// for locality, and idle workers steal from the front of the others'. Tasks from threads outside
+// the pool go to a lock-free stack per priority, which workers drain into their own deques.
+// Workers start on demand, one fewer than the concurrency since callers work too, and exit after
+// idling for a while, so a host that unloads this code is not left with threads running it.
+class TaskScheduler
+{
+private:
+    static const unsigned MAX_WORKERS = 64;
+    static const unsigned IDLE_TIMEOUT = 5000;
+
+    struct Worker
+    {
+        TaskScheduler* owner = nullptr;
+        unsigned index = 0;
+        bool running = false;
+#ifdef _WIN32
+        // The reference the thread holds on the module, see StartThread
+        HMODULE module = nullptr;
+#endif
+        std::mutex lock;
+        std::deque<Task*> tasks[TaskPriorityCount];
+    };
+
+    Worker workers[MAX_WORKERS];
+    unsigned workerCount = 0;
+    // Milliseconds a worker waits for work before it exits
+    unsigned idleTimeout;
+    std::atomic<Task*> injected[TaskPriorityCount];
+    // Tasks pushed and not taken yet
+    std::atomic<size_t> queued;
+    std::atomic<unsigned> sleeping;
+    std::atomic<unsigned> threads;
+    std::mutex sleepLock;
+    std::condition_variable wake;
+
+    static Worker*& Current()
+    {
+        static thread_local Worker* current = nullptr;
+        return current;
+    }
+
+    Worker* GetCurrentWorker() const
+    {
+        Worker* worker = Current();
+        return worker != nullptr && worker->owner == this ? worker : nullptr;
+    }
+
+    void Inject(Task* task, TaskPriority priority)
+    {
+        this->Inject(task, task, priority);
+    }
+
+    // Pushes the chain first to last, linked by next, keeping its order
+    void Inject(Task* first, Task* last, TaskPriority priority)
+    {
+        Task* head = this->injected[priority].load(std::memory_order_relaxed);
+        do {
+            last->next = head;
+        } while (!this->injected[priority].compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Takes the whole stack, as popping single entries off a lock-free stack is prone to ABA,
+    // and keeps the oldest task. The rest go to the worker's deque, or back on the stack.
+    Task* TakeInjected(TaskPriority priority, Worker* worker)
+    {
+        Task* list = this->injected[priority].exchange(nullptr, std::memory_order_acquire);
+        if (list == nullptr) {
+            return nullptr;
+        }
+        Task* rest = nullptr;
+        Task* oldest = list;
+        while (oldest->next != nullptr) {
+            rest = oldest;
+            oldest = oldest->next;
+        }
+        if (rest != nullptr) {
+            if (worker != nullptr) {
+                std::lock_guard<std::mutex> guard(worker->lock);
+                // Newest first, so the owner's pops from the back go oldest first
+                for (Task* task = list; task != oldest; task = task->next) {
+                    worker->tasks[priority].push_back(task);
+                }
+            } else {
+                // In one piece, so the next taker still finds the oldest at the bottom
+                this->Inject(list, rest, priority);
+            }
+        }
+        this->queued--;
+        return oldest;
+    }
+
+    Task* Steal(TaskPriority priority, Worker* thief)
+    {
+        const unsigned start = thief != nullptr ? thief->index + 1 : 0;
+        for (unsigned i = 0; i < this->workerCount; i++) {
+            Worker& victim = this->workers[(start + i) % this->workerCount];
+            if (&victim == thief) {
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks[priority].empty()) {
+                Task* task = victim.tasks[priority].front();
+                victim.tasks[priority].pop_front();
+                this->queued--;
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    // Highest priority first: own deque, then injected tasks, then other workers
+    Task* Find(Worker* worker)
+    {
+        if (this->queued.load() == 0) {
+            return nullptr;
+        }
+        for (int i = 0; i < TaskPriorityCount; i++) {
+            const TaskPriority priority = static_cast<TaskPriority>(i);
+            if (worker != nullptr) {
+                std::lock_guard<std::mutex> guard(worker->lock);
+                if (!worker->tasks[priority].empty()) {
+                    Task* task = worker->tasks[priority].back();
+                    worker->tasks[priority].pop_back();
+                    this->queued--;
+                    return task;
+                }
+            }
+            Task* task = this->TakeInjected(priority, worker);
+            if (task == nullptr) {
+                task = this->Steal(priority, worker);
+            }
+            if (task != nullptr) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    // Wakes a sleeping worker, or starts one when none sleeps and there is room
+    // queued is raised before sleeping is read, and a worker raises sleeping before it reads
+    // queued, so at least one of the two sees the other.
+    void Wake()
+    {
+        if (this->sleeping.load() == 0 && this->threads.load() >= this->workerCount) {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(this->sleepLock);
+        if (this->sleeping.load() > 0) {
+            this->wake.notify_one();
+            return;
+        }
+        for (unsigned i = 0; i < this->workerCount; i++) {
+            Worker& worker = this->workers[i];
+            if (!worker.running) {
+                // Callers and the running workers still get through the tasks if it fails
+                if (this->StartThread(&worker)) {
+                    worker.running = true;
+                    this->threads++;
+                }
+                return;
+            }
+        }
+    }
+
+#ifdef _WIN32
+    // Each thread holds a reference on the module this code is in and drops it as its very last
+    // step, since DllCanUnloadNow may see the thread count at zero while the thread is still on
+    // its way out of Main
+    bool StartThread(Worker* worker)
+    {
+        HMODULE module = nullptr;
+        if (!::GetModuleHandleExW(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, reinterpret_cast<LPCWSTR>(&TaskScheduler::ThreadMain), &module)) {
+            return false;
+        }
+        worker->module = module;
+        HANDLE thread = ::CreateThread(nullptr, 0, &TaskScheduler::ThreadMain, worker, 0, nullptr);
+        if (thread == nullptr) {
+            ::FreeLibrary(module);
+            return false;
+        }
+        ::CloseHandle(thread);
+        return true;
+    }
+
+    static DWORD WINAPI ThreadMain(void* param)
+    {
+        Worker* worker = static_cast<Worker*>(param);
+        // Read first, as the slot goes to the next thread once this one has left Main
+        HMODULE module = worker->module;
+        worker->owner->Main(worker);
+        ::FreeLibraryAndExitThread(module, 0);
+        return 0;
+    }
+#else
+    bool StartThread(Worker* worker)
+    {
+        try {
+            std::thread(&TaskScheduler::Main, this, worker).detach();
+        } catch (...) {
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    void Main(Worker* worker)
+    {
+        Current() = worker;
+        for (;;) {
+            Task* task = this->Find(worker);
+            if (task != nullptr) {
+                Execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(this->sleepLock);
+            this->sleeping++;
+            bool idle = false;
+            if (this->queued.load() == 0) {
+                idle = this->wake.wait_for(guard, std::chrono::milliseconds(static_cast<long long>(this->idleTimeout))) == std::cv_status::timeout;
+            }
+            if (!idle) {
+                this->sleeping--;
+                continue;
+            }
+            // Leaves the pool before the last look at the queue: a Wake that pushed after that
+            // look finds a thread missing and starts one, as it does not take the lock when
+            // everyone is running and none asleep. Nothing is left in the own deque, since
+            // only this thread pushes to it.
+            worker->running = false;
+            this->threads--;
+            this->sleeping--;
+            if (this->queued.load() == 0) {
+                Current() = nullptr;
+                return;
+            }
+            worker->running = true;
+            this->threads++;
+        }
+    }
+
+    void Submit(Task* task)
+    {
+        if (this->workerCount == 0) {
+            Execute(task);
+            return;
+        }
+        Worker* worker = this->GetCurrentWorker();
+        this->queued++;
+        if (worker != nullptr) {
+            std::lock_guard<std::mutex> guard(worker->lock);
+            worker->tasks[task->priority].push_back(task);
+        } else {
+            this->Inject(task, task->priority);
+        }
+        this->Wake();
+    }
+
+    static void Execute(Task* task);
+
+    friend class TaskGroup;
+
+public:
+    explicit TaskScheduler(unsigned concurrency, unsigned idleTimeout = IDLE_TIMEOUT)
+        : idleTimeout(idleTimeout)
+        , queued(0)
+        , sleeping(0)
+        , threads(0)
+    {
+        for (int i = 0; i < TaskPriorityCount; i++) {
+            this->injected[i].store(nullptr, std::memory_order_relaxed);
+        }
+        this->workerCount = concurrency > 0 ? concurrency - 1 : 0;
+        if (this->workerCount > MAX_WORKERS) {
+            this->workerCount = MAX_WORKERS;
+        }
+        for (unsigned i = 0; i < this->workerCount; i++) {
+            this->workers[i].owner = this;
+            this->workers[i].index = i;
+        }
+    }
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator =(const TaskScheduler&) = delete;
+
+    // Number of worker threads alive; hosts that unload this code wait for it to drop to zero
+    unsigned GetThreadCount() const
+    {
+        return this->threads.load();
+    }
+
+    // Runs task once, on a worker, without anything waiting for it, e.g. for asynchronous
+    // operations that report completion themselves. The task must stay alive until it has run and
+    // cannot be cancelled through the scheduler. Without workers it runs before Post returns.
+    void Post(Task* task, TaskPriority priority = TaskPriorityNormal)
+    {
+        task->group = nullptr;
+        task->priority = priority;
+        this->Submit(task);
+        // Nothing else would take it when no worker could be started
+        if (this->threads.load() == 0) {
+            while (Task* next = this->Find(nullptr)) {
+                Execute(next);
+            }
+        }
+    }
+
+    // One per process; it is never destroyed, as its threads may outlive static destructors
+    static TaskScheduler& GetShared();
+};
+
+
+// Tasks that are waited for together, sharing a priority and a cancel token
+// Tasks that have not started when the token fires are skipped. Waiting helps run queued tasks,
+// so groups can nest, e.g. a parallel PNG encode inside a parallel batch.
+class TaskGroup
+{
+private:
+    typedef TaskScheduler::Worker Worker;
+
+    template <class TFunc>
+    class FunctionTask : public Task
+    {
+    private:
+        TFunc fn;
+
+    public:
+        explicit FunctionTask(const TFunc& fn)
+            : fn(fn)
+        {
+        }
+
+        void Run() override
+        {
+            this->fn();
+        }
+    };
+
+    TaskScheduler& scheduler;
+    TaskPriority priority;
+    const CancelToken* cancel;
+    size_t pending = 0;
+    std::mutex lock;
+    std::condition_variable done;
+
+    // Under the lock, so a waiter cannot see zero and destroy the group while this still runs
+    void Finish()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (--this->pending == 0) {
+            this->done.notify_all();
+        }
+    }
+
+    friend class TaskScheduler;
+
+public:
+    explicit TaskGroup(TaskPriority priority = TaskPriorityNormal, const CancelToken* cancel = nullptr, TaskScheduler& scheduler = TaskScheduler::GetShared())
+        : scheduler(scheduler)
+        , priority(priority)
+        , cancel(cancel)
+    {
+    }
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator =(const TaskGroup&) = delete;
+
+    ~TaskGroup()
+    {
+        this->Wait();
+    }
+
+    HRESULT Check() const
+    {
+        return CancelToken::Check(this->cancel);
+    }
+
+    // The task must stay alive until Wait returns
+    void Run(Task* task)
+    {
+        task->group = this;
+        task->priority = this->priority;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->pending++;
+        }
+        this->scheduler.Submit(task);
+    }
+
+    // Copies fn into a task of its own; runs it right away when that cannot be allocated
+    template <class TFunc>
+    void Run(const TFunc& fn)
+    {
+        Task* task = new(std::nothrow) FunctionTask<TFunc>(fn);
+        if (task == nullptr) {
+            if (SUCCEEDED(this->Check())) {
+                fn();
+            }
+            return;
+        }
+        task->owned = true;
+        this->Run(task);
+    }
+
+    // Returns the token's error when it fired, whether or not tasks were skipped
+    HRESULT Wait()
+    {
+        Worker* worker = this->scheduler.GetCurrentWorker();
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                if (this->pending == 0) {
+                    break;
+                }
+            }
+            Task* task = this->scheduler.Find(worker);
+            if (task != nullptr) {
+                TaskScheduler::Execute(task);
+                continue;
+            }
+            // The rest are running elsewhere; look again now and then for tasks to help with
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->done.wait_for(guard, std::chrono::milliseconds(10), [this] {
+                return this->pending == 0;
+            });
+        }
+        return this->Check();
+    }
+};
+
+
+inline void TaskScheduler::Execute(Task* task)
+{
+    TaskGroup* group = task->group;
+    if (group == nullptr) {
+        // Posted; it may be gone once it has run
+        task->Run();
+        return;
+    }
+    if (SUCCEEDED(group->Check())) {
+        task->Run();
+    }
+    if (task->owned) {
+        delete task;
+    }
+    group->Finish();
+}
+
+
+class Parallel
+{
+public:
+    static const unsigned MAX_WORKERS = 64;
+
+    Parallel() = delete;
+    ~Parallel() = delete;
+
+    static unsigned GetConcurrency()
+    {
+        unsigned n = std::thread::hardware_concurrency();
+        if (n == 0) {
+            n = 1;
+        }
+        return n < MAX_WORKERS ? n : MAX_WORKERS;
+    }
+
+    // Calls fn(worker, i) for every i in [0, count) on a batch of tasks, the calling thread included
+    // Indices are handed out one at a time, so uneven jobs still balance out.
+    // worker is below GetConcurrency() and no two concurrent calls share it, which lets callers
+    // keep per-worker scratch memory. Indices not started when cancel fires are skipped, and
+    // its error is returned.
+    template <class TFunc>
+    static HRESULT ForWorker(size_t count, const TFunc& fn, TaskPriority priority = TaskPriorityNormal, const CancelToken* cancel = nullptr)
+    {
+        if (count == 0) {
+            return CancelToken::Check(cancel);
+        }
+        std::atomic<size_t> next(0);
+        auto worker = [&](unsigned id) {
+            for (size_t i = next++; i < count && SUCCEEDED(CancelToken::Check(cancel)); i = next++) {
+                fn(id, i);
+            }
+        };
+        unsigned n = GetConcurrency();
+        if (n > count) {
+            n = static_cast<unsigned>(count);
+        }
+        TaskGroup group(priority, cancel);
+        for (unsigned i = 1; i < n; i++) {
+            group.Run([&worker, i] {
+                worker(i);
+            });
+        }
+        worker(0);
+        return group.Wait();
+    }
+
+    // Calls fn(i) for every i in [0, count)
+    template <class TFunc>
+    static HRESULT For(size_t count, const TFunc& fn, TaskPriority priority = TaskPriorityNormal, const CancelToken* cancel = nullptr)
+    {
+        return ForWorker(count, [&](unsigned, size_t i) {
+            fn(i);
+        }, priority, cancel);
+    }
+};
+
+
+inline TaskScheduler& TaskScheduler::GetShared()
+{
+    static TaskScheduler* shared = new TaskScheduler(Parallel::GetConcurrency());
+    return *shared;
+}
+
+#endif
@@ -0,0 +1,245 @@
+#ifndef SVG_PIPELINE_H
+#define SVG_PIPELINE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <new>
+
+// Queue of at most capacity items between two pipeline stages
+// Push blocks while it is full, which holds back the stages before it. Pop blocks while it is
+// empty, until Close is called, after which the remaining items are still handed out.
+template <class T>
+class BoundedQueue
+{
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+    std::mutex lock;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator =(const BoundedQueue&) = delete;
+
+    void Push(T&& item)
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->notFull.wait(guard, [this] {
+            return this->items.size() < this->capacity;
+        });
+        this->items.push_back(std::move(item));
+        this->notEmpty.notify_one();
+    }
+
+    // False once the queue is closed and drained
+    bool Pop(T* item)
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->notEmpty.wait(guard, [this] {
+            return !this->items.empty() || this->closed;
+        });
+        if (this->items.empty()) {
+            return false;
+        }
+        *item = std::move(this->items.front());
+        this->items.pop_front();
+        this->notFull.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->closed = true;
+        this->notEmpty.notify_all();
+    }
+};
+
+
+struct PipelineStageStats
+{
+    const char* name;
+    unsigned concurrency;
+    uint64_t items;
+    // Time spent in the stage function, summed over its threads
+    double busySeconds;
+
+    // Share of the stage's threads' time spent working; near one marks the bottleneck
+    double GetUtilisation(double elapsedSeconds) const
+    {
+        return elapsedSeconds > 0 ? this->busySeconds / (elapsedSeconds * this->concurrency) : 0;
+    }
+};
+
+
+// Runs items through a chain of stages, each on threads of its own, with bounded queues between them
+// While one item is in a later stage the next ones are already in the earlier ones, so e.g.
+// reading files overlaps with rendering. Stages work on the item in place and see items in no
+// particular order once a stage before them has more than one thread. Stage threads are not
+// taken from the task scheduler, since a stage that waits on I/O would hold up its workers.
+template <class TItem>
+class Pipeline
+{
+public:
+    typedef std::function<void(TItem&)> StageFunc;
+
+private:
+    typedef std::unique_ptr<TItem> ItemPtr;
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stage
+    {
+        const char* name;
+        unsigned concurrency;
+        StageFunc fn;
+        std::atomic<uint64_t> items;
+        std::atomic<uint64_t> busy;
+        std::atomic<unsigned> running;
+
+        Stage(const char* name, unsigned concurrency, const StageFunc& fn)
+            : name(name)
+            , concurrency(concurrency > 0 ? concurrency : 1)
+            , fn(fn)
+            , items(0)
+            , busy(0)
+            , running(0)
+        {
+        }
+    };
+
+    std::vector<std::unique_ptr<Stage>> stages;
+    size_t queueCapacity = 2;
+    double elapsed = 0;
+
+    static void RunStage(Stage& stage, BoundedQueue<ItemPtr>& input, BoundedQueue<ItemPtr>& output)
+    {
+        ItemPtr item;
+        while (input.Pop(&item)) {
+            const auto start = Clock::now();
+            stage.fn(*item);
+            stage.busy += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            stage.items++;
+            output.Push(std::move(item));
+        }
+        // The last thread out tells the next stage nothing more is coming
+        if (--stage.running == 0) {
+            output.Close();
+        }
+    }
+
+public:
+    Pipeline() = default;
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator =(const Pipeline&) = delete;
+
+    // Stages run in the order they are added; concurrency is the number of threads for it
+    Pipeline& AddStage(const char* name, unsigned concurrency, const StageFunc& fn)
+    {
+        this->stages.emplace_back(new Stage(name, concurrency, fn));
+        return *this;
+    }
+
+    // Items each queue holds before the stage feeding it waits
+    Pipeline& SetQueueCapacity(size_t capacity)
+    {
+        this->queueCapacity = capacity;
+        return *this;
+    }
+
+    // Creates count items with init(i, item), runs them through every stage and hands each one
+    // to done(item) on the calling thread as it comes out of the last stage
+    // Fails when items cannot be allocated; those not allocated are left out.
+    template <class TInit, class TDone>
+    HRESULT Run(size_t count, const TInit& init, const TDone& done)
+    {
+        const size_t n = this->stages.size();
+        std::vector<std::unique_ptr<BoundedQueue<ItemPtr>>> queues;
+        std::vector<std::thread> threads;
+        HRESULT hr = S_OK;
+        const auto start = Clock::now();
+        try {
+            for (size_t i = 0; i <= n; i++) {
+                queues.emplace_back(new BoundedQueue<ItemPtr>(this->queueCapacity));
+            }
+            for (size_t i = 0; i < n; i++) {
+                Stage& stage = *this->stages[i];
+                stage.items = 0;
+                stage.busy = 0;
+                stage.running = stage.concurrency;
+            }
+            for (size_t i = 0; i < n; i++) {
+                Stage& stage = *this->stages[i];
+                for (unsigned j = 0; j < stage.concurrency; j++) {
+                    threads.emplace_back(RunStage, std::ref(stage), std::ref(*queues[i]), std::ref(*queues[i + 1]));
+                }
+            }
+            // Feeds from a thread of its own, so the caller can drain the last queue meanwhile
+            threads.emplace_back([&] {
+                for (size_t i = 0; i < count; i++) {
+                    ItemPtr item(new(std::nothrow) TItem());
+                    if (item == nullptr) {
+                        hr = E_OUTOFMEMORY;
+                        break;
+                    }
+                    init(i, *item);
+                    queues[0]->Push(std::move(item));
+                }
+                queues[0]->Close();
+            });
+        } catch (...) {
+            // Let whatever threads did start see an empty, closed pipeline
+            for (auto& queue : queues) {
+                queue->Close();
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            return E_OUTOFMEMORY;
+        }
+        ItemPtr item;
+        while (queues[n]->Pop(&item)) {
+            done(*item);
+            item.reset();
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        this->elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        return hr;
+    }
+
+    size_t GetStageCount() const
+    {
+        return this->stages.size();
+    }
+
+    PipelineStageStats GetStageStats(size_t i) const
+    {
+        const Stage& stage = *this->stages[i];
+        PipelineStageStats stats = { stage.name, stage.concurrency, stage.items.load(), stage.busy.load() / 1e9 };
+        return stats;
+    }
+
+    // Wall time of the last Run
+    double GetElapsedSeconds() const
+    {
+        return this->elapsed;
+    }
+};
+
+#endif
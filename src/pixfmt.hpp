@@ -0,0 +1,339 @@
+#ifndef SVG_PIXFMT_H
+#define SVG_PIXFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "simd.h"
+
+// What the alpha channel of an image turned out to hold, from least to most general
+enum PixelAlpha
+{
+    PixelAlphaOpaque,       // every pixel is 255
+    PixelAlphaBinary,       // every pixel is 0 or 255
+    PixelAlphaTranslucent,  // anything else
+};
+
+// Opaque background to composite renders onto: a solid colour, or a checkerboard when cellSize is set
+// Colours are BGRA as in a GDI DIB. (originX, originY) is where the top-left pixel of the
+// image falls on the pattern, so a composited image lines up with a pattern drawn around it.
+struct Backdrop
+{
+    uint32_t colour = 0xffffffff;
+    uint32_t alternate = 0xffffffff;
+    uint32_t cellSize = 0;
+    int32_t originX = 0;
+    int32_t originY = 0;
+
+    static Backdrop Solid(uint32_t colour)
+    {
+        Backdrop backdrop;
+        backdrop.colour = backdrop.alternate = colour | 0xff000000;
+        return backdrop;
+    }
+
+    // The cell at the pattern origin takes colour
+    static Backdrop Checker(uint32_t colour, uint32_t alternate, uint32_t cellSize, int32_t originX, int32_t originY)
+    {
+        Backdrop backdrop;
+        backdrop.colour = colour | 0xff000000;
+        backdrop.alternate = alternate | 0xff000000;
+        backdrop.cellSize = cellSize;
+        backdrop.originX = originX;
+        backdrop.originY = originY;
+        return backdrop;
+    }
+
+    bool operator ==(const Backdrop& other) const
+    {
+        return this->colour == other.colour && this->alternate == other.alternate && this->cellSize == other.cellSize
+            && this->originX == other.originX && this->originY == other.originY;
+    }
+
+    bool operator !=(const Backdrop& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+// Per-pixel helpers for the premultiplied RGBA that resvg renders
+// A pixel is read as a little-endian uint32_t, so R is the low byte and A the high one.
+class PixelFormat
+{
+public:
+    PixelFormat() = delete;
+    ~PixelFormat() = delete;
+
+    // Returns straight RGBA in the same layout, rounding to nearest
+    static uint32_t Unpremultiply(uint32_t pixel)
+    {
+        const uint32_t a = pixel >> 24;
+        if (a == 255) {
+            return pixel;
+        }
+        if (a == 0) {
+            return 0;
+        }
+        const uint32_t half = a >> 1;
+        uint32_t r = ((pixel & 0xff) * 255 + half) / a;
+        uint32_t g = (((pixel >> 8) & 0xff) * 255 + half) / a;
+        uint32_t b = (((pixel >> 16) & 0xff) * 255 + half) / a;
+        r = r > 255 ? 255 : r;
+        g = g > 255 ? 255 : g;
+        b = b > 255 ? 255 : b;
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
+    // Straight RGBA to premultiplied, rounding to nearest
+    static uint32_t Premultiply(uint32_t pixel)
+    {
+        const uint32_t a = pixel >> 24;
+        const uint32_t r = Div255((pixel & 0xff) * a);
+        const uint32_t g = Div255(((pixel >> 8) & 0xff) * a);
+        const uint32_t b = Div255(((pixel >> 16) & 0xff) * a);
+        return r | (g << 8) | (b << 16) | (a << 24);
+    }
+
+    // x / 255 rounded to nearest, for x up to 255 * 255
+    static uint32_t Div255(uint32_t x)
+    {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    static uint32_t SwapRedBlue(uint32_t pixel)
+    {
+        return (pixel & 0xff00ff00) | ((pixel & 0xff) << 16) | ((pixel >> 16) & 0xff);
+    }
+
+    // BT.601 luma from 8-bit weights that add up to 256, on the gamma-encoded channels as they are
+    static uint32_t Luma(uint32_t pixel)
+    {
+        return ((pixel & 0xff) * 77 + ((pixel >> 8) & 0xff) * 150 + ((pixel >> 16) & 0xff) * 29 + 128) >> 8;
+    }
+
+#ifdef SVG_SSE2
+    // Vector forms of the helpers above, four pixels at a time
+
+    static __m128i SwapRedBlue4(__m128i v)
+    {
+        const __m128i rb = _mm_and_si128(v, _mm_set1_epi32(0x00ff00ff));
+        return _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32(static_cast<int>(0xff00ff00))), _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+    }
+
+    // x / 255 rounded to nearest in each 16-bit lane
+    static __m128i Div255x8(__m128i x)
+    {
+        x = _mm_add_epi16(x, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    static __m128i Premultiply4(__m128i v)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        // Alpha lanes are scaled by 255, which leaves them as they are
+        const __m128i colourMask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+        const __m128i alphaOne = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        const __m128i aLo = _mm_or_si128(_mm_and_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)), colourMask), alphaOne);
+        const __m128i aHi = _mm_or_si128(_mm_and_si128(_mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)), colourMask), alphaOne);
+        lo = Div255x8(_mm_mullo_epi16(lo, aLo));
+        hi = Div255x8(_mm_mullo_epi16(hi, aHi));
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    // Same results as Unpremultiply
+    // Groups whose alpha is all 0 or 255 need no division. Otherwise the quotient is
+    // taken in single precision, which is exact here: the true quotient is never
+    // closer than 1/255 to the next integer, far above float rounding.
+    static __m128i Unpremultiply4(__m128i v)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+        const __m128i alpha = _mm_and_si128(v, alphaMask);
+        const __m128i clear = _mm_cmpeq_epi32(alpha, zero);
+        if ((_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) | _mm_movemask_epi8(clear)) == 0xffff) {
+            return _mm_andnot_si128(clear, v);
+        }
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        const __m128i q0 = UnpremultiplyLanes(_mm_unpacklo_epi16(lo, zero));
+        const __m128i q1 = UnpremultiplyLanes(_mm_unpackhi_epi16(lo, zero));
+        const __m128i q2 = UnpremultiplyLanes(_mm_unpacklo_epi16(hi, zero));
+        const __m128i q3 = UnpremultiplyLanes(_mm_unpackhi_epi16(hi, zero));
+        // Saturation clamps to 255, and clear pixels are zeroed whatever they divided to
+        const __m128i colour = _mm_andnot_si128(alphaMask, _mm_packus_epi16(_mm_packs_epi32(q0, q1), _mm_packs_epi32(q2, q3)));
+        return _mm_andnot_si128(clear, _mm_or_si128(colour, alpha));
+    }
+
+    // Luma of each pixel in the low byte of its 32-bit lane
+    static __m128i Luma4(__m128i v)
+    {
+        const __m128i low = _mm_set1_epi32(0xff);
+        // Every product fits in 16 bits, so a 16-bit multiply on zero-extended lanes is exact
+        const __m128i r = _mm_mullo_epi16(_mm_and_si128(v, low), _mm_set1_epi32(77));
+        const __m128i g = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(v, 8), low), _mm_set1_epi32(150));
+        const __m128i b = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(v, 16), low), _mm_set1_epi32(29));
+        return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(r, g), _mm_add_epi32(b, _mm_set1_epi32(128))), 8);
+    }
+
+    // Four bytes into the low bytes of the 32-bit lanes
+    static __m128i LoadBytes4(const uint8_t* src)
+    {
+        int bytes;
+        ::memcpy(&bytes, src, 4);
+        const __m128i zero = _mm_setzero_si128();
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+    }
+
+    // Packs the low byte of each 32-bit lane, which must hold 0-255, into four bytes
+    static void StoreLowBytes4(uint8_t* dst, __m128i v)
+    {
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v, v), _mm_setzero_si128());
+        const int bytes = _mm_cvtsi128_si32(packed);
+        ::memcpy(dst, &bytes, 4);
+    }
+
+    // Packs the low 16 bits of each 32-bit lane into four uint16_t
+    static void StoreLowWords4(uint8_t* dst, __m128i v)
+    {
+        // Sign extending first makes the saturating pack exact
+        v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packs_epi32(v, v));
+    }
+#endif
+
+    // Swizzles premultiplied RGBA to BGRA, premultiplied or straight, and classifies alpha on the way
+    // Runs of pixels whose alpha is 0 or 255 need no division, so opaque images never divide at all.
+    // Straight colour uses the rounding GDI thumbnails have always used.
+    template <bool Straight>
+    static PixelAlpha ToBgra(const uint32_t* src, uint32_t* dst, size_t count)
+    {
+        bool binary = true;
+        bool opaque = true;
+        size_t i = 0;
+#ifdef SVG_SSE2
+        const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+        for (; i + 4 <= count; i += 4) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const __m128i alpha = _mm_and_si128(v, alphaMask);
+            const int full = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask));
+            const int clear = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128()));
+            opaque = opaque && full == 0xffff;
+            if (Straight && (full | clear) != 0xffff) {
+                binary = false;
+                for (size_t j = i; j < i + 4; j++) {
+                    dst[j] = PixelToBgra<true>(src[j]);
+                }
+                continue;
+            }
+            binary = binary && (full | clear) == 0xffff;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), SwapRedBlue4(v));
+        }
+#endif
+        for (; i < count; i++) {
+            const uint32_t a = src[i] >> 24;
+            opaque = opaque && a == 255;
+            binary = binary && (a == 0 || a == 255);
+            dst[i] = PixelToBgra<Straight>(src[i]);
+        }
+        return opaque ? PixelAlphaOpaque : binary ? PixelAlphaBinary : PixelAlphaTranslucent;
+    }
+
+    // Composites one row over the backdrop and swizzles it to opaque BGRA in the same pass
+    // y is the row within the image, which picks the checkerboard phase.
+    static void CompositeToBgra(const uint32_t* src, uint32_t* dst, size_t count, const Backdrop& backdrop, int32_t y)
+    {
+        if (backdrop.cellSize == 0 || backdrop.colour == backdrop.alternate) {
+            CompositeToBgra(src, dst, count, backdrop.colour);
+            return;
+        }
+        const int64_t cell = backdrop.cellSize;
+        const int64_t py = FloorDiv(static_cast<int64_t>(backdrop.originY) + y, cell);
+        size_t x = 0;
+        while (x < count) {
+            const int64_t px = FloorDiv(static_cast<int64_t>(backdrop.originX) + static_cast<int64_t>(x), cell);
+            const int64_t end = (px + 1) * cell - backdrop.originX;
+            const size_t n = static_cast<size_t>(end) - x < count - x ? static_cast<size_t>(end) - x : count - x;
+            CompositeToBgra(src + x, dst + x, n, ((px + py) & 1) == 0 ? backdrop.colour : backdrop.alternate);
+            x += n;
+        }
+    }
+
+    // dst = src + background * (1 - alpha), with the division by 255 rounded to nearest
+    static void CompositeToBgra(const uint32_t* src, uint32_t* dst, size_t count, uint32_t background)
+    {
+        size_t i = 0;
+#ifdef SVG_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+        const __m128i max = _mm_set1_epi16(255);
+        const __m128i bg = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(background)), zero);
+        for (; i + 4 <= count; i += 4) {
+            const __m128i bgra = SwapRedBlue4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+            __m128i lo = _mm_unpacklo_epi8(bgra, zero);
+            __m128i hi = _mm_unpackhi_epi8(bgra, zero);
+            const __m128i invLo = _mm_sub_epi16(max, _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+            const __m128i invHi = _mm_sub_epi16(max, _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+            lo = _mm_add_epi16(lo, Div255x8(_mm_mullo_epi16(bg, invLo)));
+            hi = _mm_add_epi16(hi, Div255x8(_mm_mullo_epi16(bg, invHi)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(_mm_packus_epi16(lo, hi), alphaMask));
+        }
+#endif
+        for (; i < count; i++) {
+            const uint32_t pixel = SwapRedBlue(src[i]);
+            const uint32_t inv = 255 - (pixel >> 24);
+            uint32_t out = 0xff000000;
+            for (unsigned shift = 0; shift < 24; shift += 8) {
+                const uint32_t t = ((pixel >> shift) & 0xff) + Div255(((background >> shift) & 0xff) * inv);
+                out |= (t > 255 ? 255 : t) << shift;
+            }
+            dst[i] = out;
+        }
+    }
+
+private:
+#ifdef SVG_SSE2
+    // (c * 255 + a / 2) / a for one pixel spread over four 32-bit lanes
+    static __m128i UnpremultiplyLanes(__m128i p)
+    {
+        const __m128i a = _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3));
+        const __m128i n = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(p, 8), p), _mm_srli_epi32(a, 1));
+        return _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(n), _mm_cvtepi32_ps(a)));
+    }
+#endif
+
+    static int64_t FloorDiv(int64_t x, int64_t y)
+    {
+        return x >= 0 ? x / y : -((-x + y - 1) / y);
+    }
+
+    static uint32_t Clamp(int x)
+    {
+        return x < 0 ? 0 : (x > 255 ? 255 : static_cast<uint32_t>(x));
+    }
+
+    template <bool Straight>
+    static uint32_t PixelToBgra(uint32_t pixel)
+    {
+        const uint32_t a = pixel >> 24;
+        if (Straight && a != 0 && a != 255) {
+            return UnpremultiplyToBgra(pixel);
+        }
+        return SwapRedBlue(pixel);
+    }
+
+    // Straight BGRA from premultiplied RGBA with partial alpha
+    static uint32_t UnpremultiplyToBgra(uint32_t pixel)
+    {
+        const int r = pixel & 0xff;
+        const int g = (pixel >> 8) & 0xff;
+        const int b = (pixel >> 16) & 0xff;
+        const int a = pixel >> 24;
+        return Clamp((b * 256 - 128) / a) | (Clamp((g * 256 - 128) / a) << 8) | (Clamp((r * 256 - 128) / a) << 16) | (static_cast<uint32_t>(a) << 24);
+    }
+};
+
+#endif
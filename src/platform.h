@@ -0,0 +1,86 @@
+#ifndef SVG_PLATFORM_H
+#define SVG_PLATFORM_H
+
+// The core headers are written against the Win32 types and error codes; elsewhere this
+// supplies the few of them they use, so the same headers build with GCC and Clang
+#ifdef _WIN32
+#include <windows.h>
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+
+typedef int32_t HRESULT;
+typedef uint8_t BYTE;
+typedef uint32_t UINT;
+typedef uint32_t DWORD;
+typedef int BOOL;
+
+#define SUCCEEDED(hr)   (static_cast<HRESULT>(hr) >= 0)
+#define FAILED(hr)      (static_cast<HRESULT>(hr) < 0)
+
+#define S_OK            static_cast<HRESULT>(0)
+#define S_FALSE         static_cast<HRESULT>(1)
+#define E_NOTIMPL       static_cast<HRESULT>(0x80004001)
+#define E_POINTER       static_cast<HRESULT>(0x80004003)
+#define E_FAIL          static_cast<HRESULT>(0x80004005)
+#define E_PENDING       static_cast<HRESULT>(0x8000000A)
+#define E_UNEXPECTED    static_cast<HRESULT>(0x8000FFFF)
+#define E_OUTOFMEMORY   static_cast<HRESULT>(0x8007000E)
+#define E_INVALIDARG    static_cast<HRESULT>(0x80070057)
+
+#define ERROR_SUCCESS               0
+#define ERROR_FILE_NOT_FOUND        2
+#define ERROR_PATH_NOT_FOUND        3
+#define ERROR_ACCESS_DENIED         5
+#define ERROR_NOT_ENOUGH_MEMORY     8
+#define ERROR_INVALID_DATA          13
+#define ERROR_WRITE_FAULT           29
+#define ERROR_READ_FAULT            30
+#define ERROR_GEN_FAILURE           31
+#define ERROR_FILE_TOO_LARGE        223
+#define ERROR_BUSY                  170
+#define ERROR_PROCESS_ABORTED       1067
+#define ERROR_NOT_FOUND             1168
+#define ERROR_CANCELLED             1223
+#define ERROR_TIMEOUT               1460
+
+inline HRESULT HRESULT_FROM_WIN32(DWORD err)
+{
+    return err == 0 ? S_OK : static_cast<HRESULT>((err & 0x0000FFFF) | 0x80070000);
+}
+
+#define ZeroMemory(dst, cb)     ::memset((dst), 0, (cb))
+#define ARRAYSIZE(a)            (sizeof(a) / sizeof((a)[0]))
+
+// errno of the last failed call, as the Win32 error the callers expect
+inline DWORD GetLastError()
+{
+    switch (errno) {
+    case 0:
+        return ERROR_SUCCESS;
+    case ENOENT:
+        return ERROR_FILE_NOT_FOUND;
+    case ENOTDIR:
+        return ERROR_PATH_NOT_FOUND;
+    case EACCES:
+    case EPERM:
+        return ERROR_ACCESS_DENIED;
+    case ENOMEM:
+        return ERROR_NOT_ENOUGH_MEMORY;
+    case EFBIG:
+    case EOVERFLOW:
+        return ERROR_FILE_TOO_LARGE;
+    case EIO:
+        return ERROR_READ_FAULT;
+    default:
+        return ERROR_GEN_FAILURE;
+    }
+}
+
+#endif
+
+#endif
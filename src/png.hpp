@@ -0,0 +1,809 @@
+#ifndef SVG_PNG_H
+#define SVG_PNG_H
+
+#include <zlib.h>
+#ifdef _WIN32
+#pragma comment(lib, "zlibstatic.lib")
+#endif
+
+#include "simd.h"
+#include "pixfmt.hpp"
+#include "buffer.hpp"
+#include "sink.hpp"
+#include "parallel.hpp"
+
+class PngOptions
+{
+private:
+    static const size_t MIN_BLOCK_SIZE = 32 * 1024;
+    static const size_t MAX_BLOCK_SIZE = 16 * 1024 * 1024;
+    static const unsigned MAX_BLOCK_COUNT = 256;
+
+    int level = Z_DEFAULT_COMPRESSION;
+    bool parallel = true;
+    size_t blockSize = 128 * 1024;
+    unsigned blockCount = 0;
+
+public:
+    // zlib compression level
+    PngOptions& SetLevel(int level) noexcept
+    {
+        this->level = level;
+        return *this;
+    }
+
+    // Compresses blocks of scanlines concurrently; the output is still a single deflate stream
+    PngOptions& SetParallel(bool parallel) noexcept
+    {
+        this->parallel = parallel;
+        return *this;
+    }
+
+    // Bytes of filtered scanlines per parallel deflate block
+    PngOptions& SetBlockSize(size_t blockSize) noexcept
+    {
+        if (blockSize < MIN_BLOCK_SIZE) {
+            blockSize = MIN_BLOCK_SIZE;
+        } else if (blockSize > MAX_BLOCK_SIZE) {
+            blockSize = MAX_BLOCK_SIZE;
+        }
+        this->blockSize = blockSize;
+        return *this;
+    }
+
+    // Blocks deflated at a time in parallel mode, 0 for one per core; more than one gives the
+    // parallel stream whatever the number of cores, which is what the tests rely on
+    PngOptions& SetBlockCount(unsigned count) noexcept
+    {
+        this->blockCount = count < MAX_BLOCK_COUNT ? count : MAX_BLOCK_COUNT;
+        return *this;
+    }
+
+    int GetLevel() const noexcept
+    {
+        return this->level;
+    }
+
+    bool IsParallel() const noexcept
+    {
+        return this->parallel;
+    }
+
+    size_t GetBlockSize() const noexcept
+    {
+        return this->blockSize;
+    }
+
+    unsigned GetBlockCount() const noexcept
+    {
+        return this->blockCount != 0 ? this->blockCount : Parallel::GetConcurrency();
+    }
+};
+
+
+// Streaming PNG encoder for premultiplied RGBA rows, or for indexed-colour rows
+// RGBA rows are unpremultiplied and filtered in batches, so only a batch of rows
+// and the compressed blocks are ever held in memory.
+// In parallel mode the filtered bytes are cut into fixed-size blocks, each
+// deflated on its own thread with the previous 32KB as a preset dictionary,
+// and ended with a sync flush so the raw streams simply concatenate, as pigz does.
+class PngWriter
+{
+private:
+    static const size_t IDAT_SIZE = 64 * 1024;
+    static const size_t DICT_SIZE = 32 * 1024;
+    static const size_t SERIAL_BATCH = 64 * 1024;
+    // Zero bytes in front of every raw row, so the left neighbours of the first pixel read as zero
+    static const size_t ROW_PAD = 16;
+
+    struct Block
+    {
+        z_stream zs;
+        bool init;
+        uint8_t* out;
+        size_t outSize;
+        uLong adler;
+        bool ok;
+    };
+
+    ByteSink* sink = nullptr;
+    z_stream zs = {};
+    bool deflating = false;
+    bool started = false;
+    bool parallel = false;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t row = 0;
+    uint8_t depth = 8;
+    uint8_t colourType = 6;
+    uint32_t batchRows = 0;
+    size_t cbLine = 0;
+    size_t rawStride = 0;
+    uint8_t* prevLine = nullptr;
+    uint8_t* raw = nullptr;
+    uint8_t* scratch = nullptr;
+    ByteBuffer pending;
+    uint8_t* idat = nullptr;
+    size_t idatUsed = 0;
+    size_t blockSize = 0;
+    size_t outCapacity = 0;
+    Block* blocks = nullptr;
+    unsigned blockCount = 0;
+    uint8_t dict[DICT_SIZE];
+    size_t dictSize = 0;
+    uLong adler = 1;
+
+    HRESULT WriteChunk(const char* type, const void* data, size_t cb)
+    {
+        uint8_t header[8] = {
+            static_cast<uint8_t>(cb >> 24), static_cast<uint8_t>(cb >> 16), static_cast<uint8_t>(cb >> 8), static_cast<uint8_t>(cb),
+            static_cast<uint8_t>(type[0]), static_cast<uint8_t>(type[1]), static_cast<uint8_t>(type[2]), static_cast<uint8_t>(type[3]),
+        };
+        uLong crc = ::crc32(0, header + 4, 4);
+        if (cb > 0) {
+            crc = ::crc32(crc, static_cast<const Bytef*>(data), static_cast<uInt>(cb));
+        }
+        const uint8_t trailer[4] = {
+            static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(crc >> 16), static_cast<uint8_t>(crc >> 8), static_cast<uint8_t>(crc),
+        };
+        HRESULT hr = this->sink->Write(header, sizeof(header));
+        if (SUCCEEDED(hr) && cb > 0) {
+            hr = this->sink->Write(data, cb);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = this->sink->Write(trailer, sizeof(trailer));
+        }
+        return hr;
+    }
+
+    HRESULT FlushIdat()
+    {
+        if (this->idatUsed == 0) {
+            return S_OK;
+        }
+        HRESULT hr = this->WriteChunk("IDAT", this->idat, this->idatUsed);
+        this->idatUsed = 0;
+        return hr;
+    }
+
+    // Appends compressed bytes; anything as large as a chunk goes out as is rather than through the staging buffer
+    HRESULT WriteIdat(const uint8_t* data, size_t cb)
+    {
+        if (cb >= IDAT_SIZE) {
+            HRESULT hr = this->FlushIdat();
+            if (SUCCEEDED(hr)) {
+                hr = this->WriteChunk("IDAT", data, cb);
+            }
+            return hr;
+        }
+        while (cb > 0) {
+            size_t n = IDAT_SIZE - this->idatUsed;
+            if (n > cb) {
+                n = cb;
+            }
+            ::memcpy(this->idat + this->idatUsed, data, n);
+            this->idatUsed += n;
+            data += n;
+            cb -= n;
+            if (this->idatUsed == IDAT_SIZE) {
+                HRESULT hr = this->FlushIdat();
+                if (FAILED(hr)) {
+                    return hr;
+                }
+            }
+        }
+        return S_OK;
+    }
+
+    HRESULT Deflate(const uint8_t* data, size_t cb, int flush)
+    {
+        this->zs.next_in = const_cast<Bytef*>(data);
+        this->zs.avail_in = static_cast<uInt>(cb);
+        for (;;) {
+            this->zs.next_out = this->idat + this->idatUsed;
+            this->zs.avail_out = static_cast<uInt>(IDAT_SIZE - this->idatUsed);
+            const int ret = ::deflate(&this->zs, flush);
+            if (ret == Z_STREAM_ERROR) {
+                return E_FAIL;
+            }
+            this->idatUsed = IDAT_SIZE - this->zs.avail_out;
+            if (this->zs.avail_out == 0) {
+                HRESULT hr = this->FlushIdat();
+                if (FAILED(hr)) {
+                    return hr;
+                }
+                continue;
+            }
+            if (flush == Z_FINISH ? ret == Z_STREAM_END : this->zs.avail_in == 0) {
+                return S_OK;
+            }
+        }
+    }
+
+    static bool CompressBlock(Block* block, const uint8_t* data, size_t cb, const uint8_t* dict, size_t cbDict, size_t outCapacity, bool last)
+    {
+        z_stream* zs = &block->zs;
+        if (::deflateReset(zs) != Z_OK) {
+            return false;
+        }
+        if (cbDict > 0 && ::deflateSetDictionary(zs, dict, static_cast<uInt>(cbDict)) != Z_OK) {
+            return false;
+        }
+        zs->next_in = const_cast<Bytef*>(data);
+        zs->avail_in = static_cast<uInt>(cb);
+        zs->next_out = block->out;
+        zs->avail_out = static_cast<uInt>(outCapacity);
+        const int ret = ::deflate(zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        block->outSize = outCapacity - zs->avail_out;
+        block->adler = ::adler32(::adler32(0, nullptr, 0), data, static_cast<uInt>(cb));
+        // The buffer is sized past deflateBound, so a full one means the block did not fit
+        return last ? ret == Z_STREAM_END : (ret == Z_OK && zs->avail_in == 0 && zs->avail_out > 0);
+    }
+
+    // Compresses whole blocks of the pending filtered bytes, or everything that is left when last is set
+    HRESULT CompressBlocks(bool last)
+    {
+        const size_t cbPending = this->pending.GetSize();
+        size_t count = cbPending / this->blockSize;
+        if (last && (count == 0 || cbPending % this->blockSize != 0)) {
+            count++;
+        }
+        const uint8_t* data = this->pending.GetData();
+        size_t offset = 0;
+        for (size_t first = 0; first < count; first += this->blockCount) {
+            const size_t n = count - first < this->blockCount ? count - first : this->blockCount;
+            const size_t base = offset;
+            Parallel::For(n, [&](size_t i) {
+                const size_t start = base + i * this->blockSize;
+                const size_t cb = start + this->blockSize <= cbPending ? this->blockSize : cbPending - start;
+                const bool isLast = last && first + i == count - 1;
+                // Blocks are at least DICT_SIZE long, so only the first one needs the saved tail
+                const uint8_t* dict = this->dict;
+                size_t cbDict = this->dictSize;
+                if (start > 0) {
+                    dict = data + start - DICT_SIZE;
+                    cbDict = DICT_SIZE;
+                }
+                this->blocks[i].ok = CompressBlock(&this->blocks[i], data + start, cb, dict, cbDict, this->outCapacity, isLast);
+            });
+            for (size_t i = 0; i < n; i++) {
+                const Block& block = this->blocks[i];
+                if (!block.ok) {
+                    return E_FAIL;
+                }
+                HRESULT hr = this->WriteIdat(block.out, block.outSize);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+                const size_t start = base + i * this->blockSize;
+                const size_t cb = start + this->blockSize <= cbPending ? this->blockSize : cbPending - start;
+                this->adler = ::adler32_combine(this->adler, block.adler, static_cast<z_off_t>(cb));
+                offset = start + cb;
+            }
+        }
+        // Keep the last 32KB of what was consumed to prime the next block
+        if (offset >= DICT_SIZE) {
+            ::memcpy(this->dict, data + offset - DICT_SIZE, DICT_SIZE);
+            this->dictSize = DICT_SIZE;
+        } else if (offset > 0) {
+            const size_t keep = this->dictSize + offset > DICT_SIZE ? DICT_SIZE - offset : this->dictSize;
+            ::memmove(this->dict, this->dict + this->dictSize - keep, keep);
+            ::memcpy(this->dict + keep, data, offset);
+            this->dictSize = keep + offset;
+        }
+        this->pending.Discard(offset);
+        return S_OK;
+    }
+
+    static void Unpremultiply(const uint32_t* src, uint32_t width, uint8_t* dst)
+    {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t pixel = PixelFormat::Unpremultiply(src[x]);
+            ::memcpy(dst, &pixel, 4);
+            dst += 4;
+        }
+    }
+
+    // Predictors for the five PNG filter types; cur and prior point at the byte being filtered,
+    // and the four bytes before either row are readable zeros
+    struct PredictNone
+    {
+        static int Scalar(const uint8_t*, const uint8_t*)
+        {
+            return 0;
+        }
+#ifdef SVG_SSE2
+        static __m128i Vector(const uint8_t*, const uint8_t*)
+        {
+            return _mm_setzero_si128();
+        }
+#endif
+    };
+
+    struct PredictSub
+    {
+        static int Scalar(const uint8_t* cur, const uint8_t*)
+        {
+            return cur[-4];
+        }
+#ifdef SVG_SSE2
+        static __m128i Vector(const uint8_t* cur, const uint8_t*)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur - 4));
+        }
+#endif
+    };
+
+    struct PredictUp
+    {
+        static int Scalar(const uint8_t*, const uint8_t* prior)
+        {
+            return prior[0];
+        }
+#ifdef SVG_SSE2
+        static __m128i Vector(const uint8_t*, const uint8_t* prior)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior));
+        }
+#endif
+    };
+
+    struct PredictAverage
+    {
+        static int Scalar(const uint8_t* cur, const uint8_t* prior)
+        {
+            return (cur[-4] + prior[0]) >> 1;
+        }
+#ifdef SVG_SSE2
+        static __m128i Vector(const uint8_t* cur, const uint8_t* prior)
+        {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur - 4));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior));
+            // pavgb rounds up, the filter rounds down
+            return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+        }
+#endif
+    };
+
+    struct PredictPaeth
+    {
+        static int Scalar(const uint8_t* cur, const uint8_t* prior)
+        {
+            const int a = cur[-4];
+            const int b = prior[0];
+            const int c = prior[-4];
+            const int pa = b > c ? b - c : c - b;
+            const int pb = a > c ? a - c : c - a;
+            const int pc = a + b - c - c < 0 ? c + c - a - b : a + b - c - c;
+            if (pa <= pb && pa <= pc) {
+                return a;
+            }
+            return pb <= pc ? b : c;
+        }
+#ifdef SVG_SSE2
+        static __m128i Abs16(__m128i x)
+        {
+            return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+        }
+
+        static __m128i Select16(__m128i a, __m128i b, __m128i c)
+        {
+            const __m128i pa = Abs16(_mm_sub_epi16(b, c));
+            const __m128i pb = Abs16(_mm_sub_epi16(a, c));
+            const __m128i pc = Abs16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+            const __m128i notB = _mm_cmpgt_epi16(pb, pc);
+            const __m128i bc = _mm_or_si128(_mm_and_si128(notB, c), _mm_andnot_si128(notB, b));
+            const __m128i notA = _mm_cmpgt_epi16(pa, _mm_min_epi16(pb, pc));
+            return _mm_or_si128(_mm_and_si128(notA, bc), _mm_andnot_si128(notA, a));
+        }
+
+        static __m128i Vector(const uint8_t* cur, const uint8_t* prior)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur - 4));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior));
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior - 4));
+            const __m128i lo = Select16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+            const __m128i hi = Select16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+            return _mm_packus_epi16(lo, hi);
+        }
+#endif
+    };
+
+    // Filters a row and returns the sum of the absolute values of the output taken as signed bytes
+    template <class TPredictor>
+    static uint64_t Filter(const uint8_t* cur, const uint8_t* prior, size_t cb, uint8_t* out)
+    {
+        uint64_t cost = 0;
+        size_t i = 0;
+#ifdef SVG_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = zero;
+        for (; i + 16 <= cb; i += 16) {
+            const __m128i x = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i)), TPredictor::Vector(cur + i, prior + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), x);
+            sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_min_epu8(x, _mm_sub_epi8(zero, x)), zero));
+        }
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(&cost), _mm_add_epi64(sum, _mm_srli_si128(sum, 8)));
+#endif
+        for (; i < cb; i++) {
+            const uint8_t x = static_cast<uint8_t>(cur[i] - TPredictor::Scalar(cur + i, prior + i));
+            out[i] = x;
+            cost += x < 128 ? x : 256 - x;
+        }
+        return cost;
+    }
+
+    // Picks the filter with the lowest cost, the heuristic libpng uses; out receives the filter type and the row
+    static void FilterRow(const uint8_t* cur, const uint8_t* prior, size_t cb, uint8_t* out, uint8_t* scratch)
+    {
+        typedef uint64_t (*FilterFunc)(const uint8_t*, const uint8_t*, size_t, uint8_t*);
+        static const FilterFunc filters[5] = {
+            Filter<PredictNone>, Filter<PredictSub>, Filter<PredictUp>, Filter<PredictAverage>, Filter<PredictPaeth>,
+        };
+        uint8_t* best = out + 1;
+        uint8_t* trial = scratch;
+        uint64_t bestCost = filters[0](cur, prior, cb, best);
+        uint8_t bestType = 0;
+        for (uint8_t type = 1; type < 5 && bestCost > 0; type++) {
+            const uint64_t cost = filters[type](cur, prior, cb, trial);
+            if (cost < bestCost) {
+                uint8_t* t = best;
+                best = trial;
+                trial = t;
+                bestCost = cost;
+                bestType = type;
+            }
+        }
+        if (best != out + 1) {
+            ::memcpy(out + 1, best, cb);
+        }
+        out[0] = bestType;
+    }
+
+    uint8_t* RawRow(size_t y) const
+    {
+        return this->raw + ROW_PAD + y * this->rawStride;
+    }
+
+    // Unpremultiplies and filters a batch of rows onto the end of the pending bytes
+    HRESULT FilterRows(const uint32_t* pixels, uint32_t rows, size_t stride)
+    {
+        const size_t cbLine = this->cbLine;
+        uint8_t* out = this->pending.Extend(rows * (cbLine + 1));
+        if (out == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        auto unpremultiply = [&](size_t y) {
+            Unpremultiply(pixels + y * stride, this->width, this->RawRow(y));
+        };
+        auto filter = [&](unsigned worker, size_t y) {
+            const uint8_t* prior = y == 0 ? this->prevLine : this->RawRow(y - 1);
+            FilterRow(this->RawRow(y), prior, cbLine, out + y * (cbLine + 1), this->scratch + worker * cbLine);
+        };
+        if (this->parallel) {
+            Parallel::For(rows, unpremultiply);
+            Parallel::ForWorker(rows, filter);
+        } else {
+            for (uint32_t y = 0; y < rows; y++) {
+                unpremultiply(y);
+                filter(0, y);
+            }
+        }
+        ::memcpy(this->prevLine, this->RawRow(rows - 1), cbLine);
+        return S_OK;
+    }
+
+    void Free()
+    {
+        if (this->deflating) {
+            ::deflateEnd(&this->zs);
+            this->deflating = false;
+        }
+        if (this->blocks != nullptr) {
+            for (unsigned i = 0; i < this->blockCount; i++) {
+                if (this->blocks[i].init) {
+                    ::deflateEnd(&this->blocks[i].zs);
+                }
+                ::free(this->blocks[i].out);
+            }
+            ::free(this->blocks);
+            this->blocks = nullptr;
+        }
+        if (this->prevLine != nullptr) {
+            ::free(this->prevLine - ROW_PAD);
+            this->prevLine = nullptr;
+        }
+        ::free(this->raw);
+        ::free(this->scratch);
+        ::free(this->idat);
+        this->raw = nullptr;
+        this->scratch = nullptr;
+        this->idat = nullptr;
+        this->idatUsed = 0;
+        this->blockCount = 0;
+        this->pending.Clear();
+        this->started = false;
+    }
+
+    HRESULT InitBlocks(int level, unsigned count)
+    {
+        this->blockCount = count;
+        this->blocks = static_cast<Block*>(::calloc(this->blockCount, sizeof(Block)));
+        if (this->blocks == nullptr) {
+            this->blockCount = 0;
+            return E_OUTOFMEMORY;
+        }
+        // Room for a sync flush marker on top of the worst case
+        this->outCapacity = ::compressBound(static_cast<uLong>(this->blockSize)) + 16;
+        for (unsigned i = 0; i < this->blockCount; i++) {
+            Block& block = this->blocks[i];
+            block.out = static_cast<uint8_t*>(::malloc(this->outCapacity));
+            if (block.out == nullptr) {
+                return E_OUTOFMEMORY;
+            }
+            // Negative window bits give a raw stream; the zlib header and trailer are written here
+            if (::deflateInit2(&block.zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                return E_OUTOFMEMORY;
+            }
+            block.init = true;
+        }
+        this->dictSize = 0;
+        this->adler = ::adler32(0, nullptr, 0);
+        return S_OK;
+    }
+
+    static uint8_t ZlibFlags(int level)
+    {
+        const uint8_t cmf = 0x78;
+        const uint8_t flevel = level == Z_DEFAULT_COMPRESSION || level == 6 ? 2 : level < 2 ? 0 : level < 6 ? 1 : 3;
+        const uint8_t flg = static_cast<uint8_t>(flevel << 6);
+        return static_cast<uint8_t>(flg + 31 - ((cmf << 8) + flg) % 31);
+    }
+
+    static void PackIndices(const uint8_t* src, uint32_t width, uint8_t depth, uint8_t* dst)
+    {
+        if (depth == 8) {
+            ::memcpy(dst, src, width);
+            return;
+        }
+        const unsigned perByte = 8 / depth;
+        for (uint32_t x = 0; x < width; x += perByte) {
+            unsigned byte = 0;
+            for (unsigned i = 0; i < perByte; i++) {
+                byte = (byte << depth) | (x + i < width ? src[x + i] : 0);
+            }
+            *dst++ = static_cast<uint8_t>(byte);
+        }
+    }
+
+    // Sends the pending rows on to the deflater
+    HRESULT CompressPending()
+    {
+        if (this->parallel) {
+            return this->CompressBlocks(false);
+        }
+        HRESULT hr = this->Deflate(this->pending.GetData(), this->pending.GetSize(), Z_NO_FLUSH);
+        this->pending.Clear();
+        return hr;
+    }
+
+    HRESULT Start(ByteSink* sink, uint32_t width, uint32_t height, uint8_t depth, uint8_t colourType, const PngOptions& opt)
+    {
+        this->Free();
+        if (sink == nullptr || width == 0 || height == 0 || width > INT_MAX / 4 || height > INT_MAX) {
+            return E_INVALIDARG;
+        }
+        const bool filtered = colourType == 6;
+        this->parallel = opt.IsParallel() && opt.GetBlockCount() > 1;
+        this->blockSize = opt.GetBlockSize();
+        this->cbLine = (static_cast<size_t>(width) * depth * (filtered ? 4 : 1) + 7) / 8;
+        this->rawStride = this->cbLine + ROW_PAD;
+        const size_t batchBytes = this->parallel ? this->blockSize * opt.GetBlockCount() : SERIAL_BATCH;
+        const size_t batchRows = batchBytes / (this->cbLine + 1);
+        this->batchRows = batchRows == 0 ? 1 : batchRows < height ? static_cast<uint32_t>(batchRows) : height;
+        this->idat = static_cast<uint8_t*>(::malloc(IDAT_SIZE));
+        if (this->idat == nullptr) {
+            this->Free();
+            return E_OUTOFMEMORY;
+        }
+        if (filtered) {
+            const unsigned workers = this->parallel ? Parallel::GetConcurrency() : 1;
+            uint8_t* prevLine = static_cast<uint8_t*>(::calloc(ROW_PAD + this->cbLine, 1));
+            this->prevLine = prevLine != nullptr ? prevLine + ROW_PAD : nullptr;
+            // calloc leaves the padding between rows zero for good
+            this->raw = static_cast<uint8_t*>(::calloc(ROW_PAD + this->batchRows * this->rawStride, 1));
+            this->scratch = static_cast<uint8_t*>(::malloc(workers * this->cbLine));
+            if (this->prevLine == nullptr || this->raw == nullptr || this->scratch == nullptr) {
+                this->Free();
+                return E_OUTOFMEMORY;
+            }
+        }
+        if (this->parallel) {
+            HRESULT hr = this->InitBlocks(opt.GetLevel(), opt.GetBlockCount());
+            if (FAILED(hr)) {
+                this->Free();
+                return hr;
+            }
+        } else {
+            this->zs = {};
+            if (::deflateInit(&this->zs, opt.GetLevel()) != Z_OK) {
+                this->Free();
+                return E_OUTOFMEMORY;
+            }
+            this->deflating = true;
+        }
+        this->started = true;
+        this->sink = sink;
+        this->width = width;
+        this->height = height;
+        this->depth = depth;
+        this->colourType = colourType;
+        this->row = 0;
+        static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+        const uint8_t ihdr[13] = {
+            static_cast<uint8_t>(width >> 24), static_cast<uint8_t>(width >> 16), static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width),
+            static_cast<uint8_t>(height >> 24), static_cast<uint8_t>(height >> 16), static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height),
+            depth,
+            colourType,
+            0,  // deflate
+            0,  // adaptive filtering
+            0,  // no interlace
+        };
+        HRESULT hr = this->sink->Write(signature, sizeof(signature));
+        if (SUCCEEDED(hr)) {
+            hr = this->WriteChunk("IHDR", ihdr, sizeof(ihdr));
+        }
+        return hr;
+    }
+
+    // Parallel blocks are raw deflate streams, so the zlib header is written here
+    HRESULT StartIdat(const PngOptions& opt)
+    {
+        if (!this->parallel) {
+            return S_OK;
+        }
+        const uint8_t header[2] = { 0x78, ZlibFlags(opt.GetLevel()) };
+        return this->WriteIdat(header, sizeof(header));
+    }
+
+public:
+    PngWriter()
+    {
+    }
+
+    ~PngWriter()
+    {
+        this->Free();
+    }
+
+    PngWriter(const PngWriter&) = delete;
+    PngWriter& operator =(const PngWriter&) = delete;
+
+    // Writes the signature and the header
+    HRESULT Begin(ByteSink* sink, uint32_t width, uint32_t height, const PngOptions& opt = PngOptions())
+    {
+        HRESULT hr = this->Start(sink, width, height, 8, 6, opt);
+        if (SUCCEEDED(hr)) {
+            hr = this->StartIdat(opt);
+        }
+        return hr;
+    }
+
+    // Starts an indexed-colour image; palette holds premultiplied RGBA as IndexedImage builds it
+    // Indices are packed down to 1, 2 or 4 bits when the palette is small enough.
+    HRESULT BeginIndexed(ByteSink* sink, uint32_t width, uint32_t height, const uint32_t* palette, unsigned count, const PngOptions& opt = PngOptions())
+    {
+        if (palette == nullptr || count == 0 || count > 256) {
+            return E_INVALIDARG;
+        }
+        const uint8_t depth = count <= 2 ? 1 : count <= 4 ? 2 : count <= 16 ? 4 : 8;
+        HRESULT hr = this->Start(sink, width, height, depth, 3, opt);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        uint8_t plte[256 * 3];
+        uint8_t trns[256];
+        unsigned cbTrns = 0;
+        for (unsigned i = 0; i < count; i++) {
+            const uint32_t pixel = PixelFormat::Unpremultiply(palette[i]);
+            plte[i * 3] = static_cast<uint8_t>(pixel);
+            plte[i * 3 + 1] = static_cast<uint8_t>(pixel >> 8);
+            plte[i * 3 + 2] = static_cast<uint8_t>(pixel >> 16);
+            trns[i] = static_cast<uint8_t>(pixel >> 24);
+            if (trns[i] != 255) {
+                cbTrns = i + 1;
+            }
+        }
+        hr = this->WriteChunk("PLTE", plte, count * 3);
+        if (SUCCEEDED(hr) && cbTrns > 0) {
+            hr = this->WriteChunk("tRNS", trns, cbTrns);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = this->StartIdat(opt);
+        }
+        return hr;
+    }
+
+    // stride is in pixels
+    HRESULT WriteRows(const uint32_t* pixels, uint32_t rows, size_t stride)
+    {
+        if (!this->started || this->colourType != 6 || rows > this->height - this->row) {
+            return E_FAIL;
+        }
+        while (rows > 0) {
+            const uint32_t n = rows < this->batchRows ? rows : this->batchRows;
+            HRESULT hr = this->FilterRows(pixels, n, stride);
+            if (SUCCEEDED(hr)) {
+                hr = this->CompressPending();
+            }
+            if (FAILED(hr)) {
+                return hr;
+            }
+            pixels += n * stride;
+            rows -= n;
+            this->row += n;
+        }
+        return S_OK;
+    }
+
+    // One index per byte; stride is in bytes
+    // Palette images are left unfiltered, which is what works best for them.
+    HRESULT WriteIndexedRows(const uint8_t* indices, uint32_t rows, size_t stride)
+    {
+        if (!this->started || this->colourType != 3 || rows > this->height - this->row) {
+            return E_FAIL;
+        }
+        while (rows > 0) {
+            const uint32_t n = rows < this->batchRows ? rows : this->batchRows;
+            uint8_t* out = this->pending.Extend(n * (this->cbLine + 1));
+            if (out == nullptr) {
+                return E_OUTOFMEMORY;
+            }
+            for (uint32_t y = 0; y < n; y++) {
+                *out++ = 0;
+                PackIndices(indices, this->width, this->depth, out);
+                out += this->cbLine;
+                indices += stride;
+            }
+            HRESULT hr = this->CompressPending();
+            if (FAILED(hr)) {
+                return hr;
+            }
+            rows -= n;
+            this->row += n;
+        }
+        return S_OK;
+    }
+
+    // Flushes the compressed data and writes the trailer once every row has been written
+    HRESULT End()
+    {
+        if (!this->started || this->row != this->height) {
+            return E_FAIL;
+        }
+        HRESULT hr;
+        if (this->parallel) {
+            hr = this->CompressBlocks(true);
+            if (SUCCEEDED(hr)) {
+                const uLong adler = this->adler;
+                const uint8_t trailer[4] = {
+                    static_cast<uint8_t>(adler >> 24), static_cast<uint8_t>(adler >> 16), static_cast<uint8_t>(adler >> 8), static_cast<uint8_t>(adler),
+                };
+                hr = this->WriteIdat(trailer, sizeof(trailer));
+            }
+        } else {
+            hr = this->Deflate(nullptr, 0, Z_FINISH);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = this->FlushIdat();
+        }
+        if (SUCCEEDED(hr)) {
+            hr = this->WriteChunk("IEND", nullptr, 0);
+        }
+        this->Free();
+        return hr;
+    }
+};
+
+#endif
@@ -0,0 +1,321 @@
+#ifndef SVG_QOI_H
+#define SVG_QOI_H
+
+#include "simd.h"
+#include "pixfmt.hpp"
+#include "buffer.hpp"
+#include "sink.hpp"
+
+// Streaming encoder for the Quite OK Image format (qoiformat.org)
+// QOI stores straight alpha, so every pixel is unpremultiplied on its way
+// through the encoder rather than in a separate pass. Repeated pixels are
+// compared in premultiplied form, four at a time with SSE2.
+class QoiWriter
+{
+private:
+    static const size_t STAGE_SIZE = 64 * 1024;
+    static const uint32_t MAX_RUN = 62;
+
+    enum : uint8_t
+    {
+        OP_INDEX = 0x00,
+        OP_DIFF = 0x40,
+        OP_LUMA = 0x80,
+        OP_RUN = 0xc0,
+        OP_RGB = 0xfe,
+        OP_RGBA = 0xff,
+    };
+
+    ByteSink* sink = nullptr;
+    uint8_t* stage = nullptr;
+    size_t stageUsed = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t row = 0;
+    uint32_t index[64];
+    uint32_t prev = 0;
+    uint32_t prevPremultiplied = 0;
+    uint32_t run = 0;
+
+    static uint32_t Hash(uint32_t pixel)
+    {
+        const uint32_t r = pixel & 0xff;
+        const uint32_t g = (pixel >> 8) & 0xff;
+        const uint32_t b = (pixel >> 16) & 0xff;
+        const uint32_t a = pixel >> 24;
+        return (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+    }
+
+    HRESULT Flush()
+    {
+        HRESULT hr = S_OK;
+        if (this->stageUsed > 0) {
+            hr = this->sink->Write(this->stage, this->stageUsed);
+            this->stageUsed = 0;
+        }
+        return hr;
+    }
+
+    // Extends the current run by count pixels, emitting every full run on the way
+    uint8_t* AddRun(uint8_t* out, size_t count)
+    {
+        size_t run = this->run + count;
+        while (run >= MAX_RUN) {
+            *out++ = static_cast<uint8_t>(OP_RUN | (MAX_RUN - 1));
+            run -= MAX_RUN;
+        }
+        this->run = static_cast<uint32_t>(run);
+        return out;
+    }
+
+    uint8_t* EncodePixel(uint8_t* out, uint32_t pixel)
+    {
+        if (this->run > 0) {
+            *out++ = static_cast<uint8_t>(OP_RUN | (this->run - 1));
+            this->run = 0;
+        }
+        const uint32_t hash = Hash(pixel);
+        if (this->index[hash] == pixel) {
+            *out++ = static_cast<uint8_t>(OP_INDEX | hash);
+        } else {
+            this->index[hash] = pixel;
+            const uint32_t prev = this->prev;
+            if ((pixel >> 24) == (prev >> 24)) {
+                const int vr = static_cast<int8_t>(static_cast<uint8_t>(pixel - prev));
+                const int vg = static_cast<int8_t>(static_cast<uint8_t>((pixel >> 8) - (prev >> 8)));
+                const int vb = static_cast<int8_t>(static_cast<uint8_t>((pixel >> 16) - (prev >> 16)));
+                const int vgr = vr - vg;
+                const int vgb = vb - vg;
+                if (vr >= -2 && vr <= 1 && vg >= -2 && vg <= 1 && vb >= -2 && vb <= 1) {
+                    *out++ = static_cast<uint8_t>(OP_DIFF | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                } else if (vgr >= -8 && vgr <= 7 && vg >= -32 && vg <= 31 && vgb >= -8 && vgb <= 7) {
+                    *out++ = static_cast<uint8_t>(OP_LUMA | (vg + 32));
+                    *out++ = static_cast<uint8_t>(((vgr + 8) << 4) | (vgb + 8));
+                } else {
+                    *out++ = OP_RGB;
+                    *out++ = static_cast<uint8_t>(pixel);
+                    *out++ = static_cast<uint8_t>(pixel >> 8);
+                    *out++ = static_cast<uint8_t>(pixel >> 16);
+                }
+            } else {
+                *out++ = OP_RGBA;
+                ::memcpy(out, &pixel, 4);
+                out += 4;
+            }
+        }
+        this->prev = pixel;
+        return out;
+    }
+
+    uint8_t* EncodeRow(uint8_t* out, const uint32_t* src, size_t count)
+    {
+        size_t x = 0;
+        while (x < count) {
+            const uint32_t premultiplied = src[x];
+            if (premultiplied == this->prevPremultiplied) {
+                size_t same = 1;
+#ifdef SVG_SSE2
+                const __m128i v = _mm_set1_epi32(static_cast<int>(premultiplied));
+                while (x + same + 4 <= count && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + same)), v)) == 0xffff) {
+                    same += 4;
+                }
+#endif
+                while (x + same < count && src[x + same] == premultiplied) {
+                    same++;
+                }
+                out = this->AddRun(out, same);
+                x += same;
+                continue;
+            }
+            this->prevPremultiplied = premultiplied;
+            const uint32_t pixel = PixelFormat::Unpremultiply(premultiplied);
+            if (pixel == this->prev) {
+                out = this->AddRun(out, 1);
+            } else {
+                out = this->EncodePixel(out, pixel);
+            }
+            x++;
+        }
+        return out;
+    }
+
+public:
+    QoiWriter()
+    {
+    }
+
+    ~QoiWriter()
+    {
+        ::free(this->stage);
+    }
+
+    QoiWriter(const QoiWriter&) = delete;
+    QoiWriter& operator =(const QoiWriter&) = delete;
+
+    HRESULT Begin(ByteSink* sink, uint32_t width, uint32_t height)
+    {
+        ::free(this->stage);
+        this->stage = nullptr;
+        this->stageUsed = 0;
+        if (sink == nullptr || width == 0 || height == 0 || width > INT_MAX / 5) {
+            return E_INVALIDARG;
+        }
+        // Room for one row at five bytes per pixel past the flush threshold
+        this->stage = static_cast<uint8_t*>(::malloc(STAGE_SIZE + static_cast<size_t>(width) * 5));
+        if (this->stage == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        this->sink = sink;
+        this->width = width;
+        this->height = height;
+        this->row = 0;
+        ::memset(this->index, 0, sizeof(this->index));
+        // Opaque black, which is its own premultiplied form
+        this->prev = 0xff000000;
+        this->prevPremultiplied = 0xff000000;
+        this->run = 0;
+        const uint8_t header[14] = {
+            'q', 'o', 'i', 'f',
+            static_cast<uint8_t>(width >> 24), static_cast<uint8_t>(width >> 16), static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width),
+            static_cast<uint8_t>(height >> 24), static_cast<uint8_t>(height >> 16), static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height),
+            4,  // RGBA
+            0,  // sRGB with linear alpha
+        };
+        return this->sink->Write(header, sizeof(header));
+    }
+
+    // stride is in pixels
+    HRESULT WriteRows(const uint32_t* pixels, uint32_t rows, size_t stride)
+    {
+        if (this->stage == nullptr || rows > this->height - this->row) {
+            return E_FAIL;
+        }
+        for (uint32_t y = 0; y < rows; y++) {
+            uint8_t* out = this->EncodeRow(this->stage + this->stageUsed, pixels, this->width);
+            this->stageUsed = out - this->stage;
+            if (this->stageUsed >= STAGE_SIZE) {
+                HRESULT hr = this->Flush();
+                if (FAILED(hr)) {
+                    return hr;
+                }
+            }
+            pixels += stride;
+            this->row++;
+        }
+        return S_OK;
+    }
+
+    HRESULT End()
+    {
+        if (this->stage == nullptr || this->row != this->height) {
+            return E_FAIL;
+        }
+        if (this->run > 0) {
+            this->stage[this->stageUsed++] = static_cast<uint8_t>(OP_RUN | (this->run - 1));
+            this->run = 0;
+        }
+        static const uint8_t padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+        HRESULT hr = this->Flush();
+        if (SUCCEEDED(hr)) {
+            hr = this->sink->Write(padding, sizeof(padding));
+        }
+        ::free(this->stage);
+        this->stage = nullptr;
+        return hr;
+    }
+};
+
+
+// Decodes QOI into straight RGBA, four bytes per pixel
+class QoiReader
+{
+private:
+    // Same cap as the reference decoder
+    static const uint32_t MAX_PIXELS = 400000000;
+
+    static uint32_t Hash(uint32_t pixel)
+    {
+        return ((pixel & 0xff) * 3 + ((pixel >> 8) & 0xff) * 5 + ((pixel >> 16) & 0xff) * 7 + (pixel >> 24) * 11) & 63;
+    }
+
+public:
+    QoiReader() = delete;
+    ~QoiReader() = delete;
+
+    static HRESULT Decode(const void* data, size_t cb, uint32_t* pwidth, uint32_t* pheight, ByteBuffer* pixels)
+    {
+        *pwidth = *pheight = 0;
+        const uint8_t* src = static_cast<const uint8_t*>(data);
+        if (cb < 14 + 8 || ::memcmp(src, "qoif", 4) != 0) {
+            return E_INVALIDARG;
+        }
+        const uint32_t width = (src[4] << 24) | (src[5] << 16) | (src[6] << 8) | src[7];
+        const uint32_t height = (src[8] << 24) | (src[9] << 16) | (src[10] << 8) | src[11];
+        if (width == 0 || height == 0 || height >= MAX_PIXELS / width || src[12] < 3 || src[12] > 4) {
+            return E_INVALIDARG;
+        }
+        const size_t count = static_cast<size_t>(width) * height;
+        pixels->Clear();
+        uint8_t* out = pixels->Extend(count * 4);
+        if (out == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        uint32_t index[64] = {};
+        uint32_t pixel = 0xff000000;
+        const uint8_t* p = src + 14;
+        const uint8_t* end = src + cb - 8;
+        for (size_t i = 0; i < count; ) {
+            if (p >= end) {
+                return E_INVALIDARG;
+            }
+            const uint8_t op = *p++;
+            if (op == 0xfe || op == 0xff) {
+                const size_t n = op == 0xff ? 4 : 3;
+                if (static_cast<size_t>(end - p) < n) {
+                    return E_INVALIDARG;
+                }
+                pixel = (pixel & 0xff000000) | p[0] | (p[1] << 8) | (p[2] << 16);
+                if (n == 4) {
+                    pixel = (pixel & 0xffffff) | (static_cast<uint32_t>(p[3]) << 24);
+                }
+                p += n;
+            } else if ((op & 0xc0) == 0x00) {
+                pixel = index[op];
+            } else if ((op & 0xc0) == 0x40) {
+                const uint32_t r = (pixel + ((op >> 4) & 3) - 2) & 0xff;
+                const uint32_t g = ((pixel >> 8) + ((op >> 2) & 3) - 2) & 0xff;
+                const uint32_t b = ((pixel >> 16) + (op & 3) - 2) & 0xff;
+                pixel = (pixel & 0xff000000) | r | (g << 8) | (b << 16);
+            } else if ((op & 0xc0) == 0x80) {
+                if (p >= end) {
+                    return E_INVALIDARG;
+                }
+                const int vg = (op & 0x3f) - 32;
+                const int vr = vg + ((*p >> 4) & 0x0f) - 8;
+                const int vb = vg + (*p & 0x0f) - 8;
+                p++;
+                const uint32_t r = (pixel + vr) & 0xff;
+                const uint32_t g = ((pixel >> 8) + vg) & 0xff;
+                const uint32_t b = ((pixel >> 16) + vb) & 0xff;
+                pixel = (pixel & 0xff000000) | r | (g << 8) | (b << 16);
+            } else {
+                size_t run = (op & 0x3f) + 1;
+                if (run > count - i) {
+                    return E_INVALIDARG;
+                }
+                for (; run > 0; run--, i++) {
+                    ::memcpy(out + i * 4, &pixel, 4);
+                }
+                continue;
+            }
+            index[Hash(pixel)] = pixel;
+            ::memcpy(out + i * 4, &pixel, 4);
+            i++;
+        }
+        *pwidth = width;
+        *pheight = height;
+        return S_OK;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef SVG_QUALITY_H
+#define SVG_QUALITY_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "complexity.hpp"
+
+enum RenderQuality
+{
+    // optimizeSpeed for shapes, text and images
+    RenderQualitySpeed,
+    // geometricPrecision, optimizeLegibility and optimizeQuality
+    RenderQualityPrecise,
+};
+
+
+// Chooses the rendering modes for each request, before the document is parsed with them
+// Small outputs gain little from precise modes, so they always get speed. Larger ones
+// get precise modes while the render time predicted from similar documents stays within
+// the budget. Documents are grouped by their structure, the power of two of their element
+// count and a band of their filter primitive count, which the sanitiser gathers in its pass.
+// Each group keeps a running estimate of the time per pixel for either quality, as a
+// group's precise renders are what the budget is about and its speed renders are what it
+// falls back on. All members may be called from several threads; a lost update only costs
+// a slightly stale estimate.
+class RenderQualityPolicy
+{
+private:
+    static const unsigned ELEMENT_CLASSES = 20;
+    // No filter, 1-2, 3-8, 9-32 and more primitives; each one touches every pixel of its region
+    static const unsigned FILTER_CLASSES = 5;
+    static const unsigned CLASS_COUNT = ELEMENT_CLASSES * FILTER_CLASSES;
+
+    uint32_t smallSize = 48;
+    double budget = 0.1;
+    // Seconds per pixel by quality and group, zero until measured
+    std::atomic<float> cost[2][CLASS_COUNT];
+    // Precise over speed cost, over the groups measured both ways; zero until measured
+    std::atomic<float> ratio;
+
+    static unsigned Classify(const SvgComplexity& complexity)
+    {
+        unsigned elements = 0;
+        for (uint32_t n = complexity.elements; n > 1 && elements < ELEMENT_CLASSES - 1; n >>= 1) {
+            elements++;
+        }
+        const uint32_t primitives = complexity.filterPrimitives;
+        const unsigned filters = primitives == 0 ? 0 : primitives <= 2 ? 1 : primitives <= 8 ? 2 : primitives <= 32 ? 3 : 4;
+        return filters * ELEMENT_CLASSES + elements;
+    }
+
+    static void Blend(std::atomic<float>& estimate, double measured)
+    {
+        const double previous = estimate.load(std::memory_order_relaxed);
+        // Half weight to the latest measurement, so one odd document cannot pin a group
+        estimate.store(static_cast<float>(previous > 0 ? (previous + measured) / 2 : measured), std::memory_order_relaxed);
+    }
+
+public:
+    RenderQualityPolicy()
+        : ratio(0)
+    {
+        for (unsigned i = 0; i < CLASS_COUNT; i++) {
+            this->cost[RenderQualitySpeed][i].store(0, std::memory_order_relaxed);
+            this->cost[RenderQualityPrecise][i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    RenderQualityPolicy(const RenderQualityPolicy&) = delete;
+    RenderQualityPolicy& operator =(const RenderQualityPolicy&) = delete;
+
+    // Outputs whose longer side is at most this many pixels are rendered for speed
+    RenderQualityPolicy& SetSmallSize(uint32_t size)
+    {
+        this->smallSize = size;
+        return *this;
+    }
+
+    // Longest precise render, in seconds, before larger outputs fall back to speed
+    RenderQualityPolicy& SetBudget(double seconds)
+    {
+        this->budget = seconds;
+        return *this;
+    }
+
+    // Predicted seconds per pixel of a document like complexity at the quality, zero when
+    // nothing like it has been rendered; a precise one that has only been rendered for speed is
+    // predicted from the ratio measured over other groups
+    double Estimate(const SvgComplexity& complexity, RenderQuality quality) const
+    {
+        const unsigned group = Classify(complexity);
+        const double cost = this->cost[quality][group].load(std::memory_order_relaxed);
+        if (cost > 0 || quality == RenderQualitySpeed) {
+            return cost;
+        }
+        return this->cost[RenderQualitySpeed][group].load(std::memory_order_relaxed) * this->ratio.load(std::memory_order_relaxed);
+    }
+
+    // size is the longer side of the output and complexity the document's structure
+    RenderQuality Choose(uint32_t size, uint64_t pixels, const SvgComplexity& complexity) const
+    {
+        if (size <= this->smallSize) {
+            return RenderQualitySpeed;
+        }
+        if (this->Estimate(complexity, RenderQualityPrecise) * pixels > this->budget) {
+            return RenderQualitySpeed;
+        }
+        return RenderQualityPrecise;
+    }
+
+    // Takes renders of either quality, timed outs included as they tell a group is slow
+    // A speed render also pulls the group's precise estimate towards what the ratio predicts,
+    // so a group pinned over the budget by a few slow documents is tried at precise quality
+    // again once its speed renders show it has become cheap.
+    void Record(const SvgComplexity& complexity, RenderQuality quality, uint64_t pixels, double seconds)
+    {
+        if (pixels == 0) {
+            return;
+        }
+        const unsigned group = Classify(complexity);
+        const double measured = seconds / pixels;
+        Blend(this->cost[quality][group], measured);
+        const double speed = this->cost[RenderQualitySpeed][group].load(std::memory_order_relaxed);
+        const double precise = this->cost[RenderQualityPrecise][group].load(std::memory_order_relaxed);
+        if (speed > 0 && precise > 0) {
+            const double ratio = this->ratio.load(std::memory_order_relaxed);
+            if (quality == RenderQualityPrecise) {
+                Blend(this->ratio, precise / speed);
+            } else if (ratio > 0) {
+                Blend(this->cost[RenderQualityPrecise][group], speed * ratio);
+            }
+        }
+    }
+
+    // One policy per process, so measurements carry over between requests
+    static RenderQualityPolicy& GetShared()
+    {
+        static RenderQualityPolicy shared;
+        return shared;
+    }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef SVG_RAWIMAGE_H
+#define SVG_RAWIMAGE_H
+
+#include "sink.hpp"
+
+// Uncompressed premultiplied RGBA exactly as resvg renders it, behind a 16-byte header:
+//   "SVGR", width, height, format (all little-endian uint32_t)
+// followed by width * height pixels, top-down with no padding.
+// Readers can map the file and use the pixels in place. The pixels are bytes in R, G, B, A order
+// on any host; the header is written a byte at a time, so it is little-endian on any host too.
+class RawImageWriter
+{
+private:
+    ByteSink* sink = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t row = 0;
+
+    static void PutU32(uint8_t* dst, uint32_t value)
+    {
+        dst[0] = static_cast<uint8_t>(value);
+        dst[1] = static_cast<uint8_t>(value >> 8);
+        dst[2] = static_cast<uint8_t>(value >> 16);
+        dst[3] = static_cast<uint8_t>(value >> 24);
+    }
+
+public:
+    static const uint32_t MAGIC = 0x52475653;  // "SVGR"
+    static const uint32_t FORMAT_PRGBA = 1;
+    static const size_t HEADER_SIZE = 16;
+
+    HRESULT Begin(ByteSink* sink, uint32_t width, uint32_t height)
+    {
+        this->sink = nullptr;
+        if (sink == nullptr || width == 0 || height == 0 || width > INT_MAX / 4) {
+            return E_INVALIDARG;
+        }
+        this->sink = sink;
+        this->width = width;
+        this->height = height;
+        this->row = 0;
+        uint8_t header[HEADER_SIZE];
+        PutU32(header, MAGIC);
+        PutU32(header + 4, width);
+        PutU32(header + 8, height);
+        PutU32(header + 12, FORMAT_PRGBA);
+        return this->sink->Write(header, sizeof(header));
+    }
+
+    // stride is in pixels
+    HRESULT WriteRows(const uint32_t* pixels, uint32_t rows, size_t stride)
+    {
+        if (this->sink == nullptr || rows > this->height - this->row) {
+            return E_FAIL;
+        }
+        const size_t cbLine = static_cast<size_t>(this->width) * 4;
+        HRESULT hr = S_OK;
+        if (stride == this->width) {
+            hr = this->sink->Write(pixels, cbLine * rows);
+        } else {
+            for (uint32_t y = 0; y < rows && SUCCEEDED(hr); y++) {
+                hr = this->sink->Write(pixels, cbLine);
+                pixels += stride;
+            }
+        }
+        if (SUCCEEDED(hr)) {
+            this->row += rows;
+        }
+        return hr;
+    }
+
+    HRESULT End()
+    {
+        if (this->sink == nullptr || this->row != this->height) {
+            return E_FAIL;
+        }
+        this->sink = nullptr;
+        return S_OK;
+    }
+};
+
+
+class RawImageReader
+{
+private:
+    static uint32_t GetU32(const uint8_t* src)
+    {
+        return src[0] | (src[1] << 8) | (src[2] << 16) | (static_cast<uint32_t>(src[3]) << 24);
+    }
+
+public:
+    RawImageReader() = delete;
+    ~RawImageReader() = delete;
+
+    // Points *ppixels into data; nothing is copied
+    static HRESULT Parse(const void* data, size_t cb, uint32_t* pwidth, uint32_t* pheight, const uint32_t** ppixels)
+    {
+        *pwidth = *pheight = 0;
+        *ppixels = nullptr;
+        if (cb < RawImageWriter::HEADER_SIZE) {
+            return E_INVALIDARG;
+        }
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        const uint32_t header[4] = { GetU32(bytes), GetU32(bytes + 4), GetU32(bytes + 8), GetU32(bytes + 12) };
+        if (header[0] != RawImageWriter::MAGIC || header[3] != RawImageWriter::FORMAT_PRGBA || header[1] == 0 || header[2] == 0) {
+            return E_INVALIDARG;
+        }
+        const size_t cbPixels = (cb - RawImageWriter::HEADER_SIZE) / 4;
+        if (header[1] > cbPixels / header[2]) {
+            return E_INVALIDARG;
+        }
+        *pwidth = header[1];
+        *pheight = header[2];
+        *ppixels = reinterpret_cast<const uint32_t*>(static_cast<const uint8_t*>(data) + RawImageWriter::HEADER_SIZE);
+        return S_OK;
+    }
+};
+
+#endif
@@ -1,8 +1,16 @@
 #ifndef SVG_RENDER_H
 #define SVG_RENDER_H
 
+#include <chrono>
+#ifdef _WIN32
 #include <wincodec.h>
 #include "bitmap.hpp"
+#endif
+#include "resample.hpp"
+#include "pixfmt.hpp"
+#include "convert.hpp"
+#include "parallel.hpp"
+#include "cancel.hpp"
 
 
 template <class T>
@@ -22,6 +30,13 @@ protected:
     FitToType type = FitToScale;
     uint32_t width = 0;
     uint32_t height = 0;
+    resvg_transform transform = { 1, 0, 0, 1, 0, 0 };
+    bool clip = false;
+    int clipX = 0;
+    int clipY = 0;
+    uint32_t clipWidth = 0;
+    uint32_t clipHeight = 0;
+    const CancelToken* cancel = nullptr;
 
 public:
     RenderOptionsT()
@@ -57,12 +72,98 @@ public:
         this->type = FitToCover;
         return *this;
     }
+
+    // Applied on top of the fitting, in output pixels
+    RenderOptionsT<T>& SetTransform(const resvg_transform& transform)
+    {
+        this->transform = transform;
+        return *this;
+    }
+
+    // Renders only the given region of the fitted image
+    RenderOptionsT<T>& SetClip(int x, int y, uint32_t width, uint32_t height)
+    {
+        if (width == 0 || height == 0 || height > (UINT_MAX / 4 / width)) {
+            width = 0;
+            height = 0;
+        }
+        this->clip = true;
+        this->clipX = x;
+        this->clipY = y;
+        this->clipWidth = width;
+        this->clipHeight = height;
+        return *this;
+    }
+
+    RenderOptionsT<T>& ResetClip()
+    {
+        this->clip = false;
+        return *this;
+    }
+
+    // Lets the token stop the render between stripes and between jobs of a batch
+    // The token must outlive the render.
+    RenderOptionsT<T>& SetCancelToken(const CancelToken* token)
+    {
+        this->cancel = token;
+        return *this;
+    }
 };
 
 
 class SvgRenderTarget
 {
 private:
+    static const size_t STRIPE_BYTES = 4 << 20;
+    static const uint32_t MIN_STRIPE_ROWS = 64;
+    static const uint32_t STRIPE_OVERLAP = 8;
+    // Smaller stripes when a cancel token is set, so it is looked at more often: about an eighth
+    // of the image, which splits a thumbnail that would fit in one stripe by bytes, and no more
+    // bytes than the cap. Each stripe renders its overlap rows again, so none is shorter than the
+    // floor, which keeps that under a quarter of the stripe.
+    static const size_t CANCEL_STRIPE_BYTES = 1 << 20;
+    static const uint32_t CANCEL_STRIPES = 8;
+    static const uint32_t CANCEL_MIN_STRIPE_ROWS = 64;
+    // Conversions of at least this many pixels are split into bands run on the task scheduler
+    static const size_t PARALLEL_PIXELS = 1 << 20;
+    static const uint32_t BAND_ROWS = 64;
+
+    // Calls fn(worker, y, rows) for bands of rows covering the image; see Parallel::ForWorker
+    // The token is looked at before each band, and bands not started when it fires are skipped.
+    template <class TFunc>
+    static HRESULT ForBands(uint32_t width, uint32_t height, const CancelToken* cancel, const TFunc& fn)
+    {
+        const uint32_t count = (height + BAND_ROWS - 1) / BAND_ROWS;
+        if (static_cast<size_t>(width) * height < PARALLEL_PIXELS) {
+            if (cancel == nullptr) {
+                fn(0U, 0U, height);
+                return S_OK;
+            }
+            for (uint32_t y = 0; y < height; y += BAND_ROWS) {
+                const HRESULT hr = cancel->Check();
+                if (FAILED(hr)) {
+                    return hr;
+                }
+                fn(0U, y, BAND_ROWS < height - y ? BAND_ROWS : height - y);
+            }
+            return S_OK;
+        }
+        std::atomic<HRESULT> result(S_OK);
+        Parallel::ForWorker(count, [&](unsigned worker, size_t i) {
+            HRESULT hr = result.load(std::memory_order_relaxed);
+            if (SUCCEEDED(hr)) {
+                hr = CancelToken::Check(cancel);
+            }
+            if (FAILED(hr)) {
+                result.store(hr, std::memory_order_relaxed);
+                return;
+            }
+            const uint32_t y = static_cast<uint32_t>(i) * BAND_ROWS;
+            fn(worker, y, BAND_ROWS < height - y ? BAND_ROWS : height - y);
+        });
+        return result.load(std::memory_order_relaxed);
+    }
+
     uint32_t width = 0;
     uint32_t height = 0;
     uint32_t* pixmap = nullptr;
@@ -98,22 +199,17 @@ private:
         y = t;
     }
 
-    template <typename T>
-    static inline BYTE Clamp(T x)
-    {
-        return x < 0 ? 0 : (x > 255 ? 255 : static_cast<BYTE>(x));
-    }
-
 public:
     class RenderOptions : public RenderOptionsT<SvgRenderTarget::RenderOptions>
     {
     private:
         friend class SvgRenderTarget;
 
-        void ToResvgParams(const resvg_render_tree* tree, resvg_fit_to* fitTo) const
+        // size is null when there is no tree to fit
+        void ToResvgParams(const resvg_size* size, resvg_fit_to* fitTo) const
         {
             if (this->type == FitToScale) {
-                if (tree != nullptr && this->scale > 0 && this->scale != 1) {
+                if (size != nullptr && this->scale > 0 && this->scale != 1) {
                     fitTo->type = RESVG_FIT_TO_TYPE_ZOOM;
                     fitTo->value = this->scale;
                 } else {
@@ -121,17 +217,16 @@ public:
                     fitTo->value = 1;
                 }
             } else {
-                if (tree == nullptr || this->width == 0 || this->height == 0) {
+                if (size == nullptr || this->width == 0 || this->height == 0) {
                     fitTo->type = RESVG_FIT_TO_TYPE_ORIGINAL;
                     fitTo->value = 1;
                 } else {
-                    resvg_size size = ::resvg_get_image_size(tree);
-                    if (size.width == 0 || size.height == 0) {
+                    if (size->width == 0 || size->height == 0) {
                         fitTo->type = RESVG_FIT_TO_TYPE_ORIGINAL;
                         fitTo->value = 1;
                     } else {
-                        const double scaleX = static_cast<double>(this->width) / size.width;
-                        const double scaleY = static_cast<double>(this->height) / size.height;
+                        const double scaleX = static_cast<double>(this->width) / size->width;
+                        const double scaleY = static_cast<double>(this->height) / size->height;
                         if (this->type == FitToContain) {
                             if (scaleX > scaleY) {
                                 fitTo->type = RESVG_FIT_TO_TYPE_HEIGHT;
@@ -155,7 +250,25 @@ public:
         }
 
     public:
-        HRESULT CalcImageSize(const resvg_render_tree* tree, uint32_t* width, uint32_t* height, resvg_fit_to* fitTo = nullptr) const
+        HRESULT CalcImageSize(const SvgTree& tree, uint32_t* width, uint32_t* height, resvg_fit_to* fitTo = nullptr) const
+        {
+            resvg_size size = tree.GetSize();
+            return this->CalcFittedSize(size, width, height, fitTo);
+        }
+
+        HRESULT RenderTo(const SvgTree& tree, uint32_t width, uint32_t height, uint32_t* pixmap) const
+        {
+            return SvgRenderTarget::RenderTo(tree, *this, width, height, pixmap);
+        }
+
+        template <class TCallback>
+        HRESULT RenderStripes(const SvgTree& tree, uint32_t stripeRows, uint32_t overlap, const TCallback& callback) const
+        {
+            return SvgRenderTarget::RenderStripes(tree, *this, stripeRows, overlap, callback);
+        }
+
+        // Same as CalcImageSize, for content of the given size, e.g. a node's bounding box
+        HRESULT CalcFittedSize(const resvg_size& size, uint32_t* width, uint32_t* height, resvg_fit_to* fitTo = nullptr) const
         {
             *width = 0;
             *height = 0;
@@ -163,8 +276,7 @@ public:
             if (fitTo == nullptr) {
                 fitTo = &fitTo_;
             }
-            this->ToResvgParams(tree, fitTo);
-            resvg_size size = ::resvg_get_image_size(tree);
+            this->ToResvgParams(&size, fitTo);
             if (size.width <= 0 || size.height <= 0) {
                 return E_FAIL;
             }
@@ -189,6 +301,157 @@ public:
         }
     };
 
+private:
+    // Works out the output size and resvg parameters for the whole image, or only the element with the given id
+    static HRESULT Prepare(const SvgTree& tree, const char* id, const RenderOptions& opt, uint32_t* width, uint32_t* height, resvg_fit_to* fitTo, resvg_transform* tx)
+    {
+        HRESULT hr;
+        *tx = opt.transform;
+        if (id == nullptr) {
+            hr = opt.CalcImageSize(tree, width, height, fitTo);
+        } else {
+            resvg_rect bbox = {};
+            hr = tree.GetNodeBoundingBox(id, &bbox) ? S_OK : HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+            if (SUCCEEDED(hr)) {
+                resvg_size size = { bbox.width, bbox.height };
+                hr = opt.CalcFittedSize(size, width, height, fitTo);
+            }
+        }
+        if (SUCCEEDED(hr) && opt.clip) {
+            *width = opt.clipWidth;
+            *height = opt.clipHeight;
+            tx->e -= opt.clipX;
+            tx->f -= opt.clipY;
+        }
+        return hr;
+    }
+
+    static HRESULT Draw(const SvgTree& tree, const char* id, const resvg_fit_to& fitTo, const resvg_transform& tx, uint32_t width, uint32_t height, char* pixmap)
+    {
+        if (id == nullptr) {
+            tree.Render(fitTo, tx, width, height, pixmap);
+            return S_OK;
+        }
+        return tree.RenderNode(id, fitTo, tx, width, height, pixmap) ? S_OK : E_FAIL;
+    }
+
+    static uint32_t GetCancelStripeRows(uint32_t width, uint32_t height)
+    {
+        uint32_t stripeRows = (height + CANCEL_STRIPES - 1) / CANCEL_STRIPES;
+        const size_t byBytes = CANCEL_STRIPE_BYTES / (static_cast<size_t>(width) * 4);
+        if (stripeRows > byBytes) {
+            stripeRows = static_cast<uint32_t>(byBytes);
+        }
+        return stripeRows < CANCEL_MIN_STRIPE_ROWS ? CANCEL_MIN_STRIPE_ROWS : stripeRows;
+    }
+
+    // With a cancel token the whole image is rendered in stripes, and a render that runs out of
+    // time still hands over the stripes it finished, the rest left clear, as a fallback frame
+    static HRESULT RenderContent(const SvgTree& tree, const char* id, const RenderOptions& opt, SvgRenderTarget* target)
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        char* pixmap = nullptr;
+        resvg_fit_to fitTo = {};
+        resvg_transform tx = {};
+        SvgRenderTarget self;
+        HRESULT hr = CancelToken::Check(opt.cancel);
+        if (SUCCEEDED(hr)) {
+            hr = Prepare(tree, id, opt, &width, &height, &fitTo, &tx);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = self.Allocate(width, height, &pixmap);
+        }
+        if (FAILED(hr)) {
+            return hr;
+        }
+        if (opt.cancel != nullptr && id == nullptr) {
+            hr = RenderStripes(tree, opt, GetCancelStripeRows(width, height), STRIPE_OVERLAP, [&](const uint32_t* pixels, uint32_t, uint32_t, uint32_t y, uint32_t rows) {
+                ::memcpy(self.pixmap + static_cast<size_t>(y) * width, pixels, static_cast<size_t>(width) * 4 * rows);
+                return S_OK;
+            });
+            if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT)) {
+                *target = std::move(self);
+            }
+        } else {
+            hr = Draw(tree, id, fitTo, tx, width, height, pixmap);
+        }
+        if (SUCCEEDED(hr)) {
+            *target = std::move(self);
+        }
+        return hr;
+    }
+
+public:
+    // Decides, level by level, whether a mipmap is rendered or downsampled from a larger level
+    class MipmapPolicy
+    {
+    private:
+        uint32_t crispSize = 32;
+        ResampleFilter filter = ResampleBox;
+        const CancelToken* cancel = nullptr;
+        // seconds per pixel, refined by measurements as levels are produced
+        double renderCost = 0;
+        double resampleCost = 2e-9;
+
+    public:
+        MipmapPolicy()
+        {
+        }
+
+        // Levels at or below this size are always rendered, as downsampling blurs thin strokes
+        MipmapPolicy& SetCrispSize(uint32_t size)
+        {
+            this->crispSize = size;
+            return *this;
+        }
+
+        MipmapPolicy& SetFilter(ResampleFilter filter)
+        {
+            this->filter = filter;
+            return *this;
+        }
+
+        ResampleFilter GetFilter() const
+        {
+            return this->filter;
+        }
+
+        // Applies to every rendered level; levels not started when it fires are skipped
+        MipmapPolicy& SetCancelToken(const CancelToken* cancel)
+        {
+            this->cancel = cancel;
+            return *this;
+        }
+
+        const CancelToken* GetCancelToken() const
+        {
+            return this->cancel;
+        }
+
+        void RecordRender(uint64_t pixels, double seconds)
+        {
+            if (pixels > 0) {
+                this->renderCost = seconds / pixels;
+            }
+        }
+
+        void RecordResample(uint64_t sourcePixels, double seconds)
+        {
+            if (sourcePixels > 0) {
+                this->resampleCost = seconds / sourcePixels;
+            }
+        }
+
+        bool ShouldRender(uint32_t size, uint64_t pixels, uint64_t sourcePixels) const
+        {
+            if (size <= this->crispSize) {
+                return true;
+            }
+            return this->renderCost * pixels <= this->resampleCost * sourcePixels;
+        }
+    };
+
     SvgRenderTarget()
     {
     }
@@ -198,25 +461,356 @@ public:
         ::free(this->pixmap);
     }
 
-    static HRESULT Render(const resvg_render_tree* tree, const RenderOptions& opt, SvgRenderTarget* target)
+    static HRESULT Render(const SvgTree& tree, const RenderOptions& opt, SvgRenderTarget* target)
+    {
+        return RenderContent(tree, nullptr, opt, target);
+    }
+
+    // Renders into a caller supplied, cleared pixmap of width * height pixels instead of allocating one
+    // Content beyond the given size is cut off; use CalcImageSize to find the full size.
+    static HRESULT RenderTo(const SvgTree& tree, const RenderOptions& opt, uint32_t width, uint32_t height, uint32_t* pixmap)
+    {
+        uint32_t fullWidth = 0;
+        uint32_t fullHeight = 0;
+        resvg_fit_to fitTo = {};
+        resvg_transform tx = {};
+        if (pixmap == nullptr || width == 0 || height == 0) {
+            return E_INVALIDARG;
+        }
+        HRESULT hr = CancelToken::Check(opt.cancel);
+        if (SUCCEEDED(hr)) {
+            hr = Prepare(tree, nullptr, opt, &fullWidth, &fullHeight, &fitTo, &tx);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = Draw(tree, nullptr, fitTo, tx, width, height, reinterpret_cast<char*>(pixmap));
+        }
+        return hr;
+    }
+
+    // Renders the image top to bottom in horizontal stripes of at most stripeRows rows, zero picks
+    // about 4MB per stripe, and calls callback(pixels, width, height, y, rows) for each of them
+    // Only one stripe is held in memory, and opt's cancel token is looked at before each one.
+    // overlap rows are also rendered above and below each stripe and thrown away, since resvg
+    // clips filter regions to the canvas and blurs would otherwise show seams.
+    template <class TCallback>
+    static HRESULT RenderStripes(const SvgTree& tree, const RenderOptions& opt, uint32_t stripeRows, uint32_t overlap, const TCallback& callback)
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        resvg_fit_to fitTo = {};
+        resvg_transform tx = {};
+        HRESULT hr = Prepare(tree, nullptr, opt, &width, &height, &fitTo, &tx);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        if (width == 0 || height == 0) {
+            return E_INVALIDARG;
+        }
+        if (width > (UINT_MAX / 4) || height > INT_MAX) {
+            return E_OUTOFMEMORY;
+        }
+        const size_t cbRow = static_cast<size_t>(width) * 4;
+        if (stripeRows == 0) {
+            stripeRows = static_cast<uint32_t>(STRIPE_BYTES / cbRow);
+            if (stripeRows < MIN_STRIPE_ROWS) {
+                stripeRows = MIN_STRIPE_ROWS;
+            }
+        }
+        if (stripeRows > height) {
+            stripeRows = height;
+        }
+        if (overlap > height) {
+            overlap = height;
+        }
+        const size_t maxRows = static_cast<size_t>(stripeRows) + overlap * 2;
+        if (maxRows > SIZE_MAX / cbRow) {
+            return E_OUTOFMEMORY;
+        }
+        char* pixmap = static_cast<char*>(::malloc(maxRows * cbRow));
+        if (pixmap == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        for (uint32_t y = 0; y < height && SUCCEEDED(hr); y += stripeRows) {
+            hr = CancelToken::Check(opt.cancel);
+            if (FAILED(hr)) {
+                break;
+            }
+            const uint32_t rows = stripeRows < height - y ? stripeRows : height - y;
+            const uint32_t above = overlap < y ? overlap : y;
+            const uint32_t below = overlap < height - y - rows ? overlap : height - y - rows;
+            const uint32_t total = above + rows + below;
+            ::memset(pixmap, 0, total * cbRow);
+            resvg_transform stripeTx = tx;
+            stripeTx.f -= static_cast<double>(y - above);
+            tree.Render(fitTo, stripeTx, width, total, pixmap);
+            hr = callback(reinterpret_cast<const uint32_t*>(pixmap + above * cbRow), width, height, y, rows);
+        }
+        ::free(pixmap);
+        return hr;
+    }
+
+    // Renders a quick frame first and calls callback(preview) with it, then the full frame into target
+    // The preview is rendered at 1/previewDivisor of the resolution and scaled back up to the full
+    // size; the callback may move it away. resvg fixes the rendering modes when it parses, so both
+    // passes share the tree and the preview saves its time on pixels alone. A previewDivisor of 1
+    // or less skips the preview. The full pass goes in stripes and gives up with
+    // HRESULT_FROM_WIN32(ERROR_CANCELLED) as soon as cancelled() returns true, leaving target as it was.
+    template <class TCallback, class TCancelled>
+    static HRESULT RenderProgressive(const SvgTree& tree, const RenderOptions& opt, uint32_t previewDivisor, const TCallback& callback, const TCancelled& cancelled, SvgRenderTarget* target)
     {
         uint32_t width = 0;
         uint32_t height = 0;
-        char* pixmap = nullptr;
         resvg_fit_to fitTo = {};
+        resvg_transform tx = {};
+        HRESULT hr = Prepare(tree, nullptr, opt, &width, &height, &fitTo, &tx);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        if (previewDivisor > 1 && width >= previewDivisor && height >= previewDivisor) {
+            const uint32_t previewWidth = (width + previewDivisor - 1) / previewDivisor;
+            const uint32_t previewHeight = (height + previewDivisor - 1) / previewDivisor;
+            // Scales the output so the image maps exactly onto the smaller pixmap
+            const double scaleX = static_cast<double>(previewWidth) / width;
+            const double scaleY = static_cast<double>(previewHeight) / height;
+            resvg_transform previewTx = tx;
+            previewTx.a *= scaleX;
+            previewTx.c *= scaleX;
+            previewTx.e *= scaleX;
+            previewTx.b *= scaleY;
+            previewTx.d *= scaleY;
+            previewTx.f *= scaleY;
+            SvgRenderTarget small;
+            SvgRenderTarget preview;
+            char* pixmap = nullptr;
+            hr = small.Allocate(previewWidth, previewHeight, &pixmap);
+            if (SUCCEEDED(hr)) {
+                tree.Render(fitTo, previewTx, previewWidth, previewHeight, pixmap);
+                hr = preview.Allocate(width, height, &pixmap);
+            }
+            if (SUCCEEDED(hr)) {
+                hr = Resampler::Resample(small.pixmap, previewWidth, previewHeight, previewWidth, preview.pixmap, width, height, width);
+            }
+            if (FAILED(hr)) {
+                return hr;
+            }
+            small.Destroy();
+            callback(preview);
+        }
+        if (cancelled()) {
+            return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
         SvgRenderTarget self;
-        HRESULT hr = opt.CalcImageSize(tree, &width, &height, &fitTo);
+        char* pixmap = nullptr;
+        hr = self.Allocate(width, height, &pixmap);
+        if (SUCCEEDED(hr)) {
+            hr = RenderStripes(tree, opt, 0, STRIPE_OVERLAP, [&](const uint32_t* pixels, uint32_t, uint32_t, uint32_t y, uint32_t rows) {
+                ::memcpy(self.pixmap + static_cast<size_t>(y) * width, pixels, static_cast<size_t>(width) * 4 * rows);
+                return cancelled() ? HRESULT_FROM_WIN32(ERROR_CANCELLED) : S_OK;
+            });
+        }
+        if (SUCCEEDED(hr)) {
+            *target = std::move(self);
+        }
+        return hr;
+    }
+
+    // Renders a single element, fitted to its own bounding box
+    static HRESULT RenderNode(const SvgTree& tree, const char* id, const RenderOptions& opt, SvgRenderTarget* target)
+    {
+        if (id == nullptr) {
+            return E_INVALIDARG;
+        }
+        return RenderContent(tree, id, opt, target);
+    }
+
+    // Runs the jobs on the task scheduler; the resvg calls take turns on the tree's lock, so
+    // what overlaps is the work around them, e.g. the stripes of jobs with a cancel token.
+    // For renders that run in parallel, give each thread its own parse.
+    // targets[i] and results[i] correspond to opts[i]; returns the first failure in job order.
+    static HRESULT RenderBatch(const SvgTree& tree, const RenderOptions* opts, size_t count, SvgRenderTarget* targets, HRESULT* results)
+    {
+        HRESULT* ownResults = nullptr;
+        if (results == nullptr && count > 0) {
+            ownResults = static_cast<HRESULT*>(::calloc(count, sizeof(HRESULT)));
+            if (ownResults == nullptr) {
+                return E_OUTOFMEMORY;
+            }
+            results = ownResults;
+        }
+        Parallel::For(count, [&](size_t i) {
+            results[i] = Render(tree, opts[i], &targets[i]);
+        });
+        HRESULT hr = S_OK;
+        for (size_t i = 0; i < count && SUCCEEDED(hr); i++) {
+            hr = results[i];
+        }
+        ::free(ownResults);
+        return hr;
+    }
+
+    // Renders every element on the task scheduler, each fitted to its own bounding box; as in
+    // RenderBatch, the resvg calls take turns on the tree's lock
+    static HRESULT RenderNodes(const SvgTree& tree, const char* const* ids, size_t count, const RenderOptions& opt, SvgRenderTarget* targets, HRESULT* results)
+    {
+        HRESULT* ownResults = nullptr;
+        if (results == nullptr && count > 0) {
+            ownResults = static_cast<HRESULT*>(::calloc(count, sizeof(HRESULT)));
+            if (ownResults == nullptr) {
+                return E_OUTOFMEMORY;
+            }
+            results = ownResults;
+        }
+        Parallel::For(count, [&](size_t i) {
+            results[i] = RenderNode(tree, ids[i], opt, &targets[i]);
+        });
+        HRESULT hr = S_OK;
+        for (size_t i = 0; i < count && SUCCEEDED(hr); i++) {
+            hr = results[i];
+        }
+        ::free(ownResults);
+        return hr;
+    }
+
+private:
+    // Renders a square level, or resamples it from the largest when there is one and the
+    // policy prefers that
+    static HRESULT RenderLevel(const SvgTree& tree, uint32_t size, const SvgRenderTarget* largest, SvgRenderTarget* target, MipmapPolicy* policy)
+    {
+        typedef std::chrono::steady_clock Clock;
+        RenderOptions opt;
+        opt.SetCanvasSize(size, size).SetToContain().SetCancelToken(policy->GetCancelToken());
+        uint32_t width = 0;
+        uint32_t height = 0;
+        HRESULT hr = opt.CalcImageSize(tree, &width, &height);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        const uint64_t pixels = static_cast<uint64_t>(width) * height;
+        const uint64_t sourcePixels = largest != nullptr ? static_cast<uint64_t>(largest->width) * largest->height : 0;
+        const Clock::time_point start = Clock::now();
+        if (largest == nullptr || policy->ShouldRender(size, pixels, sourcePixels)) {
+            hr = Render(tree, opt, target);
+            if (SUCCEEDED(hr)) {
+                policy->RecordRender(pixels, std::chrono::duration<double>(Clock::now() - start).count());
+            }
+            return hr;
+        }
+        SvgRenderTarget self;
+        char* pixmap = nullptr;
+        hr = CancelToken::Check(policy->GetCancelToken());
         if (SUCCEEDED(hr)) {
             hr = self.Allocate(width, height, &pixmap);
         }
         if (SUCCEEDED(hr)) {
-            resvg_transform tx = { 1, 0, 0, 1, 0, 0 };
-            ::resvg_render(tree, fitTo, tx, width, height, pixmap);
+            hr = Resampler::Resample(largest->pixmap, largest->width, largest->height, largest->width,
+                self.pixmap, width, height, width, policy->GetFilter());
+        }
+        if (SUCCEEDED(hr)) {
+            policy->RecordResample(sourcePixels, std::chrono::duration<double>(Clock::now() - start).count());
             *target = std::move(self);
         }
         return hr;
     }
 
+public:
+    // Renders square thumbnails of every size, rendering the largest only once and deriving the
+    // others from it unless the policy says otherwise. Every derived level comes straight from
+    // that render, so resampling errors do not add up level by level.
+    static HRESULT RenderMipmaps(const SvgTree& tree, const uint32_t* sizes, size_t count, SvgRenderTarget* targets, MipmapPolicy* policy)
+    {
+        if (count == 0) {
+            return S_OK;
+        }
+        size_t* order = static_cast<size_t*>(::calloc(count, sizeof(size_t)));
+        if (order == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t j = i;
+            while (j > 0 && sizes[order[j - 1]] < sizes[i]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+        MipmapPolicy defaultPolicy;
+        if (policy == nullptr) {
+            policy = &defaultPolicy;
+        }
+        const SvgRenderTarget* largest = nullptr;
+        HRESULT hr = S_OK;
+        for (size_t i = 0; i < count && SUCCEEDED(hr); i++) {
+            const size_t index = order[i];
+            hr = RenderLevel(tree, sizes[index], largest, &targets[index], policy);
+            if (largest == nullptr) {
+                largest = &targets[index];
+            }
+        }
+        ::free(order);
+        return hr;
+    }
+
+    // Derives thumbnails of every size, no larger than the source, from a render made already,
+    // again rendering the levels the policy says to. Every level is tried whatever the others
+    // do; results[i] corresponds to sizes[i], and the first failure in that order is returned.
+    static HRESULT DeriveMipmaps(const SvgTree& tree, const SvgRenderTarget& source, const uint32_t* sizes, size_t count, SvgRenderTarget* targets, HRESULT* results, MipmapPolicy* policy)
+    {
+        if (source.IsNull()) {
+            return E_INVALIDARG;
+        }
+        MipmapPolicy defaultPolicy;
+        if (policy == nullptr) {
+            policy = &defaultPolicy;
+        }
+        HRESULT first = S_OK;
+        for (size_t i = 0; i < count; i++) {
+            const HRESULT hr = RenderLevel(tree, sizes[i], &source, &targets[i], policy);
+            if (results != nullptr) {
+                results[i] = hr;
+            }
+            if (FAILED(hr) && SUCCEEDED(first)) {
+                first = hr;
+            }
+        }
+        return first;
+    }
+
+    // Allocates a cleared pixmap to be filled by the caller
+    HRESULT Create(uint32_t width, uint32_t height)
+    {
+        SvgRenderTarget self;
+        char* pixmap = nullptr;
+        HRESULT hr = self.Allocate(width, height, &pixmap);
+        if (SUCCEEDED(hr)) {
+            *this = std::move(self);
+        }
+        return hr;
+    }
+
+    // Premultiplied RGBA, top-down, width pixels per row
+    uint32_t* GetPixels()
+    {
+        return this->pixmap;
+    }
+
+    const uint32_t* GetPixels() const
+    {
+        return this->pixmap;
+    }
+
+    bool IsNull() const
+    {
+        return this->pixmap == nullptr;
+    }
+
+    void Destroy()
+    {
+        ::free(this->pixmap);
+        this->pixmap = nullptr;
+        this->width = 0;
+        this->height = 0;
+    }
+
     UINT GetWidth() const
     {
         return this->width;
@@ -227,6 +821,7 @@ public:
         return this->height;
     }
 
+#ifdef _WIN32
     HRESULT ToWICBitmap(IWICImagingFactory* factory, IWICBitmapSource** pbitmap) const
     {
         *pbitmap = nullptr;
@@ -242,56 +837,113 @@ public:
         return hr;
     }
 
-    HRESULT ToGdiBitmap(bool premultiplied, HBITMAP* phbmp) const
+    // alpha, when given, receives what the alpha channel holds; it comes out of the same pass
+    // The token is looked at between bands of rows.
+    HRESULT ToGdiBitmap(bool premultiplied, HBITMAP* phbmp, PixelAlpha* alpha = nullptr, const CancelToken* cancel = nullptr) const
     {
         *phbmp = nullptr;
         if (this->pixmap == nullptr) {
             return E_FAIL;
         }
-        int width = static_cast<int>(this->width);
-        int height = static_cast<int>(this->height);
+        return ToGdiBitmap(this->pixmap, this->width, this->height, premultiplied, phbmp, alpha, cancel);
+    }
+
+    // Same for pixels rendered elsewhere, e.g. in the memory shared with a worker process
+    static HRESULT ToGdiBitmap(const uint32_t* pixels, uint32_t width, uint32_t height, bool premultiplied, HBITMAP* phbmp, PixelAlpha* alpha = nullptr, const CancelToken* cancel = nullptr)
+    {
+        *phbmp = nullptr;
         void* bits = nullptr;
-        Bitmap32bppDIB bitmap(width, height, &bits);
+        Bitmap32bppDIB bitmap(static_cast<int>(width), static_cast<int>(height), &bits);
         if (bitmap.IsNull()) {
             return E_OUTOFMEMORY;
         }
-        const uint32_t* source = this->pixmap;
-        uint32_t* destination = static_cast<uint32_t*>(bits) + this->width * (this->height - 1);
-        if (premultiplied) {
-            for (int y = 0; y < height; y++) {
-                uint32_t* dst = destination;
-                for (int x = 0; x < width; x++) {
-                    // TODO: SSE2
-                    uint32_t src = *source++;
-                    *dst++ = (src & 0xff00ff00) | ((src & 0xff) << 16) | ((src >> 16) & 0xff);
-                }
-                destination -= width;
-            }
-        } else {
-            for (int y = 0; y < height; y++) {
-                uint32_t* dst = destination;
-                for (int x = 0; x < width; x++) {
-                    // TODO: SSE2
-                    uint32_t src = *source++;
-                    uint8_t r = static_cast<uint8_t>(src);
-                    uint8_t g = static_cast<uint8_t>(src >> 8);
-                    uint8_t b = static_cast<uint8_t>(src >> 16);
-                    uint8_t a = static_cast<uint8_t>(src >> 24);
-                    if (a == 0) {
-                        *dst++ = 0;
-                    } else {
-                        *dst++ = Clamp((b * 256 - 128) / a)
-                               | (Clamp((g * 256 - 128) / a) << 8)
-                               | (Clamp((r * 256 - 128) / a) << 16)
-                               | (a << 24);
-                    }
-                }
+        uint32_t* const bottom = static_cast<uint32_t*>(bits) + static_cast<size_t>(width) * (height - 1);
+        PixelAlpha kinds[Parallel::MAX_WORKERS];
+        for (PixelAlpha& kind : kinds) {
+            kind = PixelAlphaOpaque;
+        }
+        const HRESULT hr = ForBands(width, height, cancel, [&](unsigned worker, uint32_t y, uint32_t rows) {
+            const uint32_t* source = pixels + static_cast<size_t>(width) * y;
+            uint32_t* destination = bottom - static_cast<size_t>(width) * y;
+            PixelAlpha kind = kinds[worker];
+            for (uint32_t i = 0; i < rows; i++) {
+                const PixelAlpha row = premultiplied
+                    ? PixelFormat::ToBgra<false>(source, destination, width)
+                    : PixelFormat::ToBgra<true>(source, destination, width);
+                kind = row > kind ? row : kind;
+                source += width;
                 destination -= width;
             }
+            kinds[worker] = kind;
+        });
+        if (FAILED(hr)) {
+            return hr;
+        }
+        PixelAlpha kind = PixelAlphaOpaque;
+        for (PixelAlpha each : kinds) {
+            kind = each > kind ? each : kind;
+        }
+        if (alpha != nullptr) {
+            *alpha = kind;
         }
         *phbmp = bitmap.Detach();
         return S_OK;
     }
+#endif
+
+    // Composites over the backdrop into opaque BGRA in a single pass
+    // stride is in pixels and may be negative, which writes a bottom-up image from its last row.
+    // The token is looked at between bands of rows; rows not reached are left as they were.
+    HRESULT CompositeTo(const Backdrop& backdrop, uint32_t* pixels, ptrdiff_t stride, const CancelToken* cancel = nullptr) const
+    {
+        if (this->pixmap == nullptr) {
+            return E_FAIL;
+        }
+        return ForBands(this->width, this->height, cancel, [&](unsigned, uint32_t y, uint32_t rows) {
+            const uint32_t* source = this->pixmap + static_cast<size_t>(this->width) * y;
+            uint32_t* destination = pixels + stride * static_cast<ptrdiff_t>(y);
+            for (uint32_t i = 0; i < rows; i++) {
+                PixelFormat::CompositeToBgra(source, destination, this->width, backdrop, static_cast<int32_t>(y + i));
+                source += this->width;
+                destination += stride;
+            }
+        });
+    }
+
+    // Copies the image out in any layout from convert.hpp, e.g. ConvertTo<FormatRGB565>
+    // stride is in bytes and may be negative. The token is looked at as in CompositeTo.
+    template <class TFormat>
+    HRESULT ConvertTo(void* pixels, ptrdiff_t stride, const CancelToken* cancel = nullptr) const
+    {
+        if (this->pixmap == nullptr) {
+            return E_FAIL;
+        }
+        return ForBands(this->width, this->height, cancel, [&](unsigned, uint32_t y, uint32_t rows) {
+            PixelConverter::Convert<FormatPRGBA8, TFormat>(this->pixmap + static_cast<size_t>(this->width) * y, static_cast<ptrdiff_t>(this->width) * 4, static_cast<uint8_t*>(pixels) + stride * static_cast<ptrdiff_t>(y), stride, this->width, rows);
+        });
+    }
+
+#ifdef _WIN32
+    // An opaque bitmap that can be blitted without alpha blending
+    HRESULT ToGdiBitmap(const Backdrop& backdrop, HBITMAP* phbmp) const
+    {
+        *phbmp = nullptr;
+        if (this->pixmap == nullptr) {
+            return E_FAIL;
+        }
+        void* bits = nullptr;
+        Bitmap32bppDIB bitmap(static_cast<int>(this->width), static_cast<int>(this->height), &bits);
+        if (bitmap.IsNull()) {
+            return E_OUTOFMEMORY;
+        }
+        uint32_t* lastRow = static_cast<uint32_t*>(bits) + static_cast<size_t>(this->width) * (this->height - 1);
+        HRESULT hr = this->CompositeTo(backdrop, lastRow, -static_cast<ptrdiff_t>(this->width));
+        if (SUCCEEDED(hr)) {
+            *phbmp = bitmap.Detach();
+        }
+        return hr;
+    }
+#endif
 
     SvgRenderTarget(SvgRenderTarget&& src)
     {
@@ -316,4 +968,149 @@ public:
 };
 
 
+// A single 8-bit channel per pixel, for cursor masks, monochrome glyphs and hit-testing
+// The image goes through resvg in stripes, so besides the mask itself only one stripe of
+// RGBA is ever held; the kept frame is a quarter of an SvgRenderTarget.
+class SvgMaskTarget
+{
+public:
+    enum Channel
+    {
+        // Coverage
+        ChannelAlpha,
+        // BT.601 luma of the premultiplied colour, so luma times alpha: the image over black
+        // This is not an SVG luminance mask, which weighs linearRGB with other coefficients.
+        ChannelLuminance,
+    };
+
+    class RenderOptions : public SvgRenderTarget::RenderOptions
+    {
+    private:
+        friend class SvgMaskTarget;
+
+        Channel channel = ChannelAlpha;
+
+    public:
+        RenderOptions()
+        {
+        }
+
+        RenderOptions& SetChannel(Channel channel)
+        {
+            this->channel = channel;
+            return *this;
+        }
+    };
+
+private:
+    static const uint32_t STRIPE_OVERLAP = 8;
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    Channel channel = ChannelAlpha;
+    uint8_t* mask = nullptr;
+
+public:
+    SvgMaskTarget()
+    {
+    }
+
+    ~SvgMaskTarget()
+    {
+        ::free(this->mask);
+    }
+
+    static HRESULT Render(const SvgTree& tree, const RenderOptions& opt, SvgMaskTarget* target)
+    {
+        SvgMaskTarget self;
+        HRESULT hr = SvgRenderTarget::RenderStripes(tree, opt, 0, STRIPE_OVERLAP, [&](const uint32_t* pixels, uint32_t width, uint32_t height, uint32_t y, uint32_t rows) {
+            if (y == 0) {
+                self.mask = static_cast<uint8_t*>(::malloc(static_cast<size_t>(width) * height));
+                if (self.mask == nullptr) {
+                    return E_OUTOFMEMORY;
+                }
+                self.width = width;
+                self.height = height;
+                self.channel = opt.channel;
+            }
+            uint8_t* dst = self.mask + static_cast<size_t>(y) * width;
+            const ptrdiff_t srcStride = static_cast<ptrdiff_t>(width) * 4;
+            if (opt.channel == ChannelAlpha) {
+                PixelConverter::Convert<FormatPRGBA8, FormatAlpha8>(pixels, srcStride, dst, width, width, rows);
+            } else {
+                PixelConverter::Convert<FormatPRGBA8, FormatGray8>(pixels, srcStride, dst, width, width, rows);
+            }
+            return S_OK;
+        });
+        if (SUCCEEDED(hr)) {
+            *target = std::move(self);
+        }
+        return hr;
+    }
+
+    // One byte per pixel, top-down, width bytes per row
+    const uint8_t* GetPixels() const
+    {
+        return this->mask;
+    }
+
+    Channel GetChannel() const
+    {
+        return this->channel;
+    }
+
+    bool IsNull() const
+    {
+        return this->mask == nullptr;
+    }
+
+    void Destroy()
+    {
+        ::free(this->mask);
+        this->mask = nullptr;
+        this->width = 0;
+        this->height = 0;
+    }
+
+    UINT GetWidth() const
+    {
+        return this->width;
+    }
+
+    UINT GetHeight() const
+    {
+        return this->height;
+    }
+
+    SvgMaskTarget(SvgMaskTarget&& src)
+    {
+        this->width = src.width;
+        this->height = src.height;
+        this->channel = src.channel;
+        this->mask = src.mask;
+        src.width = 0;
+        src.height = 0;
+        src.mask = nullptr;
+    }
+
+    SvgMaskTarget& operator =(SvgMaskTarget&& src)
+    {
+        if (this != &src) {
+            ::free(this->mask);
+            this->width = src.width;
+            this->height = src.height;
+            this->channel = src.channel;
+            this->mask = src.mask;
+            src.width = 0;
+            src.height = 0;
+            src.mask = nullptr;
+        }
+        return *this;
+    }
+
+    SvgMaskTarget(const SvgMaskTarget&) = delete;
+    SvgMaskTarget& operator =(const SvgMaskTarget&) = delete;
+};
+
+
 #endif
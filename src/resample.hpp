@@ -0,0 +1,230 @@
+#ifndef SVG_RESAMPLE_H
+#define SVG_RESAMPLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "simd.h"
+
+enum ResampleFilter
+{
+    ResampleBox,
+    ResampleLanczos3,
+};
+
+
+// Separable resampler for premultiplied RGBA pixmaps
+// Filtering premultiplied pixels keeps transparent edges from bleeding colour,
+// so the output is valid premultiplied RGBA without any extra pass.
+class Resampler
+{
+private:
+    static const int WEIGHT_BITS = 14;
+
+    struct WeightTable
+    {
+        int* start = nullptr;
+        int* count = nullptr;
+        int16_t* weights = nullptr;
+        int maxTaps = 0;
+
+        ~WeightTable()
+        {
+            ::free(this->start);
+            ::free(this->count);
+            ::free(this->weights);
+        }
+    };
+
+    static double Sinc(double x)
+    {
+        if (x == 0) {
+            return 1;
+        }
+        x *= 3.14159265358979323846;
+        return ::sin(x) / x;
+    }
+
+    static double Lanczos3(double x)
+    {
+        if (x <= -3 || x >= 3) {
+            return 0;
+        }
+        return Sinc(x) * Sinc(x / 3);
+    }
+
+    static bool BuildWeights(uint32_t srcSize, uint32_t dstSize, ResampleFilter filter, WeightTable* table)
+    {
+        const double scale = static_cast<double>(srcSize) / dstSize;
+        const double filterScale = scale > 1 ? scale : 1;
+        const double support = (filter == ResampleBox ? 0.5 : 3.0) * filterScale;
+        const int maxTaps = static_cast<int>(::ceil(support * 2)) + 2;
+        table->start = static_cast<int*>(::calloc(dstSize, sizeof(int)));
+        table->count = static_cast<int*>(::calloc(dstSize, sizeof(int)));
+        table->weights = static_cast<int16_t*>(::calloc(dstSize, maxTaps * sizeof(int16_t)));
+        double* temp = static_cast<double*>(::calloc(maxTaps, sizeof(double)));
+        if (table->start == nullptr || table->count == nullptr || table->weights == nullptr || temp == nullptr) {
+            ::free(temp);
+            return false;
+        }
+        table->maxTaps = maxTaps;
+        for (uint32_t i = 0; i < dstSize; i++) {
+            const double centre = (i + 0.5) * scale;
+            int left = static_cast<int>(::floor(centre - support));
+            int right = static_cast<int>(::ceil(centre + support));
+            if (left < 0) {
+                left = 0;
+            }
+            if (right > static_cast<int>(srcSize)) {
+                right = static_cast<int>(srcSize);
+            }
+            if (right - left > maxTaps) {
+                right = left + maxTaps;
+            }
+            double total = 0;
+            for (int j = left; j < right; j++) {
+                double weight;
+                if (filter == ResampleBox) {
+                    // area covered by the source pixel
+                    const double lo = j > centre - support ? j : centre - support;
+                    const double hi = j + 1 < centre + support ? j + 1 : centre + support;
+                    weight = hi > lo ? hi - lo : 0;
+                } else {
+                    weight = Lanczos3((j + 0.5 - centre) / filterScale);
+                }
+                temp[j - left] = weight;
+                total += weight;
+            }
+            // drop zero taps at both ends
+            while (left < right && temp[0] == 0) {
+                ::memmove(temp, temp + 1, (right - left - 1) * sizeof(double));
+                left++;
+            }
+            while (right > left && temp[right - left - 1] == 0) {
+                right--;
+            }
+            if (right <= left || total == 0) {
+                // degenerate: nearest neighbour
+                left = static_cast<int>(centre);
+                if (left >= static_cast<int>(srcSize)) {
+                    left = static_cast<int>(srcSize) - 1;
+                }
+                right = left + 1;
+                temp[0] = total = 1;
+            }
+            // normalise to fixed point so that the taps add up to exactly one
+            int16_t* weights = table->weights + i * maxTaps;
+            int sum = 0;
+            int largest = 0;
+            for (int j = 0; j < right - left; j++) {
+                weights[j] = static_cast<int16_t>(::floor(temp[j] / total * (1 << WEIGHT_BITS) + 0.5));
+                sum += weights[j];
+                if (weights[j] > weights[largest]) {
+                    largest = j;
+                }
+            }
+            weights[largest] = static_cast<int16_t>(weights[largest] + (1 << WEIGHT_BITS) - sum);
+            table->start[i] = left;
+            table->count[i] = right - left;
+        }
+        ::free(temp);
+        return true;
+    }
+
+#ifdef SVG_SSE2
+    static inline __m128i Expand(uint32_t pixel)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(pixel)), zero), zero);
+    }
+
+    static inline uint32_t Pack(__m128i acc)
+    {
+        acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(1 << (WEIGHT_BITS - 1))), WEIGHT_BITS);
+        __m128i v = _mm_packs_epi32(acc, acc);
+        // Lanczos may ring; colour must not exceed alpha in premultiplied space
+        v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3)));
+        return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(v, v)));
+    }
+
+    static uint32_t Filter(const uint32_t* src, size_t step, const int16_t* weights, int count)
+    {
+        __m128i acc = _mm_setzero_si128();
+        for (int k = 0; k < count; k++) {
+            const __m128i w = _mm_set1_epi32(static_cast<uint16_t>(weights[k]));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(Expand(*src), w));
+            src += step;
+        }
+        return Pack(acc);
+    }
+#else
+    static inline int ClampChannel(int x, int max)
+    {
+        return x < 0 ? 0 : (x > max ? max : x);
+    }
+
+    static uint32_t Filter(const uint32_t* src, size_t step, const int16_t* weights, int count)
+    {
+        int acc[4] = { 0, 0, 0, 0 };
+        for (int k = 0; k < count; k++) {
+            const uint32_t pixel = *src;
+            const int w = weights[k];
+            acc[0] += static_cast<int>(pixel & 0xff) * w;
+            acc[1] += static_cast<int>((pixel >> 8) & 0xff) * w;
+            acc[2] += static_cast<int>((pixel >> 16) & 0xff) * w;
+            acc[3] += static_cast<int>(pixel >> 24) * w;
+            src += step;
+        }
+        const int round = 1 << (WEIGHT_BITS - 1);
+        const int a = ClampChannel((acc[3] + round) >> WEIGHT_BITS, 255);
+        const int r = ClampChannel((acc[0] + round) >> WEIGHT_BITS, a);
+        const int g = ClampChannel((acc[1] + round) >> WEIGHT_BITS, a);
+        const int b = ClampChannel((acc[2] + round) >> WEIGHT_BITS, a);
+        return static_cast<uint32_t>(r | (g << 8) | (b << 16) | (a << 24));
+    }
+#endif
+
+public:
+    Resampler() = delete;
+    ~Resampler() = delete;
+
+    // Strides are in pixels
+    static HRESULT Resample(const uint32_t* src, uint32_t srcWidth, uint32_t srcHeight, size_t srcStride,
+        uint32_t* dst, uint32_t dstWidth, uint32_t dstHeight, size_t dstStride, ResampleFilter filter = ResampleBox)
+    {
+        if (src == nullptr || dst == nullptr || srcWidth == 0 || srcHeight == 0 || dstWidth == 0 || dstHeight == 0) {
+            return E_INVALIDARG;
+        }
+        WeightTable horz, vert;
+        if (!BuildWeights(srcWidth, dstWidth, filter, &horz) || !BuildWeights(srcHeight, dstHeight, filter, &vert)) {
+            return E_OUTOFMEMORY;
+        }
+        // horizontal pass first, so the intermediate is only as wide as the output
+        uint32_t* temp = static_cast<uint32_t*>(::calloc(srcHeight, dstWidth * sizeof(uint32_t)));
+        if (temp == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        for (uint32_t y = 0; y < srcHeight; y++) {
+            const uint32_t* srcRow = src + y * srcStride;
+            uint32_t* tempRow = temp + y * dstWidth;
+            for (uint32_t x = 0; x < dstWidth; x++) {
+                tempRow[x] = Filter(srcRow + horz.start[x], 1, horz.weights + x * horz.maxTaps, horz.count[x]);
+            }
+        }
+        for (uint32_t y = 0; y < dstHeight; y++) {
+            const uint32_t* tempCol = temp + vert.start[y] * dstWidth;
+            const int16_t* weights = vert.weights + y * vert.maxTaps;
+            const int count = vert.count[y];
+            uint32_t* dstRow = dst + y * dstStride;
+            for (uint32_t x = 0; x < dstWidth; x++) {
+                dstRow[x] = Filter(tempCol + x, dstWidth, weights, count);
+            }
+        }
+        ::free(temp);
+        return S_OK;
+    }
+};
+
+#endif
@@ -2,7 +2,12 @@
 #define SANS_HEADER
 
 #include <zlib.h>
+#ifdef _WIN32
 #pragma comment(lib, "zlibstatic.lib")
+#endif
+
+#include "cancel.hpp"
+#include "complexity.hpp"
 
 // Replace BackgroundImage with SourceGraphic until the issue #257 is resolved
 // https://github.com/RazrFalcon/resvg/issues/257
@@ -12,6 +17,9 @@
 // https://github.com/memononen/nanosvg
 class Sanitiser {
 private:
+    // Input between two looks at the cancel token
+    static const size_t CHECK_BYTES = 1 << 20;
+
     void* memPtr;
     size_t cbMem;
 
@@ -20,22 +28,35 @@ private:
         return ::strchr(" \t\n\v\f\r", c) != nullptr;
     }
 
+    // The whole of s, not a prefix: an empty value must not pass for BackgroundImage, as its
+    // longer replacement would then run past the output
+    static bool IsEqual(const char* s, size_t len, const char* literal)
+    {
+        return ::strlen(literal) == len && ::memcmp(s, literal, len) == 0;
+    }
+
     static bool IsProblematicTag(const char* tag, size_t len)
     {
-        return ::strncmp(tag, "feBlend", len) == 0 || ::strncmp(tag, "feComposite", len) == 0 || ::strncmp(tag, "feDisplacementMap", len) == 0;
+        return IsEqual(tag, len, "feBlend") || IsEqual(tag, len, "feComposite") || IsEqual(tag, len, "feDisplacementMap");
     }
 
     static bool IsProblematicAttr(const char* name, size_t len)
     {
-        return ::strncmp(name, "in", len) == 0 || ::strncmp(name, "in2", len) == 0;
+        return IsEqual(name, len, "in") || IsEqual(name, len, "in2");
     }
 
     static bool IsProblematicValue(const char* value, size_t len)
     {
-        return ::strncmp(value, "BackgroundImage", len) == 0;
+        return IsEqual(value, len, "BackgroundImage");
     }
 
-    static char* InElement(const char* in, const char* end, char* out)
+    static bool IsNameEnd(char c)
+    {
+        return IsCharSpace(c) || c == '/' || c == '>';
+    }
+
+    // Copies one tag, rewriting the problematic filters, and counts it into complexity if given
+    static char* InElement(const char* in, const char* end, char* out, SvgComplexity* complexity)
     {
         // Skip white space after the '<'
         while (in < end && IsCharSpace(*in)) {
@@ -48,7 +69,16 @@ private:
             while (in < end && !IsCharSpace(*in)) {
                 *out++ = *in++;
             }
-            if (in < end && IsProblematicTag(tag, in - tag)) {
+            SvgComplexity::Attributes attributes = SvgComplexity::AttributesNone;
+            if (complexity != nullptr) {
+                const char* name = tag;
+                while (name < in && !IsNameEnd(*name)) {
+                    name++;
+                }
+                attributes = complexity->AddElement(tag, name - tag);
+            }
+            const bool problematic = in < end && IsProblematicTag(tag, in - tag);
+            if (problematic || attributes != SvgComplexity::AttributesNone) {
                 const char* s = in;
                 while (s < end) {
                     // Skip white space before the attrib name
@@ -63,7 +93,8 @@ private:
                     while (s < end && !IsCharSpace(*s) && *s != '=') {
                         s++;
                     }
-                    const bool aoi = s < end && IsProblematicAttr(name, s - name);
+                    const size_t cbName = s - name;
+                    const bool aoi = problematic && s < end && IsProblematicAttr(name, cbName);
                     // Skip until the beginning of the value.
                     while (s < end && *s != '\"' && *s != '\'') {
                         s++;
@@ -81,6 +112,9 @@ private:
                     if (s < end) {
                         s++;
                     }
+                    if (attributes != SvgComplexity::AttributesNone) {
+                        complexity->AddAttribute(attributes, name, cbName, value, len);
+                    }
                     if (aoi && IsProblematicValue(value, len)) {
                         while (in < value) {
                             *out++ = *in++;
@@ -103,13 +137,21 @@ private:
         return out;
     }
 
-    static size_t RunWorker(const char* in, size_t cb, char* out)
+    static HRESULT RunWorker(const char* in, size_t cb, char* out, const CancelToken* token, SvgComplexity* complexity, size_t* pcbOut)
     {
         bool tag = false;
         const char* const end = in + cb;
         const char* mark = in;
+        const char* check = in;
         char* const outp = out;
         while (in < end) {
+            if (in >= check) {
+                HRESULT hr = CancelToken::Check(token);
+                if (FAILED(hr)) {
+                    return hr;
+                }
+                check = in + (static_cast<size_t>(end - in) > CHECK_BYTES ? CHECK_BYTES : end - in);
+            }
             if (*in == '<' && tag == false) {
                 // Start of a tag
                 in++;
@@ -124,7 +166,7 @@ private:
             } else if (*in == '>' && tag) {
                 // Start of a content or new tag.
                 in++;
-                out = InElement(mark, in, out);
+                out = InElement(mark, in, out, complexity);
                 mark = in;
                 tag = false;
             } else {
@@ -134,27 +176,37 @@ private:
         while (mark < in) {
             *out++ = *mark++;
         }
-        return out - outp;
+        *pcbOut = out - outp;
+        return S_OK;
     }
 
-    static void* GZipDecompress(const void* data, size_t cb, size_t* pcbOut)
+    // Returns S_FALSE, and no data, for input that is not gzip or does not inflate
+    static HRESULT GZipDecompress(const void* data, size_t cb, const CancelToken* token, void** ppOut, size_t* pcbOut)
     {
+        *ppOut = nullptr;
         *pcbOut = 0;
         Bytef* in = static_cast<Bytef*>(const_cast<void*>(data));
         if (cb < 2 || cb > INT_MAX || (in[0] | in[1] << 8) != 0x8b1f) {
-            return nullptr;
+            return S_FALSE;
         }
         z_stream zs = {};
         zs.next_in = in;
         int ret = inflateInit2(&zs, 15 | 32);
         if (ret < 0) {
-            return nullptr;
+            return S_FALSE;
         }
         zs.next_in = in;
         zs.avail_in = static_cast<uInt>(cb);
         Bytef* outPtr = nullptr;
         size_t size = 0;
         do {
+            // A small file can inflate to a lot, so each block is a cancellation point
+            HRESULT hr = CancelToken::Check(token);
+            if (FAILED(hr)) {
+                inflateEnd(&zs);
+                ::free(outPtr);
+                return hr;
+            }
             Bytef buf[2048];
             zs.next_out = buf;
             zs.avail_out = sizeof(buf);
@@ -166,20 +218,23 @@ private:
                     newPtr = static_cast<Bytef*>(::realloc(outPtr, size + cbWritten));
                 }
                 if (newPtr == nullptr) {
+                    inflateEnd(&zs);
                     ::free(outPtr);
-                    return nullptr;
+                    return S_FALSE;
                 }
                 outPtr = newPtr;
                 ::memcpy(outPtr + size, buf, cbWritten);
                 size += cbWritten;
             } else {
+                inflateEnd(&zs);
                 ::free(outPtr);
-                return nullptr;
+                return S_FALSE;
             }
         } while (ret != Z_STREAM_END && ret != Z_BUF_ERROR);
         inflateEnd(&zs);
+        *ppOut = outPtr;
         *pcbOut = size;
-        return outPtr;
+        return outPtr != nullptr ? S_OK : S_FALSE;
     }
 
 public:
@@ -214,27 +269,45 @@ public:
         return this->cbMem;
     }
 
-    bool Run(const void* data, size_t cb)
+    // Inflates gzip input and rewrites the problematic filters, see GetData
+    // Fails with the token's error when it asks to stop. Given complexity, it also gathers the
+    // document's structure on the way, which costs far less than parsing it.
+    HRESULT Run(const void* data, size_t cb, const CancelToken* token = nullptr, SvgComplexity* complexity = nullptr)
     {
+        if (complexity != nullptr) {
+            *complexity = SvgComplexity();
+        }
         ::free(this->memPtr);
         this->memPtr = nullptr;
         this->cbMem = 0;
         size_t cbDec;
-        void* gzDec = GZipDecompress(data, cb, &cbDec);
+        void* gzDec = nullptr;
+        HRESULT hr = GZipDecompress(data, cb, token, &gzDec, &cbDec);
+        if (FAILED(hr)) {
+            return hr;
+        }
         if (gzDec != nullptr) {
             data = gzDec;
             cb = cbDec;
         }
         char* outPtr = static_cast<char*>(calloc(cb + 1, 1));
         if (outPtr == nullptr) {
-            return false;
+            ::free(gzDec);
+            return E_OUTOFMEMORY;
         }
-        cb = RunWorker(static_cast<const char*>(data), cb, outPtr);
-        outPtr[cb] = '\0';
+        if (complexity != nullptr) {
+            complexity->bytes = cb;
+        }
+        hr = RunWorker(static_cast<const char*>(data), cb, outPtr, token, complexity, &cb);
         ::free(gzDec);
+        if (FAILED(hr)) {
+            ::free(outPtr);
+            return hr;
+        }
+        outPtr[cb] = '\0';
         this->memPtr = outPtr;
         this->cbMem = cb;
-        return true;
+        return S_OK;
     }
 };
 
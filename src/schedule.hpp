@@ -0,0 +1,375 @@
+#ifndef SVG_SCHEDULE_H
+#define SVG_SCHEDULE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <set>
+#include <vector>
+#include <chrono>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "parallel.hpp"
+#include "cancel.hpp"
+
+// What a render is for; queued jobs of an earlier class always start first
+enum RenderJobClass
+{
+    // On screen now
+    RenderJobVisible,
+    // Likely on screen soon, e.g. next to the viewport in the scroll direction
+    RenderJobPrefetch,
+    RenderJobBackground,
+    RenderJobClassCount,
+};
+
+
+// Unit of work for RenderJobScheduler; the job itself is the handle to it
+// The caller owns it and must not destroy it while it is queued, running or in its completion
+// callback. Once it has completed it can be submitted again.
+class RenderJob
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef void (*Completion)(RenderJob& job, void* context);
+
+private:
+    enum State
+    {
+        StateIdle,
+        StateQueued,
+        StateRunning,
+        // Finished, with its completion callback running
+        StateCompleting,
+    };
+
+    RenderJobClass jobClass = RenderJobBackground;
+    Clock::time_point deadline;
+    uint64_t sequence = 0;
+    State state = StateIdle;
+    HRESULT result = S_OK;
+    Completion completion = nullptr;
+    void* context = nullptr;
+    CancelToken token;
+
+    friend class RenderJobScheduler;
+
+protected:
+    // Runs on a scheduler thread; token fires when the job is cancelled while running
+    virtual HRESULT Execute(const CancelToken* token) = 0;
+
+public:
+    RenderJob() = default;
+    RenderJob(const RenderJob&) = delete;
+    RenderJob& operator =(const RenderJob&) = delete;
+    virtual ~RenderJob() = default;
+
+    // Called on the thread that finished the job, or the one that cancelled it while queued
+    // Waiting for the job returns only after the callback has, so the callback reads the result
+    // with GetResult and cannot wait for, submit or destroy the job itself.
+    RenderJob& SetCompletion(Completion completion, void* context)
+    {
+        this->completion = completion;
+        this->context = context;
+        return *this;
+    }
+
+    RenderJobClass GetClass() const
+    {
+        return this->jobClass;
+    }
+
+    // For the completion callback; other threads get it from RenderJobScheduler::Wait
+    HRESULT GetResult() const
+    {
+        return this->result;
+    }
+};
+
+
+// Renders a parsed document into a target
+class SvgRenderJob : public RenderJob
+{
+private:
+    const Svg* svg = nullptr;
+    SvgRenderTarget::RenderOptions opt;
+    SvgRenderTarget* target = nullptr;
+
+protected:
+    HRESULT Execute(const CancelToken* token) override
+    {
+        SvgRenderTarget::RenderOptions opt = this->opt;
+        opt.SetCancelToken(token);
+        return this->svg->Render(opt, this->target);
+    }
+
+public:
+    // svg and target must stay alive until the job completes; opt is copied
+    SvgRenderJob& Set(const Svg* svg, const SvgRenderTarget::RenderOptions& opt, SvgRenderTarget* target)
+    {
+        this->svg = svg;
+        this->opt = opt;
+        this->target = target;
+        return *this;
+    }
+};
+
+
+// Runs render jobs on threads of its own, by class first and earliest deadline within a class
+// Jobs are picked when a thread comes free rather than when submitted, so moving a job to
+// another class or cancelling it takes effect as long as it has not started. A running job
+// that is cancelled stops at its next cancellation check, e.g. the next render stripe; running
+// jobs are never preempted otherwise. Meant for views that scroll through many documents,
+// where renders for items that went off screen must not hold up the ones that came on.
+class RenderJobScheduler
+{
+public:
+    typedef RenderJob::Clock Clock;
+
+private:
+    struct EarliestDeadline
+    {
+        bool operator ()(const RenderJob* a, const RenderJob* b) const
+        {
+            if (a->deadline != b->deadline) {
+                return a->deadline < b->deadline;
+            }
+            return a->sequence < b->sequence;
+        }
+    };
+
+    typedef std::set<RenderJob*, EarliestDeadline> JobQueue;
+
+    JobQueue queues[RenderJobClassCount];
+    unsigned concurrency;
+    // Jobs in the queues, and threads waiting for one
+    size_t pending = 0;
+    unsigned idle = 0;
+    bool stopping = false;
+    uint64_t sequence = 0;
+    uint64_t completed[RenderJobClassCount] = {};
+    uint64_t cancelled = 0;
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable queued;
+    std::condition_variable finished;
+
+    RenderJob* Pop()
+    {
+        for (JobQueue& queue : this->queues) {
+            if (!queue.empty()) {
+                RenderJob* job = *queue.begin();
+                queue.erase(queue.begin());
+                this->pending--;
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    // Called with the lock held, and returns with it held; the job stays busy while its
+    // callback runs without the lock, and is marked idle only afterwards, as a waiter may
+    // destroy it as soon as it is
+    void Finish(std::unique_lock<std::mutex>& guard, RenderJob* job, HRESULT hr)
+    {
+        job->result = hr;
+        if (CancelToken::IsCancellation(hr)) {
+            this->cancelled++;
+        } else {
+            this->completed[job->jobClass]++;
+        }
+        if (job->completion != nullptr) {
+            job->state = RenderJob::StateCompleting;
+            guard.unlock();
+            job->completion(*job, job->context);
+            guard.lock();
+        }
+        job->state = RenderJob::StateIdle;
+        this->finished.notify_all();
+    }
+
+    // Takes a job out of its queue and completes it with hr
+    void Abandon(std::unique_lock<std::mutex>& guard, RenderJob* job, HRESULT hr)
+    {
+        this->queues[job->jobClass].erase(job);
+        this->pending--;
+        this->Finish(guard, job, hr);
+    }
+
+    void Main()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        for (;;) {
+            RenderJob* job = this->Pop();
+            if (job == nullptr) {
+                if (this->stopping) {
+                    return;
+                }
+                this->idle++;
+                this->queued.wait(guard);
+                this->idle--;
+                continue;
+            }
+            job->state = RenderJob::StateRunning;
+            guard.unlock();
+            HRESULT hr = job->token.Check();
+            if (SUCCEEDED(hr)) {
+                hr = job->Execute(&job->token);
+            }
+            guard.lock();
+            this->Finish(guard, job, hr);
+        }
+    }
+
+    // Under the lock; starts a thread when there are more jobs than idle ones and there is room
+    void Wake()
+    {
+        if (this->idle > 0) {
+            this->queued.notify_one();
+        }
+        if (this->pending > this->idle && this->threads.size() < this->concurrency) {
+            try {
+                this->threads.emplace_back(&RenderJobScheduler::Main, this);
+            } catch (...) {
+                // The threads already running get through the queue, if there are any
+            }
+        }
+    }
+
+public:
+    explicit RenderJobScheduler(unsigned concurrency = Parallel::GetConcurrency())
+        : concurrency(concurrency > 0 ? concurrency : 1)
+    {
+    }
+
+    RenderJobScheduler(const RenderJobScheduler&) = delete;
+    RenderJobScheduler& operator =(const RenderJobScheduler&) = delete;
+
+    // Cancels what is queued and waits for what is running
+    ~RenderJobScheduler()
+    {
+        this->CancelAll();
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stopping = true;
+            this->queued.notify_all();
+        }
+        for (std::thread& thread : this->threads) {
+            thread.join();
+        }
+    }
+
+    // Fails with ERROR_BUSY when the job is already queued or running
+    HRESULT Submit(RenderJob* job, RenderJobClass jobClass, Clock::time_point deadline = Clock::time_point::max())
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if (job->state != RenderJob::StateIdle) {
+            return HRESULT_FROM_WIN32(ERROR_BUSY);
+        }
+        if (this->stopping) {
+            return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+        }
+        job->jobClass = jobClass;
+        job->deadline = deadline;
+        job->sequence = this->sequence++;
+        job->token.Reset();
+        job->result = E_PENDING;
+        try {
+            this->queues[jobClass].insert(job);
+        } catch (...) {
+            return E_OUTOFMEMORY;
+        }
+        this->pending++;
+        job->state = RenderJob::StateQueued;
+        this->Wake();
+        return S_OK;
+    }
+
+    // Moves a queued job to another class and deadline, e.g. when it scrolls into view
+    // S_FALSE when it has already started or finished.
+    HRESULT Reprioritise(RenderJob* job, RenderJobClass jobClass, Clock::time_point deadline = Clock::time_point::max())
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        if (job->state != RenderJob::StateQueued) {
+            return S_FALSE;
+        }
+        // The key is part of the ordering, so the job leaves its queue before it changes
+        this->queues[job->jobClass].erase(job);
+        job->jobClass = jobClass;
+        job->deadline = deadline;
+        try {
+            this->queues[jobClass].insert(job);
+        } catch (...) {
+            // It is in no queue now, so it is completed rather than left behind
+            this->Abandon(guard, job, E_OUTOFMEMORY);
+            return E_OUTOFMEMORY;
+        }
+        return S_OK;
+    }
+
+    // A queued job completes with ERROR_CANCELLED before this returns, and a running one asks
+    // to stop; S_FALSE when it has already finished
+    HRESULT Cancel(RenderJob* job)
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        if (job->state == RenderJob::StateRunning) {
+            job->token.Cancel();
+            return S_OK;
+        }
+        if (job->state != RenderJob::StateQueued) {
+            return S_FALSE;
+        }
+        this->Abandon(guard, job, HRESULT_FROM_WIN32(ERROR_CANCELLED));
+        return S_OK;
+    }
+
+    // Cancels every queued job of the class, e.g. all prefetches after the scroll direction
+    // changed; running ones go on
+    void CancelClass(RenderJobClass jobClass)
+    {
+        for (;;) {
+            std::unique_lock<std::mutex> guard(this->lock);
+            JobQueue& queue = this->queues[jobClass];
+            if (queue.empty()) {
+                return;
+            }
+            this->Abandon(guard, *queue.begin(), HRESULT_FROM_WIN32(ERROR_CANCELLED));
+        }
+    }
+
+    void CancelAll()
+    {
+        for (int i = 0; i < RenderJobClassCount; i++) {
+            this->CancelClass(static_cast<RenderJobClass>(i));
+        }
+    }
+
+    // Returns the job's result once it has completed and its callback has returned
+    HRESULT Wait(RenderJob* job)
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->finished.wait(guard, [job] {
+            return job->state == RenderJob::StateIdle;
+        });
+        return job->result;
+    }
+
+    // Jobs of the class that ran to the end, successfully or not
+    uint64_t GetCompletedCount(RenderJobClass jobClass)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->completed[jobClass];
+    }
+
+    // Jobs cancelled, queued or running
+    uint64_t GetCancelledCount()
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->cancelled;
+    }
+};
+
+#endif
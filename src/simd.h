@@ -0,0 +1,10 @@
+#ifndef SVG_SIMD_H
+#define SVG_SIMD_H
+
+// SSE2 is part of the x64 baseline, so it needs no runtime check
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SVG_SSE2
+#include <emmintrin.h>
+#endif
+
+#endif
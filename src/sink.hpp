@@ -0,0 +1,132 @@
+#ifndef SVG_SINK_H
+#define SVG_SINK_H
+
+#include <stdio.h>
+
+#include "buffer.hpp"
+
+// Destination for encoded bytes
+class ByteSink
+{
+public:
+    virtual ~ByteSink()
+    {
+    }
+
+    virtual HRESULT Write(const void* data, size_t cb) = 0;
+};
+
+
+class MemorySink : public ByteSink
+{
+private:
+    ByteBuffer buffer;
+
+public:
+    HRESULT Write(const void* data, size_t cb) override
+    {
+        return this->buffer.Append(data, cb) ? S_OK : E_OUTOFMEMORY;
+    }
+
+    const ByteBuffer& GetBuffer() const
+    {
+        return this->buffer;
+    }
+
+    ByteBuffer& GetBuffer()
+    {
+        return this->buffer;
+    }
+};
+
+
+class FileSink : public ByteSink
+{
+private:
+#ifdef _WIN32
+    HANDLE hf = INVALID_HANDLE_VALUE;
+#else
+    FILE* fp = nullptr;
+#endif
+
+public:
+    FileSink()
+    {
+    }
+
+    ~FileSink()
+    {
+        this->Close();
+    }
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator =(const FileSink&) = delete;
+
+#ifdef _WIN32
+    HRESULT Open(const wchar_t* path)
+    {
+        this->Close();
+        this->hf = ::CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (this->hf == INVALID_HANDLE_VALUE) {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+        return S_OK;
+    }
+
+    HRESULT Write(const void* data, size_t cb) override
+    {
+        const BYTE* ptr = static_cast<const BYTE*>(data);
+        while (cb > 0) {
+            const DWORD chunk = cb > 0x40000000 ? 0x40000000 : static_cast<DWORD>(cb);
+            DWORD written = 0;
+            if (!::WriteFile(this->hf, ptr, chunk, &written, nullptr)) {
+                return HRESULT_FROM_WIN32(::GetLastError());
+            }
+            ptr += written;
+            cb -= written;
+        }
+        return S_OK;
+    }
+
+    HRESULT Close()
+    {
+        if (this->hf != INVALID_HANDLE_VALUE) {
+            BOOL ok = ::CloseHandle(this->hf);
+            this->hf = INVALID_HANDLE_VALUE;
+            if (!ok) {
+                return HRESULT_FROM_WIN32(::GetLastError());
+            }
+        }
+        return S_OK;
+    }
+#else
+    HRESULT Open(const char* path)
+    {
+        this->Close();
+        this->fp = ::fopen(path, "wb");
+        return this->fp != nullptr ? S_OK : E_FAIL;
+    }
+
+    HRESULT Write(const void* data, size_t cb) override
+    {
+        if (this->fp == nullptr || ::fwrite(data, 1, cb, this->fp) != cb) {
+            return E_FAIL;
+        }
+        return S_OK;
+    }
+
+    HRESULT Close()
+    {
+        if (this->fp != nullptr) {
+            int ret = ::fclose(this->fp);
+            this->fp = nullptr;
+            if (ret != 0) {
+                return E_FAIL;
+            }
+        }
+        return S_OK;
+    }
+#endif
+};
+
+#endif
@@ -4,15 +4,22 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <math.h>
+#include <stdio.h>
+#include <errno.h>
+#include <mutex>
 
 #include <resvg.h>
-#pragma comment(lib, "resvg.lib")
 
 #include "debug.hpp"
 #include "svgopts.hpp"
 #include "sans.hpp"
 
-const void* mmopen(const wchar_t* path, size_t* filesize)
+#ifdef _WIN32
+#pragma comment(lib, "resvg.lib")
+
+typedef wchar_t PathChar;
+
+inline const void* mmopen(const PathChar* path, size_t* filesize)
 {
     HANDLE hf, hfm;
     void* ptr = NULL;
@@ -33,12 +40,52 @@ const void* mmopen(const wchar_t* path, size_t* filesize)
     return ptr;
 }
 
-void mmclose(const void* ptr)
+inline void mmclose(const void* ptr)
 {
     UnmapViewOfFile((void*)(ptr));
 }
+#else
+// UTF-8, or whatever the file system takes
+typedef char PathChar;
+
+// Read into memory rather than mapped, as mmclose gets no size to unmap with
+inline const void* mmopen(const PathChar* path, size_t* filesize)
+{
+    *filesize = 0;
+    FILE* fp = ::fopen(path, "rb");
+    if (fp == nullptr) {
+        return nullptr;
+    }
+    char* ptr = nullptr;
+    long cb = -1;
+    if (::fseek(fp, 0, SEEK_END) == 0) {
+        cb = ::ftell(fp);
+    }
+    if (cb >= 0 && static_cast<unsigned long>(cb) <= UINT32_MAX && ::fseek(fp, 0, SEEK_SET) == 0) {
+        // One more byte, so that an empty file is not a null pointer
+        ptr = static_cast<char*>(::malloc(static_cast<size_t>(cb) + 1));
+        if (ptr != nullptr && ::fread(ptr, 1, static_cast<size_t>(cb), fp) != static_cast<size_t>(cb)) {
+            ::free(ptr);
+            ptr = nullptr;
+            errno = EIO;
+        }
+    } else if (cb >= 0) {
+        errno = EFBIG;
+    }
+    ::fclose(fp);
+    if (ptr != nullptr) {
+        *filesize = static_cast<size_t>(cb);
+    }
+    return ptr;
+}
 
-HRESULT HresultFromKnownResvgError(resvg_error error)
+inline void mmclose(const void* ptr)
+{
+    ::free(const_cast<void*>(ptr));
+}
+#endif
+
+inline HRESULT HresultFromKnownResvgError(resvg_error error)
 {
     switch (error) {
     case RESVG_OK:
@@ -50,17 +97,109 @@ HRESULT HresultFromKnownResvgError(resvg_error error)
 }
 
 
+// A parsed tree, and the lock that every call on it takes
+// resvg builds its trees from reference-counted nodes whose counts and borrow flags are not
+// atomic, so even two renders of one tree at the same time corrupt it. Calls on a tree go one
+// at a time; only the work around them, e.g. on the stripes they produce, runs in parallel.
+class SvgTree
+{
+private:
+    resvg_render_tree* tree = nullptr;
+    mutable std::mutex lock;
+
+public:
+    SvgTree()
+    {
+    }
+
+    ~SvgTree()
+    {
+        this->Destroy();
+    }
+
+    SvgTree(SvgTree&& src)
+    {
+        this->tree = src.tree;
+        src.tree = nullptr;
+    }
+
+    SvgTree(const SvgTree&) = delete;
+    SvgTree& operator =(const SvgTree&) = delete;
+
+    // Nothing else may use the tree at the same time
+    resvg_error Parse(const void* ptr, size_t cb, const resvg_options* opt)
+    {
+        this->Destroy();
+        return static_cast<resvg_error>(::resvg_parse_tree_from_data(static_cast<const char*>(ptr), cb, opt, &this->tree));
+    }
+
+    void Destroy()
+    {
+        if (this->tree != nullptr) {
+            ::resvg_tree_destroy(this->tree);
+            this->tree = nullptr;
+        }
+    }
+
+    bool IsNull() const
+    {
+        return this->tree == nullptr;
+    }
+
+    resvg_size GetSize() const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return ::resvg_get_image_size(this->tree);
+    }
+
+    resvg_rect GetViewBox() const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return ::resvg_get_image_viewbox(this->tree);
+    }
+
+    bool GetBoundingBox(resvg_rect* rect) const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return ::resvg_get_image_bbox(this->tree, rect);
+    }
+
+    bool GetNodeBoundingBox(const char* id, resvg_rect* rect) const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return ::resvg_get_node_bbox(this->tree, id, rect);
+    }
+
+    bool IsImageEmpty() const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return ::resvg_is_image_empty(this->tree);
+    }
+
+    void Render(const resvg_fit_to& fitTo, const resvg_transform& tx, uint32_t width, uint32_t height, char* pixmap) const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        ::resvg_render(this->tree, fitTo, tx, width, height, pixmap);
+    }
+
+    bool RenderNode(const char* id, const resvg_fit_to& fitTo, const resvg_transform& tx, uint32_t width, uint32_t height, char* pixmap) const
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return ::resvg_render_node(this->tree, id, fitTo, tx, width, height, pixmap);
+    }
+};
+
+
 class Svg
 {
 private:
     static const uint32_t MAX_SIZE = INT_MAX / 2;
     resvg_error error;
-    resvg_render_tree* tree;
+    SvgTree tree;
     resvg_size size;
 
     void Clear()
     {
-        this->tree = nullptr;
         this->size.width = 0;
         this->size.height = 0;
     }
@@ -78,10 +217,11 @@ public:
     }
 
     Svg(Svg&& src)
+        : tree(std::move(src.tree))
     {
         this->error = src.error;
-        this->tree = src.tree;
-        src.tree = nullptr;
+        this->size = src.size;
+        src.Clear();
     }
 
     Svg(const Svg&) = delete;
@@ -89,9 +229,7 @@ public:
 
     void Destroy()
     {
-        if (this->tree != nullptr) {
-            ::resvg_tree_destroy(this->tree);
-        }
+        this->tree.Destroy();
         this->Clear();
     }
 
@@ -102,30 +240,30 @@ public:
 
     resvg_rect GetViewBox() const
     {
-        if (this->tree == nullptr) {
+        if (this->tree.IsNull()) {
             resvg_rect empty = {};
             return empty;
         }
-        return ::resvg_get_image_viewbox(this->tree);
+        return this->tree.GetViewBox();
     }
 
     bool GetBoundingBox(resvg_rect* rect) const
     {
         ZeroMemory(rect, sizeof(*rect));
-        if (this->tree == nullptr) {
+        if (this->tree.IsNull()) {
             return false;
         }
-        return ::resvg_get_image_bbox(this->tree, rect);
+        return this->tree.GetBoundingBox(rect);
     }
 
     bool IsNull() const
     {
-        return this->tree == nullptr;
+        return this->tree.IsNull();
     }
 
     bool IsEmpty() const
     {
-        return this->tree == nullptr || !::resvg_is_image_empty(this->tree);
+        return this->tree.IsNull() || !this->tree.IsImageEmpty();
     }
 
     bool IsRenderable() const
@@ -133,18 +271,36 @@ public:
         return !this->IsEmpty() && this->size.width > 0 && this->size.height > 0;
     }
 
-    HRESULT Load(const void* ptr, size_t cb, const SvgOptions& opt)
+    // token may stop the load before and while sanitising; resvg parses in one go
+    HRESULT Load(const void* ptr, size_t cb, const SvgOptions& opt, const CancelToken* token = nullptr)
     {
         this->Destroy();
+        HRESULT hr = CancelToken::Check(token);
+        if (FAILED(hr)) {
+            return hr;
+        }
         Sanitiser sans;
-        if (opt.GetWorkaround() && sans.Run(ptr, cb)) {
-            ptr = sans.GetData();
-            cb = sans.GetSize();
+        if (opt.GetWorkaround()) {
+            hr = sans.Run(ptr, cb, token);
+            if (CancelToken::IsCancellation(hr)) {
+                return hr;
+            }
+            if (SUCCEEDED(hr)) {
+                ptr = sans.GetData();
+                cb = sans.GetSize();
+            }
         }
-        this->error = static_cast<resvg_error>(::resvg_parse_tree_from_data(static_cast<const char*>(ptr), cb, opt.GetOptions(), &this->tree));
+        return this->Parse(ptr, cb, opt);
+    }
+
+    // Same as Load without the sanitiser, for data that has been through it already
+    HRESULT Parse(const void* ptr, size_t cb, const SvgOptions& opt)
+    {
+        this->Destroy();
+        this->error = this->tree.Parse(ptr, cb, opt.GetOptions());
         HRESULT hr = HresultFromKnownResvgError(this->error);
         if (SUCCEEDED(hr)) {
-            resvg_size size = ::resvg_get_image_size(this->tree);
+            resvg_size size = this->tree.GetSize();
             if (size.width > MAX_SIZE || size.height > MAX_SIZE) {
                 this->Destroy();
                 return E_OUTOFMEMORY;
@@ -154,7 +310,7 @@ public:
         return hr;
     }
 
-    HRESULT Load(const wchar_t* path, const SvgOptions& opt)
+    HRESULT Load(const PathChar* path, const SvgOptions& opt, const CancelToken* token = nullptr)
     {
         this->Destroy();
         size_t cb;
@@ -162,7 +318,7 @@ public:
         if (ptr == nullptr) {
             return HRESULT_FROM_WIN32(::GetLastError());
         }
-        HRESULT hr = this->Load(ptr, cb, opt);
+        HRESULT hr = this->Load(ptr, cb, opt, token);
         mmclose(ptr);
         return hr;
     }
@@ -186,6 +342,82 @@ public:
         }
         return TSvgRenderTarget::Render(this->tree, opt, target);
     }
+
+    template <class TRenderOptions>
+    HRESULT RenderTo(const TRenderOptions& opt, uint32_t width, uint32_t height, uint32_t* pixmap) const
+    {
+        if (!this->IsRenderable()) {
+            return E_FAIL;
+        }
+        return opt.RenderTo(this->tree, width, height, pixmap);
+    }
+
+    // Renders in horizontal stripes to keep memory bounded, see SvgRenderTarget::RenderStripes
+    template <class TRenderOptions, class TCallback>
+    HRESULT RenderStripes(const TRenderOptions& opt, uint32_t stripeRows, uint32_t overlap, const TCallback& callback) const
+    {
+        if (!this->IsRenderable()) {
+            return E_FAIL;
+        }
+        return opt.RenderStripes(this->tree, stripeRows, overlap, callback);
+    }
+
+    // Quick preview first, then full quality, see SvgRenderTarget::RenderProgressive
+    template <class TSvgRenderTarget, class TCallback, class TCancelled>
+    HRESULT RenderProgressive(const typename TSvgRenderTarget::RenderOptions& opt, uint32_t previewDivisor, const TCallback& callback, const TCancelled& cancelled, TSvgRenderTarget* target) const
+    {
+        if (!this->IsRenderable()) {
+            return E_FAIL;
+        }
+        return TSvgRenderTarget::RenderProgressive(this->tree, opt, previewDivisor, callback, cancelled, target);
+    }
+
+    template <class TSvgRenderTarget>
+    HRESULT RenderBatch(const typename TSvgRenderTarget::RenderOptions* opts, size_t count, TSvgRenderTarget* targets, HRESULT* results = nullptr) const
+    {
+        if (!this->IsRenderable()) {
+            return E_FAIL;
+        }
+        return TSvgRenderTarget::RenderBatch(this->tree, opts, count, targets, results);
+    }
+
+    template <class TSvgRenderTarget>
+    HRESULT RenderNode(const char* id, const typename TSvgRenderTarget::RenderOptions& opt, TSvgRenderTarget* target) const
+    {
+        if (this->IsNull()) {
+            return E_FAIL;
+        }
+        return TSvgRenderTarget::RenderNode(this->tree, id, opt, target);
+    }
+
+    // Renders many elements, e.g. icons of a sprite sheet, from this single parse
+    template <class TSvgRenderTarget>
+    HRESULT RenderNodes(const char* const* ids, size_t count, const typename TSvgRenderTarget::RenderOptions& opt, TSvgRenderTarget* targets, HRESULT* results = nullptr) const
+    {
+        if (this->IsNull()) {
+            return E_FAIL;
+        }
+        return TSvgRenderTarget::RenderNodes(this->tree, ids, count, opt, targets, results);
+    }
+
+    template <class TSvgRenderTarget>
+    HRESULT RenderMipmaps(const uint32_t* sizes, size_t count, TSvgRenderTarget* targets, typename TSvgRenderTarget::MipmapPolicy* policy = nullptr) const
+    {
+        if (!this->IsRenderable()) {
+            return E_FAIL;
+        }
+        return TSvgRenderTarget::RenderMipmaps(this->tree, sizes, count, targets, policy);
+    }
+
+    // Smaller thumbnails of a render of this parse
+    template <class TSvgRenderTarget>
+    HRESULT DeriveMipmaps(const TSvgRenderTarget& source, const uint32_t* sizes, size_t count, TSvgRenderTarget* targets, HRESULT* results = nullptr, typename TSvgRenderTarget::MipmapPolicy* policy = nullptr) const
+    {
+        if (!this->IsRenderable()) {
+            return E_FAIL;
+        }
+        return TSvgRenderTarget::DeriveMipmaps(this->tree, source, sizes, count, targets, results, policy);
+    }
 };
 
 
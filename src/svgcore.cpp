@@ -0,0 +1,551 @@
+#define _WIN32_WINNT    0x0A00
+#define STRICT
+#include "platform.h"
+#include <stddef.h>
+#include <new>
+
+#include "svgcore.h"
+#include "svg.hpp"
+#include "render.hpp"
+#include "export.hpp"
+#include "convert.hpp"
+#include "parallel.hpp"
+#include "complexity.hpp"
+
+
+static_assert(SVGCORE_FILTER_TYPES == SvgFilterTypeCount, "filter types out of step");
+
+struct svgcore_document
+{
+    Svg svg;
+};
+
+
+// Whether the caller's version of a struct that starts with its size has the member
+#define SVGCORE_HAS(ptr, type, member) ((ptr)->size >= offsetof(type, member) + sizeof((ptr)->member))
+
+
+// Hands the encoded bytes to the caller's write function
+class CallbackSink : public ByteSink
+{
+private:
+    svgcore_write_fn write;
+    void* context;
+
+public:
+    CallbackSink(svgcore_write_fn write, void* context)
+        : write(write)
+        , context(context)
+    {
+    }
+
+    HRESULT Write(const void* data, size_t cb) override
+    {
+        const svgcore_result result = this->write(this->context, data, cb);
+        return result < 0 ? static_cast<HRESULT>(result) : S_OK;
+    }
+};
+
+
+// What the C functions are made of
+class SvgCore
+{
+private:
+    static const uint32_t STRIPE_OVERLAP = 8;
+    // Conversions of at least this many pixels are split into bands run on the task scheduler
+    static const size_t PARALLEL_PIXELS = 1 << 20;
+    static const uint32_t BAND_ROWS = 64;
+
+public:
+    SvgCore() = delete;
+    ~SvgCore() = delete;
+
+    // C callers get the error rather than an exception through their frames
+    template <class TFunc>
+    static svgcore_result Call(const TFunc& fn)
+    {
+        try {
+            return static_cast<svgcore_result>(fn());
+        } catch (...) {
+            return static_cast<svgcore_result>(E_OUTOFMEMORY);
+        }
+    }
+
+    static size_t GetBytesPerPixel(svgcore_format format)
+    {
+        switch (format) {
+        case SVGCORE_FORMAT_PRGBA8:
+        case SVGCORE_FORMAT_RGBA8:
+        case SVGCORE_FORMAT_PBGRA8:
+        case SVGCORE_FORMAT_BGRA8:
+        case SVGCORE_FORMAT_PARGB8:
+        case SVGCORE_FORMAT_ARGB8:
+            return 4;
+        case SVGCORE_FORMAT_RGB565:
+        case SVGCORE_FORMAT_GRAYA8:
+            return 2;
+        case SVGCORE_FORMAT_GRAY8:
+        case SVGCORE_FORMAT_ALPHA8:
+            return 1;
+        case SVGCORE_FORMAT_RGBA16:
+            return 8;
+        default:
+            return 0;
+        }
+    }
+
+    static bool IsValidStride(ptrdiff_t stride, uint32_t width, svgcore_format format)
+    {
+        const size_t cb = GetBytesPerPixel(format);
+        const size_t cbStride = stride < 0 ? 0 - static_cast<size_t>(stride) : static_cast<size_t>(stride);
+        return cb != 0 && width <= PTRDIFF_MAX / cb && cbStride >= width * cb;
+    }
+
+    template <class TSrc>
+    static void ConvertFrom(const void* src, ptrdiff_t srcStride, void* dst, ptrdiff_t dstStride, svgcore_format dstFormat, uint32_t width, uint32_t height)
+    {
+        switch (dstFormat) {
+        case SVGCORE_FORMAT_PRGBA8:
+            PixelConverter::Convert<TSrc, FormatPRGBA8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_RGBA8:
+            PixelConverter::Convert<TSrc, FormatRGBA8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_PBGRA8:
+            PixelConverter::Convert<TSrc, FormatPBGRA8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_BGRA8:
+            PixelConverter::Convert<TSrc, FormatBGRA8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_PARGB8:
+            PixelConverter::Convert<TSrc, FormatPARGB8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_ARGB8:
+            PixelConverter::Convert<TSrc, FormatARGB8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_RGB565:
+            PixelConverter::Convert<TSrc, FormatRGB565>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_GRAY8:
+            PixelConverter::Convert<TSrc, FormatGray8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_GRAYA8:
+            PixelConverter::Convert<TSrc, FormatGrayA8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_ALPHA8:
+            PixelConverter::Convert<TSrc, FormatAlpha8>(src, srcStride, dst, dstStride, width, height);
+            break;
+        case SVGCORE_FORMAT_RGBA16:
+            PixelConverter::Convert<TSrc, FormatRGBA16>(src, srcStride, dst, dstStride, width, height);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // The formats are known to be valid
+    static void ConvertRows(const void* src, ptrdiff_t srcStride, svgcore_format srcFormat, void* dst, ptrdiff_t dstStride, svgcore_format dstFormat, uint32_t width, uint32_t height)
+    {
+        switch (srcFormat) {
+        case SVGCORE_FORMAT_PRGBA8:
+            ConvertFrom<FormatPRGBA8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_RGBA8:
+            ConvertFrom<FormatRGBA8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_PBGRA8:
+            ConvertFrom<FormatPBGRA8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_BGRA8:
+            ConvertFrom<FormatBGRA8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_PARGB8:
+            ConvertFrom<FormatPARGB8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_ARGB8:
+            ConvertFrom<FormatARGB8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_RGB565:
+            ConvertFrom<FormatRGB565>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_GRAY8:
+            ConvertFrom<FormatGray8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_GRAYA8:
+            ConvertFrom<FormatGrayA8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_ALPHA8:
+            ConvertFrom<FormatAlpha8>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        case SVGCORE_FORMAT_RGBA16:
+            ConvertFrom<FormatRGBA16>(src, srcStride, dst, dstStride, dstFormat, width, height);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Same in bands on the task scheduler when there are enough pixels to be worth it
+    static void ConvertBands(const void* src, ptrdiff_t srcStride, svgcore_format srcFormat, void* dst, ptrdiff_t dstStride, svgcore_format dstFormat, uint32_t width, uint32_t height)
+    {
+        if (static_cast<size_t>(width) * height < PARALLEL_PIXELS) {
+            ConvertRows(src, srcStride, srcFormat, dst, dstStride, dstFormat, width, height);
+            return;
+        }
+        Parallel::For((height + BAND_ROWS - 1) / BAND_ROWS, [&](size_t i) {
+            const uint32_t y = static_cast<uint32_t>(i) * BAND_ROWS;
+            ConvertRows(static_cast<const uint8_t*>(src) + srcStride * static_cast<ptrdiff_t>(y), srcStride, srcFormat,
+                static_cast<uint8_t*>(dst) + dstStride * static_cast<ptrdiff_t>(y), dstStride, dstFormat,
+                width, BAND_ROWS < height - y ? BAND_ROWS : height - y);
+        });
+    }
+
+    static HRESULT ToSvgOptions(const svgcore_open_options* options, SvgOptions* opt)
+    {
+        if (opt->GetOptions() == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        uint32_t flags = 0;
+        if (options != nullptr) {
+            if (SVGCORE_HAS(options, svgcore_open_options, flags)) {
+                flags = options->flags;
+            }
+            if (SVGCORE_HAS(options, svgcore_open_options, dpi) && options->dpi > 0) {
+                opt->SetDpi(options->dpi);
+            }
+            if (SVGCORE_HAS(options, svgcore_open_options, resources_dir) && options->resources_dir != nullptr) {
+                opt->SetResourcesDir(options->resources_dir);
+            }
+            if (SVGCORE_HAS(options, svgcore_open_options, font_family) && options->font_family != nullptr) {
+                opt->SetFontFamily(options->font_family);
+            }
+            if (SVGCORE_HAS(options, svgcore_open_options, monospace_family) && options->monospace_family != nullptr) {
+                opt->SetMonospaceFamily(options->monospace_family);
+            }
+            if (SVGCORE_HAS(options, svgcore_open_options, languages) && options->languages != nullptr) {
+                opt->SetLanguages(options->languages);
+            }
+        }
+        if ((flags & SVGCORE_OPEN_NO_SYSTEM_FONTS) == 0) {
+            opt->LoadSystemFonts();
+        }
+        opt->SetWorkaround((flags & SVGCORE_OPEN_NO_WORKAROUND) == 0);
+        return S_OK;
+    }
+
+    static HRESULT ToRenderOptions(const svgcore_render_options* options, SvgRenderTarget::RenderOptions* opt)
+    {
+        if (options == nullptr) {
+            return S_OK;
+        }
+        const svgcore_fit fit = SVGCORE_HAS(options, svgcore_render_options, fit) ? options->fit : SVGCORE_FIT_SCALE;
+        switch (fit) {
+        case SVGCORE_FIT_SCALE:
+            opt->SetScale(SVGCORE_HAS(options, svgcore_render_options, scale) && options->scale > 0 ? options->scale : 1);
+            return S_OK;
+        case SVGCORE_FIT_CONTAIN:
+        case SVGCORE_FIT_COVER:
+            if (!SVGCORE_HAS(options, svgcore_render_options, height)) {
+                return E_INVALIDARG;
+            }
+            opt->SetCanvasSize(options->width, options->height);
+            if (fit == SVGCORE_FIT_CONTAIN) {
+                opt->SetToContain();
+            } else {
+                opt->SetToCover();
+            }
+            return S_OK;
+        default:
+            return E_INVALIDARG;
+        }
+    }
+
+    // Resources are looked up next to the file unless the caller says otherwise
+    static bool HasResourcesDir(const svgcore_open_options* options)
+    {
+        return options != nullptr && SVGCORE_HAS(options, svgcore_open_options, resources_dir) && options->resources_dir != nullptr;
+    }
+
+    static HRESULT SetResourcesDirOf(const char* path, SvgOptions* opt)
+    {
+        const char* slash = ::strrchr(path, '/');
+#ifdef _WIN32
+        const char* backslash = ::strrchr(path, '\\');
+        if (backslash != nullptr && (slash == nullptr || backslash > slash)) {
+            slash = backslash;
+        }
+#endif
+        if (slash == nullptr) {
+            opt->SetResourcesDir(".");
+            return S_OK;
+        }
+        const size_t cch = slash == path ? 1 : slash - path;
+        char* dir = static_cast<char*>(::malloc(cch + 1));
+        if (dir == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        ::memcpy(dir, path, cch);
+        dir[cch] = '\0';
+        opt->SetResourcesDir(dir);
+        ::free(dir);
+        return S_OK;
+    }
+
+#ifdef _WIN32
+    static HRESULT LoadFile(Svg* svg, const char* path, const SvgOptions& opt)
+    {
+        const int cch = ::MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path, -1, nullptr, 0);
+        if (cch <= 0) {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+        wchar_t* wide = static_cast<wchar_t*>(::malloc(cch * sizeof(wchar_t)));
+        if (wide == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        ::MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, path, -1, wide, cch);
+        HRESULT hr = svg->Load(wide, opt);
+        ::free(wide);
+        return hr;
+    }
+#else
+    static HRESULT LoadFile(Svg* svg, const char* path, const SvgOptions& opt)
+    {
+        return svg->Load(path, opt);
+    }
+#endif
+
+    static HRESULT Open(const void* data, size_t size, const char* path, const svgcore_open_options* options, svgcore_document** document)
+    {
+        svgcore_document* self = new(std::nothrow) svgcore_document();
+        if (self == nullptr) {
+            return E_OUTOFMEMORY;
+        }
+        SvgOptions opt;
+        HRESULT hr = ToSvgOptions(options, &opt);
+        if (SUCCEEDED(hr) && path != nullptr && !HasResourcesDir(options)) {
+            hr = SetResourcesDirOf(path, &opt);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = path != nullptr ? LoadFile(&self->svg, path, opt) : self->svg.Load(data, size, opt);
+        }
+        if (SUCCEEDED(hr) && !self->svg.IsRenderable()) {
+            hr = E_FAIL;
+        }
+        if (FAILED(hr)) {
+            delete self;
+            return hr;
+        }
+        *document = self;
+        return S_OK;
+    }
+
+    static HRESULT Render(const svgcore_document* document, const svgcore_render_options* options, void* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, svgcore_format format)
+    {
+        if (document == nullptr || pixels == nullptr || width == 0 || height == 0 || !IsValidStride(stride, width, format)) {
+            return E_INVALIDARG;
+        }
+        SvgRenderTarget::RenderOptions opt;
+        HRESULT hr = ToRenderOptions(options, &opt);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        opt.SetClip(0, 0, width, height);
+        if (format == SVGCORE_FORMAT_PRGBA8 && stride == static_cast<ptrdiff_t>(width) * 4) {
+            // Straight into the caller's buffer
+            ::memset(pixels, 0, static_cast<size_t>(stride) * height);
+            return document->svg.RenderTo(opt, width, height, static_cast<uint32_t*>(pixels));
+        }
+        // One stripe at a time, converted on its way out
+        return document->svg.RenderStripes(opt, 0, STRIPE_OVERLAP, [&](const uint32_t* src, uint32_t cx, uint32_t, uint32_t y, uint32_t rows) {
+            ConvertBands(src, static_cast<ptrdiff_t>(cx) * 4, SVGCORE_FORMAT_PRGBA8,
+                static_cast<uint8_t*>(pixels) + stride * static_cast<ptrdiff_t>(y), stride, format, cx, rows);
+            return S_OK;
+        });
+    }
+
+    static HRESULT Encode(const void* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, svgcore_encoding encoding, svgcore_write_fn write, void* context)
+    {
+        if (pixels == nullptr || write == nullptr || width == 0 || height == 0 || stride <= 0 || stride % 4 != 0 || !IsValidStride(stride, width, SVGCORE_FORMAT_PRGBA8)) {
+            return E_INVALIDARG;
+        }
+        CallbackSink sink(write, context);
+        const uint32_t* src = static_cast<const uint32_t*>(pixels);
+        const size_t pitch = static_cast<size_t>(stride) / 4;
+        switch (encoding) {
+        case SVGCORE_ENCODING_PNG:
+            return SvgExporter::SaveCompactPng(src, width, height, pitch, &sink);
+        case SVGCORE_ENCODING_QOI: {
+            QoiWriter writer;
+            HRESULT hr = writer.Begin(&sink, width, height);
+            if (SUCCEEDED(hr)) {
+                hr = writer.WriteRows(src, height, pitch);
+            }
+            if (SUCCEEDED(hr)) {
+                hr = writer.End();
+            }
+            return hr;
+        }
+        default:
+            return E_INVALIDARG;
+        }
+    }
+
+    static HRESULT Export(const svgcore_document* document, const svgcore_render_options* options, svgcore_encoding encoding, svgcore_write_fn write, void* context)
+    {
+        if (document == nullptr || write == nullptr) {
+            return E_INVALIDARG;
+        }
+        SvgRenderTarget::RenderOptions opt;
+        HRESULT hr = ToRenderOptions(options, &opt);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        CallbackSink sink(write, context);
+        switch (encoding) {
+        case SVGCORE_ENCODING_PNG:
+            return SvgExporter::SavePng(document->svg, opt, &sink);
+        case SVGCORE_ENCODING_QOI:
+            return SvgExporter::SaveQoi(document->svg, opt, &sink);
+        default:
+            return E_INVALIDARG;
+        }
+    }
+};
+
+
+extern "C" {
+
+uint32_t svgcore_version(void)
+{
+    return SVGCORE_VERSION;
+}
+
+svgcore_result svgcore_open_file(const char* path, const svgcore_open_options* options, svgcore_document** document)
+{
+    if (document == nullptr) {
+        return E_POINTER;
+    }
+    *document = nullptr;
+    if (path == nullptr) {
+        return E_INVALIDARG;
+    }
+    return SvgCore::Call([&] {
+        return SvgCore::Open(nullptr, 0, path, options, document);
+    });
+}
+
+svgcore_result svgcore_open_memory(const void* data, size_t size, const svgcore_open_options* options, svgcore_document** document)
+{
+    if (document == nullptr) {
+        return E_POINTER;
+    }
+    *document = nullptr;
+    if (data == nullptr || size == 0) {
+        return E_INVALIDARG;
+    }
+    return SvgCore::Call([&] {
+        return SvgCore::Open(data, size, nullptr, options, document);
+    });
+}
+
+void svgcore_close(svgcore_document* document)
+{
+    delete document;
+}
+
+svgcore_result svgcore_get_size(const svgcore_document* document, double* width, double* height)
+{
+    if (document == nullptr || width == nullptr || height == nullptr) {
+        return E_INVALIDARG;
+    }
+    const resvg_size size = document->svg.GetSize();
+    *width = size.width;
+    *height = size.height;
+    return S_OK;
+}
+
+svgcore_result svgcore_probe(const void* data, size_t size, svgcore_complexity* complexity)
+{
+    if (data == nullptr || complexity == nullptr) {
+        return E_INVALIDARG;
+    }
+    return SvgCore::Call([&] {
+        Sanitiser sans;
+        SvgComplexity counts;
+        HRESULT hr = sans.Run(data, size, nullptr, &counts);
+        if (SUCCEEDED(hr)) {
+            complexity->bytes = counts.bytes;
+            complexity->elements = counts.elements;
+            complexity->path_commands = counts.pathCommands;
+            complexity->path_coordinates = counts.pathCoordinates;
+            complexity->filter_primitives = counts.filterPrimitives;
+            for (int i = 0; i < SvgFilterTypeCount; i++) {
+                complexity->filters[i] = counts.filters[i];
+            }
+            complexity->gradients = counts.gradients;
+            complexity->masks = counts.masks;
+            complexity->clip_paths = counts.clipPaths;
+            complexity->texts = counts.texts;
+            complexity->images = counts.images;
+            complexity->image_bytes = counts.imageBytes;
+        }
+        return hr;
+    });
+}
+
+const char* svgcore_filter_name(uint32_t type)
+{
+    return type < SvgFilterTypeCount ? SvgComplexity::GetFilterName(static_cast<SvgFilterType>(type)) : nullptr;
+}
+
+svgcore_result svgcore_get_image_size(const svgcore_document* document, const svgcore_render_options* options, uint32_t* width, uint32_t* height)
+{
+    if (document == nullptr || width == nullptr || height == nullptr) {
+        return E_INVALIDARG;
+    }
+    SvgRenderTarget::RenderOptions opt;
+    HRESULT hr = SvgCore::ToRenderOptions(options, &opt);
+    if (FAILED(hr)) {
+        return hr;
+    }
+    UINT cx = 0;
+    UINT cy = 0;
+    hr = document->svg.CalcImageSize(opt, &cx, &cy);
+    *width = cx;
+    *height = cy;
+    return hr;
+}
+
+svgcore_result svgcore_render(const svgcore_document* document, const svgcore_render_options* options, void* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, svgcore_format format)
+{
+    return SvgCore::Call([&] {
+        return SvgCore::Render(document, options, pixels, width, height, stride, format);
+    });
+}
+
+svgcore_result svgcore_convert(const void* src, ptrdiff_t src_stride, svgcore_format src_format, void* dst, ptrdiff_t dst_stride, svgcore_format dst_format, uint32_t width, uint32_t height)
+{
+    if (src == nullptr || dst == nullptr || !SvgCore::IsValidStride(src_stride, width, src_format) || !SvgCore::IsValidStride(dst_stride, width, dst_format)) {
+        return E_INVALIDARG;
+    }
+    return SvgCore::Call([&] {
+        SvgCore::ConvertBands(src, src_stride, src_format, dst, dst_stride, dst_format, width, height);
+        return S_OK;
+    });
+}
+
+svgcore_result svgcore_encode(const void* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, svgcore_encoding encoding, svgcore_write_fn write, void* context)
+{
+    return SvgCore::Call([&] {
+        return SvgCore::Encode(pixels, width, height, stride, encoding, write, context);
+    });
+}
+
+svgcore_result svgcore_export(const svgcore_document* document, const svgcore_render_options* options, svgcore_encoding encoding, svgcore_write_fn write, void* context)
+{
+    return SvgCore::Call([&] {
+        return SvgCore::Export(document, options, encoding, write, context);
+    });
+}
+
+}
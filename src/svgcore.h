@@ -0,0 +1,183 @@
+#ifndef SVGCORE_H
+#define SVGCORE_H
+
+// C interface to the renderer, for use outside the shell extension and on other platforms
+// Everything is reached through opaque handles and plain structs, so that programs built
+// against one version keep working with later ones: functions and enum values are only ever
+// added, and structs passed in start with their size so that fields can be added at the end.
+// Results are HRESULT values, negative on failure. A document may be used from several threads
+// at once, but its calls into resvg take turns on a lock of its own, so renders of one document
+// do not overlap; open it once per thread for that. A handle is closed once, after every other
+// call on it has returned. The enums end in a MAX_ENUM value that is never valid, which keeps
+// them as wide as an int, so any value can be passed.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define SVGCORE_API
+#elif defined(__GNUC__)
+#define SVGCORE_API __attribute__((visibility("default")))
+#else
+#define SVGCORE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped when something is added
+#define SVGCORE_VERSION 1
+
+typedef int32_t svgcore_result;
+
+#define SVGCORE_SUCCEEDED(r)    ((r) >= 0)
+#define SVGCORE_FAILED(r)       ((r) < 0)
+
+typedef struct svgcore_document svgcore_document;
+
+enum
+{
+    // Skips loading the installed fonts, which is slow; text then renders with none
+    SVGCORE_OPEN_NO_SYSTEM_FONTS = 0x1,
+    // Parses the text as it is, without the rewrites that work around resvg issues
+    SVGCORE_OPEN_NO_WORKAROUND = 0x2,
+};
+
+typedef struct svgcore_open_options
+{
+    // sizeof(svgcore_open_options)
+    uint32_t size;
+    uint32_t flags;
+    // Zero for 96
+    double dpi;
+    // UTF-8; null for the defaults, and for the directory of the file if there is one
+    const char* resources_dir;
+    const char* font_family;
+    const char* monospace_family;
+    // Comma separated, e.g. "en,de"
+    const char* languages;
+} svgcore_open_options;
+
+// How the document is sized to the output
+typedef enum svgcore_fit
+{
+    // Its own size times scale
+    SVGCORE_FIT_SCALE,
+    // As large as fits in width by height, keeping the aspect ratio
+    SVGCORE_FIT_CONTAIN,
+    // As small as covers width by height, keeping the aspect ratio
+    SVGCORE_FIT_COVER,
+    SVGCORE_FIT_MAX_ENUM = 0x7fffffff,
+} svgcore_fit;
+
+typedef struct svgcore_render_options
+{
+    // sizeof(svgcore_render_options)
+    uint32_t size;
+    svgcore_fit fit;
+    // For SVGCORE_FIT_SCALE; zero for 1
+    float scale;
+    // For the other fits
+    uint32_t width;
+    uint32_t height;
+} svgcore_render_options;
+
+// Pixel layouts, eight bits per channel unless named otherwise
+typedef enum svgcore_format
+{
+    // Premultiplied RGBA, which is what the renderer produces
+    SVGCORE_FORMAT_PRGBA8,
+    SVGCORE_FORMAT_RGBA8,
+    SVGCORE_FORMAT_PBGRA8,
+    SVGCORE_FORMAT_BGRA8,
+    SVGCORE_FORMAT_PARGB8,
+    SVGCORE_FORMAT_ARGB8,
+    // 5-6-5 bits with red at the top, of the image over black
+    SVGCORE_FORMAT_RGB565,
+    // Luma of the image over black
+    SVGCORE_FORMAT_GRAY8,
+    // Straight luma and alpha
+    SVGCORE_FORMAT_GRAYA8,
+    // Coverage only
+    SVGCORE_FORMAT_ALPHA8,
+    // Straight RGBA, sixteen bits per channel in native byte order
+    SVGCORE_FORMAT_RGBA16,
+    SVGCORE_FORMAT_MAX_ENUM = 0x7fffffff,
+} svgcore_format;
+
+typedef enum svgcore_encoding
+{
+    SVGCORE_ENCODING_PNG,
+    SVGCORE_ENCODING_QOI,
+    SVGCORE_ENCODING_MAX_ENUM = 0x7fffffff,
+} svgcore_encoding;
+
+// Receives encoded bytes in order; returns a negative value to stop the encoder with it
+typedef svgcore_result (*svgcore_write_fn)(void* context, const void* data, size_t size);
+
+#define SVGCORE_FILTER_TYPES 17
+
+// Structure of a document, as counted by svgcore_probe without parsing it
+typedef struct svgcore_complexity
+{
+    // Of the text after gzip is inflated
+    uint64_t bytes;
+    uint32_t elements;
+    uint32_t path_commands;
+    uint32_t path_coordinates;
+    uint32_t filter_primitives;
+    // Per type, in the order of svgcore_filter_name
+    uint32_t filters[SVGCORE_FILTER_TYPES];
+    uint32_t gradients;
+    uint32_t masks;
+    uint32_t clip_paths;
+    uint32_t texts;
+    uint32_t images;
+    // Decoded size of the images embedded as data URLs
+    uint64_t image_bytes;
+} svgcore_complexity;
+
+SVGCORE_API uint32_t svgcore_version(void);
+
+// options may be null for the defaults; path is UTF-8
+SVGCORE_API svgcore_result svgcore_open_file(const char* path, const svgcore_open_options* options, svgcore_document** document);
+
+// The data may be SVG or gzipped SVG, and is not needed after this returns
+SVGCORE_API svgcore_result svgcore_open_memory(const void* data, size_t size, const svgcore_open_options* options, svgcore_document** document);
+
+SVGCORE_API void svgcore_close(svgcore_document* document);
+
+// Size in user units, as given by the document
+SVGCORE_API svgcore_result svgcore_get_size(const svgcore_document* document, double* width, double* height);
+
+// Counts what a document holds in a single pass over the text, e.g. to decide whether it is
+// worth rendering; much cheaper than opening it
+SVGCORE_API svgcore_result svgcore_probe(const void* data, size_t size, svgcore_complexity* complexity);
+
+SVGCORE_API const char* svgcore_filter_name(uint32_t type);
+
+// Size in pixels the document renders at with the options, which may be null for its own size
+SVGCORE_API svgcore_result svgcore_get_image_size(const svgcore_document* document, const svgcore_render_options* options, uint32_t* width, uint32_t* height);
+
+// Renders into the caller's buffer of width by height pixels, which is overwritten
+// Content beyond it is cut off. stride is in bytes and may be negative for a bottom-up image,
+// in which case pixels points at the top row.
+SVGCORE_API svgcore_result svgcore_render(const svgcore_document* document, const svgcore_render_options* options, void* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, svgcore_format format);
+
+// Converts width by height pixels between any two layouts; strides are in bytes
+SVGCORE_API svgcore_result svgcore_convert(const void* src, ptrdiff_t src_stride, svgcore_format src_format, void* dst, ptrdiff_t dst_stride, svgcore_format dst_format, uint32_t width, uint32_t height);
+
+// Encodes premultiplied RGBA; stride is in bytes and a positive multiple of four
+// PNG is stored with indexed colour when the image has at most 256 colours, RGBA otherwise.
+SVGCORE_API svgcore_result svgcore_encode(const void* pixels, uint32_t width, uint32_t height, ptrdiff_t stride, svgcore_encoding encoding, svgcore_write_fn write, void* context);
+
+// Renders and encodes in stripes, so that memory does not grow with the output size
+// PNG is always RGBA, as the whole image is never at hand to count its colours.
+SVGCORE_API svgcore_result svgcore_export(const svgcore_document* document, const svgcore_render_options* options, svgcore_encoding encoding, svgcore_write_fn write, void* context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef SVG_OPTIONS_H
 #define SVG_OPTIONS_H
 
+#ifdef _WIN32
 #include "utf8str.hpp"
+#endif
 
 class SvgOptions
 {
@@ -16,10 +18,16 @@ public:
         (*this)
             // TODO: dpi aware
             .SetDpi(96.)
+#ifdef _WIN32
             // TODO: use EnumFontFamilies()
             .SetFontFamily("Microsoft Sans Serif")
             .SetFontSize(12.)
             .SetMonospaceFamily("Consolas")
+#else
+            .SetFontFamily("DejaVu Sans")
+            .SetFontSize(12.)
+            .SetMonospaceFamily("DejaVu Sans Mono")
+#endif
             // TODO: use GetSystemPreferredUILanguages()
             .SetLanguages("en");
     }
@@ -64,6 +72,7 @@ public:
         return *this;
     }
 
+#ifdef _WIN32
     SvgOptions& SetResourcesDir(LPCWSTR path) noexcept
     {
         if (this->opt != nullptr) {
@@ -72,7 +81,18 @@ public:
         }
         return *this;
     }
+#endif
+
+    // UTF-8, as are the other strings
+    SvgOptions& SetResourcesDir(const char* path) noexcept
+    {
+        if (this->opt != nullptr) {
+            ::resvg_options_set_resources_dir(this->opt, path);
+        }
+        return *this;
+    }
 
+#ifdef _WIN32
     SvgOptions& SetFontFamily(LPCWSTR name) noexcept
     {
         if (this->opt != nullptr) {
@@ -81,6 +101,7 @@ public:
         }
         return *this;
     }
+#endif
 
     SvgOptions& SetFontFamily(const char* name) noexcept
     {
@@ -90,6 +111,7 @@ public:
         return *this;
     }
 
+#ifdef _WIN32
     SvgOptions& SetMonospaceFamily(LPCWSTR name) noexcept
     {
         if (this->opt != nullptr) {
@@ -98,6 +120,7 @@ public:
         }
         return *this;
     }
+#endif
 
     SvgOptions& SetMonospaceFamily(const char* name) noexcept
     {
@@ -107,6 +130,7 @@ public:
         return *this;
     }
 
+#ifdef _WIN32
     SvgOptions& SetLanguages(LPCWSTR langs) noexcept
     {
         if (this->opt != nullptr) {
@@ -115,6 +139,7 @@ public:
         }
         return *this;
     }
+#endif
 
     SvgOptions& SetLanguages(const char* langs) noexcept
     {
@@ -138,6 +163,15 @@ public:
         return *this;
     }
 
+    // Keeps groups with an id in the tree, so that they can be rendered on their own
+    SvgOptions& SetKeepNamedGroups(bool enabled) noexcept
+    {
+        if (this->opt != nullptr) {
+            ::resvg_options_set_keep_named_groups(this->opt, enabled);
+        }
+        return *this;
+    }
+
     resvg_options* GetOptions() const noexcept
     {
         return this->opt;
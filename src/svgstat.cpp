@@ -0,0 +1,134 @@
+#define _WIN32_WINNT    0x0A00
+#define STRICT
+#include "platform.h"
+#include <stdio.h>
+#include <wchar.h>
+#include <chrono>
+
+#include "svg.hpp"
+#include "complexity.hpp"
+
+#ifdef _WIN32
+#define PATH_FORMAT "%ls"
+#else
+#define PATH_FORMAT "%s"
+#endif
+
+
+// Prints the structure of SVG documents, one tab-separated line each, to find out what makes
+// some of them slow; with -t it also times the sanitiser pass without and with the scan, their
+// difference being what the scan costs, against a full parse of the same text
+class SvgStat
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Fastest of these many passes, as single files are small enough for the timer to be noisy
+    static const int RUNS = 5;
+
+    bool timed = false;
+
+    static double GetMilliseconds(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    static void PrintHeader(bool timed)
+    {
+        ::printf("file\tbytes\telements\tpathCommands\tpathCoordinates\tfilterPrimitives\tgradients\tmasks\tclipPaths\ttexts\timages\timageBytes\tfilters");
+        ::printf(timed ? "\tsanitiseMs\tscanMs\tparseMs\n" : "\n");
+    }
+
+    // Milliseconds of the fastest sanitiser pass, with the scan when complexity is given
+    static double TimeSanitiser(const void* ptr, size_t cb, SvgComplexity* complexity)
+    {
+        double best = 0;
+        for (int i = 0; i < RUNS; i++) {
+            Sanitiser sans;
+            const auto start = Clock::now();
+            sans.Run(ptr, cb, nullptr, complexity);
+            const double ms = GetMilliseconds(start);
+            best = i == 0 || ms < best ? ms : best;
+        }
+        return best;
+    }
+
+    void PrintFile(const PathChar* path) const
+    {
+        size_t cb = 0;
+        const void* ptr = mmopen(path, &cb);
+        if (ptr == nullptr) {
+            ::fprintf(stderr, PATH_FORMAT ": cannot open (%lu)\n", path, static_cast<unsigned long>(::GetLastError()));
+            return;
+        }
+        Sanitiser sans;
+        SvgComplexity complexity;
+        HRESULT hr = sans.Run(ptr, cb, nullptr, &complexity);
+        if (FAILED(hr)) {
+            mmclose(ptr);
+            ::fprintf(stderr, PATH_FORMAT ": cannot scan (%08lx)\n", path, static_cast<unsigned long>(hr));
+            return;
+        }
+        ::printf(PATH_FORMAT, path);
+        ::printf("\t%llu\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%llu\t",
+            static_cast<unsigned long long>(complexity.bytes), complexity.elements,
+            complexity.pathCommands, complexity.pathCoordinates, complexity.filterPrimitives,
+            complexity.gradients, complexity.masks, complexity.clipPaths, complexity.texts,
+            complexity.images, static_cast<unsigned long long>(complexity.imageBytes));
+        // Only the filter types present, e.g. feGaussianBlur:2,feOffset:1
+        const char* separator = "";
+        for (int i = 0; i < SvgFilterTypeCount; i++) {
+            if (complexity.filters[i] != 0) {
+                ::printf("%s%s:%u", separator, SvgComplexity::GetFilterName(static_cast<SvgFilterType>(i)), complexity.filters[i]);
+                separator = ",";
+            }
+        }
+        if (this->timed) {
+            const double sanitiseMs = TimeSanitiser(ptr, cb, nullptr);
+            SvgComplexity scanned;
+            const double scanMs = TimeSanitiser(ptr, cb, &scanned);
+            SvgOptions opt;
+            Svg svg;
+            const auto parseStart = Clock::now();
+            hr = svg.Parse(sans.GetData(), sans.GetSize(), opt);
+            const double parseMs = GetMilliseconds(parseStart);
+            if (SUCCEEDED(hr)) {
+                ::printf("\t%.3f\t%.3f\t%.3f", sanitiseMs, scanMs, parseMs);
+            } else {
+                ::printf("\t%.3f\t%.3f\t", sanitiseMs, scanMs);
+            }
+        }
+        ::printf("\n");
+        mmclose(ptr);
+    }
+
+public:
+    int Run(int argc, PathChar** argv)
+    {
+        int first = 1;
+        if (argc > 1 && argv[1][0] == '-' && argv[1][1] == 't' && argv[1][2] == 0) {
+            this->timed = true;
+            first++;
+        }
+        if (first >= argc) {
+            ::fprintf(stderr, "usage: svgstat [-t] file...\n");
+            return 2;
+        }
+        PrintHeader(this->timed);
+        for (int i = first; i < argc; i++) {
+            this->PrintFile(argv[i]);
+        }
+        return 0;
+    }
+};
+
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t** argv)
+#else
+int main(int argc, char** argv)
+#endif
+{
+    SvgStat stat;
+    return stat.Run(argc, argv);
+}
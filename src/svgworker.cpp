@@ -0,0 +1,15 @@
+#include "platform.h"
+#include <stdio.h>
+
+#include "isolate.hpp"
+
+// The render worker RenderWorkerPool runs outside Windows, where there is no rundll32 to host it
+// in the DLL: `svgworker --render-worker` or `svgworker --render-zygote`, with the socket as stdin
+int main(int argc, char** argv)
+{
+    if (!RenderWorker::ServeIfAsked(argc, argv)) {
+        ::fprintf(stderr, "usage: svgworker %s|%s\nRuns render jobs from a RenderWorkerPool; not meant to be started by hand.\n", RenderWorker::GetWorkerArg(), RenderWorker::GetZygoteArg());
+        return 2;
+    }
+    return 0;
+}
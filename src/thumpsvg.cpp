@@ -14,17 +14,18 @@
 #include <propvarutil.h>
 
 #include <new>
+#include <deque>
 
 #pragma comment(lib, "propsys.lib")
 
-// The WICCreateImagingFactory_Proxy function is not declared in the public SDK header
-EXTERN_C DECLSPEC_IMPORT HRESULT WINAPI WICCreateImagingFactory_Proxy(_In_ UINT SDKVersion, _Out_ IWICImagingFactory** ppIImagingFactory);
-
 
 #define SVG_DLL
 #include "thumpsvg.h"
 #include "svg.hpp"
 #include "render.hpp"
+#include "quality.hpp"
+#include "isolate.hpp"
+#include "coalesce.hpp"
 #include "bitmap.hpp"
 
 #include "common.h"
@@ -473,6 +474,108 @@ public:
 };
 
 
+// Thumbnails are rendered in worker processes when HKCU\Software\thumpsvg\IsolateRendering is
+// a non-zero DWORD, so a document that crashes or hangs resvg does not take Explorer with it
+bool IsRenderingIsolated()
+{
+    DWORD value = 0;
+    DWORD cb = sizeof(value);
+    auto lr = ::RegGetValueW(HKEY_CURRENT_USER, L"Software\\thumpsvg", L"IsolateRendering", RRF_RT_REG_DWORD | RRF_SUBKEY_WOW6464KEY, nullptr, &value, &cb);
+    return lr == ERROR_SUCCESS && value != 0;
+}
+
+
+// The shell often asks several providers for the same file at once, e.g. a folder view and the
+// preview pane, which then share one render once their sources compare equal
+struct ThumbnailKey
+{
+    uint64_t fingerprint;
+    uint64_t size;
+    UINT cx;
+    RenderQuality quality;
+
+    bool operator <(const ThumbnailKey& other) const
+    {
+        if (this->fingerprint != other.fingerprint) {
+            return this->fingerprint < other.fingerprint;
+        }
+        if (this->size != other.size) {
+            return this->size < other.size;
+        }
+        if (this->cx != other.cx) {
+            return this->cx < other.cx;
+        }
+        return this->quality < other.quality;
+    }
+
+    bool operator ==(const ThumbnailKey& other) const
+    {
+        return !(*this < other) && !(other < *this);
+    }
+};
+
+
+// The shell keeps thumbnails at several sizes and asks for each one separately as views change;
+// the sizes below the one asked for come out of the same render as mipmaps and wait here, for
+// the one request each, until newer ones push them out
+class ThumbnailLevels
+{
+public:
+    // The thumbnail cache's own sizes that mipmaps serve well
+    static const UINT SIZES[5];
+    static const size_t SIZE_COUNT = sizeof(SIZES) / sizeof(SIZES[0]);
+
+private:
+    static const size_t CAPACITY = 64;
+
+    struct Level
+    {
+        ThumbnailKey key;
+        std::shared_ptr<const SvgRenderTarget> target;
+    };
+
+    std::mutex lock;
+    // Oldest first
+    std::deque<Level> levels;
+
+public:
+    bool Take(const ThumbnailKey& key, std::shared_ptr<const SvgRenderTarget>* target)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        for (auto it = this->levels.begin(); it != this->levels.end(); ++it) {
+            if (it->key == key) {
+                *target = std::move(it->target);
+                this->levels.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Put(const ThumbnailKey& key, std::shared_ptr<const SvgRenderTarget> target)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        try {
+            // A newer render of the same level replaces the older one
+            for (auto it = this->levels.begin(); it != this->levels.end(); ++it) {
+                if (it->key == key) {
+                    this->levels.erase(it);
+                    break;
+                }
+            }
+            if (this->levels.size() >= CAPACITY) {
+                this->levels.pop_front();
+            }
+            this->levels.push_back({ key, std::move(target) });
+        } catch (...) {
+            // Only a cache
+        }
+    }
+};
+
+const UINT ThumbnailLevels::SIZES[5] = { 16, 32, 48, 96, 256 };
+
+
 class DECLSPEC_NOVTABLE ThumbProviderSVG
     : public IInitializeWithFile
     , public IInitializeWithStream
@@ -482,15 +585,80 @@ class DECLSPEC_NOVTABLE ThumbProviderSVG
     , public ComBaseObject<ThumbProviderSVG>
 {
 private:
+    static const uint32_t THUMBNAIL_TIMEOUT = 2000;
+
+    // The document is parsed when the thumbnail size is known, since the rendering modes
+    // are fixed at parse time; it is sanitised once before that, which also gives its structure
+    // to choose the modes by
+    MemData source;
+    Sanitiser sanitised;
+    SvgComplexity complexity;
+    bool scanned = false;
+    HRESULT scanResult = E_UNEXPECTED;
     Svg svg;
+    bool parsed = false;
+    HRESULT parseResult = E_UNEXPECTED;
+    RenderQuality quality = RenderQualitySpeed;
     ComPtr<IPropertyStoreCache> cache;
 
     void Destroy() noexcept
     {
+        this->source.Free();
+        this->scanned = false;
+        this->complexity = SvgComplexity();
         this->svg.Destroy();
+        this->parsed = false;
         this->cache.Release();
     }
 
+    // Sanitises the source and gathers its structure, unless that is already done
+    HRESULT Scan(const CancelToken* token = nullptr) noexcept
+    {
+        if (this->scanned) {
+            return this->scanResult;
+        }
+        if (!this->source.IsLoaded()) {
+            return E_UNEXPECTED;
+        }
+        HRESULT hr = this->sanitised.Run(this->source.GetData(), this->source.GetSize(), token, &this->complexity);
+        if (CancelToken::IsCancellation(hr)) {
+            return hr;
+        }
+        this->scanResult = hr;
+        this->scanned = true;
+        return hr;
+    }
+
+    // Parses the source with the modes for the given quality, unless that is already done
+    HRESULT Parse(RenderQuality quality, const CancelToken* token = nullptr) noexcept
+    {
+        if (this->parsed && this->quality == quality) {
+            return this->parseResult;
+        }
+        HRESULT hr = this->Scan(token);
+        if (CancelToken::IsCancellation(hr)) {
+            return hr;
+        }
+        SvgOptions opt;
+        // TODO: loading system fonts might be overkill
+        opt.LoadSystemFonts();
+        opt.SetSpeedOverQuality(quality == RenderQualitySpeed);
+        // Like Svg::Load, what the sanitiser cannot handle goes to the parser as it is
+        const bool clean = SUCCEEDED(hr);
+        hr = CancelToken::Check(token);
+        if (SUCCEEDED(hr)) {
+            hr = this->svg.Parse(clean ? this->sanitised.GetData() : this->source.GetData(), clean ? this->sanitised.GetSize() : this->source.GetSize(), opt);
+        }
+        if (CancelToken::IsCancellation(hr)) {
+            // Not the document's fault, so a later call may try again
+            return hr;
+        }
+        this->parseResult = hr;
+        this->parsed = true;
+        this->quality = quality;
+        return this->parseResult;
+    }
+
 public:
     ThumbProviderSVG() noexcept
     {
@@ -520,26 +688,27 @@ public:
     IFACEMETHODIMP Initialize(LPCWSTR filePath, DWORD mode) noexcept
     {
         this->Destroy();
-        SvgOptions opt;
-        // TODO: loading system fonts might be overkill
-        opt.LoadSystemFonts();
-        opt.SetSpeedOverQuality(true);
-        return this->svg.Load(filePath, opt);
+        size_t cb = 0;
+        const void* ptr = mmopen(filePath, &cb);
+        if (ptr == nullptr) {
+            return HRESULT_FROM_WIN32(::GetLastError());
+        }
+        HRESULT hr = cb <= MAX_SVG_SIZE ? S_OK : E_FAIL;
+        if (SUCCEEDED(hr)) {
+            hr = this->source.Alloc(static_cast<ULONG>(cb));
+        }
+        if (SUCCEEDED(hr)) {
+            ::memcpy(this->source.GetData(), ptr, cb);
+        }
+        mmclose(ptr);
+        return hr;
     }
 
     // IInitializeWithStream
     IFACEMETHODIMP Initialize(IStream* pstm, DWORD mode) noexcept
     {
         this->Destroy();
-        MemData data;
-        HRESULT hr = StreamReadAll(pstm, data);
-        if (SUCCEEDED(hr)) {
-            SvgOptions opt;
-            // TODO: loading system fonts might be overkill
-            opt.LoadSystemFonts();
-            hr = this->svg.Load(data.GetData(), data.GetSize(), opt);
-        }
-        return hr;
+        return StreamReadAll(pstm, this->source);
     }
 
     HRESULT CachePropertyStore() noexcept
@@ -547,8 +716,13 @@ public:
         if (this->cache != nullptr) {
             return S_OK;
         }
+        // Any modes will do for the size
+        HRESULT hr = this->Parse(this->parsed ? this->quality : RenderQualitySpeed);
+        if (FAILED(hr)) {
+            return hr;
+        }
         ComPtr<IPropertyStoreCache> cache;
-        HRESULT hr = ::PSCreateMemoryPropertyStore(IID_PPV_ARGS(&cache));
+        hr = ::PSCreateMemoryPropertyStore(IID_PPV_ARGS(&cache));
         if (SUCCEEDED(hr)) {
             auto size = this->svg.GetSize();
             WCHAR buff[256] = {};
@@ -585,10 +759,11 @@ public:
         if (type != nullptr) {
             *type = WTSAT_ARGB;
         }
-        return InternalGetThumbnail(cx, phbmp);
+        return InternalGetThumbnail(cx, phbmp, type);
     }
 
-    HRESULT InternalGetThumbnail(UINT cx, HBITMAP* phbmp) noexcept
+    // Opaque renders are reported as WTSAT_RGB, so the shell does not blend them
+    HRESULT InternalGetThumbnail(UINT cx, HBITMAP* phbmp, WTS_ALPHATYPE* type = nullptr) noexcept
     {
         if (phbmp == nullptr) {
             return E_POINTER;
@@ -597,19 +772,148 @@ public:
         if (cx >= INT_MAX) {
             return E_INVALIDARG;
         }
+        if (!this->source.IsLoaded()) {
+            return E_UNEXPECTED;
+        }
+        // Past the deadline the shell shows its placeholder rather than a half drawn image,
+        // which it would cache
+        CancelToken token;
+        token.SetTimeout(THUMBNAIL_TIMEOUT);
+        HRESULT hr = this->Scan(&token);
+        if (CancelToken::IsCancellation(hr)) {
+            return hr;
+        }
+        // A document the sanitiser failed on is grouped with the empty ones
+        const RenderQuality quality = RenderQualityPolicy::GetShared().Choose(cx, static_cast<uint64_t>(cx) * cx, this->complexity);
+        const ThumbnailKey key = { ContentFingerprint(this->source.GetData(), this->source.GetSize()), this->source.GetSize(), cx, quality };
+        if (IsRenderingIsolated()) {
+            return this->GetIsolatedThumbnail(key, &token, phbmp, type);
+        }
+        std::shared_ptr<const SvgRenderTarget> target;
+        hr = S_OK;
+        if (!GetThumbnailLevels().Take(key, &target)) {
+            hr = GetThumbnailFlight().Do(key, this->source.GetData(), this->source.GetSize(), [&](SvgRenderTarget* rendered) {
+                return this->RenderThumbnail(key, &token, rendered);
+            }, &target, &token);
+        }
+        if (SUCCEEDED(hr)) {
+            Bitmap bmp;
+            PixelAlpha alpha = PixelAlphaTranslucent;
+            hr = target->ToGdiBitmap(false, bmp.GetAddressOf(), &alpha, &token);
+            if (SUCCEEDED(hr)) {
+                *phbmp = bmp.Detach();
+                if (type != nullptr && alpha == PixelAlphaOpaque) {
+                    *type = WTSAT_RGB;
+                }
+            }
+        }
+        return hr;
+    }
+
+    // Renders the thumbnail and, as mipmaps of it, the smaller sizes the shell may ask for next
+    HRESULT RenderThumbnail(const ThumbnailKey& key, const CancelToken* token, SvgRenderTarget* rendered) noexcept
+    {
+        HRESULT hr = this->Parse(key.quality, token);
+        if (FAILED(hr)) {
+            return hr;
+        }
         SvgRenderTarget::RenderOptions opt;
-        opt.SetCanvasSize(cx, cx).SetToContain();
-        SvgRenderTarget target;
-        HRESULT hr = this->svg.Render(opt, &target);
+        opt.SetCanvasSize(key.cx, key.cx).SetToContain().SetCancelToken(token);
+        const auto start = std::chrono::steady_clock::now();
+        hr = this->svg.Render(opt, rendered);
+        if (SUCCEEDED(hr) || hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT)) {
+            // A timed out render still tells the policy the document is slow
+            const uint64_t pixels = SUCCEEDED(hr) ? static_cast<uint64_t>(rendered->GetWidth()) * rendered->GetHeight() : static_cast<uint64_t>(key.cx) * key.cx;
+            RenderQualityPolicy::GetShared().Record(this->complexity, key.quality, pixels, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (FAILED(hr)) {
+            return hr;
+        }
+        this->PutThumbnailLevels(key, *rendered, token);
+        return hr;
+    }
+
+    // Best effort: the levels share what is left of the request's deadline, and one that fails
+    // is only missing from the cache. Each is kept under the quality a request for its size
+    // would choose, whatever the quality of the render it comes from.
+    void PutThumbnailLevels(const ThumbnailKey& key, const SvgRenderTarget& source, const CancelToken* token) noexcept
+    {
+        uint32_t sizes[ThumbnailLevels::SIZE_COUNT] = {};
+        size_t count = 0;
+        for (UINT size : ThumbnailLevels::SIZES) {
+            if (size < key.cx) {
+                sizes[count++] = size;
+            }
+        }
+        SvgRenderTarget levels[ThumbnailLevels::SIZE_COUNT];
+        HRESULT results[ThumbnailLevels::SIZE_COUNT] = {};
+        SvgRenderTarget::MipmapPolicy mipmaps;
+        mipmaps.SetCancelToken(token);
+        this->svg.DeriveMipmaps(source, sizes, count, levels, results, &mipmaps);
+        for (size_t i = 0; i < count; i++) {
+            if (FAILED(results[i])) {
+                continue;
+            }
+            const RenderQuality quality = RenderQualityPolicy::GetShared().Choose(sizes[i], static_cast<uint64_t>(sizes[i]) * sizes[i], this->complexity);
+            const ThumbnailKey level = { key.fingerprint, key.size, sizes[i], quality };
+            try {
+                GetThumbnailLevels().Put(level, std::make_shared<const SvgRenderTarget>(std::move(levels[i])));
+            } catch (...) {
+                break;
+            }
+        }
+    }
+
+    // Same as InternalGetThumbnail with the document parsed and rendered in a worker process
+    HRESULT GetIsolatedThumbnail(const ThumbnailKey& key, const CancelToken* token, HBITMAP* phbmp, WTS_ALPHATYPE* type) noexcept
+    {
+        std::shared_ptr<const RenderWorkerResult> result;
+        HRESULT hr = GetIsolatedThumbnailFlight().Do(key, this->source.GetData(), this->source.GetSize(), [&](RenderWorkerResult* rendered) {
+            const auto start = std::chrono::steady_clock::now();
+            HRESULT hr = GetRenderWorkerPool().Render(this->source.GetData(), this->source.GetSize(), key.cx, key.quality, THUMBNAIL_TIMEOUT, rendered);
+            if (SUCCEEDED(hr)) {
+                RenderQualityPolicy::GetShared().Record(this->complexity, key.quality, static_cast<uint64_t>(rendered->GetWidth()) * rendered->GetHeight(), std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            }
+            return hr;
+        }, &result, token);
         if (SUCCEEDED(hr)) {
             Bitmap bmp;
-            if (SUCCEEDED(target.ToGdiBitmap(false, bmp.GetAddressOf()))) {
+            PixelAlpha alpha = PixelAlphaTranslucent;
+            hr = result->ToGdiBitmap(false, bmp.GetAddressOf(), &alpha, token);
+            if (SUCCEEDED(hr)) {
                 *phbmp = bmp.Detach();
+                if (type != nullptr && alpha == PixelAlphaOpaque) {
+                    *type = WTSAT_RGB;
+                }
             }
         }
         return hr;
     }
 
+    static ThumbnailLevels& GetThumbnailLevels() noexcept
+    {
+        static ThumbnailLevels levels;
+        return levels;
+    }
+
+    static SingleFlight<ThumbnailKey, SvgRenderTarget>& GetThumbnailFlight() noexcept
+    {
+        static SingleFlight<ThumbnailKey, SvgRenderTarget> flight;
+        return flight;
+    }
+
+    static SingleFlight<ThumbnailKey, RenderWorkerResult>& GetIsolatedThumbnailFlight() noexcept
+    {
+        static SingleFlight<ThumbnailKey, RenderWorkerResult> flight;
+        return flight;
+    }
+
+    static RenderWorkerPool& GetRenderWorkerPool() noexcept
+    {
+        static RenderWorkerPool pool(HINST_THISCOMPONENT);
+        return pool;
+    }
+
     // IPropertyStore
     IFACEMETHODIMP STDMETHODCALLTYPE GetCount(DWORD* cProps)
     {
@@ -784,7 +1088,9 @@ extern "C"
 
 STDAPI DllCanUnloadNow(void)
 {
-    return (DllRefCount::GetLockCount() == 0) ? S_OK : S_FALSE;
+    // Idle task scheduler threads exit on their own after a while; each holds a reference on
+    // the module until its last instruction, so zero threads here is enough
+    return (DllRefCount::GetLockCount() == 0 && TaskScheduler::GetShared().GetThreadCount() == 0) ? S_OK : S_FALSE;
 }
 
 STDAPI DllGetClassObject(REFCLSID rclsid, REFIID riid, void** ppv)
@@ -867,6 +1173,15 @@ STDAPI DllInstall(BOOL install, LPCWSTR cmdLine)
     return hr;
 }
 
+// Entry point of the render worker processes, run as rundll32 thumpsvg.dll,RenderWorker <event>
+// Jobs come in on stdin, see RenderWorkerPool.
+void CALLBACK RenderWorkerW(HWND, HINSTANCE, LPWSTR cmdLine, int)
+{
+    // The pool passes the handle of the event to set once the worker is warm
+    HANDLE ready = reinterpret_cast<HANDLE>(static_cast<uintptr_t>(::_wcstoui64(cmdLine, nullptr, 10)));
+    RenderWorker::Serve(::GetStdHandle(STD_INPUT_HANDLE), ready);
+}
+
 STDAPI DllRegisterServer(void)
 {
     return DllInstall(TRUE, nullptr);
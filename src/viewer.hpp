@@ -27,6 +27,7 @@ constexpr UINT SVGOPT_BBOX             = 3;
 constexpr UINT SVGOPT_SPEED            = 4;
 constexpr UINT SVGOPT_BACKMODE         = 5;
 constexpr UINT SVGOPT_BACKCOLOUR       = 6;
+constexpr UINT SVGOPT_PROGRESSIVE      = 7;
 
 // SVGOPT_ZOOM
 constexpr int SVGZOOM_CONTAIN          = -1;
@@ -36,6 +37,8 @@ constexpr int SVGZOOM_COVER            = -2;
 constexpr UINT SVGEXP_PNG              = 0;
 constexpr UINT SVGEXP_BMP              = 1;
 constexpr UINT SVGEXP_GIF              = 2;
+constexpr UINT SVGEXP_RAW              = 3;
+constexpr UINT SVGEXP_QOI              = 4;
 
 // SVGOPT_BACKMODE
 constexpr UINT SVGBGM_CHECKER          = 0;
@@ -116,6 +119,16 @@ public:
         return this->SendMessageHresult(SVGWM_EXPORT, SVGEXP_PNG, reinterpret_cast<LPARAM>(path));
     }
 
+    HRESULT SaveToRaw(LPCWSTR path)
+    {
+        return this->SendMessageHresult(SVGWM_EXPORT, SVGEXP_RAW, reinterpret_cast<LPARAM>(path));
+    }
+
+    HRESULT SaveToQOI(LPCWSTR path)
+    {
+        return this->SendMessageHresult(SVGWM_EXPORT, SVGEXP_QOI, reinterpret_cast<LPARAM>(path));
+    }
+
     HRESULT SetZoomMode(int mode)
     {
         if (mode < 0) {
@@ -144,6 +157,12 @@ public:
         return this->SendMessageHresult(SVGWM_SET_OPTION, SVGOPT_SPEED, enabled);
     }
 
+    // Paints a low-resolution frame first when rendering takes a while
+    HRESULT SetProgressive(bool enabled)
+    {
+        return this->SendMessageHresult(SVGWM_SET_OPTION, SVGOPT_PROGRESSIVE, enabled);
+    }
+
     HRESULT SetBackgroundMode(UINT mode)
     {
         return this->SendMessageHresult(SVGWM_SET_OPTION, SVGOPT_BACKMODE, mode);
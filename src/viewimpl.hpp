@@ -6,16 +6,30 @@
 #include "viewer.hpp"
 #include "bitmap.hpp"
 #include "brush.hpp"
+#include "export.hpp"
 
 class SvgViewerImpl : public WindowImpl<SvgViewerImpl>, public NoThrowObject
 {
 private:
+    // Windows below this many pixels render fast enough without a preview
+    static const uint64_t PREVIEW_MIN_PIXELS = 512 * 512;
+    static const uint32_t PREVIEW_DIVISOR = 4;
+    static const UINT REFINE_DELAY = 100;
+
     Svg svg;
+    // The render as it came out of resvg, and the same image composited for painting
+    SvgRenderTarget image;
     Bitmap cache;
+    Backdrop cacheBackdrop;
     Brush checker;
+    int checkerCellSize = 0;
     bool showViewBox = false;
     bool showBBox = false;
     bool speedOverQuality = false;
+    bool progressive = false;
+    // image holds a preview whose full pass was cut short
+    bool refining = false;
+    UINT_PTR idRefineTimer = 0;
     UINT backMode = SVGBGM_CHECKER;
     COLORREF backColour = CLR_NONE;
     int zoom = SVGZOOM_CONTAIN;
@@ -35,7 +49,9 @@ private:
 
         auto size = this->svg.GetSize();
         if (size.width == 0 || size.height == 0) {
+            this->image.Destroy();
             this->cache.Destroy();
+            this->refining = false;
             return;
         }
 
@@ -51,14 +67,18 @@ private:
             opt.SetScale(static_cast<float>(1 / 100.) * this->zoom);
         }
 
+        bool sameSize = false;
         if (always) {
+            this->image.Destroy();
             this->cache.Destroy();
-        } else if (!this->cache.IsNull()) {
-            SIZE size = this->cache.GetSize();
+            this->refining = false;
+        } else if (!this->image.IsNull()) {
             UINT width, height;
             this->svg.CalcImageSize(opt, &width, &height);
-            if (size.cx == width && size.cy == height) {
-                // not necessary
+            sameSize = this->image.GetWidth() == width && this->image.GetHeight() == height;
+            if (sameSize && !this->refining) {
+                // no need to render again, but the backdrop may have moved
+                this->Composite(hwnd);
                 return;
             }
         }
@@ -66,12 +86,90 @@ private:
             return;
         }
         SvgRenderTarget target;
+        HRESULT hr;
         // TODO: background thread
-        if (SUCCEEDED(this->svg.Render(opt, &target))) {
-            Bitmap bmp;
-            if (SUCCEEDED(target.ToGdiBitmap(true, bmp.GetAddressOf()))) {
-                this->cache = std::move(bmp);
+        if (this->progressive) {
+            // A preview already on screen at this size only needs the full pass
+            uint32_t divisor = 1;
+            if (!sameSize && static_cast<uint64_t>(rect.width()) * rect.height() >= PREVIEW_MIN_PIXELS) {
+                divisor = PREVIEW_DIVISOR;
             }
+            hr = this->svg.RenderProgressive(opt, divisor, [&](SvgRenderTarget& preview) {
+                this->image = std::move(preview);
+                this->cache.Destroy();
+                this->Composite(hwnd);
+                ::UpdateWindow(hwnd);
+            }, []() {
+                // Keys and clicks are what ask for a different frame
+                return HIWORD(::GetQueueStatus(QS_KEY | QS_MOUSEBUTTON)) != 0;
+            }, &target);
+        } else {
+            hr = this->svg.Render(opt, &target);
+        }
+        if (SUCCEEDED(hr)) {
+            this->image = std::move(target);
+            this->cache.Destroy();
+            this->Composite(hwnd);
+            this->refining = false;
+        } else if (hr == HRESULT_FROM_WIN32(ERROR_CANCELLED)) {
+            // Finish once the input has been handled, unless it renders again first
+            this->refining = true;
+            this->SetRefineTimer(hwnd);
+        }
+    }
+
+    void SetRefineTimer(HWND hwnd)
+    {
+        if (this->idRefineTimer == 0) {
+            this->idRefineTimer = ::SetTimer(hwnd, reinterpret_cast<UINT_PTR>(this), REFINE_DELAY, [](HWND hwnd, UINT, UINT_PTR id, DWORD) -> void {
+                SvgViewerImpl* self = reinterpret_cast<SvgViewerImpl*>(id);
+                self->KillRefineTimer(hwnd);
+                if (self->refining) {
+                    self->Invalidate(hwnd);
+                }
+            });
+        }
+    }
+
+    void KillRefineTimer(HWND hwnd)
+    {
+        if (this->idRefineTimer != 0) {
+            ::KillTimer(hwnd, this->idRefineTimer);
+            this->idRefineTimer = 0;
+        }
+    }
+
+    // What PaintContent fills the window with, aligned to where the image will be drawn
+    Backdrop GetBackdrop(const ClientRect& rect, int width, int height) const
+    {
+        const int x = rect.left + (rect.width() - width) / 2;
+        const int y = rect.top + (rect.height() - height) / 2;
+        if (this->backMode == SVGBGM_CHECKER && !this->checker.IsNull()) {
+            // The pattern brush paints its 0 bits in the text colour, and the cell at the origin is 0
+            return Backdrop::Checker(0xaaaaaa, 0xdddddd, this->checkerCellSize, x, y);
+        }
+        COLORREF colour = this->backColour;
+        if (colour == CLR_NONE) {
+            colour = ::GetSysColor(COLOR_WINDOW);
+        }
+        return Backdrop::Solid(RGB(GetBValue(colour), GetGValue(colour), GetRValue(colour)));
+    }
+
+    // Blends the render over the backdrop once, so painting is a plain blit
+    void Composite(HWND hwnd)
+    {
+        if (this->image.IsNull()) {
+            return;
+        }
+        ClientRect rect(hwnd);
+        const Backdrop backdrop = this->GetBackdrop(rect, this->image.GetWidth(), this->image.GetHeight());
+        if (!this->cache.IsNull() && backdrop == this->cacheBackdrop) {
+            return;
+        }
+        Bitmap bmp;
+        if (SUCCEEDED(this->image.ToGdiBitmap(backdrop, bmp.GetAddressOf()))) {
+            this->cache = std::move(bmp);
+            this->cacheBackdrop = backdrop;
         }
     }
 
@@ -79,6 +177,7 @@ private:
     {
         int dpi = ::GetDpiForWindow(hwnd);
         int cellSize = ::MulDiv(8, dpi, 96);
+        this->checkerCellSize = cellSize;
         Bitmap bmp(::CreateBitmap(cellSize * 2, cellSize * 2, 1, 1, nullptr));
         if (!bmp.IsNull()) {
             HDC hdc = ::CreateCompatibleDC(nullptr);
@@ -108,6 +207,13 @@ private:
         return oldValue ? S_OK : S_FALSE;
     }
 
+    static HRESULT SetBoolValue(LPARAM value, bool* param)
+    {
+        bool oldValue = *param;
+        *param = value != 0;
+        return oldValue ? S_OK : S_FALSE;
+    }
+
     template <typename T>
     HRESULT UpdateIntValue(HWND hwnd, LPARAM value, T* param)
     {
@@ -167,7 +273,7 @@ public:
             SIZE size = this->cache.GetSize();
             int x = rect.left + (rect.width() - size.cx) / 2;
             int y = rect.top + (rect.height() - size.cy) / 2;
-            this->cache.DrawClippedAlpha(hdc, x, y, size.cx, size.cy);
+            this->cache.DrawClipped(hdc, x, y, size.cx, size.cy);
             if (this->showViewBox || this->showBBox) {
                 resvg_rect rrect = this->svg.GetViewBox();
                 if (rrect.width && rrect.height) {
@@ -377,7 +483,10 @@ public:
     HRESULT OnSvgClose(HWND hwnd)
     {
         this->svg.Destroy();
+        this->image.Destroy();
         this->cache.Destroy();
+        this->refining = false;
+        this->KillRefineTimer(hwnd);
         ::InvalidateRect(hwnd, nullptr, FALSE);
         return S_OK;
     }
@@ -387,85 +496,28 @@ public:
         if (path == nullptr) {
             return E_INVALIDARG;
         }
-        if (type == SVGEXP_PNG) {
-            return this->OnSvgSaveToPNG(path);
+        if (type == SVGEXP_PNG || type == SVGEXP_RAW || type == SVGEXP_QOI) {
+            return this->OnSvgSaveToFile(type, path);
         }
         return E_INVALIDARG;
     }
 
-    HRESULT OnSvgSaveToPNG(const wchar_t* path)
+    HRESULT OnSvgSaveToFile(UINT type, const wchar_t* path)
     {
-        IWICImagingFactory* factory = nullptr;
-        IWICBitmapSource* source = nullptr;
-        IWICStream* stream = nullptr;
-        IWICBitmapEncoder* encoder = nullptr;
-        IWICBitmapFrameEncode* frame = nullptr;
         SvgRenderTarget::RenderOptions opt;
-        SvgRenderTarget target;
-
-        HRESULT hr = ::WICCreateImagingFactory_Proxy(WINCODEC_SDK_VERSION, &factory);
-        if (SUCCEEDED(hr)) {
-            hr = this->svg.Render(opt, &target);
-        }
-        if (SUCCEEDED(hr)) {
-            hr = target.ToWICBitmap(factory, &source);
-        }
-        if (SUCCEEDED(hr)) {
-            hr = factory->CreateStream(&stream);
-        }
-        if (SUCCEEDED(hr)) {
-            hr = stream->InitializeFromFilename(path, GENERIC_WRITE);
-        }
-        if (SUCCEEDED(hr)) {
-            GUID guid = GUID_VendorMicrosoftBuiltIn;
-            hr = factory->CreateEncoder(GUID_ContainerFormatPng, &guid, &encoder);
-        }
-        if (SUCCEEDED(hr)) {
-            hr = encoder->Initialize(stream, WICBitmapEncoderNoCache);
-        }
-        if (SUCCEEDED(hr)) {
-            hr = encoder->CreateNewFrame(&frame, nullptr);
-        }
-        if (SUCCEEDED(hr)) {
-            hr = frame->Initialize(nullptr);
-        }
-        if (SUCCEEDED(hr)) {
-            WICPixelFormatGUID guid = GUID_WICPixelFormat32bppRGBA;
-            hr = frame->SetPixelFormat(&guid);
-        }
+        FileSink file;
+        HRESULT hr = file.Open(path);
         if (SUCCEEDED(hr)) {
-            const UINT width = target.GetWidth();
-            const UINT height = target.GetHeight();
-            hr = frame->SetSize(width, height);
-            if (SUCCEEDED(hr)) {
-                WICRect rect;
-                rect.X = 0;
-                rect.Y = 0;
-                rect.Width = width;
-                rect.Height = height;
-                hr = frame->WriteSource(source, &rect);
+            if (type == SVGEXP_RAW) {
+                hr = SvgExporter::SaveRaw(this->svg, opt, &file);
+            } else if (type == SVGEXP_QOI) {
+                hr = SvgExporter::SaveQoi(this->svg, opt, &file);
+            } else {
+                hr = SvgExporter::SavePng(this->svg, opt, &file);
             }
         }
         if (SUCCEEDED(hr)) {
-            hr = frame->Commit();
-        }
-        if (SUCCEEDED(hr)) {
-            hr = encoder->Commit();
-        }
-        if (frame != nullptr) {
-            frame->Release();
-        }
-        if (encoder != nullptr) {
-            encoder->Release();
-        }
-        if (stream != nullptr) {
-            stream->Release();
-        }
-        if (source != nullptr) {
-            source->Release();
-        }
-        if (factory != nullptr) {
-            factory->Release();
+            hr = file.Close();
         }
         return hr;
     }
@@ -488,6 +540,8 @@ public:
             return this->showBBox ? S_OK : S_FALSE;
         case SVGOPT_SPEED:
             return this->speedOverQuality ? S_OK : S_FALSE;
+        case SVGOPT_PROGRESSIVE:
+            return this->progressive ? S_OK : S_FALSE;
         case SVGOPT_BACKMODE:
             uparam = reinterpret_cast<int*>(lParam);
             if (uparam == nullptr) {
@@ -521,6 +575,9 @@ public:
             return this->UpdateBoolValue(hwnd, lParam, &this->showBBox);
         case SVGOPT_SPEED:
             return this->UpdateBoolValue(hwnd, lParam, &this->speedOverQuality);
+        case SVGOPT_PROGRESSIVE:
+            // takes effect from the next render
+            return this->SetBoolValue(lParam, &this->progressive);
         case SVGOPT_BACKMODE:
             if (lParam == SVGBGM_CHECKER || lParam == SVGBGM_SOLID) {
                 return this->UpdateIntValue(hwnd, lParam, &this->backMode);
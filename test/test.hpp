@@ -0,0 +1,86 @@
+#ifndef SVG_TEST_H
+#define SVG_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Just enough for the programs `make check` runs: each one calls Test::Run per case and
+// returns Test::Result() from main, which fails when any CHECK did. platform.h comes first.
+class Test
+{
+private:
+    static int& Failures()
+    {
+        static int failures = 0;
+        return failures;
+    }
+
+public:
+    Test() = delete;
+    ~Test() = delete;
+
+    static bool Check(bool ok, const char* expr, const char* file, int line)
+    {
+        if (!ok) {
+            ::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+            Failures()++;
+        }
+        return ok;
+    }
+
+    static bool CheckHr(HRESULT hr, HRESULT expected, const char* expr, const char* file, int line)
+    {
+        if (hr != expected) {
+            ::fprintf(stderr, "%s:%d: %s returned %08lx, not %08lx\n", file, line, expr,
+                static_cast<unsigned long>(static_cast<uint32_t>(hr)), static_cast<unsigned long>(static_cast<uint32_t>(expected)));
+            Failures()++;
+        }
+        return hr == expected;
+    }
+
+    template <class TFunc>
+    static void Run(const char* name, const TFunc& fn)
+    {
+        const int before = Failures();
+        fn();
+        ::printf("%s %s\n", Failures() == before ? "ok  " : "FAIL", name);
+    }
+
+    static int Result()
+    {
+        return Failures() == 0 ? 0 : 1;
+    }
+
+    // Deterministic, so that a failure can be reproduced
+    class Random
+    {
+    private:
+        uint64_t state;
+
+    public:
+        explicit Random(uint64_t seed)
+            : state(seed * 2 + 1)
+        {
+        }
+
+        uint32_t Next()
+        {
+            this->state ^= this->state << 13;
+            this->state ^= this->state >> 7;
+            this->state ^= this->state << 17;
+            return static_cast<uint32_t>(this->state >> 16);
+        }
+
+        uint32_t Below(uint32_t n)
+        {
+            return static_cast<uint32_t>((static_cast<uint64_t>(this->Next()) * n) >> 32);
+        }
+    };
+};
+
+#define CHECK(expr)             Test::Check(!!(expr), #expr, __FILE__, __LINE__)
+#define CHECK_HR(expr, hr)      Test::CheckHr((expr), (hr), #expr, __FILE__, __LINE__)
+
+#endif
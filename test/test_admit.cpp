@@ -0,0 +1,176 @@
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "admit.hpp"
+#include "schedule.hpp"
+#include "test.hpp"
+
+// A burst of renders, arriving faster than the scheduler can finish them, through an
+// AdmissionController: with a budget, the p99 latency of the jobs let in stays within the budget
+// plus one job, while without one it grows with the backlog. The weights are
+// calibrated first from a measured render, so they hold for resvg and for a stand-in slowed
+// down with STUB_SLOW_MS, milliseconds per 256x256 pixels.
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned THREADS = 2;
+static const int JOBS = 300;
+// Between arrivals, in microseconds; about twice what the threads get through
+static const int INTERVAL = 600;
+
+static const char SVG[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='400' height='400'>"
+    "<circle cx='200' cy='200' r='150' fill='#f80' stroke='#222' stroke-width='8'/>"
+    "</svg>";
+
+struct Request
+{
+    Svg svg;
+    SvgRenderTarget target;
+    SvgRenderJob job;
+    AdmissionTicket ticket;
+    Clock::time_point arrival;
+    Clock::time_point finish;
+    AdmissionDecision decision = AdmissionReject;
+};
+
+static double GetMilliseconds(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static void Finish(RenderJob&, void* context)
+{
+    Request* request = static_cast<Request*>(context);
+    request->finish = Clock::now();
+    request->ticket.Release();
+}
+
+// Nanoseconds a pixel takes to render, from the best of a few 256x256 renders
+static double MeasurePixelCost()
+{
+    Svg svg;
+    SvgOptions opt;
+    CHECK_HR(svg.Load(SVG, sizeof(SVG) - 1, opt), S_OK);
+    SvgRenderTarget::RenderOptions ropt;
+    ropt.SetCanvasSize(256, 256).SetToContain();
+    double best = 0;
+    for (int i = 0; i < 3; i++) {
+        SvgRenderTarget target;
+        const Clock::time_point start = Clock::now();
+        CHECK_HR(svg.Render(ropt, &target), S_OK);
+        const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        best = i == 0 || ns < best ? ns : best;
+    }
+    return best / (256 * 256);
+}
+
+struct LoadResult
+{
+    double p50 = 0;
+    double p99 = 0;
+    double worst = 0;
+    int served = 0;
+};
+
+// Runs the burst through the controller; the sizes go from 64 to 512 pixels at random
+static LoadResult RunBurst(AdmissionController& admission, const SvgComplexity& complexity)
+{
+    std::vector<std::unique_ptr<Request>> requests;
+    for (int i = 0; i < JOBS; i++) {
+        requests.emplace_back(new Request());
+    }
+    SvgOptions svgOpt;
+    Test::Random random(48);
+    {
+        RenderJobScheduler scheduler(THREADS);
+        Clock::time_point next = Clock::now();
+        for (int i = 0; i < JOBS; i++) {
+            Request* request = requests[i].get();
+            std::this_thread::sleep_until(next);
+            next += std::chrono::microseconds(INTERVAL);
+            request->arrival = Clock::now();
+            uint32_t size = 64 + random.Below(449);
+            const uint64_t cost = admission.Estimate(complexity, static_cast<uint64_t>(size) * size);
+            // The placeholder is the same document at a quarter of the size
+            const uint64_t placeholderCost = admission.Estimate(complexity, static_cast<uint64_t>(size / 4) * (size / 4));
+            request->decision = admission.Admit(cost, placeholderCost, &request->ticket);
+            if (request->decision == AdmissionReject) {
+                continue;
+            }
+            if (request->decision == AdmissionDowngrade) {
+                size /= 4;
+            }
+            CHECK_HR(request->svg.Load(SVG, sizeof(SVG) - 1, svgOpt), S_OK);
+            SvgRenderTarget::RenderOptions opt;
+            opt.SetCanvasSize(size, size).SetToContain();
+            request->job.Set(&request->svg, opt, &request->target).SetCompletion(Finish, request);
+            CHECK_HR(scheduler.Submit(&request->job, RenderJobVisible), S_OK);
+        }
+        for (auto& request : requests) {
+            if (request->decision != AdmissionReject) {
+                CHECK_HR(scheduler.Wait(&request->job), S_OK);
+            }
+        }
+    }
+    std::vector<double> latencies;
+    for (auto& request : requests) {
+        if (request->decision != AdmissionReject) {
+            latencies.push_back(GetMilliseconds(request->arrival, request->finish));
+        }
+    }
+    LoadResult result;
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        result.p50 = latencies[latencies.size() / 2];
+        result.p99 = latencies[(latencies.size() * 99 + 99) / 100 - 1];
+        result.worst = latencies.back();
+        result.served = static_cast<int>(latencies.size());
+    }
+    return result;
+}
+
+int main()
+{
+    ::setenv("STUB_SLOW_MS", "2", 0);
+    Sanitiser sans;
+    SvgComplexity complexity;
+    CHECK_HR(sans.Run(SVG, sizeof(SVG) - 1, nullptr, &complexity), S_OK);
+    const double perPixel = MeasurePixelCost();
+    // The largest job, 512x512, in milliseconds
+    const double largest = perPixel * 512 * 512 / 1e6;
+
+    Test::Run("admission keeps the p99 of a burst near the budget", [&] {
+        // A job waits for at most the budget's worth of work queued ahead of it, less when the
+        // threads get a core each
+        static const double BUDGET_MS = 40;
+        AdmissionController bounded(static_cast<uint64_t>(BUDGET_MS * 1e6));
+        bounded.SetWeights(0, 0, perPixel, 0);
+        const LoadResult admitted = RunBurst(bounded, complexity);
+        AdmissionController unbounded(UINT64_MAX / 2);
+        unbounded.SetWeights(0, 0, perPixel, 0);
+        const LoadResult everything = RunBurst(unbounded, complexity);
+        // 30 ms more for scheduling and the render of the job itself beyond the estimate
+        const double bound = BUDGET_MS + largest + 30;
+        if (!CHECK(admitted.p99 <= bound) || !CHECK(everything.p99 > 2 * admitted.p99)) {
+            ::fprintf(stderr, "largest job %.1f ms; p50/p99/worst with a budget %.1f/%.1f/%.1f ms over %d jobs, bound %.1f ms; without %.1f/%.1f/%.1f ms\n",
+                largest, admitted.p50, admitted.p99, admitted.worst, admitted.served, bound, everything.p50, everything.p99, everything.worst);
+        }
+        CHECK(bounded.GetAdmittedCount() + bounded.GetDowngradedCount() + bounded.GetRejectedCount() == JOBS);
+        CHECK(bounded.GetDowngradedCount() + bounded.GetRejectedCount() > 0);
+        CHECK(bounded.GetAdmittedCount() > 0);
+        CHECK(bounded.GetOutstandingCost() == 0);
+        // The budget, overshot only by a job let in when nothing was outstanding
+        CHECK(bounded.GetPeakCost() <= static_cast<uint64_t>(BUDGET_MS * 1e6 + largest * 1e6));
+        CHECK(unbounded.GetAdmittedCount() == JOBS);
+    });
+
+    return Test::Result();
+}
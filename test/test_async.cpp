@@ -0,0 +1,103 @@
+#include "platform.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "async.hpp"
+#include "test.hpp"
+
+static const char SVG[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='40' height='20'>"
+    "<rect x='2' y='2' width='36' height='16' fill='#08f'/>"
+    "</svg>";
+
+// Runs every task on a thread of its own, as the task scheduler has no workers on a single processor
+class ThreadExecutor : public Executor
+{
+public:
+    void Post(Task* task) override
+    {
+        std::thread([task] {
+            task->Run();
+        }).detach();
+    }
+};
+
+struct Observed
+{
+    std::atomic<bool> returned;
+    HRESULT result;
+
+    Observed()
+        : returned(false)
+        , result(S_OK)
+    {
+    }
+};
+
+static void SlowCompletion(AsyncOperation& op, void* context)
+{
+    Observed* observed = static_cast<Observed*>(context);
+    observed->result = op.GetResult();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    observed->returned = true;
+}
+
+int main()
+{
+    Test::Run("waiting returns after the completion callback", [] {
+        ThreadExecutor executor;
+        SvgOptions opt;
+        Svg svg;
+        Observed observed;
+        SvgLoadOperation op;
+        op.SetExecutor(&executor).SetCompletion(SlowCompletion, &observed);
+        CHECK_HR(op.Start(&svg, SVG, sizeof(SVG) - 1, opt), S_OK);
+        CHECK_HR(op.Wait(), S_OK);
+        CHECK(observed.returned.load());
+        CHECK_HR(observed.result, S_OK);
+        CHECK(!op.IsPending());
+    });
+
+    Test::Run("an operation stays busy until its callback returns", [] {
+        ThreadExecutor executor;
+        SvgOptions opt;
+        Svg svg;
+        Observed observed;
+        SvgLoadOperation op;
+        op.SetExecutor(&executor).SetCompletion(SlowCompletion, &observed);
+        CHECK_HR(op.Start(&svg, SVG, sizeof(SVG) - 1, opt), S_OK);
+        while (op.GetResult() == E_PENDING) {
+            std::this_thread::yield();
+        }
+        if (!observed.returned.load()) {
+            CHECK(op.IsPending());
+            CHECK_HR(op.Start(&svg, SVG, sizeof(SVG) - 1, opt), HRESULT_FROM_WIN32(ERROR_BUSY));
+        }
+        CHECK_HR(op.Wait(), S_OK);
+    });
+
+    // Destroyed right after waiting, while the worker thread is still on its way out of Run
+    Test::Run("operations can be destroyed once waited for", [] {
+        ThreadExecutor executor;
+        SvgOptions opt;
+        Svg svg;
+        CHECK_HR(svg.Load(SVG, sizeof(SVG) - 1, opt), S_OK);
+        for (int i = 0; i < 50; i++) {
+            Observed observed;
+            SvgRenderTarget target;
+            SvgRenderTarget::RenderOptions renderOpt;
+            SvgRenderOperation* op = new SvgRenderOperation();
+            op->SetExecutor(&executor).SetCompletion([](AsyncOperation&, void* context) {
+                static_cast<Observed*>(context)->returned = true;
+            }, &observed);
+            CHECK_HR(op->Start(&svg, renderOpt, &target), S_OK);
+            CHECK_HR(op->Wait(), S_OK);
+            CHECK(observed.returned.load());
+            delete op;
+            CHECK(target.GetWidth() == 40 && target.GetHeight() == 20);
+        }
+    });
+
+    return Test::Result();
+}
@@ -0,0 +1,321 @@
+#include "platform.h"
+#include <string>
+#include <vector>
+
+#include "atlas.hpp"
+#include "test.hpp"
+
+// SvgAtlas: where the packer puts each icon, what ends up in its slot, and that both indexes
+// describe the same slots
+
+struct Icon
+{
+    std::string name;
+    std::string text;
+};
+
+// Documents of assorted aspect ratios up to 8:1, rendered at canvas sizes that keep every side
+// at least a pixel
+static std::vector<Icon> MakeIcons(Test::Random& random, size_t count)
+{
+    std::vector<Icon> icons(count);
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t w = 16 + random.Below(112);
+        const uint32_t h = 16 + random.Below(112);
+        icons[i].name = "icon-" + std::to_string(i);
+        icons[i].text = "<svg xmlns='http://www.w3.org/2000/svg' width='" + std::to_string(w) + "' height='" + std::to_string(h) + "'>"
+            "<rect x='1' y='1' width='" + std::to_string(w - 2) + "' height='" + std::to_string(h - 2) + "' fill='#08f'/>"
+            "<circle cx='" + std::to_string(w / 2) + "' cy='" + std::to_string(h / 2) + "' r='" + std::to_string((w < h ? w : h) / 3) + "' fill='#f80'/></svg>";
+    }
+    return icons;
+}
+
+static std::vector<SvgAtlas::Item> MakeItems(Test::Random& random, const std::vector<Icon>& icons)
+{
+    std::vector<SvgAtlas::Item> items(icons.size());
+    for (size_t i = 0; i < icons.size(); i++) {
+        items[i] = {};
+        items[i].name = icons[i].name.c_str();
+        items[i].data = icons[i].text.data();
+        items[i].size = icons[i].text.size();
+        items[i].canvasSize = 16 + random.Below(49);
+    }
+    return items;
+}
+
+// Slots, padding included, must not share a pixel and must lie inside the atlas
+static bool CheckSlots(const SvgAtlas& atlas, const std::vector<SvgAtlas::Item>& items, uint32_t padding)
+{
+    const uint32_t width = atlas.GetImage().GetWidth();
+    const uint32_t height = atlas.GetImage().GetHeight();
+    bool ok = true;
+    for (size_t i = 0; i < items.size() && ok; i++) {
+        const SvgAtlas::Item& a = items[i];
+        if (FAILED(a.result)) {
+            continue;
+        }
+        ok = CHECK(a.width > 0 && a.height > 0 && a.x + a.width <= width && a.y + a.height <= height);
+        for (size_t j = i + 1; j < items.size() && ok; j++) {
+            const SvgAtlas::Item& b = items[j];
+            if (SUCCEEDED(b.result)) {
+                ok = CHECK(a.x + a.width + padding <= b.x || b.x + b.width + padding <= a.x
+                    || a.y + a.height + padding <= b.y || b.y + b.height + padding <= a.y);
+            }
+        }
+    }
+    return ok;
+}
+
+// Each slot holds its icon as rendered alone, and everything outside the slots stays clear
+static bool CheckPixels(const SvgAtlas& atlas, const std::vector<SvgAtlas::Item>& items)
+{
+    const SvgRenderTarget& image = atlas.GetImage();
+    std::vector<bool> covered(static_cast<size_t>(image.GetWidth()) * image.GetHeight(), false);
+    bool ok = true;
+    for (size_t i = 0; i < items.size() && ok; i++) {
+        const SvgAtlas::Item& item = items[i];
+        if (FAILED(item.result)) {
+            continue;
+        }
+        Svg svg;
+        SvgOptions opt;
+        SvgRenderTarget alone;
+        SvgRenderTarget::RenderOptions ropt;
+        ropt.SetCanvasSize(item.canvasSize, item.canvasSize).SetToContain();
+        ok = CHECK_HR(svg.Load(item.data, item.size, opt), S_OK) && CHECK_HR(svg.Render(ropt, &alone), S_OK)
+            && CHECK(alone.GetWidth() == item.width && alone.GetHeight() == item.height);
+        for (uint32_t y = 0; y < item.height && ok; y++) {
+            const size_t offset = static_cast<size_t>(item.y + y) * image.GetWidth() + item.x;
+            ok = CHECK(::memcmp(image.GetPixels() + offset, alone.GetPixels() + static_cast<size_t>(y) * item.width, item.width * 4) == 0);
+            std::fill(covered.begin() + offset, covered.begin() + offset + item.width, true);
+        }
+        if (!ok) {
+            ::fprintf(stderr, "slot of %s at %u,%u\n", item.name, item.x, item.y);
+        }
+    }
+    size_t stray = 0;
+    for (size_t i = 0; i < covered.size(); i++) {
+        stray += !covered[i] && image.GetPixels()[i] != 0;
+    }
+    return ok && CHECK(stray == 0);
+}
+
+// Reads back what WriteIndexJson writes, which is all this needs to understand
+class JsonReader
+{
+private:
+    const char* p;
+    const char* end;
+
+public:
+    JsonReader(const ByteBuffer& json)
+        : p(reinterpret_cast<const char*>(json.GetData()))
+        , end(reinterpret_cast<const char*>(json.GetData()) + json.GetSize())
+    {
+    }
+
+    bool Expect(const char* text)
+    {
+        const size_t cch = ::strlen(text);
+        if (static_cast<size_t>(this->end - this->p) < cch || ::memcmp(this->p, text, cch) != 0) {
+            return false;
+        }
+        this->p += cch;
+        return true;
+    }
+
+    bool Number(uint32_t* value)
+    {
+        *value = 0;
+        const char* start = this->p;
+        while (this->p < this->end && *this->p >= '0' && *this->p <= '9') {
+            *value = *value * 10 + (*this->p++ - '0');
+        }
+        return this->p > start;
+    }
+
+    bool String(std::string* value)
+    {
+        value->clear();
+        if (!this->Expect("\"")) {
+            return false;
+        }
+        while (this->p < this->end && *this->p != '"') {
+            char c = *this->p++;
+            if (c == '\\' && this->p < this->end) {
+                c = *this->p++;
+                if (c == 'u') {
+                    unsigned code = 0;
+                    if (this->end - this->p < 4 || ::sscanf(std::string(this->p, 4).c_str(), "%4x", &code) != 1) {
+                        return false;
+                    }
+                    this->p += 4;
+                    c = static_cast<char>(code);
+                }
+            }
+            value->push_back(c);
+        }
+        return this->Expect("\"");
+    }
+};
+
+struct Sprite
+{
+    std::string name;
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+static bool ReadJson(const ByteBuffer& json, uint32_t* width, uint32_t* height, std::vector<Sprite>* sprites)
+{
+    JsonReader reader(json);
+    if (!reader.Expect("{\"width\":") || !reader.Number(width) || !reader.Expect(",\"height\":") || !reader.Number(height)
+        || !reader.Expect(",\"sprites\":[")) {
+        return false;
+    }
+    while (!reader.Expect("]}\n")) {
+        Sprite sprite;
+        if ((!sprites->empty() && !reader.Expect(",")) || !reader.Expect("{\"name\":") || !reader.String(&sprite.name)
+            || !reader.Expect(",\"x\":") || !reader.Number(&sprite.x) || !reader.Expect(",\"y\":") || !reader.Number(&sprite.y)
+            || !reader.Expect(",\"width\":") || !reader.Number(&sprite.width) || !reader.Expect(",\"height\":") || !reader.Number(&sprite.height)
+            || !reader.Expect("}")) {
+            return false;
+        }
+        sprites->push_back(sprite);
+    }
+    return true;
+}
+
+static uint32_t GetU32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static bool ReadBinary(const ByteBuffer& binary, uint32_t* width, uint32_t* height, std::vector<Sprite>* sprites)
+{
+    const uint8_t* p = binary.GetData();
+    const uint8_t* end = p + binary.GetSize();
+    if (end - p < 20 || ::memcmp(p, "SVGA", 4) != 0 || GetU32(p + 4) != 1) {
+        return false;
+    }
+    *width = GetU32(p + 8);
+    *height = GetU32(p + 12);
+    const uint32_t count = GetU32(p + 16);
+    p += 20;
+    for (uint32_t i = 0; i < count; i++) {
+        if (end - p < 18) {
+            return false;
+        }
+        Sprite sprite = { std::string(), GetU32(p), GetU32(p + 4), GetU32(p + 8), GetU32(p + 12) };
+        const size_t len = p[16] | (p[17] << 8);
+        p += 18;
+        if (static_cast<size_t>(end - p) < len) {
+            return false;
+        }
+        sprite.name.assign(reinterpret_cast<const char*>(p), len);
+        p += len;
+        sprites->push_back(sprite);
+    }
+    return p == end;
+}
+
+// Both indexes list the items that succeeded, in item order, at their slots
+static bool CheckIndex(const SvgAtlas& atlas, const std::vector<SvgAtlas::Item>& items)
+{
+    ByteBuffer json;
+    ByteBuffer binary;
+    if (!CHECK_HR(atlas.WriteIndexJson(&json), S_OK) || !CHECK_HR(atlas.WriteIndexBinary(&binary), S_OK)) {
+        return false;
+    }
+    bool ok = true;
+    for (int format = 0; format < 2 && ok; format++) {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        std::vector<Sprite> sprites;
+        ok = CHECK(format == 0 ? ReadJson(json, &width, &height, &sprites) : ReadBinary(binary, &width, &height, &sprites))
+            && CHECK(width == atlas.GetImage().GetWidth() && height == atlas.GetImage().GetHeight());
+        size_t next = 0;
+        for (const SvgAtlas::Item& item : items) {
+            if (FAILED(item.result) || !ok) {
+                continue;
+            }
+            ok = CHECK(next < sprites.size());
+            if (ok) {
+                const Sprite& sprite = sprites[next++];
+                ok = CHECK(sprite.name == item.name && sprite.x == item.x && sprite.y == item.y
+                    && sprite.width == item.width && sprite.height == item.height);
+            }
+        }
+        ok = ok && CHECK(next == sprites.size());
+        if (!ok) {
+            ::fprintf(stderr, "%s index\n", format == 0 ? "JSON" : "binary");
+        }
+    }
+    return ok;
+}
+
+int main()
+{
+    Test::Run("icons are packed apart, inside the atlas, each in its own slot", [] {
+        Test::Random random(29);
+        const std::vector<Icon> icons = MakeIcons(random, 150);
+        for (uint32_t padding : { 0u, 1u, 3u }) {
+            std::vector<SvgAtlas::Item> items = MakeItems(random, icons);
+            SvgAtlas atlas;
+            atlas.SetPadding(padding);
+            SvgOptions opt;
+            CHECK_HR(atlas.Build(items.data(), items.size(), opt), S_OK);
+            for (const SvgAtlas::Item& item : items) {
+                CHECK_HR(item.result, S_OK);
+            }
+            if (CheckSlots(atlas, items, padding) && CheckPixels(atlas, items)) {
+                CheckIndex(atlas, items);
+            }
+        }
+    });
+
+    // Failed items keep their own result and are left out of the image and the indexes
+    Test::Run("failed and oversized icons are left out", [] {
+        Test::Random random(129);
+        std::vector<Icon> icons = MakeIcons(random, 20);
+        icons[3].text = "<html/>";
+        icons[11].text = "<svg xmlns='http://www.w3.org/2000/svg' width='200' height='100'/>";
+        // Quotes, backslashes and control characters in names are escaped in JSON
+        icons[7].name = "a \"quoted\" \\name\\\t\x01";
+        std::vector<SvgAtlas::Item> items = MakeItems(random, icons);
+        items[11].canvasSize = 200;
+        SvgAtlas atlas;
+        atlas.SetWidth(64);
+        SvgOptions opt;
+        CHECK_HR(atlas.Build(items.data(), items.size(), opt), S_OK);
+        CHECK(atlas.GetImage().GetWidth() == 64);
+        CHECK(FAILED(items[3].result));
+        CHECK(items[11].result == E_OUTOFMEMORY);
+        CHECK_HR(items[7].result, S_OK);
+        std::vector<SvgAtlas::Item> placed;
+        for (const SvgAtlas::Item& item : items) {
+            if (SUCCEEDED(item.result)) {
+                placed.push_back(item);
+            }
+        }
+        CHECK(placed.size() == items.size() - 2);
+        if (CheckSlots(atlas, items, 1) && CheckPixels(atlas, placed)) {
+            CheckIndex(atlas, items);
+        }
+    });
+
+    Test::Run("an atlas of nothing fails", [] {
+        Test::Random random(229);
+        std::vector<Icon> icons = MakeIcons(random, 2);
+        icons[0].text = icons[1].text = "<html/>";
+        std::vector<SvgAtlas::Item> items = MakeItems(random, icons);
+        SvgAtlas atlas;
+        SvgOptions opt;
+        CHECK(FAILED(atlas.Build(items.data(), items.size(), opt)));
+        CHECK(FAILED(atlas.Build(nullptr, 0, opt)));
+    });
+
+    return Test::Result();
+}
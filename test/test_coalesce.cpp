@@ -0,0 +1,181 @@
+#include "platform.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "coalesce.hpp"
+#include "test.hpp"
+
+// SingleFlight under concurrent callers, with keys that collide on purpose: a result may only be
+// shared between callers whose content is the same bytes
+
+struct Result
+{
+    uint64_t sum = 0;
+    size_t cb = 0;
+};
+
+static uint64_t Sum(const std::string& content)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < content.size(); i++) {
+        sum = sum * 31 + static_cast<uint8_t>(content[i]);
+    }
+    return sum;
+}
+
+static HRESULT Compute(const std::string& content, Result* result)
+{
+    result->sum = Sum(content);
+    result->cb = content.size();
+    return S_OK;
+}
+
+// Until fn returns true or a second has passed
+template <class TFunc>
+static void WaitFor(const TFunc& fn)
+{
+    const auto end = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (!fn() && std::chrono::steady_clock::now() < end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+int main()
+{
+    Test::Run("fingerprints tell apart every single-byte change", [] {
+        for (size_t cb : { 1, 31, 32, 33, 100, 1000 }) {
+            std::string content(cb, 'a');
+            const uint64_t fingerprint = ContentFingerprint(content.data(), content.size());
+            CHECK(ContentFingerprint(std::string(content).data(), cb) == fingerprint);
+            for (size_t i = 0; i < cb; i++) {
+                content[i] = 'b';
+                CHECK(ContentFingerprint(content.data(), cb) != fingerprint);
+                content[i] = 'a';
+            }
+            CHECK(ContentFingerprint(content.data(), cb - 1) != fingerprint);
+        }
+    });
+
+    Test::Run("identical concurrent requests share one computation", [] {
+        static const int CALLERS = 8;
+        SingleFlight<int, Result> flight;
+        const std::string source(100000, 'x');
+        std::atomic<int> ok(0);
+        std::vector<std::thread> callers;
+        for (int i = 0; i < CALLERS; i++) {
+            callers.emplace_back([&] {
+                // Each caller has its own copy, as each shell provider does
+                const std::string content = source;
+                std::shared_ptr<const Result> result;
+                const HRESULT hr = flight.Do(1, content.data(), content.size(), [&](Result* value) {
+                    WaitFor([&] {
+                        return flight.GetCoalescedCount() == CALLERS - 1;
+                    });
+                    return Compute(content, value);
+                }, &result);
+                if (hr == S_OK && result->sum == Sum(source)) {
+                    ok++;
+                }
+            });
+        }
+        for (std::thread& caller : callers) {
+            caller.join();
+        }
+        CHECK(ok.load() == CALLERS);
+        CHECK(flight.GetExecutedCount() == 1);
+        CHECK(flight.GetCoalescedCount() == CALLERS - 1);
+        CHECK(flight.GetCollidedCount() == 0);
+    });
+
+    Test::Run("a key that collides over other content runs on its own", [] {
+        SingleFlight<int, Result> flight;
+        const std::string first(5000, 'x');
+        std::string second = first;
+        second[4000] = 'y';
+        std::atomic<bool> joined(false);
+        std::shared_ptr<const Result> firstResult;
+        std::thread leader([&] {
+            flight.Do(1, first.data(), first.size(), [&](Result* value) {
+                WaitFor([&] {
+                    return joined.load();
+                });
+                return Compute(first, value);
+            }, &firstResult);
+        });
+        WaitFor([&] {
+            return flight.GetExecutedCount() == 1;
+        });
+        std::shared_ptr<const Result> secondResult;
+        CHECK_HR(flight.Do(1, second.data(), second.size(), [&](Result* value) {
+            return Compute(second, value);
+        }, &secondResult), S_OK);
+        joined = true;
+        leader.join();
+        CHECK(firstResult != nullptr && firstResult->sum == Sum(first));
+        CHECK(secondResult != nullptr && secondResult->sum == Sum(second));
+        CHECK(flight.GetCollidedCount() == 1);
+        CHECK(flight.GetCoalescedCount() == 0);
+    });
+
+    // Many callers over a few documents, with keys that collide between them, waiters that give
+    // up, and each caller's content freed as soon as its call returns, so that a waiter reading
+    // a leader's content after it was gone shows up under the address sanitizer
+    Test::Run("callers with colliding keys under load get their own content's result", [] {
+        static const int THREADS = 8;
+        static const int CALLS = 2000;
+        std::vector<std::string> documents;
+        for (int i = 0; i < 6; i++) {
+            std::string document(1000 + i % 2, 'a');
+            document[i * 100] = 'b';
+            documents.push_back(document);
+        }
+        SingleFlight<uint64_t, Result> flight;
+        std::atomic<int> ok(0);
+        std::atomic<int> cancelled(0);
+        std::atomic<int> wrong(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < THREADS; t++) {
+            threads.emplace_back([&, t] {
+                Test::Random random(46 + t);
+                for (int i = 0; i < CALLS; i++) {
+                    const size_t index = random.Below(static_cast<uint32_t>(documents.size()));
+                    std::unique_ptr<std::string> content(new std::string(documents[index]));
+                    // Two keys for six documents
+                    const uint64_t key = ContentFingerprint(content->data(), content->size()) % 2;
+                    CancelToken token;
+                    if (random.Below(8) == 0) {
+                        token.Cancel();
+                    }
+                    std::shared_ptr<const Result> result;
+                    const HRESULT hr = flight.Do(key, content->data(), content->size(), [&](Result* value) {
+                        if (random.Below(4) == 0) {
+                            std::this_thread::yield();
+                        }
+                        return Compute(*content, value);
+                    }, &result, &token);
+                    content.reset();
+                    if (hr == S_OK && result->sum == Sum(documents[index]) && result->cb == documents[index].size()) {
+                        ok++;
+                    } else if (hr == HRESULT_FROM_WIN32(ERROR_CANCELLED)) {
+                        cancelled++;
+                    } else {
+                        wrong++;
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        CHECK(wrong.load() == 0);
+        CHECK(ok.load() + cancelled.load() == THREADS * CALLS);
+        CHECK(ok.load() > 0);
+        CHECK(flight.GetExecutedCount() + flight.GetCoalescedCount() >= static_cast<uint64_t>(ok.load()));
+    });
+
+    return Test::Result();
+}
@@ -0,0 +1,191 @@
+#include "platform.h"
+#include <vector>
+
+#include "convert.hpp"
+#include "test.hpp"
+
+template <class T>
+struct Tag
+{
+    typedef T Type;
+};
+
+// Calls fn(Tag<TFormat>(), name) for every layout
+template <class TFunc>
+static void ForEachFormat(const TFunc& fn)
+{
+    fn(Tag<FormatPRGBA8>(), "PRGBA8");
+    fn(Tag<FormatRGBA8>(), "RGBA8");
+    fn(Tag<FormatPBGRA8>(), "PBGRA8");
+    fn(Tag<FormatBGRA8>(), "BGRA8");
+    fn(Tag<FormatPARGB8>(), "PARGB8");
+    fn(Tag<FormatARGB8>(), "ARGB8");
+    fn(Tag<FormatRGB565>(), "RGB565");
+    fn(Tag<FormatGray8>(), "Gray8");
+    fn(Tag<FormatGrayA8>(), "GrayA8");
+    fn(Tag<FormatAlpha8>(), "Alpha8");
+    fn(Tag<FormatRGBA16>(), "RGBA16");
+}
+
+// Every premultiplied pixel with r, g and b each at or below alpha, stepping through the colour
+// values of each alpha so that every channel takes every value it can
+static std::vector<uint32_t> PremultipliedPixels()
+{
+    std::vector<uint32_t> pixels;
+    for (uint32_t a = 0; a < 256; a++) {
+        for (uint32_t c = 0; c <= a; c++) {
+            const uint32_t g = (c * 7 + 3) % (a + 1);
+            const uint32_t b = a - c;
+            pixels.push_back(c | (g << 8) | (b << 16) | (a << 24));
+        }
+    }
+    return pixels;
+}
+
+// PRGBA8 to the format and back, for each pixel on its own and for the whole run
+template <class TFormat>
+static std::vector<uint32_t> RoundTrip(const std::vector<uint32_t>& pixels)
+{
+    std::vector<uint8_t> converted(pixels.size() * TFormat::BYTES);
+    std::vector<uint32_t> back(pixels.size());
+    PixelConverter::Convert<FormatPRGBA8, TFormat>(pixels.data(), converted.data(), pixels.size());
+    PixelConverter::Convert<TFormat, FormatPRGBA8>(converted.data(), back.data(), pixels.size());
+    return back;
+}
+
+template <class TFormat>
+static int CountMismatches(const std::vector<uint8_t>& values, size_t count)
+{
+    std::vector<uint32_t> pixels(count);
+    std::vector<uint8_t> back(values.size());
+    PixelConverter::Convert<TFormat, FormatPRGBA8>(values.data(), pixels.data(), count);
+    PixelConverter::Convert<FormatPRGBA8, TFormat>(pixels.data(), back.data(), count);
+    int mismatches = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        mismatches += values[i] != back[i];
+    }
+    return mismatches;
+}
+
+int main()
+{
+    // Premultiplied in, premultiplied out: the layouts that keep colour and alpha lose nothing,
+    // straight ones included, as unpremultiplying and premultiplying both round to nearest
+    Test::Run("premultiplied pixels survive every colour layout", [] {
+        const std::vector<uint32_t> pixels = PremultipliedPixels();
+        ForEachFormat([&](auto tag, const char* name) {
+            typedef typename decltype(tag)::Type Format;
+            if (Format::BYTES < 4) {
+                return;
+            }
+            const std::vector<uint32_t> back = RoundTrip<Format>(pixels);
+            for (size_t i = 0; i < pixels.size(); i++) {
+                if (back[i] != pixels[i]) {
+                    ::fprintf(stderr, "%s: %08x came back as %08x\n", name, pixels[i], back[i]);
+                    CHECK(back[i] == pixels[i]);
+                    break;
+                }
+            }
+        });
+    });
+
+    Test::Run("every RGB565 value round-trips", [] {
+        std::vector<uint8_t> values(65536 * 2);
+        for (uint32_t i = 0; i < 65536; i++) {
+            const uint16_t value = static_cast<uint16_t>(i);
+            ::memcpy(&values[i * 2], &value, 2);
+        }
+        CHECK(CountMismatches<FormatRGB565>(values, 65536) == 0);
+    });
+
+    Test::Run("every Gray8 and Alpha8 value round-trips", [] {
+        std::vector<uint8_t> values(256);
+        for (uint32_t i = 0; i < 256; i++) {
+            values[i] = static_cast<uint8_t>(i);
+        }
+        CHECK(CountMismatches<FormatGray8>(values, 256) == 0);
+        CHECK(CountMismatches<FormatAlpha8>(values, 256) == 0);
+    });
+
+    // Premultiplying loses colour under low alpha; alpha itself and opaque grey do not
+    Test::Run("every GrayA8 value round-trips within the alpha's precision", [] {
+        std::vector<uint8_t> values(65536 * 2);
+        for (uint32_t i = 0; i < 65536; i++) {
+            values[i * 2] = static_cast<uint8_t>(i & 0xff);
+            values[i * 2 + 1] = static_cast<uint8_t>(i >> 8);
+        }
+        std::vector<uint32_t> pixels(65536);
+        std::vector<uint8_t> back(values.size());
+        PixelConverter::Convert<FormatGrayA8, FormatPRGBA8>(values.data(), pixels.data(), 65536);
+        PixelConverter::Convert<FormatPRGBA8, FormatGrayA8>(pixels.data(), back.data(), 65536);
+        int bad = 0;
+        for (uint32_t i = 0; i < 65536; i++) {
+            const int g = values[i * 2];
+            const int a = values[i * 2 + 1];
+            const int error = ::abs(back[i * 2] - g);
+            const int allowed = a == 0 ? 255 : (255 + a) / (2 * a);
+            if (back[i * 2 + 1] != a || error > allowed) {
+                bad++;
+            }
+        }
+        CHECK(bad == 0);
+    });
+
+    Test::Run("every 8-bit RGBA16 value round-trips", [] {
+        std::vector<uint8_t> values(256 * 8);
+        for (uint32_t i = 0; i < 256; i++) {
+            const uint16_t channels[4] = { static_cast<uint16_t>(i * 257), static_cast<uint16_t>((255 - i) * 257), static_cast<uint16_t>((i * 3 % 256) * 257), 65535 };
+            ::memcpy(&values[i * 8], channels, 8);
+        }
+        CHECK(CountMismatches<FormatRGBA16>(values, 256) == 0);
+    });
+
+    // The vector loops against the scalar tail, which a single pixel always takes, for all
+    // 121 pairs; sources are arbitrary bytes, invalid premultiplied pixels included
+    Test::Run("vector and scalar conversions agree for every pair", [] {
+        static const size_t COUNT = 1031;
+        Test::Random random(36);
+        std::vector<uint8_t> source(COUNT * 8);
+        for (uint8_t& byte : source) {
+            byte = static_cast<uint8_t>(random.Next());
+        }
+        ForEachFormat([&](auto srcTag, const char* srcName) {
+            typedef typename decltype(srcTag)::Type Src;
+            ForEachFormat([&](auto dstTag, const char* dstName) {
+                typedef typename decltype(dstTag)::Type Dst;
+                std::vector<uint8_t> bulk(COUNT * Dst::BYTES);
+                std::vector<uint8_t> single(COUNT * Dst::BYTES);
+                PixelConverter::Convert<Src, Dst>(source.data(), bulk.data(), COUNT);
+                for (size_t i = 0; i < COUNT; i++) {
+                    PixelConverter::Convert<Src, Dst>(source.data() + i * Src::BYTES, single.data() + i * Dst::BYTES, 1);
+                }
+                if (bulk != single) {
+                    ::fprintf(stderr, "%s to %s: vector and scalar results differ\n", srcName, dstName);
+                    CHECK(bulk == single);
+                }
+            });
+        });
+    });
+
+    Test::Run("strided conversions walk bottom-up images", [] {
+        static const uint32_t WIDTH = 13;
+        static const uint32_t HEIGHT = 5;
+        uint32_t pixels[WIDTH * HEIGHT];
+        for (uint32_t i = 0; i < WIDTH * HEIGHT; i++) {
+            pixels[i] = 0xff000000u | (i * 0x030507u);
+        }
+        const ptrdiff_t stride = WIDTH * 2 + 6;
+        std::vector<uint8_t> image(stride * HEIGHT);
+        uint32_t back[WIDTH * HEIGHT];
+        PixelConverter::Convert<FormatPRGBA8, FormatRGB565>(pixels, WIDTH * 4, &image[stride * (HEIGHT - 1)], -stride, WIDTH, HEIGHT);
+        PixelConverter::Convert<FormatRGB565, FormatPRGBA8>(&image[stride * (HEIGHT - 1)], -stride, back, WIDTH * 4, WIDTH, HEIGHT);
+        uint16_t packed[WIDTH * HEIGHT];
+        uint32_t expected[WIDTH * HEIGHT];
+        PixelConverter::Convert<FormatPRGBA8, FormatRGB565>(pixels, packed, WIDTH * HEIGHT);
+        PixelConverter::Convert<FormatRGB565, FormatPRGBA8>(packed, expected, WIDTH * HEIGHT);
+        CHECK(::memcmp(back, expected, sizeof(back)) == 0);
+        CHECK(::memcmp(&image[stride * (HEIGHT - 1)], packed, WIDTH * 2) == 0);
+    });
+
+    return Test::Result();
+}
@@ -0,0 +1,114 @@
+// Built as C++20, for AsyncAwaiter
+#include "platform.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "async.hpp"
+#include "test.hpp"
+
+static const char SVG[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='40' height='20'>"
+    "<rect x='2' y='2' width='36' height='16' fill='#08f'/>"
+    "</svg>";
+
+class ThreadExecutor : public Executor
+{
+public:
+    void Post(Task* task) override
+    {
+        std::thread([task] {
+            task->Run();
+        }).detach();
+    }
+};
+
+// Starts at once and runs to the end on whichever threads resume it
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { ::abort(); }
+    };
+};
+
+// The operations live in the coroutine frame and are destroyed with it, right after resuming
+static Detached LoadAndRender(Executor* executor, std::promise<HRESULT>* done, uint32_t* width)
+{
+    SvgOptions opt;
+    Svg svg;
+    SvgRenderTarget target;
+    SvgRenderTarget::RenderOptions renderOpt;
+    SvgLoadOperation load;
+    SvgRenderOperation render;
+    load.SetExecutor(executor);
+    render.SetExecutor(executor);
+    HRESULT hr = co_await AsyncAwaiter(load, [&] {
+        return load.Start(&svg, SVG, sizeof(SVG) - 1, opt);
+    });
+    if (SUCCEEDED(hr)) {
+        hr = co_await AsyncAwaiter(render, [&] {
+            return render.Start(&svg, renderOpt, &target);
+        });
+    }
+    *width = target.GetWidth();
+    done->set_value(hr);
+}
+
+static void SlowCompletion(AsyncOperation&, void*)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+static Detached StartBusy(SvgLoadOperation* op, Svg* svg, const SvgOptions* opt, std::promise<HRESULT>* done)
+{
+    HRESULT hr = co_await AsyncAwaiter(*op, [&] {
+        return op->Start(svg, SVG, sizeof(SVG) - 1, *opt);
+    });
+    done->set_value(hr);
+}
+
+int main()
+{
+    Test::Run("a coroutine awaits load and render", [] {
+        ThreadExecutor executor;
+        for (int i = 0; i < 50; i++) {
+            std::promise<HRESULT> done;
+            uint32_t width = 0;
+            LoadAndRender(&executor, &done, &width);
+            CHECK_HR(done.get_future().get(), S_OK);
+            CHECK(width == 40);
+        }
+    });
+
+    Test::Run("a coroutine awaits inline executors", [] {
+        std::promise<HRESULT> done;
+        uint32_t width = 0;
+        LoadAndRender(nullptr, &done, &width);
+        CHECK_HR(done.get_future().get(), S_OK);
+        CHECK(width == 40);
+    });
+
+    Test::Run("awaiting a busy operation resumes with its error", [] {
+        ThreadExecutor executor;
+        SvgOptions opt;
+        Svg first;
+        Svg second;
+        SvgLoadOperation op;
+        op.SetExecutor(&executor).SetCompletion(SlowCompletion, nullptr);
+        CHECK_HR(op.Start(&first, SVG, sizeof(SVG) - 1, opt), S_OK);
+        std::promise<HRESULT> done;
+        StartBusy(&op, &second, &opt, &done);
+        std::future<HRESULT> result = done.get_future();
+        CHECK(result.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        CHECK_HR(result.get(), HRESULT_FROM_WIN32(ERROR_BUSY));
+        CHECK_HR(op.Wait(), S_OK);
+    });
+
+    return Test::Result();
+}
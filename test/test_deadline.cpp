@@ -0,0 +1,107 @@
+#include "platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "test.hpp"
+
+// Slow inputs against the thumbnail deadline: whatever a document costs, a render with a token
+// must give up within the deadline plus about one stripe, never run to the end of a slow one.
+// The documents here are slow for resvg on their own; a resvg stand-in built for tests can be
+// slowed down in proportion to the pixels it renders with STUB_SLOW_MS, milliseconds per 256x256.
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string MakeBlurChain(int filters, int shapes)
+{
+    std::string text = "<svg xmlns='http://www.w3.org/2000/svg' width='400' height='400'>";
+    for (int i = 0; i < filters; i++) {
+        text += "<filter id='f" + std::to_string(i) + "' x='-50%' y='-50%' width='200%' height='200%'>"
+            "<feGaussianBlur stdDeviation='" + std::to_string(20 + i) + "'/><feOffset dx='3' dy='3'/></filter>";
+    }
+    for (int i = 0; i < shapes; i++) {
+        text += "<circle cx='" + std::to_string(20 + (i * 37) % 360) + "' cy='" + std::to_string(20 + (i * 53) % 360)
+            + "' r='30' fill='#f80' filter='url(#f" + std::to_string(i % filters) + ")'/>";
+    }
+    return text + "</svg>";
+}
+
+static double GetMilliseconds(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Milliseconds for a thumbnail without a deadline
+static double TimeUnbounded(const Svg& svg, uint32_t size)
+{
+    SvgRenderTarget::RenderOptions opt;
+    opt.SetCanvasSize(size, size).SetToContain();
+    SvgRenderTarget target;
+    const Clock::time_point start = Clock::now();
+    CHECK_HR(svg.Render(opt, &target), S_OK);
+    return GetMilliseconds(start);
+}
+
+int main()
+{
+    ::setenv("STUB_SLOW_MS", "400", 0);
+    static const uint32_t SIZE = 256;
+    static const uint32_t DEADLINE = 100;
+    const std::string inputs[] = { MakeBlurChain(8, 200), MakeBlurChain(32, 800) };
+
+    Test::Run("slow thumbnails stop within the deadline and one stripe", [&] {
+        for (const std::string& text : inputs) {
+            SvgOptions svgOpt;
+            Svg svg;
+            CHECK_HR(svg.Load(text.data(), text.size(), svgOpt), S_OK);
+            const double unbounded = TimeUnbounded(svg, SIZE);
+            // A stripe is 64 rows and 16 of overlap out of 256, with 50 ms more for scheduling
+            const double bound = DEADLINE + unbounded * 80 / SIZE + 50;
+            std::vector<double> latencies;
+            for (int i = 0; i < 20; i++) {
+                CancelToken token;
+                token.SetTimeout(DEADLINE);
+                SvgRenderTarget::RenderOptions opt;
+                opt.SetCanvasSize(SIZE, SIZE).SetToContain().SetCancelToken(&token);
+                SvgRenderTarget target;
+                const Clock::time_point start = Clock::now();
+                const HRESULT hr = svg.Render(opt, &target);
+                latencies.push_back(GetMilliseconds(start));
+                CHECK(hr == S_OK || hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+                // What was finished in time comes back as a fallback frame
+                CHECK(!target.IsNull());
+            }
+            const double worst = *std::max_element(latencies.begin(), latencies.end());
+            if (!CHECK(unbounded <= DEADLINE || worst <= bound)) {
+                ::fprintf(stderr, "unbounded %.1f ms, worst %.1f ms, bound %.1f ms\n", unbounded, worst, bound);
+            }
+        }
+    });
+
+    Test::Run("conversions stop between bands", [] {
+        SvgRenderTarget target;
+        CHECK_HR(target.Create(2048, 1024), S_OK);
+        std::vector<uint32_t> pixels(2048 * 1024, 0x12345678);
+        CancelToken token;
+        token.Cancel();
+        CHECK_HR(target.ConvertTo<FormatBGRA8>(pixels.data(), 2048 * 4, &token), HRESULT_FROM_WIN32(ERROR_CANCELLED));
+        CHECK(pixels.back() == 0x12345678);
+        Backdrop backdrop;
+        CHECK_HR(target.CompositeTo(backdrop, pixels.data(), 2048, &token), HRESULT_FROM_WIN32(ERROR_CANCELLED));
+        token.Reset();
+        token.SetTimeout(0);
+        CHECK_HR(target.ConvertTo<FormatBGRA8>(pixels.data(), 2048 * 4, &token), HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+        SvgRenderTarget small;
+        CHECK_HR(small.Create(64, 64), S_OK);
+        CHECK_HR(small.ConvertTo<FormatBGRA8>(pixels.data(), 64 * 4, &token), HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+        CHECK_HR(target.ConvertTo<FormatBGRA8>(pixels.data(), 2048 * 4), S_OK);
+        CHECK(pixels.back() == 0);
+    });
+
+    return Test::Result();
+}
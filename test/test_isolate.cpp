@@ -0,0 +1,371 @@
+#include "platform.h"
+#include <stdio.h>
+#include <dirent.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "isolate.hpp"
+#include "test.hpp"
+
+// The workers and the zygote are this program, run again with RenderWorker::GetWorkerArg() and
+// RenderWorker::GetZygoteArg(); every pool test runs with workers exec'd and forked by a zygote
+
+static const char SVG[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='120' height='80'>"
+    "<circle cx='60' cy='40' r='30' fill='#f80' stroke='#222' stroke-width='3'/>"
+    "</svg>";
+
+typedef std::chrono::steady_clock Clock;
+
+// Sanitized workers map far more address space than any sensible limit
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+static const bool SANITIZED = true;
+#else
+static const bool SANITIZED = false;
+#endif
+
+static std::string GetSelf()
+{
+    char path[4096];
+    const ssize_t cch = ::readlink("/proc/self/exe", path, sizeof(path) - 1);
+    return std::string(path, cch > 0 ? static_cast<size_t>(cch) : 0);
+}
+
+// Live processes whose parent is parent, read from /proc
+static std::vector<pid_t> GetChildren(pid_t parent = ::getpid())
+{
+    std::vector<pid_t> children;
+    DIR* dir = ::opendir("/proc");
+    if (dir == nullptr) {
+        return children;
+    }
+    while (dirent* entry = ::readdir(dir)) {
+        const pid_t pid = static_cast<pid_t>(::atoi(entry->d_name));
+        if (pid <= 0) {
+            continue;
+        }
+        char path[64];
+        ::snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+        FILE* fp = ::fopen(path, "r");
+        if (fp == nullptr) {
+            continue;
+        }
+        char stat[512] = {};
+        const size_t cb = ::fread(stat, 1, sizeof(stat) - 1, fp);
+        ::fclose(fp);
+        stat[cb] = 0;
+        // The command name is in parentheses and may contain anything, the state and parent follow
+        const char* end = ::strrchr(stat, ')');
+        char state = 0;
+        int ppid = 0;
+        if (end != nullptr && ::sscanf(end + 1, " %c %d", &state, &ppid) == 2 && ppid == parent && state != 'Z') {
+            children.push_back(pid);
+        }
+    }
+    ::closedir(dir);
+    return children;
+}
+
+// Workers forked by a zygote are its children rather than this process'
+static std::vector<pid_t> GetGrandchildren()
+{
+    std::vector<pid_t> grandchildren;
+    for (pid_t child : GetChildren()) {
+        const std::vector<pid_t> more = GetChildren(child);
+        grandchildren.insert(grandchildren.end(), more.begin(), more.end());
+    }
+    return grandchildren;
+}
+
+// The workers, whichever process started them
+static std::vector<pid_t> GetWorkers(bool zygote)
+{
+    return zygote ? GetGrandchildren() : GetChildren();
+}
+
+static void SignalWorkers(bool zygote, int sig)
+{
+    for (pid_t pid : GetWorkers(zygote)) {
+        ::kill(pid, sig);
+    }
+}
+
+// Until they are all dead, though not yet reaped
+static void KillWorkers(bool zygote)
+{
+    SignalWorkers(zygote, SIGKILL);
+    while (!GetWorkers(zygote).empty()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void MakePool(RenderWorkerPool* pool, bool zygote)
+{
+    if (SANITIZED) {
+        pool->SetMemoryLimit(0);
+    }
+    pool->SetZygote(zygote);
+}
+
+static HRESULT Render(RenderWorkerPool& pool, uint32_t size, DWORD timeout, RenderWorkerResult* result)
+{
+    return pool.Render(SVG, sizeof(SVG) - 1, size, RenderQualityPrecise, timeout, result);
+}
+
+static bool Matches(const RenderWorkerResult& result, const SvgRenderTarget& expected)
+{
+    return !result.IsNull() && result.GetWidth() == expected.GetWidth() && result.GetHeight() == expected.GetHeight()
+        && ::memcmp(result.GetPixels(), expected.GetPixels(), static_cast<size_t>(expected.GetWidth()) * expected.GetHeight() * 4) == 0;
+}
+
+static void RenderInProcess(uint32_t size, SvgRenderTarget* target)
+{
+    Svg svg;
+    SvgOptions opt;
+    CHECK_HR(svg.Load(SVG, sizeof(SVG) - 1, opt), S_OK);
+    SvgRenderTarget::RenderOptions ropt;
+    ropt.SetCanvasSize(size, size).SetToContain();
+    CHECK_HR(svg.Render(ropt, target), S_OK);
+}
+
+static double GetSeconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    if (RenderWorker::ServeIfAsked(argc, argv)) {
+        return 0;
+    }
+    const std::string self = GetSelf();
+
+    Test::Run("a worker header out of bounds is rejected", [] {
+        RenderWorker::Header header = { S_OK, 64, 48, 0 };
+        uint32_t width = 0;
+        uint32_t height = 0;
+        CHECK_HR(RenderWorker::ReadHeader(reinterpret_cast<const BYTE*>(&header), 64, &width, &height), S_OK);
+        CHECK(width == 64 && height == 48);
+        header.width = 65;
+        CHECK_HR(RenderWorker::ReadHeader(reinterpret_cast<const BYTE*>(&header), 64, &width, &height), E_UNEXPECTED);
+        header.width = 0;
+        CHECK_HR(RenderWorker::ReadHeader(reinterpret_cast<const BYTE*>(&header), 64, &width, &height), E_UNEXPECTED);
+        header.width = 64;
+        header.height = 0xFFFFFFFF;
+        CHECK_HR(RenderWorker::ReadHeader(reinterpret_cast<const BYTE*>(&header), 64, &width, &height), E_UNEXPECTED);
+        header.hr = E_OUTOFMEMORY;
+        CHECK_HR(RenderWorker::ReadHeader(reinterpret_cast<const BYTE*>(&header), 64, &width, &height), E_OUTOFMEMORY);
+    });
+
+    for (bool zygote : { false, true }) {
+        const std::string mode = zygote ? " (zygote)" : " (exec)";
+
+        Test::Run(("worker renders match in-process renders" + mode).c_str(), [&] {
+            RenderWorkerPool pool(self.c_str(), 2);
+            MakePool(&pool, zygote);
+            const uint32_t sizes[] = { 16, 64, 256 };
+            for (uint32_t size : sizes) {
+                SvgRenderTarget expected;
+                RenderInProcess(size, &expected);
+                RenderWorkerResult result;
+                CHECK_HR(Render(pool, size, 5000, &result), S_OK);
+                CHECK(Matches(result, expected));
+            }
+        });
+
+        Test::Run(("a worker that died while idle is restarted" + mode).c_str(), [&] {
+            RenderWorkerPool pool(self.c_str(), 1);
+            MakePool(&pool, zygote);
+            RenderWorkerResult result;
+            CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+            KillWorkers(zygote);
+            CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        });
+
+        Test::Run(("a worker that dies during a job fails only that job" + mode).c_str(), [&] {
+            RenderWorkerPool pool(self.c_str(), 1);
+            MakePool(&pool, zygote);
+            RenderWorkerResult result;
+            CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+            // Stopped, the worker still takes the job into its socket, and dies with it
+            SignalWorkers(zygote, SIGSTOP);
+            HRESULT hr = S_OK;
+            std::thread render([&] {
+                RenderWorkerResult result;
+                hr = Render(pool, 32, 10000, &result);
+            });
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            SignalWorkers(zygote, SIGKILL);
+            render.join();
+            CHECK_HR(hr, HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED));
+            CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        });
+
+        Test::Run(("a hung worker times out and is replaced" + mode).c_str(), [&] {
+            RenderWorkerPool pool(self.c_str(), 1);
+            MakePool(&pool, zygote);
+            RenderWorkerResult result;
+            CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+            SignalWorkers(zygote, SIGSTOP);
+            const Clock::time_point start = Clock::now();
+            CHECK_HR(Render(pool, 32, 300, &result), HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+            CHECK(GetSeconds(start) < 2);
+            CHECK(result.IsNull());
+            CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        });
+
+        Test::Run(("the timeout covers the wait for a free worker" + mode).c_str(), [&] {
+            RenderWorkerPool pool(self.c_str(), 1);
+            MakePool(&pool, zygote);
+            RenderWorkerResult result;
+            CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+            SignalWorkers(zygote, SIGSTOP);
+            std::thread hung([&] {
+                RenderWorkerResult result;
+                Render(pool, 32, 3000, &result);
+            });
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            const Clock::time_point start = Clock::now();
+            CHECK_HR(Render(pool, 32, 300, &result), HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+            CHECK(GetSeconds(start) < 2);
+            hung.join();
+        });
+
+        if (!SANITIZED) {
+            Test::Run(("a job over the memory limit fails without taking the pool down" + mode).c_str(), [&] {
+                RenderWorkerPool pool(self.c_str(), 1);
+                MakePool(&pool, zygote);
+                CHECK_HR(pool.SetMemoryLimit(256U << 20), S_OK);
+                RenderWorkerResult result;
+                CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+                // 1 GB of pixels, more than the worker may map
+                CHECK(FAILED(Render(pool, 16384, 5000, &result)));
+                CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+            });
+        }
+
+        // Workers, and the zygote, are killed and stopped at random under load; every job must
+        // end with its pixels, a timeout or an abort, and the pool must still serve afterwards
+        // and leave no process behind
+        Test::Run(("workers killed and hung under load" + mode).c_str(), [&] {
+            static const uint32_t SIZES[] = { 16, 48, 128 };
+            SvgRenderTarget expected[3];
+            for (int i = 0; i < 3; i++) {
+                RenderInProcess(SIZES[i], &expected[i]);
+            }
+            // Workers the zygote forked outlive it, as children of init
+            std::vector<pid_t> orphans;
+            {
+                RenderWorkerPool pool(self.c_str(), 3);
+                MakePool(&pool, zygote);
+                std::atomic<int> ok(0);
+                std::atomic<int> lost(0);
+                std::atomic<int> wrong(0);
+                std::atomic<bool> running(true);
+                std::thread chaos([&] {
+                    Test::Random random(41);
+                    for (int i = 0; i < 20 && running; i++) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(10 + random.Below(30)));
+                        const std::vector<pid_t> workers = GetWorkers(zygote);
+                        if (zygote && i % 5 == 4) {
+                            orphans.insert(orphans.end(), workers.begin(), workers.end());
+                            SignalWorkers(false, SIGKILL);
+                        } else if (!workers.empty()) {
+                            ::kill(workers[random.Below(static_cast<uint32_t>(workers.size()))], random.Below(2) == 0 ? SIGKILL : SIGSTOP);
+                        }
+                    }
+                });
+                std::vector<std::thread> clients;
+                for (int t = 0; t < 4; t++) {
+                    clients.emplace_back([&, t] {
+                        for (int i = 0; i < 40; i++) {
+                            const int index = (t + i) % 3;
+                            RenderWorkerResult result;
+                            const HRESULT hr = Render(pool, SIZES[index], 1000, &result);
+                            if (hr == S_OK && Matches(result, expected[index])) {
+                                ok++;
+                            } else if (hr == HRESULT_FROM_WIN32(ERROR_TIMEOUT) || hr == HRESULT_FROM_WIN32(ERROR_PROCESS_ABORTED)) {
+                                lost++;
+                            } else {
+                                wrong++;
+                            }
+                        }
+                    });
+                }
+                for (std::thread& client : clients) {
+                    client.join();
+                }
+                running = false;
+                chaos.join();
+                CHECK(wrong.load() == 0);
+                CHECK(ok.load() + lost.load() == 160);
+                CHECK(ok.load() > lost.load());
+                // Stopped workers left idle are found out by the next jobs
+                SignalWorkers(zygote, SIGCONT);
+                for (pid_t pid : orphans) {
+                    ::kill(pid, SIGCONT);
+                }
+                RenderWorkerResult result;
+                CHECK_HR(Render(pool, 48, 5000, &result), S_OK);
+                CHECK(Matches(result, expected[1]));
+            }
+            CHECK(GetChildren().empty());
+            CHECK(GetGrandchildren().empty());
+            // The pool killed the orphans it still had; the others were already dead
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            for (pid_t pid : orphans) {
+                char path[64];
+                ::snprintf(path, sizeof(path), "/proc/%d/stat", static_cast<int>(pid));
+                FILE* fp = ::fopen(path, "r");
+                if (fp != nullptr) {
+                    char stat[512] = {};
+                    const size_t cb = ::fread(stat, 1, sizeof(stat) - 1, fp);
+                    ::fclose(fp);
+                    stat[cb] = 0;
+                    const char* end = ::strrchr(stat, ')');
+                    CHECK(end == nullptr || end[2] == 'Z' || end[2] == 'X');
+                }
+            }
+        });
+    }
+
+    Test::Run("a zygote that died is restarted", [&] {
+        RenderWorkerPool pool(self.c_str(), 1);
+        MakePool(&pool, true);
+        RenderWorkerResult result;
+        CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        const std::vector<pid_t> workers = GetGrandchildren();
+        CHECK(workers.size() == 1);
+        CHECK(GetChildren().size() == 1);
+        // Its worker goes on serving without it, until it dies too
+        SignalWorkers(false, SIGKILL);
+        while (!GetChildren().empty()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        for (pid_t pid : workers) {
+            ::kill(pid, SIGKILL);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        CHECK(GetChildren().size() == 1);
+        CHECK(GetGrandchildren().size() == 1);
+    });
+
+    Test::Run("turning the zygote off kills it", [&] {
+        RenderWorkerPool pool(self.c_str(), 2);
+        MakePool(&pool, true);
+        RenderWorkerResult result;
+        CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        CHECK_HR(pool.SetZygote(false), S_OK);
+        CHECK(GetGrandchildren().empty());
+        CHECK_HR(Render(pool, 32, 5000, &result), S_OK);
+        CHECK(GetChildren().size() == 1);
+        CHECK(GetGrandchildren().empty());
+    });
+
+    return Test::Result();
+}
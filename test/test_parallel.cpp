@@ -0,0 +1,129 @@
+#include "platform.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "parallel.hpp"
+#include "test.hpp"
+
+class CountTask : public Task
+{
+public:
+    std::atomic<int>* count = nullptr;
+
+    void Run() override
+    {
+        (*this->count)++;
+    }
+};
+
+// Holds its worker until released
+class BlockTask : public Task
+{
+public:
+    std::atomic<bool> started;
+    std::atomic<bool> released;
+
+    BlockTask()
+        : started(false)
+        , released(false)
+    {
+    }
+
+    void Run() override
+    {
+        this->started = true;
+        while (!this->released) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+static bool WaitFor(const std::atomic<int>& count, int expected)
+{
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (count.load() < expected) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+// Workers that idle for a millisecond; never destroyed, as their threads may still be on their
+// way out when a test ends
+static TaskScheduler* NewScheduler(unsigned concurrency = 4)
+{
+    static TaskScheduler* schedulers[3];
+    static int count = 0;
+    return schedulers[count++] = new TaskScheduler(concurrency, 1);
+}
+
+int main()
+{
+    // Workers exit while tasks keep arriving around that time; a task pushed as the last one
+    // leaves must still run
+    Test::Run("posted tasks run while workers come and go", [] {
+        TaskScheduler* scheduler = NewScheduler();
+        Test::Random random(43);
+        static CountTask tasks[1000];
+        std::atomic<int> count(0);
+        int lost = 0;
+        for (int i = 0; i < 1000 && lost == 0; i++) {
+            tasks[i].count = &count;
+            scheduler->Post(&tasks[i]);
+            if (!WaitFor(count, i + 1)) {
+                lost++;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(500 + random.Below(1500)));
+        }
+        CHECK(lost == 0);
+    });
+
+    Test::Run("groups on a scheduler of their own finish every task", [] {
+        TaskScheduler* scheduler = NewScheduler();
+        for (int round = 0; round < 50; round++) {
+            std::atomic<int> count(0);
+            TaskGroup group(TaskPriorityNormal, nullptr, *scheduler);
+            for (int i = 0; i < 100; i++) {
+                group.Run([&count] {
+                    count++;
+                });
+            }
+            CHECK_HR(group.Wait(), S_OK);
+            CHECK(count.load() == 100);
+            std::this_thread::sleep_for(std::chrono::milliseconds(round % 3));
+        }
+    });
+
+    // With its only worker held, the waiting thread takes every task off the injection stack,
+    // oldest first, putting the rest back each time; they must go back in the order they came
+    Test::Run("a waiter that is not a worker runs tasks in the order they came", [] {
+        TaskScheduler* scheduler = NewScheduler(2);
+        // Static, as the worker may still be in Run when the test returns
+        static BlockTask block;
+        scheduler->Post(&block);
+        while (!block.started) {
+            std::this_thread::yield();
+        }
+        for (int count : { 2, 3, 10, 100 }) {
+            std::vector<int> order;
+            TaskGroup group(TaskPriorityNormal, nullptr, *scheduler);
+            for (int i = 0; i < count; i++) {
+                group.Run([&order, i] {
+                    order.push_back(i);
+                });
+            }
+            CHECK_HR(group.Wait(), S_OK);
+            bool sorted = CHECK(static_cast<int>(order.size()) == count);
+            for (int i = 0; i < count && sorted; i++) {
+                sorted = CHECK(order[i] == i);
+            }
+        }
+        block.released = true;
+    });
+
+    return Test::Result();
+}
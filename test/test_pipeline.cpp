@@ -0,0 +1,217 @@
+#include "platform.h"
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pipeline.hpp"
+#include "batch.hpp"
+#include "test.hpp"
+
+// BoundedQueue's blocking at capacity and on close, Pipeline's delivery with several threads a
+// stage, and SvgBatchExporter over real files
+
+static void Sleep(int ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+struct Traced
+{
+    size_t index = 0;
+    std::string stages;
+};
+
+int main()
+{
+    Test::Run("a full queue holds the producer back until an item is taken", [] {
+        BoundedQueue<int> queue(3);
+        std::atomic<int> pushed(0);
+        std::thread producer([&] {
+            for (int i = 0; i < 5; i++) {
+                queue.Push(std::move(i));
+                pushed++;
+            }
+        });
+        Sleep(50);
+        CHECK(pushed == 3);
+        int item = -1;
+        CHECK(queue.Pop(&item) && item == 0);
+        Sleep(50);
+        CHECK(pushed == 4);
+        CHECK(queue.Pop(&item) && item == 1);
+        producer.join();
+        CHECK(pushed == 5);
+    });
+
+    Test::Run("a closed queue hands out what it holds, then wakes waiters empty-handed", [] {
+        BoundedQueue<int> queue(4);
+        for (int i = 0; i < 3; i++) {
+            queue.Push(std::move(i));
+        }
+        queue.Close();
+        int item = -1;
+        for (int i = 0; i < 3; i++) {
+            CHECK(queue.Pop(&item) && item == i);
+        }
+        CHECK(!queue.Pop(&item));
+        BoundedQueue<int> empty(1);
+        std::atomic<int> woken(0);
+        std::vector<std::thread> waiters;
+        for (int i = 0; i < 3; i++) {
+            waiters.emplace_back([&] {
+                int unused;
+                woken += empty.Pop(&unused) ? 100 : 1;
+            });
+        }
+        Sleep(30);
+        CHECK(woken == 0);
+        empty.Close();
+        for (auto& waiter : waiters) {
+            waiter.join();
+        }
+        CHECK(woken == 3);
+    });
+
+    // Stages with several threads reorder items, so only the set that comes out is checked
+    Test::Run("every item passes every stage once, in stage order", [] {
+        static const size_t COUNT = 2000;
+        Pipeline<Traced> pipeline;
+        pipeline.SetQueueCapacity(3);
+        pipeline.AddStage("a", 1, [](Traced& item) {
+            item.stages += 'a';
+        }).AddStage("b", 4, [](Traced& item) {
+            item.stages += 'b';
+            if (item.index % 7 == 0) {
+                std::this_thread::yield();
+            }
+        }).AddStage("c", 3, [](Traced& item) {
+            item.stages += 'c';
+        });
+        std::vector<int> seen(COUNT, 0);
+        int misrouted = 0;
+        CHECK_HR(pipeline.Run(COUNT, [](size_t i, Traced& item) {
+            item.index = i;
+        }, [&](Traced& item) {
+            seen[item.index]++;
+            misrouted += item.stages != "abc";
+        }), S_OK);
+        CHECK(std::count(seen.begin(), seen.end(), 1) == static_cast<ptrdiff_t>(COUNT));
+        CHECK(misrouted == 0);
+        CHECK(pipeline.GetStageCount() == 3);
+        for (size_t i = 0; i < 3; i++) {
+            CHECK(pipeline.GetStageStats(i).items == COUNT);
+        }
+        CHECK(pipeline.GetStageStats(1).concurrency == 4);
+        CHECK(pipeline.GetElapsedSeconds() > 0);
+    });
+
+    // A slow last stage holds the earlier ones back: no more items are alive than the stage
+    // threads, the queues, the feeder and the caller can hold
+    Test::Run("a slow stage bounds the items in flight", [] {
+        static const size_t COUNT = 200;
+        static const size_t CAPACITY = 2;
+        Pipeline<Traced> pipeline;
+        pipeline.SetQueueCapacity(CAPACITY);
+        pipeline.AddStage("fast", 2, [](Traced&) {
+        }).AddStage("slow", 1, [](Traced&) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        });
+        std::atomic<int> alive(0);
+        std::atomic<int> peak(0);
+        CHECK_HR(pipeline.Run(COUNT, [&](size_t, Traced&) {
+            const int now = ++alive;
+            int seen = peak.load();
+            while (now > seen && !peak.compare_exchange_weak(seen, now)) {
+            }
+        }, [&](Traced&) {
+            alive--;
+        }), S_OK);
+        const int bound = static_cast<int>(3 + 3 * CAPACITY + 2);
+        if (!CHECK(peak <= bound)) {
+            ::fprintf(stderr, "peak %d items in flight, bound %d\n", peak.load(), bound);
+        }
+        const PipelineStageStats slow = pipeline.GetStageStats(1);
+        const PipelineStageStats fast = pipeline.GetStageStats(0);
+        CHECK(slow.GetUtilisation(pipeline.GetElapsedSeconds()) > fast.GetUtilisation(pipeline.GetElapsedSeconds()));
+    });
+
+    Test::Run("no items, and stages of zero threads", [] {
+        Pipeline<Traced> pipeline;
+        pipeline.AddStage("one", 0, [](Traced& item) {
+            item.stages += '1';
+        });
+        int done = 0;
+        CHECK_HR(pipeline.Run(0, [](size_t, Traced&) {
+        }, [&](Traced&) {
+            done++;
+        }), S_OK);
+        CHECK(done == 0);
+        CHECK(pipeline.GetStageStats(0).concurrency == 1);
+        CHECK_HR(pipeline.Run(5, [](size_t, Traced&) {
+        }, [&](Traced& item) {
+            done += item.stages == "1";
+        }), S_OK);
+        CHECK(done == 5);
+    });
+
+    Test::Run("a batch exports every file and reports the ones that fail", [] {
+        static const size_t COUNT = 24;
+        static const char SVG[] = "<svg xmlns='http://www.w3.org/2000/svg' width='40' height='30'><rect width='40' height='30' fill='#08f'/></svg>";
+        static const char BROKEN[] = "<html><body/></html>";
+        std::vector<std::string> paths(COUNT);
+        for (size_t i = 0; i < COUNT; i++) {
+            char path[32];
+            ::strcpy(path, "/tmp/svg-batch-XXXXXX");
+            const int fd = ::mkstemp(path);
+            CHECK(fd >= 0);
+            if (fd >= 0) {
+                const char* text = i == 5 ? BROKEN : SVG;
+                const size_t cb = i == 5 ? sizeof(BROKEN) - 1 : sizeof(SVG) - 1;
+                CHECK(::write(fd, text, cb) == static_cast<ssize_t>(cb));
+                ::close(fd);
+            }
+            paths[i] = path;
+        }
+        // One that is not there
+        ::unlink(paths[9].c_str());
+        std::vector<MemorySink> sinks(COUNT);
+        std::vector<SvgBatchJob> jobs(COUNT);
+        for (size_t i = 0; i < COUNT; i++) {
+            jobs[i] = { paths[i].c_str(), &sinks[i], E_UNEXPECTED };
+        }
+        SvgBatchExporter exporter;
+        exporter.SetConcurrency(BatchStageParse, 2).SetConcurrency(BatchStageRender, 3).SetQueueCapacity(1);
+        SvgOptions opt;
+        SvgRenderTarget::RenderOptions ropt;
+        ropt.SetCanvasSize(64, 64).SetToContain();
+        CHECK_HR(exporter.SavePngs(jobs.data(), COUNT, opt, ropt), S_OK);
+        for (size_t i = 0; i < COUNT; i++) {
+            if (i == 5 || i == 9) {
+                CHECK(FAILED(jobs[i].result));
+                CHECK(sinks[i].GetBuffer().GetSize() == 0);
+            } else {
+                CHECK_HR(jobs[i].result, S_OK);
+                CHECK(sinks[i].GetBuffer().GetSize() > 8 && ::memcmp(sinks[i].GetBuffer().GetData(), "\x89PNG", 4) == 0);
+            }
+        }
+        for (size_t stage = 0; stage < BatchStageCount; stage++) {
+            CHECK(exporter.GetStageStats(static_cast<BatchStage>(stage)).items == COUNT);
+        }
+        CHECK(exporter.GetThroughput() > 0);
+        CancelToken cancelled;
+        cancelled.Cancel();
+        CHECK_HR(exporter.SavePngs(jobs.data(), COUNT, opt, ropt, PngOptions(), &cancelled), S_OK);
+        for (const SvgBatchJob& job : jobs) {
+            CHECK(CancelToken::IsCancellation(job.result));
+        }
+        for (const std::string& path : paths) {
+            ::unlink(path.c_str());
+        }
+    });
+
+    return Test::Result();
+}
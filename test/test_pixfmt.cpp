@@ -0,0 +1,205 @@
+#include "platform.h"
+#include <vector>
+
+#include "pixfmt.hpp"
+#include "test.hpp"
+
+// PixelFormat::ToBgra and CompositeToBgra against plain per-pixel references, at lengths and
+// offsets that split the input between the SSE2 groups of four and the scalar tail
+
+static uint32_t Clamp(int x)
+{
+    return x < 0 ? 0 : x > 255 ? 255 : static_cast<uint32_t>(x);
+}
+
+// Opaque and clear pixels are only swizzled; the rest are unpremultiplied with GDI's rounding
+static uint32_t ReferenceBgra(uint32_t pixel, bool straight)
+{
+    const uint32_t a = pixel >> 24;
+    const uint32_t r = pixel & 0xff;
+    const uint32_t g = (pixel >> 8) & 0xff;
+    const uint32_t b = (pixel >> 16) & 0xff;
+    if (!straight || a == 0 || a == 255) {
+        return b | (g << 8) | (r << 16) | (a << 24);
+    }
+    const int ia = static_cast<int>(a);
+    return Clamp((static_cast<int>(b) * 256 - 128) / ia) | (Clamp((static_cast<int>(g) * 256 - 128) / ia) << 8)
+        | (Clamp((static_cast<int>(r) * 256 - 128) / ia) << 16) | (a << 24);
+}
+
+static PixelAlpha ReferenceAlpha(const uint32_t* pixels, size_t count)
+{
+    PixelAlpha alpha = PixelAlphaOpaque;
+    for (size_t i = 0; i < count; i++) {
+        const uint32_t a = pixels[i] >> 24;
+        if (a != 255 && a != 0) {
+            return PixelAlphaTranslucent;
+        }
+        if (a == 0) {
+            alpha = PixelAlphaBinary;
+        }
+    }
+    return alpha;
+}
+
+// Premultiplied, with the given share of opaque, clear and translucent pixels out of 8
+static std::vector<uint32_t> MakePixels(Test::Random& random, size_t count, uint32_t opaque, uint32_t clear)
+{
+    std::vector<uint32_t> pixels(count);
+    for (uint32_t& pixel : pixels) {
+        const uint32_t kind = random.Below(8);
+        const uint32_t a = kind < opaque ? 255 : kind < opaque + clear ? 0 : 1 + random.Below(254);
+        const uint32_t r = random.Below(a + 1);
+        const uint32_t g = random.Below(a + 1);
+        const uint32_t b = random.Below(a + 1);
+        pixel = r | (g << 8) | (b << 16) | (a << 24);
+    }
+    return pixels;
+}
+
+// src + background * (1 - alpha) per channel, rounded to nearest, as opaque BGRA
+static uint32_t ReferenceComposite(uint32_t pixel, uint32_t background)
+{
+    const uint32_t inv = 255 - (pixel >> 24);
+    const uint32_t rgb[3] = { (pixel >> 16) & 0xff, (pixel >> 8) & 0xff, pixel & 0xff };
+    uint32_t out = 0xff000000;
+    for (unsigned i = 0; i < 3; i++) {
+        const uint32_t x = ((background >> (i * 8)) & 0xff) * inv;
+        const uint32_t t = rgb[i] + (2 * x + 255) / 510;
+        out |= (t > 255 ? 255 : t) << (i * 8);
+    }
+    return out;
+}
+
+// The colour of the checkerboard under pixel (x, y) of the image
+static uint32_t ReferenceBackdrop(const Backdrop& backdrop, int64_t x, int64_t y)
+{
+    if (backdrop.cellSize == 0) {
+        return backdrop.colour;
+    }
+    const int64_t cell = backdrop.cellSize;
+    const int64_t px = x + backdrop.originX;
+    const int64_t py = y + backdrop.originY;
+    const int64_t cx = px >= 0 ? px / cell : -((-px + cell - 1) / cell);
+    const int64_t cy = py >= 0 ? py / cell : -((-py + cell - 1) / cell);
+    return ((cx + cy) & 1) == 0 ? backdrop.colour : backdrop.alternate;
+}
+
+template <bool Straight>
+static bool CheckBgra(const std::vector<uint32_t>& pixels, size_t offset, size_t count)
+{
+    std::vector<uint32_t> out(count + 2, 0x12345678);
+    const PixelAlpha alpha = PixelFormat::ToBgra<Straight>(pixels.data() + offset, out.data() + 1, count);
+    bool ok = CHECK(alpha == ReferenceAlpha(pixels.data() + offset, count));
+    for (size_t i = 0; i < count && ok; i++) {
+        ok = CHECK(out[1 + i] == ReferenceBgra(pixels[offset + i], Straight));
+    }
+    return ok && CHECK(out[0] == 0x12345678 && out[count + 1] == 0x12345678);
+}
+
+int main()
+{
+    Test::Run("alpha is classified as opaque, binary or translucent", [] {
+        for (size_t count : { 1u, 3u, 4u, 5u, 16u, 31u }) {
+            for (size_t at = 0; at < count; at++) {
+                std::vector<uint32_t> pixels(count, 0xff336699u);
+                CHECK(PixelFormat::ToBgra<true>(pixels.data(), pixels.data(), count) == PixelAlphaOpaque);
+                pixels.assign(count, 0xff336699u);
+                pixels[at] = 0;
+                CHECK(PixelFormat::ToBgra<true>(pixels.data(), pixels.data(), count) == PixelAlphaBinary);
+                pixels.assign(count, 0xff336699u);
+                pixels[at] = 0x80102030u;
+                CHECK(PixelFormat::ToBgra<false>(pixels.data(), pixels.data(), count) == PixelAlphaTranslucent);
+                pixels.assign(count, 0);
+                pixels[at] = 0x01000000u;
+                CHECK(PixelFormat::ToBgra<true>(pixels.data(), pixels.data(), count) == PixelAlphaTranslucent);
+            }
+        }
+    });
+
+    // The SSE2 path must not round differently, nor divide opaque or clear pixels
+    Test::Run("ToBgra matches the per-pixel reference", [] {
+        Test::Random random(34);
+        static const uint32_t MIXES[][2] = { { 8, 0 }, { 4, 4 }, { 7, 0 }, { 6, 1 }, { 0, 0 }, { 2, 2 } };
+        for (const auto& mix : MIXES) {
+            const std::vector<uint32_t> pixels = MakePixels(random, 1031, mix[0], mix[1]);
+            for (size_t offset = 0; offset < 4; offset++) {
+                for (size_t count : { 0u, 1u, 2u, 3u, 7u, 64u, 1027u }) {
+                    if (!CheckBgra<true>(pixels, offset, count) || !CheckBgra<false>(pixels, offset, count)) {
+                        ::fprintf(stderr, "mix %u/%u, offset %zu, count %zu\n", mix[0], mix[1], offset, count);
+                    }
+                }
+            }
+        }
+    });
+
+    Test::Run("every translucent pixel converts as the reference does", [] {
+        std::vector<uint32_t> pixels;
+        for (uint32_t a = 0; a < 256; a++) {
+            for (uint32_t c = 0; c <= a; c++) {
+                pixels.push_back(c | ((a - c) << 8) | ((c / 2) << 16) | (a << 24));
+            }
+        }
+        CheckBgra<true>(pixels, 0, pixels.size());
+    });
+
+    Test::Run("compositing over a colour matches the reference", [] {
+        Test::Random random(35);
+        const std::vector<uint32_t> pixels = MakePixels(random, 1031, 2, 2);
+        for (uint32_t background : { 0xffffffffu, 0xff000000u, 0xff1e90ffu, 0x00808080u }) {
+            for (size_t offset = 0; offset < 4; offset++) {
+                for (size_t count : { 1u, 3u, 4u, 9u, 1027u }) {
+                    std::vector<uint32_t> out(count + 1, 0x12345678);
+                    PixelFormat::CompositeToBgra(pixels.data() + offset, out.data(), count, background);
+                    bool ok = true;
+                    for (size_t x = 0; x < count && ok; x++) {
+                        ok = CHECK(out[x] == ReferenceComposite(pixels[offset + x], background));
+                    }
+                    CHECK(out[count] == 0x12345678);
+                }
+            }
+        }
+    });
+
+    // Clear pixels show the pattern itself, so each one must be the cell's colour
+    Test::Run("checkerboard cells line up with the origin", [] {
+        static const size_t WIDTH = 37;
+        const std::vector<uint32_t> clear(WIDTH, 0);
+        std::vector<uint32_t> out(WIDTH);
+        for (uint32_t cell : { 1u, 3u, 8u, 16u }) {
+            for (int32_t origin : { 0, 5, -5, -17, 1000003 }) {
+                const Backdrop backdrop = Backdrop::Checker(0xcccccc, 0x999999, cell, origin, -origin / 2);
+                for (int32_t y = 0; y < 20; y++) {
+                    PixelFormat::CompositeToBgra(clear.data(), out.data(), WIDTH, backdrop, y);
+                    bool ok = true;
+                    for (size_t x = 0; x < WIDTH && ok; x++) {
+                        ok = CHECK(out[x] == ReferenceBackdrop(backdrop, static_cast<int64_t>(x), y));
+                    }
+                    if (!ok) {
+                        ::fprintf(stderr, "cell %u, origin %d, row %d\n", cell, origin, y);
+                        break;
+                    }
+                }
+            }
+        }
+        // A solid backdrop, or a pattern of one colour, ignores the cells
+        PixelFormat::CompositeToBgra(clear.data(), out.data(), WIDTH, Backdrop::Solid(0x123456), 3);
+        CHECK(out[0] == 0xff123456 && out[WIDTH - 1] == 0xff123456);
+    });
+
+    Test::Run("translucent pixels blend with the cell under them", [] {
+        Test::Random random(135);
+        const std::vector<uint32_t> pixels = MakePixels(random, 101, 2, 2);
+        const Backdrop backdrop = Backdrop::Checker(0xffffff, 0x404040, 4, -3, 2);
+        std::vector<uint32_t> out(pixels.size());
+        for (int32_t y = 0; y < 9; y++) {
+            PixelFormat::CompositeToBgra(pixels.data(), out.data(), pixels.size(), backdrop, y);
+            bool ok = true;
+            for (size_t x = 0; x < pixels.size() && ok; x++) {
+                ok = CHECK(out[x] == ReferenceComposite(pixels[x], ReferenceBackdrop(backdrop, static_cast<int64_t>(x), y)));
+            }
+        }
+    });
+
+    return Test::Result();
+}
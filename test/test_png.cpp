@@ -0,0 +1,313 @@
+#include "platform.h"
+#include <vector>
+
+#include "png.hpp"
+#include "palette.hpp"
+#include "export.hpp"
+#include "test.hpp"
+
+// PngWriter output inflated with zlib and unfiltered here, so the tests do not depend on the
+// encoder's own reading of the format. SetBlockCount forces the parallel, pigz-style stream on
+// any number of cores.
+
+struct PngImage
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint8_t depth = 0;
+    uint8_t colourType = 0;
+    // Unfiltered bytes of each row, without the filter type
+    std::vector<uint8_t> rows;
+    size_t cbLine = 0;
+    // RGB triples, and the alphas of the first entries when there is a tRNS chunk
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> alphas;
+    bool hasAlphas = false;
+
+    // Unpremultiplied RGBA, laid out as PixelFormat::Unpremultiply returns it
+    uint32_t GetPixel(uint32_t x, uint32_t y) const
+    {
+        const uint8_t* row = this->rows.data() + y * this->cbLine;
+        if (this->colourType == 6) {
+            uint32_t pixel;
+            ::memcpy(&pixel, row + x * 4, 4);
+            return pixel;
+        }
+        const unsigned perByte = 8 / this->depth;
+        const unsigned shift = (perByte - 1 - x % perByte) * this->depth;
+        const unsigned index = (row[x / perByte] >> shift) & ((1u << this->depth) - 1);
+        if (index * 3 + 3 > this->palette.size()) {
+            return 0xDEADBEEF;
+        }
+        const uint32_t alpha = index < this->alphas.size() ? this->alphas[index] : 255;
+        return this->palette[index * 3] | (this->palette[index * 3 + 1] << 8) | (this->palette[index * 3 + 2] << 16) | (alpha << 24);
+    }
+};
+
+static uint32_t ReadBig(const uint8_t* p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+static int Paeth(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = ::abs(p - a);
+    const int pb = ::abs(p - b);
+    const int pc = ::abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// Checks every chunk's CRC and the zlib stream's checksum on the way
+static bool Decode(const ByteBuffer& buffer, PngImage* image)
+{
+    static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    const uint8_t* data = buffer.GetData();
+    const size_t size = buffer.GetSize();
+    if (size < 8 || ::memcmp(data, SIGNATURE, 8) != 0) {
+        return false;
+    }
+    std::vector<uint8_t> idat;
+    bool ended = false;
+    for (size_t offset = 8; offset < size && !ended;) {
+        if (size - offset < 12) {
+            return false;
+        }
+        const uint32_t cb = ReadBig(data + offset);
+        if (cb > size - offset - 12) {
+            return false;
+        }
+        const uint8_t* type = data + offset + 4;
+        const uint8_t* body = type + 4;
+        if (ReadBig(body + cb) != static_cast<uint32_t>(::crc32(0, type, cb + 4))) {
+            return false;
+        }
+        if (::memcmp(type, "IHDR", 4) == 0 && cb == 13) {
+            image->width = ReadBig(body);
+            image->height = ReadBig(body + 4);
+            image->depth = body[8];
+            image->colourType = body[9];
+        } else if (::memcmp(type, "PLTE", 4) == 0) {
+            image->palette.assign(body, body + cb);
+        } else if (::memcmp(type, "tRNS", 4) == 0) {
+            // Only allowed between PLTE and the data
+            if (image->palette.empty() || !idat.empty()) {
+                return false;
+            }
+            image->alphas.assign(body, body + cb);
+            image->hasAlphas = true;
+        } else if (::memcmp(type, "IDAT", 4) == 0) {
+            idat.insert(idat.end(), body, body + cb);
+        } else if (::memcmp(type, "IEND", 4) == 0) {
+            ended = true;
+        }
+        offset += cb + 12;
+    }
+    if (!ended || image->width == 0 || image->height == 0) {
+        return false;
+    }
+    const unsigned bytesPerPixel = image->colourType == 6 ? 4 : 1;
+    image->cbLine = (static_cast<size_t>(image->width) * image->depth * bytesPerPixel + 7) / 8;
+    std::vector<uint8_t> filtered(image->height * (image->cbLine + 1));
+    uLongf cbFiltered = static_cast<uLongf>(filtered.size());
+    if (::uncompress(filtered.data(), &cbFiltered, idat.data(), static_cast<uLong>(idat.size())) != Z_OK || cbFiltered != filtered.size()) {
+        return false;
+    }
+    image->rows.assign(image->height * image->cbLine, 0);
+    const size_t bpp = image->colourType == 6 ? 4 : 1;
+    for (uint32_t y = 0; y < image->height; y++) {
+        const uint8_t* in = filtered.data() + y * (image->cbLine + 1);
+        uint8_t* out = image->rows.data() + y * image->cbLine;
+        const uint8_t* prior = y > 0 ? out - image->cbLine : nullptr;
+        for (size_t i = 0; i < image->cbLine; i++) {
+            const int a = i >= bpp ? out[i - bpp] : 0;
+            const int b = prior != nullptr ? prior[i] : 0;
+            const int c = prior != nullptr && i >= bpp ? prior[i - bpp] : 0;
+            int predicted;
+            switch (in[0]) {
+            case 0: predicted = 0; break;
+            case 1: predicted = a; break;
+            case 2: predicted = b; break;
+            case 3: predicted = (a + b) >> 1; break;
+            case 4: predicted = Paeth(a, b, c); break;
+            default: return false;
+            }
+            out[i] = static_cast<uint8_t>(in[1 + i] + predicted);
+        }
+    }
+    return true;
+}
+
+// Premultiplied RGBA with smooth areas, noise and transparency, so every filter gets picked
+static std::vector<uint32_t> MakePixels(uint32_t width, uint32_t height, uint64_t seed)
+{
+    Test::Random random(seed);
+    std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            const uint32_t region = (x / 64 + y / 48) % 4;
+            uint32_t a = region == 0 ? 255 : region == 1 ? (x * 3 + y) & 0xFF : region == 2 ? 0 : random.Below(256);
+            uint32_t r = (x * 255 / width) * a / 255;
+            uint32_t g = (y * 255 / height) * a / 255;
+            uint32_t b = (region == 3 ? random.Below(256) : (x ^ y) & 0xFF) * a / 255;
+            pixels[static_cast<size_t>(y) * width + x] = r | (g << 8) | (b << 16) | (a << 24);
+        }
+    }
+    return pixels;
+}
+
+// Writes the rows in uneven runs, so batches and blocks end mid-row
+static HRESULT Encode(const std::vector<uint32_t>& pixels, uint32_t width, uint32_t height, const PngOptions& opt, MemorySink* sink)
+{
+    PngWriter writer;
+    HRESULT hr = writer.Begin(sink, width, height, opt);
+    for (uint32_t y = 0; y < height && SUCCEEDED(hr);) {
+        const uint32_t rows = height - y < 37 ? height - y : 37;
+        hr = writer.WriteRows(pixels.data() + static_cast<size_t>(y) * width, rows, width);
+        y += rows;
+    }
+    if (SUCCEEDED(hr)) {
+        hr = writer.End();
+    }
+    return hr;
+}
+
+static bool IsSamePixels(const PngImage& image, const std::vector<uint32_t>& pixels)
+{
+    if (static_cast<size_t>(image.width) * image.height != pixels.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < pixels.size(); i++) {
+        if (image.GetPixel(static_cast<uint32_t>(i % image.width), static_cast<uint32_t>(i / image.width)) != PixelFormat::Unpremultiply(pixels[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// count distinct colours: the even entries translucent, each with its own alpha and the first
+// one fully transparent, and the odd ones opaque; a count prime to 7 uses them all
+static std::vector<uint32_t> MakeColours(uint32_t width, uint32_t height, unsigned count)
+{
+    std::vector<uint32_t> colours;
+    for (unsigned i = 0; i < count; i++) {
+        if (i % 2 == 0) {
+            const uint32_t a = i / 2;
+            colours.push_back(a | (a / 2 << 16) | (a << 24));
+        } else {
+            colours.push_back(i | ((255 - i) << 8) | ((i * 3 & 0xFF) << 16) | 0xFF000000u);
+        }
+    }
+    std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < pixels.size(); i++) {
+        pixels[i] = colours[i * 7 % count];
+    }
+    return pixels;
+}
+
+int main()
+{
+    Test::Run("parallel deflate streams inflate to the pixels, at every level", [] {
+        static const uint32_t WIDTH = 333;
+        static const uint32_t HEIGHT = 500;
+        const std::vector<uint32_t> pixels = MakePixels(WIDTH, HEIGHT, 31);
+        for (int level : { 1, 6, 9 }) {
+            for (unsigned blocks : { 1u, 2u, 3u, 8u }) {
+                MemorySink sink;
+                PngOptions opt;
+                opt.SetLevel(level).SetBlockSize(32 * 1024).SetBlockCount(blocks);
+                CHECK_HR(Encode(pixels, WIDTH, HEIGHT, opt, &sink), S_OK);
+                PngImage image;
+                if (!CHECK(Decode(sink.GetBuffer(), &image)) || !CHECK(IsSamePixels(image, pixels))) {
+                    ::fprintf(stderr, "level %d, %u blocks\n", level, blocks);
+                }
+            }
+        }
+    });
+
+    Test::Run("the serial stream inflates to the same pixels", [] {
+        static const uint32_t WIDTH = 200;
+        static const uint32_t HEIGHT = 150;
+        const std::vector<uint32_t> pixels = MakePixels(WIDTH, HEIGHT, 32);
+        MemorySink sink;
+        PngOptions opt;
+        opt.SetParallel(false).SetBlockCount(4);
+        CHECK_HR(Encode(pixels, WIDTH, HEIGHT, opt, &sink), S_OK);
+        PngImage image;
+        CHECK(Decode(sink.GetBuffer(), &image));
+        CHECK(image.width == WIDTH && image.height == HEIGHT);
+        CHECK(IsSamePixels(image, pixels));
+    });
+
+    // Less than a block, and less than the dictionary, in all
+    Test::Run("tiny images in parallel mode", [] {
+        for (uint32_t size : { 1u, 2u, 7u, 90u }) {
+            const std::vector<uint32_t> pixels = MakePixels(size, size, size);
+            MemorySink sink;
+            PngOptions opt;
+            opt.SetBlockCount(4);
+            CHECK_HR(Encode(pixels, size, size, opt, &sink), S_OK);
+            PngImage image;
+            CHECK(Decode(sink.GetBuffer(), &image));
+            CHECK(IsSamePixels(image, pixels));
+        }
+    });
+
+    // Widths that leave the last byte of a row part filled at every depth
+    Test::Run("indexed images round-trip at 1, 2, 4 and 8 bits", [] {
+        static const uint32_t WIDTH = 29;
+        static const uint32_t HEIGHT = 23;
+        for (unsigned count : { 1u, 2u, 3u, 4u, 5u, 16u, 17u, 143u, 256u }) {
+            const std::vector<uint32_t> pixels = MakeColours(WIDTH, HEIGHT, count);
+            IndexedImage indexed;
+            CHECK_HR(indexed.Create(pixels.data(), WIDTH, HEIGHT, WIDTH), S_OK);
+            CHECK(indexed.GetColourCount() == count);
+            MemorySink sink;
+            PngOptions opt;
+            opt.SetBlockCount(count % 2 ? 1 : 3);
+            CHECK_HR(SvgExporter::SaveCompactPng(pixels.data(), WIDTH, HEIGHT, WIDTH, &sink, opt), S_OK);
+            PngImage image;
+            if (!CHECK(Decode(sink.GetBuffer(), &image)) || !CHECK(IsSamePixels(image, pixels))) {
+                ::fprintf(stderr, "%u colours\n", count);
+            }
+            const uint8_t depth = count <= 2 ? 1 : count <= 4 ? 2 : count <= 16 ? 4 : 8;
+            CHECK(image.colourType == 3 && image.depth == depth);
+            CHECK(image.palette.size() == count * 3);
+            // Translucent entries come first, so tRNS stops at the last of them
+            CHECK(image.alphas.size() == (count + 1) / 2);
+            for (uint8_t alpha : image.alphas) {
+                CHECK(alpha != 255);
+            }
+        }
+    });
+
+    Test::Run("opaque palettes have no tRNS chunk", [] {
+        std::vector<uint32_t> pixels(64 * 64);
+        for (size_t i = 0; i < pixels.size(); i++) {
+            pixels[i] = 0xFF000000u | (i % 3 == 0 ? 0x0000FF : i % 3 == 1 ? 0x00FF00 : 0xFF0000);
+        }
+        MemorySink sink;
+        CHECK_HR(SvgExporter::SaveCompactPng(pixels.data(), 64, 64, 64, &sink), S_OK);
+        PngImage image;
+        CHECK(Decode(sink.GetBuffer(), &image));
+        CHECK(image.colourType == 3 && image.depth == 2 && !image.hasAlphas);
+        CHECK(IsSamePixels(image, pixels));
+    });
+
+    Test::Run("the 257th colour falls back to RGBA", [] {
+        static const uint32_t WIDTH = 40;
+        static const uint32_t HEIGHT = 30;
+        const std::vector<uint32_t> pixels = MakeColours(WIDTH, HEIGHT, 257);
+        IndexedImage indexed;
+        CHECK_HR(indexed.Create(pixels.data(), WIDTH, HEIGHT, WIDTH), S_FALSE);
+        CHECK(indexed.IsNull());
+        MemorySink sink;
+        CHECK_HR(SvgExporter::SaveCompactPng(pixels.data(), WIDTH, HEIGHT, WIDTH, &sink), S_OK);
+        PngImage image;
+        CHECK(Decode(sink.GetBuffer(), &image));
+        CHECK(image.colourType == 6 && image.depth == 8 && image.palette.empty());
+        CHECK(IsSamePixels(image, pixels));
+    });
+
+    return Test::Result();
+}
@@ -0,0 +1,70 @@
+#include "platform.h"
+
+#include "quality.hpp"
+#include "test.hpp"
+
+// RenderQualityPolicy: grouping by structure, and separate speed and precise estimates
+
+static SvgComplexity MakeComplexity(uint32_t elements, uint32_t filterPrimitives)
+{
+    SvgComplexity complexity;
+    complexity.elements = elements;
+    complexity.filterPrimitives = filterPrimitives;
+    return complexity;
+}
+
+int main()
+{
+    static const uint64_t PIXELS = 256 * 256;
+
+    Test::Run("small outputs and unmeasured documents", [] {
+        RenderQualityPolicy policy;
+        const SvgComplexity complexity = MakeComplexity(100, 0);
+        CHECK(policy.Choose(48, 48 * 48, complexity) == RenderQualitySpeed);
+        CHECK(policy.Choose(256, PIXELS, complexity) == RenderQualityPrecise);
+    });
+
+    Test::Run("a group over the budget falls back to speed, and only that group", [] {
+        RenderQualityPolicy policy;
+        policy.SetBudget(0.1);
+        const SvgComplexity filtered = MakeComplexity(100, 20);
+        const SvgComplexity plain = MakeComplexity(100, 0);
+        const SvgComplexity larger = MakeComplexity(10000, 20);
+        policy.Record(filtered, RenderQualityPrecise, PIXELS, 0.5);
+        CHECK(policy.Choose(256, PIXELS, filtered) == RenderQualitySpeed);
+        // Same source size class or not, other structures are not held to it
+        CHECK(policy.Choose(256, PIXELS, plain) == RenderQualityPrecise);
+        CHECK(policy.Choose(256, PIXELS, larger) == RenderQualityPrecise);
+        // A smaller output of the same group fits
+        CHECK(policy.Choose(96, 96 * 96, filtered) == RenderQualityPrecise);
+    });
+
+    Test::Run("speed and precise renders are estimated apart", [] {
+        RenderQualityPolicy policy;
+        const SvgComplexity complexity = MakeComplexity(500, 3);
+        policy.Record(complexity, RenderQualitySpeed, PIXELS, 0.01);
+        policy.Record(complexity, RenderQualityPrecise, PIXELS, 0.04);
+        CHECK(policy.Estimate(complexity, RenderQualitySpeed) * PIXELS < 0.011);
+        CHECK(policy.Estimate(complexity, RenderQualityPrecise) * PIXELS > 0.039);
+        // Another group measured only for speed is predicted precise by the ratio, 4 here
+        const SvgComplexity other = MakeComplexity(5000, 0);
+        policy.Record(other, RenderQualitySpeed, PIXELS, 0.05);
+        CHECK(policy.Estimate(other, RenderQualityPrecise) * PIXELS > 0.19);
+        CHECK(policy.Choose(256, PIXELS, other) == RenderQualitySpeed);
+    });
+
+    Test::Run("a group whose speed renders became cheap is tried precise again", [] {
+        RenderQualityPolicy policy;
+        policy.SetBudget(0.1);
+        const SvgComplexity complexity = MakeComplexity(100, 0);
+        policy.Record(complexity, RenderQualitySpeed, PIXELS, 0.1);
+        policy.Record(complexity, RenderQualityPrecise, PIXELS, 0.3);
+        CHECK(policy.Choose(256, PIXELS, complexity) == RenderQualitySpeed);
+        for (int i = 0; i < 20 && policy.Choose(256, PIXELS, complexity) == RenderQualitySpeed; i++) {
+            policy.Record(complexity, RenderQualitySpeed, PIXELS, 0.01);
+        }
+        CHECK(policy.Choose(256, PIXELS, complexity) == RenderQualityPrecise);
+    });
+
+    return Test::Result();
+}
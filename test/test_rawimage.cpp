@@ -0,0 +1,69 @@
+#include "platform.h"
+
+#include "rawimage.hpp"
+#include "test.hpp"
+
+int main()
+{
+    // Spelt out byte by byte, so that it holds on hosts of either byte order
+    Test::Run("the header is little-endian", [] {
+        MemorySink sink;
+        RawImageWriter writer;
+        const uint32_t pixels[3] = {};
+        CHECK_HR(writer.Begin(&sink, 0x0103, 1), S_OK);
+        CHECK_HR(writer.End(), E_FAIL);
+        RawImageWriter small;
+        CHECK_HR(small.Begin(&sink, 3, 1), S_OK);
+        CHECK_HR(small.WriteRows(pixels, 1, 3), S_OK);
+        CHECK_HR(small.End(), S_OK);
+        static const uint8_t EXPECTED[16] = { 'S', 'V', 'G', 'R', 3, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0 };
+        static const uint8_t FIRST[8] = { 'S', 'V', 'G', 'R', 3, 1, 0, 0 };
+        const ByteBuffer& buffer = sink.GetBuffer();
+        CHECK(buffer.GetSize() == 16 + 16 + 12);
+        CHECK(::memcmp(buffer.GetData(), FIRST, sizeof(FIRST)) == 0);
+        CHECK(::memcmp(buffer.GetData() + 16, EXPECTED, sizeof(EXPECTED)) == 0);
+    });
+
+    Test::Run("images read back in place", [] {
+        static const uint32_t WIDTH = 5;
+        static const uint32_t HEIGHT = 3;
+        uint32_t padded[(WIDTH + 2) * HEIGHT];
+        for (uint32_t i = 0; i < (WIDTH + 2) * HEIGHT; i++) {
+            padded[i] = 0x80000000u | i;
+        }
+        MemorySink sink;
+        RawImageWriter writer;
+        CHECK_HR(writer.Begin(&sink, WIDTH, HEIGHT), S_OK);
+        CHECK_HR(writer.WriteRows(padded, 2, WIDTH + 2), S_OK);
+        CHECK_HR(writer.WriteRows(padded + (WIDTH + 2) * 2, 2, WIDTH + 2), E_FAIL);
+        CHECK_HR(writer.WriteRows(padded + (WIDTH + 2) * 2, 1, WIDTH + 2), S_OK);
+        CHECK_HR(writer.End(), S_OK);
+        const ByteBuffer& buffer = sink.GetBuffer();
+        uint32_t width = 0;
+        uint32_t height = 0;
+        const uint32_t* pixels = nullptr;
+        CHECK_HR(RawImageReader::Parse(buffer.GetData(), buffer.GetSize(), &width, &height, &pixels), S_OK);
+        CHECK(width == WIDTH && height == HEIGHT);
+        for (uint32_t y = 0; y < HEIGHT && pixels != nullptr; y++) {
+            CHECK(::memcmp(pixels + y * WIDTH, padded + y * (WIDTH + 2), WIDTH * 4) == 0);
+        }
+        CHECK_HR(RawImageReader::Parse(buffer.GetData(), buffer.GetSize() - 1, &width, &height, &pixels), E_INVALIDARG);
+        CHECK(pixels == nullptr);
+        CHECK_HR(RawImageReader::Parse(buffer.GetData(), 15, &width, &height, &pixels), E_INVALIDARG);
+    });
+
+    Test::Run("foreign headers are rejected", [] {
+        uint8_t data[20] = { 'S', 'V', 'G', 'R', 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0 };
+        uint32_t width;
+        uint32_t height;
+        const uint32_t* pixels;
+        CHECK_HR(RawImageReader::Parse(data, sizeof(data), &width, &height, &pixels), S_OK);
+        // The same header from a big-endian writer
+        uint8_t swapped[20] = { 'R', 'G', 'V', 'S', 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+        CHECK_HR(RawImageReader::Parse(swapped, sizeof(swapped), &width, &height, &pixels), E_INVALIDARG);
+        data[12] = 2;
+        CHECK_HR(RawImageReader::Parse(data, sizeof(data), &width, &height, &pixels), E_INVALIDARG);
+    });
+
+    return Test::Result();
+}
@@ -0,0 +1,404 @@
+#include "platform.h"
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "svg.hpp"
+#include "render.hpp"
+#include "export.hpp"
+#include "test.hpp"
+
+static const char SVG[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='120' height='80'>"
+    "<linearGradient id='g'><stop offset='0' stop-color='#f80'/><stop offset='1' stop-color='#08f' stop-opacity='0.5'/></linearGradient>"
+    "<rect x='4' y='4' width='112' height='72' rx='10' fill='url(#g)'/>"
+    "<circle cx='60' cy='40' r='30' fill='none' stroke='#222' stroke-width='3'/>"
+    "</svg>";
+
+static const char SPRITES[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='64' height='32'>"
+    "<g id='a'><circle cx='8' cy='8' r='6' fill='#f80'/></g>"
+    "<g id='b'><rect x='20' y='2' width='10' height='12' fill='#08f'/></g>"
+    "<g id='c'><path d='M40 2l8 12h-16z' fill='#222'/></g>"
+    "</svg>";
+
+// Blurred shapes across the rows where stripes meet, whose filter regions resvg clips to the
+// canvas of each stripe
+static const char BLURRED[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='120' height='80'>"
+    "<filter id='b'><feGaussianBlur stdDeviation='2'/></filter>"
+    "<rect x='10' y='6' width='100' height='20' fill='#08f' filter='url(#b)'/>"
+    "<circle cx='60' cy='48' r='22' fill='#f80' filter='url(#b)'/>"
+    "<path d='M0 40h120' stroke='#222' stroke-width='3' filter='url(#b)'/>"
+    "</svg>";
+
+static bool IsSame(const SvgRenderTarget& a, const SvgRenderTarget& b)
+{
+    return a.GetWidth() == b.GetWidth() && a.GetHeight() == b.GetHeight() && !a.IsNull() && !b.IsNull()
+        && ::memcmp(a.GetPixels(), b.GetPixels(), static_cast<size_t>(a.GetWidth()) * a.GetHeight() * 4) == 0;
+}
+
+// Largest difference of any channel
+static int GetMaxDifference(const uint32_t* a, const uint32_t* b, size_t count)
+{
+    int worst = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            worst = std::max(worst, std::abs(static_cast<int>((a[i] >> shift) & 0xFF) - static_cast<int>((b[i] >> shift) & 0xFF)));
+        }
+    }
+    return worst;
+}
+
+static void Load(Svg* svg, const char* text = SVG)
+{
+    SvgOptions opt;
+    CHECK_HR(svg->Load(text, ::strlen(text), opt), S_OK);
+}
+
+int main()
+{
+    Test::Run("batch renders match serial renders", [] {
+        Svg svg;
+        Load(&svg);
+        static const size_t JOBS = 48;
+        SvgRenderTarget::RenderOptions opts[JOBS];
+        for (size_t i = 0; i < JOBS; i++) {
+            switch (i % 4) {
+            case 0:
+                opts[i].SetCanvasSize(256, 256).SetToContain();
+                break;
+            case 1:
+                opts[i].SetScale(static_cast<float>(1 + i % 7));
+                break;
+            case 2:
+                opts[i].SetScale(4).SetClip(100, 60, 200, 120);
+                break;
+            default: {
+                const resvg_transform tx = { 1, 0, 0, 1, static_cast<double>(i), 3 };
+                opts[i].SetCanvasSize(300, 100).SetToCover().SetTransform(tx);
+                break;
+            }
+            }
+        }
+        SvgRenderTarget serial[JOBS];
+        for (size_t i = 0; i < JOBS; i++) {
+            CHECK_HR(svg.Render(opts[i], &serial[i]), S_OK);
+        }
+        for (int round = 0; round < 4; round++) {
+            SvgRenderTarget batch[JOBS];
+            HRESULT results[JOBS];
+            CHECK_HR(svg.RenderBatch(opts, JOBS, batch, results), S_OK);
+            for (size_t i = 0; i < JOBS; i++) {
+                CHECK_HR(results[i], S_OK);
+                CHECK(IsSame(serial[i], batch[i]));
+            }
+        }
+    });
+
+    Test::Run("batch reports failures in job order", [] {
+        Svg svg;
+        Load(&svg);
+        SvgRenderTarget::RenderOptions opts[3];
+        opts[1].SetClip(0, 0, 0, 0);
+        SvgRenderTarget targets[3];
+        HRESULT results[3];
+        CHECK_HR(svg.RenderBatch(opts, 3, targets, results), E_INVALIDARG);
+        CHECK_HR(results[0], S_OK);
+        CHECK_HR(results[1], E_INVALIDARG);
+        CHECK_HR(results[2], S_OK);
+        CHECK(!targets[0].IsNull() && targets[1].IsNull() && !targets[2].IsNull());
+    });
+
+    // Threads of their own, as the task scheduler has no workers on a single processor
+    Test::Run("one document renders from several threads", [] {
+        Svg svg;
+        Load(&svg);
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetScale(2);
+        SvgRenderTarget expected;
+        CHECK_HR(svg.Render(opt, &expected), S_OK);
+        std::vector<std::thread> threads;
+        std::atomic<int> mismatches(0);
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&] {
+                for (int j = 0; j < 20; j++) {
+                    SvgRenderTarget target;
+                    uint32_t width = 0;
+                    uint32_t height = 0;
+                    if (FAILED(svg.CalcImageSize(opt, &width, &height)) || FAILED(svg.Render(opt, &target)) || !IsSame(expected, target)) {
+                        mismatches++;
+                    }
+                    resvg_rect bbox;
+                    svg.GetBoundingBox(&bbox);
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        CHECK(mismatches.load() == 0);
+    });
+
+    Test::Run("node batch matches single node renders", [] {
+        Svg svg;
+        Load(&svg, SPRITES);
+        static const char* const IDS[] = { "a", "b", "missing", "c", "a" };
+        static const size_t COUNT = sizeof(IDS) / sizeof(IDS[0]);
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetCanvasSize(48, 48).SetToContain();
+        SvgRenderTarget targets[COUNT];
+        HRESULT results[COUNT];
+        CHECK_HR(svg.RenderNodes(IDS, COUNT, opt, targets, results), HRESULT_FROM_WIN32(ERROR_NOT_FOUND));
+        for (size_t i = 0; i < COUNT; i++) {
+            SvgRenderTarget single;
+            CHECK_HR(results[i], svg.RenderNode(IDS[i], opt, &single));
+            if (SUCCEEDED(results[i])) {
+                CHECK(IsSame(single, targets[i]));
+            }
+        }
+        CHECK(targets[2].IsNull());
+    });
+
+    Test::Run("nodes render from several threads", [] {
+        Svg svg;
+        Load(&svg, SPRITES);
+        static const char* const IDS[] = { "a", "b", "c" };
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetCanvasSize(32, 32).SetToContain();
+        SvgRenderTarget expected[3];
+        for (int i = 0; i < 3; i++) {
+            CHECK_HR(svg.RenderNode(IDS[i], opt, &expected[i]), S_OK);
+        }
+        std::vector<std::thread> threads;
+        std::atomic<int> mismatches(0);
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([&, i] {
+                for (int j = 0; j < 30; j++) {
+                    const int k = (i + j) % 3;
+                    SvgRenderTarget target;
+                    if (FAILED(svg.RenderNode(IDS[k], opt, &target)) || !IsSame(expected[k], target)) {
+                        mismatches++;
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        CHECK(mismatches.load() == 0);
+    });
+
+    // Large enough for several stripes; the mask has to match the full RGBA render but for
+    // rounding, as each stripe goes through resvg with its own translation
+    Test::Run("alpha and luminance masks match the RGBA render", [] {
+        Svg svg;
+        Load(&svg);
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetScale(20);
+        SvgRenderTarget rgba;
+        CHECK_HR(svg.Render(opt, &rgba), S_OK);
+        const SvgMaskTarget::Channel channels[] = { SvgMaskTarget::ChannelAlpha, SvgMaskTarget::ChannelLuminance };
+        for (SvgMaskTarget::Channel channel : channels) {
+            SvgMaskTarget::RenderOptions maskOpt;
+            maskOpt.SetScale(20);
+            maskOpt.SetChannel(channel);
+            SvgMaskTarget mask;
+            CHECK_HR(svg.Render(maskOpt, &mask), S_OK);
+            CHECK(mask.GetWidth() == rgba.GetWidth() && mask.GetHeight() == rgba.GetHeight());
+            CHECK(mask.GetChannel() == channel);
+            if (mask.IsNull() || rgba.IsNull() || mask.GetWidth() != rgba.GetWidth() || mask.GetHeight() != rgba.GetHeight()) {
+                continue;
+            }
+            const uint32_t* pixels = rgba.GetPixels();
+            const size_t count = static_cast<size_t>(rgba.GetWidth()) * rgba.GetHeight();
+            size_t bad = 0;
+            for (size_t i = 0; i < count; i++) {
+                const int expected = channel == SvgMaskTarget::ChannelAlpha ? static_cast<int>(pixels[i] >> 24) : static_cast<int>(PixelFormat::Luma(pixels[i]));
+                bad += ::abs(mask.GetPixels()[i] - expected) > 2;
+            }
+            CHECK(bad == 0);
+        }
+    });
+
+    // Whether a level is rendered or derived depends on timing, so each must be one or the other;
+    // sizes that do not halve make a level derived from the previous one differ from both
+    Test::Run("mipmap levels come from the largest render", [] {
+        Svg svg;
+        Load(&svg);
+        const uint32_t sizes[] = { 150, 256, 100, 200 };
+        SvgRenderTarget levels[4];
+        SvgRenderTarget::MipmapPolicy policy;
+        policy.SetCrispSize(0);
+        CHECK_HR(svg.RenderMipmaps(sizes, 4, levels, &policy), S_OK);
+        const SvgRenderTarget& largest = levels[1];
+        for (int i = 0; i < 4; i++) {
+            if (i == 1 || levels[i].IsNull() || largest.IsNull()) {
+                continue;
+            }
+            SvgRenderTarget::RenderOptions opt;
+            opt.SetCanvasSize(sizes[i], sizes[i]).SetToContain();
+            SvgRenderTarget rendered;
+            CHECK_HR(svg.Render(opt, &rendered), S_OK);
+            SvgRenderTarget derived;
+            CHECK_HR(derived.Create(rendered.GetWidth(), rendered.GetHeight()), S_OK);
+            CHECK_HR(Resampler::Resample(largest.GetPixels(), largest.GetWidth(), largest.GetHeight(), largest.GetWidth(),
+                derived.GetPixels(), derived.GetWidth(), derived.GetHeight(), derived.GetWidth(), policy.GetFilter()), S_OK);
+            CHECK(IsSame(levels[i], rendered) || IsSame(levels[i], derived));
+        }
+    });
+
+    // A level that fails leaves the others to be tried, for thumbnails derived off a request
+    Test::Run("mipmaps derived from a render are made level by level", [] {
+        Svg svg;
+        Load(&svg);
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetCanvasSize(256, 256).SetToContain();
+        SvgRenderTarget source;
+        CHECK_HR(svg.Render(opt, &source), S_OK);
+        // One pixel wide leaves the 3:2 document no rows
+        const uint32_t sizes[] = { 100, 1, 48 };
+        SvgRenderTarget levels[3];
+        HRESULT results[3] = {};
+        SvgRenderTarget::MipmapPolicy policy;
+        policy.SetCrispSize(0);
+        CHECK(FAILED(svg.DeriveMipmaps(source, sizes, 3, levels, results, &policy)));
+        CHECK_HR(results[0], S_OK);
+        CHECK(FAILED(results[1]));
+        CHECK_HR(results[2], S_OK);
+        CHECK(levels[0].GetWidth() == 100 && levels[2].GetWidth() == 48);
+        CHECK(levels[1].IsNull());
+        CancelToken cancelled;
+        cancelled.Cancel();
+        policy.SetCancelToken(&cancelled);
+        SvgRenderTarget more[1];
+        CHECK(CancelToken::IsCancellation(svg.DeriveMipmaps(source, sizes, 1, more, nullptr, &policy)));
+    });
+
+    // Row y of the image lands on row height - 1 - y of a bottom-up DIB, with the checkerboard
+    // phase of row y; large enough to be split into bands on several threads
+    Test::Run("compositing bottom-up follows the image rows", [] {
+        static const uint32_t WIDTH = 1001;
+        static const uint32_t HEIGHT = 1100;
+        SvgRenderTarget target;
+        CHECK_HR(target.Create(WIDTH, HEIGHT), S_OK);
+        Test::Random random(235);
+        for (size_t i = 0; i < static_cast<size_t>(WIDTH) * HEIGHT; i++) {
+            const uint32_t a = random.Below(4) == 0 ? 0 : random.Below(256);
+            target.GetPixels()[i] = random.Below(a + 1) | (random.Below(a + 1) << 8) | (random.Below(a + 1) << 16) | (a << 24);
+        }
+        const Backdrop backdrop = Backdrop::Checker(0xeeeeee, 0x333333, 7, -9, 4);
+        std::vector<uint32_t> bottomUp(static_cast<size_t>(WIDTH) * HEIGHT, 0x12345678);
+        CHECK_HR(target.CompositeTo(backdrop, bottomUp.data() + static_cast<size_t>(WIDTH) * (HEIGHT - 1), -static_cast<ptrdiff_t>(WIDTH)), S_OK);
+        std::vector<uint32_t> topDown(static_cast<size_t>(WIDTH) * HEIGHT, 0x12345678);
+        CHECK_HR(target.CompositeTo(backdrop, topDown.data(), WIDTH), S_OK);
+        std::vector<uint32_t> row(WIDTH);
+        int bad = 0;
+        for (uint32_t y = 0; y < HEIGHT; y++) {
+            PixelFormat::CompositeToBgra(target.GetPixels() + static_cast<size_t>(WIDTH) * y, row.data(), WIDTH, backdrop, static_cast<int32_t>(y));
+            bad += ::memcmp(row.data(), bottomUp.data() + static_cast<size_t>(WIDTH) * (HEIGHT - 1 - y), WIDTH * 4) != 0;
+            bad += ::memcmp(row.data(), topDown.data() + static_cast<size_t>(WIDTH) * y, WIDTH * 4) != 0;
+        }
+        CHECK(bad == 0);
+    });
+
+    // The overlap rows are what keeps a blur from seaming; with a stdDeviation of 2 the kernel
+    // ends inside them, and up to one step per channel is left for resvg's blur approximation
+    Test::Run("striped renders match a single pass", [] {
+        Svg svg;
+        Load(&svg, BLURRED);
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetScale(3);
+        SvgRenderTarget whole;
+        CHECK_HR(svg.Render(opt, &whole), S_OK);
+        const uint32_t width = whole.GetWidth();
+        const uint32_t height = whole.GetHeight();
+        CHECK(width == 360 && height == 240);
+        for (uint32_t stripeRows : { 1u, 7u, 16u, 100u, 239u, 240u, 1000u }) {
+            std::vector<uint32_t> pixels(static_cast<size_t>(width) * height, 0x12345678);
+            uint32_t next = 0;
+            CHECK_HR(svg.RenderStripes(opt, stripeRows, 8, [&](const uint32_t* stripe, uint32_t w, uint32_t h, uint32_t y, uint32_t rows) {
+                CHECK(w == width && h == height && y == next && rows <= stripeRows && rows > 0);
+                ::memcpy(pixels.data() + static_cast<size_t>(y) * width, stripe, static_cast<size_t>(width) * 4 * rows);
+                next = y + rows;
+                return S_OK;
+            }), S_OK);
+            CHECK(next == height);
+            const int worst = GetMaxDifference(pixels.data(), whole.GetPixels(), pixels.size());
+            if (!CHECK(worst <= 1)) {
+                ::fprintf(stderr, "stripes of %u rows differ by up to %d\n", stripeRows, worst);
+            }
+        }
+        // The exporters stream the same stripes; raw output holds the pixels as they are
+        for (uint32_t stripeRows : { 0u, 1u, 13u }) {
+            MemorySink raw;
+            CHECK_HR(SvgExporter::SaveRaw(svg, opt, &raw, stripeRows), S_OK);
+            if (CHECK(raw.GetBuffer().GetSize() == RawImageWriter::HEADER_SIZE + static_cast<size_t>(width) * height * 4)) {
+                std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+                ::memcpy(pixels.data(), raw.GetBuffer().GetData() + RawImageWriter::HEADER_SIZE, pixels.size() * 4);
+                CHECK(GetMaxDifference(pixels.data(), whole.GetPixels(), pixels.size()) <= 1);
+            }
+        }
+        MemorySink png;
+        CHECK_HR(SvgExporter::SavePng(svg, opt, &png, PngOptions(), 13), S_OK);
+        CHECK(png.GetBuffer().GetSize() > 0);
+        CancelToken cancelled;
+        cancelled.Cancel();
+        opt.SetCancelToken(&cancelled);
+        MemorySink none;
+        CHECK(CancelToken::IsCancellation(SvgExporter::SavePng(svg, opt, &none, PngOptions(), 13)));
+    });
+
+    // cancelled() is asked once after the preview and once after every stripe of the full pass;
+    // 3000 columns make stripes of 349 rows, six of them
+    Test::Run("progressive renders preview at full size and stop between stripes", [] {
+        Svg svg;
+        Load(&svg);
+        SvgRenderTarget::RenderOptions opt;
+        opt.SetCanvasSize(3000, 3000).SetToContain();
+        SvgRenderTarget single;
+        CHECK_HR(svg.Render(opt, &single), S_OK);
+        CHECK(single.GetWidth() == 3000 && single.GetHeight() == 2000);
+        int previews = 0;
+        int asked = 0;
+        SvgRenderTarget target;
+        CHECK_HR(svg.RenderProgressive(opt, 4, [&](SvgRenderTarget& preview) {
+            previews++;
+            CHECK(preview.GetWidth() == 3000 && preview.GetHeight() == 2000 && asked == 0);
+        }, [&] {
+            asked++;
+            return false;
+        }, &target), S_OK);
+        CHECK(previews == 1 && asked == 7);
+        CHECK(IsSame(target, single));
+        // No preview when asked not to, or when it would be less than a pixel
+        for (uint32_t divisor : { 0u, 1u, 2001u }) {
+            previews = 0;
+            CHECK_HR(svg.RenderProgressive(opt, divisor, [&](SvgRenderTarget&) {
+                previews++;
+            }, [] {
+                return false;
+            }, &target), S_OK);
+            CHECK(previews == 0);
+        }
+        for (int stopAt : { 1, 2, 4, 7 }) {
+            SvgRenderTarget kept;
+            CHECK_HR(kept.Create(5, 5), S_OK);
+            previews = 0;
+            asked = 0;
+            const HRESULT hr = svg.RenderProgressive(opt, 8, [&](SvgRenderTarget& preview) {
+                previews++;
+                CHECK(preview.GetWidth() == 3000 && preview.GetHeight() == 2000);
+            }, [&] {
+                return ++asked == stopAt;
+            }, &kept);
+            CHECK_HR(hr, HRESULT_FROM_WIN32(ERROR_CANCELLED));
+            CHECK(previews == 1 && asked == stopAt);
+            CHECK(kept.GetWidth() == 5 && kept.GetHeight() == 5);
+        }
+    });
+
+    return Test::Result();
+}
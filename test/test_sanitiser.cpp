@@ -0,0 +1,102 @@
+#include "platform.h"
+#include <string>
+
+#include "sans.hpp"
+#include "test.hpp"
+
+// The Sanitiser gathers SvgComplexity in the same pass that rewrites the text, and must rewrite
+// it the same way whether or not it does; 20000 random inputs, made of the pieces the pass
+// looks at, are run both ways
+
+static std::string MakeInput(Test::Random& random)
+{
+    static const char* const PIECES[] = {
+        "<", ">", "/", "/>", " ", "\t", "\n", "=", "'", "\"", "<!--", "-->", "<![CDATA[", "]]>",
+        "<?xml version='1.0'?>", "<!DOCTYPE svg>", "svg", "svg:", "g", "path", "d", "polygon",
+        "polyline", "points", "M10 20L30-5.5e2.5.5z", "1,2 3,4", "image", "href", "xlink:href",
+        "data:image/png;base64,iVBORw0KGgo=", "data:,text", "feBlend", "feComposite",
+        "feDisplacementMap", "feGaussianBlur", "feOffset", "feTurbulence", "fe", "in", "in2",
+        "mode", "BackgroundImage", "SourceGraphic", "BackgroundImageX", "text", "mask",
+        "clipPath", "linearGradient", "radialGradient", "filter", "id", "x",
+    };
+    static const uint32_t COUNT = sizeof(PIECES) / sizeof(PIECES[0]);
+    static const char* const TAGS[] = { "feBlend", "feComposite", "feDisplacementMap", "feOffset", "path", "polygon", "image", "svg:feBlend", "text" };
+    static const char* const NAMES[] = { "in", "in2", "d", "points", "href", "xlink:href", "mode" };
+    static const char* const VALUES[] = { "BackgroundImage", "SourceGraphic", "M0 0h10v10z", "1 2 3 4", "data:,abc", "" };
+    static const char* const QUOTES[] = { "'", "\"", "" };
+    std::string input;
+    const uint32_t length = random.Below(80);
+    for (uint32_t i = 0; i < length; i++) {
+        const uint32_t kind = random.Below(16);
+        if (kind == 0) {
+            input += static_cast<char>(random.Below(256));
+        } else if (kind < 6) {
+            // An element most of the way well formed, as the rewrite only applies to those
+            input += std::string("<") + TAGS[random.Below(9)];
+            for (uint32_t n = random.Below(4); n > 0; n--) {
+                const char* quote = QUOTES[random.Below(3)];
+                input += std::string(random.Below(2) ? " " : "\n") + NAMES[random.Below(7)] + "=" + quote + VALUES[random.Below(6)] + QUOTES[random.Below(3)];
+            }
+            input += random.Below(2) ? "/>" : ">";
+        } else {
+            input += PIECES[random.Below(COUNT)];
+        }
+    }
+    return input;
+}
+
+static std::string GetOutput(const Sanitiser& sans)
+{
+    return std::string(static_cast<const char*>(sans.GetData()), sans.GetSize());
+}
+
+int main()
+{
+    Test::Run("the scan leaves the rewritten text as it is, over 20000 random inputs", [] {
+        Test::Random random(49);
+        int different = 0;
+        int rewritten = 0;
+        for (int i = 0; i < 20000; i++) {
+            const std::string input = MakeInput(random);
+            Sanitiser plain;
+            Sanitiser scanned;
+            SvgComplexity complexity;
+            const HRESULT hrPlain = plain.Run(input.data(), input.size());
+            const HRESULT hrScanned = scanned.Run(input.data(), input.size(), nullptr, &complexity);
+            if (hrPlain != hrScanned || GetOutput(plain) != GetOutput(scanned)) {
+                if (different++ == 0) {
+                    ::fprintf(stderr, "first difference for input %d: %s\n", i, input.c_str());
+                }
+            }
+            if (SUCCEEDED(hrPlain) && GetOutput(plain) != input) {
+                rewritten++;
+            }
+            uint32_t filters = 0;
+            for (uint32_t count : complexity.filters) {
+                filters += count;
+            }
+            CHECK(complexity.filterPrimitives == filters);
+            CHECK(complexity.bytes == input.size());
+        }
+        CHECK(different == 0);
+        // Enough of the inputs have filters to rewrite for the comparison to mean something
+        CHECK(rewritten > 100);
+    });
+
+    Test::Run("problematic filter inputs are rewritten", [] {
+        const std::string input = "<svg><filter><feBlend in='BackgroundImage' in2=\"BackgroundImage\"/><feOffset in='BackgroundImage'/></filter></svg>";
+        Sanitiser sans;
+        SvgComplexity complexity;
+        CHECK_HR(sans.Run(input.data(), input.size(), nullptr, &complexity), S_OK);
+        CHECK(GetOutput(sans) == "<svg><filter><feBlend in='SourceGraphic' in2=\"SourceGraphic\"/><feOffset in='BackgroundImage'/></filter></svg>");
+        CHECK(complexity.elements == 4);
+        CHECK(complexity.filterPrimitives == 2);
+        CHECK(complexity.filters[SvgFilterBlend] == 1 && complexity.filters[SvgFilterOffset] == 1);
+        // Prefixes of the names and values are not them; an empty value once overran the output
+        const std::string prefixes = "<fe in='BackgroundImage'/><feBlend i='BackgroundImage' in=''/><feBlend in='Background'>";
+        CHECK_HR(sans.Run(prefixes.data(), prefixes.size()), S_OK);
+        CHECK(GetOutput(sans) == prefixes);
+    });
+
+    return Test::Result();
+}
@@ -0,0 +1,126 @@
+#include "platform.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "schedule.hpp"
+#include "test.hpp"
+
+// Blocks until opened, to keep the scheduler's one thread busy
+class GateJob : public RenderJob
+{
+public:
+    std::atomic<bool> started;
+    std::atomic<bool> open;
+
+    GateJob()
+        : started(false)
+        , open(false)
+    {
+    }
+
+protected:
+    HRESULT Execute(const CancelToken*) override
+    {
+        this->started = true;
+        while (!this->open.load()) {
+            std::this_thread::yield();
+        }
+        return S_OK;
+    }
+};
+
+class NopJob : public RenderJob
+{
+protected:
+    HRESULT Execute(const CancelToken*) override
+    {
+        return S_OK;
+    }
+};
+
+struct Observed
+{
+    std::atomic<bool> returned;
+    HRESULT result;
+
+    Observed()
+        : returned(false)
+        , result(S_OK)
+    {
+    }
+};
+
+static void SlowCompletion(RenderJob& job, void* context)
+{
+    Observed* observed = static_cast<Observed*>(context);
+    observed->result = job.GetResult();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    observed->returned = true;
+}
+
+int main()
+{
+    Test::Run("waiting for a job returns after its callback", [] {
+        RenderJobScheduler scheduler(2);
+        Observed observed;
+        NopJob job;
+        job.SetCompletion(SlowCompletion, &observed);
+        CHECK_HR(scheduler.Submit(&job, RenderJobVisible), S_OK);
+        CHECK_HR(scheduler.Wait(&job), S_OK);
+        CHECK(observed.returned.load());
+        CHECK_HR(observed.result, S_OK);
+    });
+
+    Test::Run("a job is busy while its callback runs", [] {
+        RenderJobScheduler scheduler(1);
+        Observed observed;
+        NopJob job;
+        job.SetCompletion(SlowCompletion, &observed);
+        CHECK_HR(scheduler.Submit(&job, RenderJobVisible), S_OK);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (!observed.returned.load()) {
+            CHECK_HR(scheduler.Submit(&job, RenderJobVisible), HRESULT_FROM_WIN32(ERROR_BUSY));
+            CHECK_HR(scheduler.Cancel(&job), S_FALSE);
+        }
+        CHECK_HR(scheduler.Wait(&job), S_OK);
+    });
+
+    Test::Run("cancelling a queued job runs its callback first", [] {
+        RenderJobScheduler scheduler(1);
+        GateJob gate;
+        CHECK_HR(scheduler.Submit(&gate, RenderJobVisible), S_OK);
+        while (!gate.started.load()) {
+            std::this_thread::yield();
+        }
+        Observed observed;
+        NopJob job;
+        job.SetCompletion(SlowCompletion, &observed);
+        CHECK_HR(scheduler.Submit(&job, RenderJobBackground), S_OK);
+        CHECK_HR(scheduler.Cancel(&job), S_OK);
+        CHECK(observed.returned.load());
+        CHECK_HR(observed.result, HRESULT_FROM_WIN32(ERROR_CANCELLED));
+        CHECK_HR(scheduler.Wait(&job), HRESULT_FROM_WIN32(ERROR_CANCELLED));
+        gate.open = true;
+        CHECK_HR(scheduler.Wait(&gate), S_OK);
+    });
+
+    // Deleted right after waiting, while a scheduler thread is still on its way out of Finish
+    Test::Run("jobs can be destroyed once waited for", [] {
+        RenderJobScheduler scheduler(3);
+        for (int i = 0; i < 200; i++) {
+            std::atomic<int> calls(0);
+            NopJob* job = new NopJob();
+            job->SetCompletion([](RenderJob&, void* context) {
+                (*static_cast<std::atomic<int>*>(context))++;
+            }, &calls);
+            CHECK_HR(scheduler.Submit(job, static_cast<RenderJobClass>(i % RenderJobClassCount)), S_OK);
+            CHECK_HR(scheduler.Wait(job), S_OK);
+            CHECK(calls.load() == 1);
+            delete job;
+        }
+        CHECK(scheduler.GetCompletedCount(RenderJobVisible) + scheduler.GetCompletedCount(RenderJobPrefetch) + scheduler.GetCompletedCount(RenderJobBackground) == 200);
+    });
+
+    return Test::Result();
+}
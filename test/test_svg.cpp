@@ -0,0 +1,71 @@
+#include "platform.h"
+#include <unistd.h>
+
+#include "svg.hpp"
+#include "test.hpp"
+
+static const char SVG[] = "<svg xmlns='http://www.w3.org/2000/svg' width='40' height='30'><rect width='40' height='30'/></svg>";
+
+
+// Writes the data to a new file and its name to path, which the caller unlinks
+static void WriteFile(char* path, const void* data, size_t size)
+{
+    ::strcpy(path, "/tmp/svg-test-XXXXXX");
+    const int fd = ::mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        CHECK(::write(fd, data, size) == static_cast<ssize_t>(size));
+        ::close(fd);
+    }
+}
+
+int main()
+{
+    Test::Run("mmopen reads the whole file", [] {
+        char path[32];
+        WriteFile(path, SVG, sizeof(SVG) - 1);
+        size_t cb = 0;
+        const void* ptr = mmopen(path, &cb);
+        CHECK(ptr != nullptr);
+        CHECK(cb == sizeof(SVG) - 1);
+        CHECK(ptr != nullptr && ::memcmp(ptr, SVG, cb) == 0);
+        mmclose(ptr);
+        ::unlink(path);
+    });
+
+    Test::Run("mmopen opens an empty file", [] {
+        char path[32];
+        WriteFile(path, "", 0);
+        size_t cb = 1;
+        const void* ptr = mmopen(path, &cb);
+        CHECK(ptr != nullptr);
+        CHECK(cb == 0);
+        mmclose(ptr);
+        ::unlink(path);
+    });
+
+    Test::Run("errors map to Win32 codes", [] {
+        size_t cb = 1;
+        CHECK(mmopen("/nonexistent/svg-test.svg", &cb) == nullptr);
+        CHECK(cb == 0);
+        CHECK(::GetLastError() == ERROR_PATH_NOT_FOUND || ::GetLastError() == ERROR_FILE_NOT_FOUND);
+        errno = EACCES;
+        CHECK_HR(HRESULT_FROM_WIN32(::GetLastError()), static_cast<HRESULT>(0x80070005));
+        CHECK_HR(HRESULT_FROM_WIN32(ERROR_SUCCESS), S_OK);
+        CHECK(FAILED(E_OUTOFMEMORY) && SUCCEEDED(S_FALSE));
+    });
+
+    Test::Run("Svg loads from a path", [] {
+        char path[32];
+        WriteFile(path, SVG, sizeof(SVG) - 1);
+        SvgOptions opt;
+        Svg svg;
+        CHECK_HR(svg.Load(path, opt), S_OK);
+        CHECK(svg.GetSize().width == 40 && svg.GetSize().height == 30);
+        ::unlink(path);
+        CHECK_HR(svg.Load(path, opt), HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND));
+        CHECK(svg.IsNull());
+    });
+
+    return Test::Result();
+}
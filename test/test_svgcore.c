@@ -0,0 +1,292 @@
+/* C API, built as C99 so that svgcore.h is checked to be plain C */
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "svgcore.h"
+
+static int failures = 0;
+
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+            failures++; \
+        } \
+    } while (0)
+
+#define E_INVALIDARG            ((svgcore_result)0x80070057)
+#define E_FILE_NOT_FOUND        ((svgcore_result)0x80070002)
+
+static const char SVG[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='100' height='50'>"
+    "<filter id='f'><feGaussianBlur stdDeviation='2'/><feOffset dx='1'/></filter>"
+    "<linearGradient id='g'><stop offset='0' stop-color='red'/><stop offset='1' stop-color='blue' stop-opacity='0.5'/></linearGradient>"
+    "<circle cx='50' cy='25' r='20' fill='url(#g)' filter='url(#f)'/>"
+    "<path d='M0 0L10 10h5z'/>"
+    "</svg>";
+
+/* Without filters, whose regions resvg clips to each stripe */
+static const char PLAIN[] =
+    "<svg xmlns='http://www.w3.org/2000/svg' width='100' height='50'>"
+    "<radialGradient id='g'><stop offset='0' stop-color='#f80'/><stop offset='1' stop-color='#08f' stop-opacity='0.25'/></radialGradient>"
+    "<ellipse cx='50' cy='25' rx='45' ry='20' fill='url(#g)' stroke='black' stroke-width='0.5'/>"
+    "</svg>";
+
+typedef struct Buffer
+{
+    unsigned char* data;
+    size_t size;
+} Buffer;
+
+static svgcore_result Append(void* context, const void* data, size_t size)
+{
+    Buffer* buffer = (Buffer*)context;
+    unsigned char* grown = (unsigned char*)realloc(buffer->data, buffer->size + size);
+    if (grown == NULL) {
+        return -1;
+    }
+    memcpy(grown + buffer->size, data, size);
+    buffer->data = grown;
+    buffer->size += size;
+    return 0;
+}
+
+static void Reset(Buffer* buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+}
+
+static svgcore_document* OpenText(const char* text)
+{
+    svgcore_document* document = NULL;
+    CHECK(svgcore_open_memory(text, strlen(text), NULL, &document) == 0);
+    CHECK(document != NULL);
+    return document;
+}
+
+static void TestProbe(void)
+{
+    svgcore_complexity complexity;
+    uint32_t i;
+    CHECK(svgcore_probe(SVG, sizeof(SVG) - 1, &complexity) == 0);
+    CHECK(complexity.bytes > 0);
+    CHECK(complexity.elements == 9);
+    CHECK(complexity.path_commands == 4);
+    CHECK(complexity.path_coordinates == 5);
+    CHECK(complexity.filter_primitives == 2);
+    CHECK(complexity.gradients == 1);
+    for (i = 0; i < SVGCORE_FILTER_TYPES; i++) {
+        const char* name = svgcore_filter_name(i);
+        CHECK(name != NULL);
+        if (strcmp(name, "feGaussianBlur") == 0 || strcmp(name, "feOffset") == 0) {
+            CHECK(complexity.filters[i] == 1);
+        } else {
+            CHECK(complexity.filters[i] == 0);
+        }
+    }
+    CHECK(svgcore_filter_name(SVGCORE_FILTER_TYPES) == NULL);
+    CHECK(svgcore_probe(NULL, 1, &complexity) == E_INVALIDARG);
+}
+
+static void TestOpen(void)
+{
+    char path[] = "/tmp/svgcore-test-XXXXXX";
+    svgcore_document* document = NULL;
+    svgcore_open_options options = { sizeof(options), SVGCORE_OPEN_NO_SYSTEM_FONTS, 72, NULL, "Sans", NULL, "en" };
+    double width = 0;
+    double height = 0;
+    int fd;
+
+    CHECK(svgcore_version() >= SVGCORE_VERSION);
+    document = OpenText(SVG);
+    CHECK(svgcore_get_size(document, &width, &height) == 0);
+    CHECK(width == 100 && height == 50);
+    svgcore_close(document);
+
+    fd = mkstemp(path);
+    CHECK(fd >= 0);
+    if (fd >= 0) {
+        CHECK(write(fd, SVG, sizeof(SVG) - 1) == (ssize_t)(sizeof(SVG) - 1));
+        close(fd);
+        document = NULL;
+        CHECK(svgcore_open_file(path, &options, &document) == 0);
+        CHECK(document != NULL);
+        svgcore_close(document);
+        unlink(path);
+        document = NULL;
+        CHECK(svgcore_open_file(path, NULL, &document) == E_FILE_NOT_FOUND);
+        CHECK(document == NULL);
+    }
+    CHECK(svgcore_open_memory("<sv", 3, &options, &document) < 0);
+    CHECK(document == NULL);
+    svgcore_close(NULL);
+}
+
+static void TestRender(void)
+{
+    svgcore_document* document = OpenText(SVG);
+    svgcore_render_options options = { sizeof(options), SVGCORE_FIT_CONTAIN, 0, 64, 64 };
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t* pixels;
+    int format;
+
+    CHECK(svgcore_get_image_size(document, &options, &width, &height) == 0);
+    CHECK(width == 64 && height == 32);
+    pixels = (uint32_t*)malloc((size_t)width * height * 4);
+    CHECK(svgcore_render(document, &options, pixels, width, height, (ptrdiff_t)width * 4, SVGCORE_FORMAT_PRGBA8) == 0);
+
+    /* Every layout, bottom-up, back to premultiplied RGBA; alpha survives all but the opaque ones */
+    for (format = SVGCORE_FORMAT_PRGBA8; format <= SVGCORE_FORMAT_RGBA16; format++) {
+        const size_t stride = (size_t)width * 8 + 16;
+        unsigned char* image = (unsigned char*)calloc(height, stride);
+        uint32_t* back = (uint32_t*)calloc((size_t)width * height, 4);
+        const int opaque = format == SVGCORE_FORMAT_RGB565 || format == SVGCORE_FORMAT_GRAY8;
+        uint32_t i;
+        CHECK(svgcore_render(document, &options, image + stride * (height - 1), width, height, -(ptrdiff_t)stride, (svgcore_format)format) == 0);
+        CHECK(svgcore_convert(image + stride * (height - 1), -(ptrdiff_t)stride, (svgcore_format)format, back, (ptrdiff_t)width * 4, SVGCORE_FORMAT_PRGBA8, width, height) == 0);
+        for (i = 0; i < width * height; i++) {
+            const uint32_t alpha = opaque ? 255 : pixels[i] >> 24;
+            if ((back[i] >> 24) != alpha) {
+                fprintf(stderr, "format %d, pixel %u: alpha %u for %u\n", format, i, back[i] >> 24, alpha);
+                failures++;
+                break;
+            }
+        }
+        free(image);
+        free(back);
+    }
+    CHECK(svgcore_render(document, &options, pixels, width, height, 3, SVGCORE_FORMAT_PRGBA8) == E_INVALIDARG);
+    CHECK(svgcore_render(document, &options, pixels, width, height, (ptrdiff_t)width * 4, (svgcore_format)99) == E_INVALIDARG);
+    free(pixels);
+    svgcore_close(document);
+}
+
+/* Large enough for the striped and banded path, which has to match the direct render but for
+   rounding, as each stripe goes through resvg with its own translation */
+static void TestStripes(void)
+{
+    svgcore_document* document = OpenText(PLAIN);
+    svgcore_render_options options = { sizeof(options), SVGCORE_FIT_SCALE, 30, 0, 0 };
+    uint32_t width = 0;
+    uint32_t height = 0;
+    size_t i;
+    uint32_t* direct;
+    unsigned char* padded;
+    size_t stride;
+
+    CHECK(svgcore_get_image_size(document, &options, &width, &height) == 0);
+    CHECK(width == 3000 && height == 1500);
+    stride = (size_t)width * 4 + 4;
+    direct = (uint32_t*)malloc((size_t)width * height * 4);
+    padded = (unsigned char*)malloc(stride * height);
+    CHECK(svgcore_render(document, &options, direct, width, height, (ptrdiff_t)width * 4, SVGCORE_FORMAT_PRGBA8) == 0);
+    CHECK(svgcore_render(document, &options, padded, width, height, (ptrdiff_t)stride, SVGCORE_FORMAT_PRGBA8) == 0);
+    for (i = 0; i < (size_t)width * 4 * height; i++) {
+        const int a = ((const unsigned char*)direct)[i];
+        const int b = padded[i / ((size_t)width * 4) * stride + i % ((size_t)width * 4)];
+        if (abs(a - b) > 2) {
+            fprintf(stderr, "striped byte %u is %d, direct %d\n", (unsigned)i, b, a);
+            failures++;
+            break;
+        }
+    }
+    free(direct);
+    free(padded);
+    svgcore_close(document);
+}
+
+typedef struct Shared
+{
+    svgcore_document* document;
+    const uint32_t* expected;
+    int mismatches;
+} Shared;
+
+static void* RenderLoop(void* context)
+{
+    Shared* shared = (Shared*)context;
+    svgcore_render_options options = { sizeof(options), SVGCORE_FIT_CONTAIN, 0, 64, 64 };
+    uint32_t pixels[64 * 32];
+    int i;
+    for (i = 0; i < 20; i++) {
+        if (svgcore_render(shared->document, &options, pixels, 64, 32, 64 * 4, SVGCORE_FORMAT_PRGBA8) != 0
+            || memcmp(pixels, shared->expected, sizeof(pixels)) != 0) {
+            shared->mismatches++;
+        }
+    }
+    return NULL;
+}
+
+/* One document from several threads, as the header allows */
+static void TestThreads(void)
+{
+    svgcore_render_options options = { sizeof(options), SVGCORE_FIT_CONTAIN, 0, 64, 64 };
+    static uint32_t expected[64 * 32];
+    Shared shared[4];
+    pthread_t threads[4];
+    int i;
+
+    shared[0].document = OpenText(SVG);
+    CHECK(svgcore_render(shared[0].document, &options, expected, 64, 32, 64 * 4, SVGCORE_FORMAT_PRGBA8) == 0);
+    for (i = 0; i < 4; i++) {
+        shared[i].document = shared[0].document;
+        shared[i].expected = expected;
+        shared[i].mismatches = 0;
+        CHECK(pthread_create(&threads[i], NULL, RenderLoop, &shared[i]) == 0);
+    }
+    for (i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(shared[i].mismatches == 0);
+    }
+    svgcore_close(shared[0].document);
+}
+
+static void TestEncode(void)
+{
+    static const unsigned char PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    svgcore_document* document = OpenText(SVG);
+    svgcore_render_options options = { sizeof(options), SVGCORE_FIT_CONTAIN, 0, 64, 64 };
+    Buffer buffer = { NULL, 0 };
+    uint32_t pixels[16 * 8];
+    size_t i;
+
+    for (i = 0; i < 16 * 8; i++) {
+        pixels[i] = (uint32_t)(i * 0x01020304u) | 0xff000000u;
+    }
+    CHECK(svgcore_encode(pixels, 16, 8, 64, SVGCORE_ENCODING_PNG, Append, &buffer) == 0);
+    CHECK(buffer.size > 8 && memcmp(buffer.data, PNG_SIGNATURE, 8) == 0);
+    Reset(&buffer);
+    CHECK(svgcore_encode(pixels, 16, 8, 64, SVGCORE_ENCODING_QOI, Append, &buffer) == 0);
+    CHECK(buffer.size > 14 && memcmp(buffer.data, "qoif", 4) == 0);
+    CHECK(buffer.size > 14 && buffer.data[7] == 16 && buffer.data[11] == 8);
+    Reset(&buffer);
+    CHECK(svgcore_encode(pixels, 16, 8, 3, SVGCORE_ENCODING_PNG, Append, &buffer) == E_INVALIDARG);
+    CHECK(svgcore_encode(pixels, 16, 8, 64, (svgcore_encoding)9, Append, &buffer) == E_INVALIDARG);
+    Reset(&buffer);
+    CHECK(svgcore_export(document, &options, SVGCORE_ENCODING_PNG, Append, &buffer) == 0);
+    CHECK(buffer.size > 8 && memcmp(buffer.data, PNG_SIGNATURE, 8) == 0);
+    Reset(&buffer);
+    CHECK(svgcore_export(document, &options, SVGCORE_ENCODING_QOI, Append, &buffer) == 0);
+    CHECK(buffer.size > 14 && buffer.data[7] == 64 && buffer.data[11] == 32);
+    Reset(&buffer);
+    svgcore_close(document);
+}
+
+int main(void)
+{
+    TestProbe();
+    TestOpen();
+    TestRender();
+    TestStripes();
+    TestThreads();
+    TestEncode();
+    printf("%s test_svgcore\n", failures == 0 ? "ok  " : "FAIL");
+    return failures == 0 ? 0 : 1;
+}